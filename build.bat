@@ -2,8 +2,8 @@
 
 @SET CFLAGS=-W3 -WX -MTd -Zi -D_CRT_SECURE_NO_WARNINGS=1 -DARCH_X64=1 -DOS_WINDOWS=1 -DBUILD_DEBUG=1
 @SET LFLAGS=-subsystem:console -incremental:no -opt:ref -dynamicbase
-@SET LLIBS=ws2_32.lib
-@SET SRC="../src/common.cc" "../src/crypto.cc" "../src/main.cc" "../src/login_server.cc" "../src/game.cc" "../src/game_server.cc" "../src/server.cc" "../src/world.cc" "../src/mini-gmp/mini-gmp.c"
+@SET LLIBS=ws2_32.lib winmm.lib bcrypt.lib
+@SET SRC="../src/common.cc" "../src/crypto.cc" "../src/main.cc" "../src/login_server.cc" "../src/game.cc" "../src/game_server.cc" "../src/server.cc" "../src/world.cc" "../src/world_save.cc" "../src/pathfind.cc" "../src/protocol.cc" "../src/frame.cc" "../src/profile.cc" "../src/metrics.cc" "../src/metrics_server.cc" "../src/database.cc" "../src/storage.cc" "../src/password.cc" "../src/module.cc" "../src/base_data.cc" "../src/mini-gmp/mini-gmp.c"
 
 pushd %~dp0
 del /q .\build\*
@@ -0,0 +1,15 @@
+@SETLOCAL
+
+@SET CFLAGS=%1 -W3 -WX -MTd -Zi -D_CRT_SECURE_NO_WARNINGS=1
+@SET LFLAGS=-incremental:no -opt:ref
+
+@REM NOTE: The build folder isn't cleared since the server may be running
+@REM with copies of the modules that are in it.
+pushd %~dp0
+mkdir .\build
+pushd .\build
+cl -LD -Fe:"example.dll" %CFLAGS% "../example.cc" /link %LFLAGS%
+popd
+popd
+
+@ENDLOCAL
@@ -0,0 +1,81 @@
+// NOTE: A small module showing how to use module_api.hh. It only depends
+// on that header and the C standard library.
+
+#include "../src/module_api.hh"
+
+#include <stdio.h>
+
+#define ITEM_LEVER 1945
+#define ITEM_MAGIC_FORCEFIELD 1387
+#define SPELL_LIGHT 1
+
+// NOTE: Kept by the server across reloads. Bump `state_version` in the
+// module description whenever this changes.
+struct ExampleState{
+	uint32_t lever_uses;
+	uint32_t light_casts;
+};
+
+static
+void example_on_load(ModuleHost *host, void *state, int fresh_state){
+	ExampleState *example = (ExampleState*)state;
+	char message[128];
+	snprintf(message, sizeof(message), "example module loaded"
+		" (fresh state = %d, lever uses = %u, light casts = %u)",
+		fresh_state, example->lever_uses, example->light_casts);
+	host->log(host, message);
+}
+
+static
+void example_use_lever(ModuleHost *host, void *state,
+		ModuleCreature *user, ModulePosition pos, uint16_t item_id){
+	ExampleState *example = (ExampleState*)state;
+	example->lever_uses += 1;
+
+	char text[64];
+	snprintf(text, sizeof(text), "Click! (%u)", example->lever_uses);
+	host->creature_say(host, user, text);
+}
+
+static
+void example_step_forcefield(ModuleHost *host, void *state,
+		ModuleCreature *creature, ModulePosition pos, uint16_t item_id){
+	host->player_send_message(host, creature, "You feel a strange tingling.");
+}
+
+static
+void example_cast_light(ModuleHost *host, void *state,
+		ModuleCreature *caster, uint16_t spell_id){
+	ExampleState *example = (ExampleState*)state;
+	example->light_casts += 1;
+	host->player_send_message(host, caster, "The light spell isn't ready yet.");
+}
+
+static const ModuleItemHandler example_item_handlers[] = {
+	{ ITEM_LEVER, example_use_lever, NULL },
+	{ ITEM_MAGIC_FORCEFIELD, NULL, example_step_forcefield },
+};
+
+static const ModuleSpell example_spells[] = {
+	{ SPELL_LIGHT, "utevo lux", example_cast_light },
+};
+
+extern "C" MODULE_EXPORT
+const ModuleDesc *kaplar_module_get(uint32_t host_api_version){
+	static ModuleDesc desc;
+	if(host_api_version != MODULE_API_VERSION)
+		return NULL;
+
+	desc.api_version = MODULE_API_VERSION;
+	desc.name = "example";
+	desc.state_size = sizeof(ExampleState);
+	desc.state_version = 1;
+	desc.on_load = example_on_load;
+	desc.on_unload = NULL;
+	desc.on_say = NULL;
+	desc.num_item_handlers = sizeof(example_item_handlers) / sizeof(example_item_handlers[0]);
+	desc.item_handlers = example_item_handlers;
+	desc.num_spells = sizeof(example_spells) / sizeof(example_spells[0]);
+	desc.spells = example_spells;
+	return &desc;
+}
@@ -11,6 +11,7 @@ cl -Fe:"is.exe" %CFLAGS% "../common.cc" "../xml.cc" "../items_stats.cc" /link %L
 cl -Fe:"os.exe" %CFLAGS% "../common.cc" "../otb_stats.cc" /link %LFLAGS%
 cl -Fe:"ol.exe" %CFLAGS% "../common.cc" "../otb_list.cc" /link %LFLAGS%
 cl -Fe:"ml.exe" %CFLAGS% "../common.cc" "../otbm_list.cc" /link %LFLAGS%
+cl -Fe:"dg.exe" %CFLAGS% "../common.cc" "../xml.cc" "../data_gen.cc" /link %LFLAGS%
 popd
 popd
 
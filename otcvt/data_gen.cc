@@ -0,0 +1,836 @@
+// NOTE: Converts items.otb, items.xml and the monster XML files into the
+// C++ source with the base item and monster tables that is compiled into
+// the server (see "src/base_data.hh").
+//	Item data is split into hot arrays indexed by server id (flags, ground
+// speed, client id, top order) and a cold array with names and
+// descriptions, matching the server's BaseItemTable. Everything is written
+// as positional aggregate initializers so the server doesn't need to do
+// anything at startup. The generated file also asserts the layout of the
+// structures and the flag values this generator assumes, so if any of them
+// change on the server side, the build fails until the generator is
+// updated to match.
+//
+//	usage: dg [-placeholder] [items.otb] [items.xml] [monsters.xml] [base_data.cc]
+//
+//	With `-placeholder`, the generated file is marked as coming from the
+// minimal data files in "otcvt/placeholder" (see generate.bat there) rather
+// than the real ones.
+//
+
+#include "xml.hh"
+
+enum OTB_ClientVersion : u8 {
+	OTB_CLIENT_VERSION_860 = 20,
+	OTB_CLIENT_VERSION_870 = 23,
+};
+
+enum OTB_ItemGroup : u8 {
+	OTB_GROUP_NONE = 0,
+	OTB_GROUP_GROUND,
+	OTB_GROUP_CONTAINER,
+	OTB_GROUP_WEAPON,		// deprecated
+	OTB_GROUP_AMMUNITION,	// deprecated
+	OTB_GROUP_ARMOR,		// deprecated
+	OTB_GROUP_CHARGES,
+	OTB_GROUP_TELEPORT,		// deprecated
+	OTB_GROUP_MAGICFIELD,	// deprecated
+	OTB_GROUP_WRITEABLE,	// deprecated
+	OTB_GROUP_KEY,			// deprecated
+	OTB_GROUP_SPLASH,
+	OTB_GROUP_FLUID,
+	OTB_GROUP_DOOR,			// deprecated
+	OTB_GROUP_DEPRECATED,
+	OTB_GROUP_LAST,
+};
+
+enum OTB_ItemAttrib : u8 {
+	OTB_ATTRIB_SERVER_ID = 0x10,
+	OTB_ATTRIB_CLIENT_ID = 0x11,
+	OTB_ATTRIB_SPEED = 0x14,
+	OTB_ATTRIB_TOP_ORDER = 0x2B,
+};
+
+enum OTB_ItemFlags : u32 {
+	OTB_FLAG_BLOCK_SOLID = (1 << 0),
+	OTB_FLAG_BLOCK_PROJECTILE = (1 << 1),
+	OTB_FLAG_BLOCK_PATHFIND = (1 << 2),
+	OTB_FLAG_HAS_HEIGHT = (1 << 3),
+	OTB_FLAG_USEABLE = (1 << 4),
+	OTB_FLAG_PICKUPABLE = (1 << 5),
+	OTB_FLAG_MOVEABLE = (1 << 6),
+	OTB_FLAG_STACKABLE = (1 << 7),
+	OTB_FLAG_FLOOR_CHANGE_DOWN = (1 << 8),
+	OTB_FLAG_FLOOR_CHANGE_NORTH = (1 << 9),
+	OTB_FLAG_FLOOR_CHANGE_EAST = (1 << 10),
+	OTB_FLAG_FLOOR_CHANGE_SOUTH = (1 << 11),
+	OTB_FLAG_FLOOR_CHANGE_WEST = (1 << 12),
+	OTB_FLAG_ALWAYS_ON_TOP = (1 << 13),
+	OTB_FLAG_READABLE = (1 << 14),
+	OTB_FLAG_ROTABLE = (1 << 15),
+	OTB_FLAG_HANGABLE = (1 << 16),
+	OTB_FLAG_LOOKTHROUGH = (1 << 23),
+};
+
+// NOTE: These must match the server's ItemType and ItemFlags (world.hh).
+// Types are emitted by name and flags are emitted as numbers, with a static
+// assert on the value of each flag.
+static const char *item_type_names[] = {
+	"ITEM_TYPE_NONE",
+	"ITEM_TYPE_GROUND",
+	"ITEM_TYPE_CONTAINER",
+	"ITEM_TYPE_SPLASH",
+	"ITEM_TYPE_FLUID",
+};
+
+enum : u8 {
+	ITEM_TYPE_NONE = 0,
+	ITEM_TYPE_GROUND,
+	ITEM_TYPE_CONTAINER,
+	ITEM_TYPE_SPLASH,
+	ITEM_TYPE_FLUID,
+};
+
+struct FlagMapping{
+	u32 otb_flags;
+	const char *name;
+};
+
+static const FlagMapping item_flags[] = {
+	{ OTB_FLAG_BLOCK_SOLID,			"ITEM_FLAG_BLOCK_SOLID" },
+	{ OTB_FLAG_BLOCK_PROJECTILE,	"ITEM_FLAG_BLOCK_PROJECTILE" },
+	{ OTB_FLAG_BLOCK_PATHFIND,		"ITEM_FLAG_BLOCK_PATH" },
+	{ OTB_FLAG_HAS_HEIGHT,			"ITEM_FLAG_HAS_HEIGHT" },
+	{ OTB_FLAG_USEABLE,				"ITEM_FLAG_USEABLE" },
+	{ OTB_FLAG_PICKUPABLE,			"ITEM_FLAG_PICKUPABLE" },
+	{ OTB_FLAG_MOVEABLE,			"ITEM_FLAG_MOVEABLE" },
+	{ OTB_FLAG_STACKABLE,			"ITEM_FLAG_STACKABLE" },
+	{ OTB_FLAG_ALWAYS_ON_TOP,		"ITEM_FLAG_ALWAYS_ON_TOP" },
+	{ OTB_FLAG_READABLE,			"ITEM_FLAG_READABLE" },
+	{ OTB_FLAG_ROTABLE,				"ITEM_FLAG_ROTATABLE" },
+	{ OTB_FLAG_HANGABLE,			"ITEM_FLAG_HANGABLE" },
+	{ OTB_FLAG_LOOKTHROUGH,			"ITEM_FLAG_LOOKTHROUGH" },
+	{ OTB_FLAG_FLOOR_CHANGE_DOWN | OTB_FLAG_FLOOR_CHANGE_NORTH
+		| OTB_FLAG_FLOOR_CHANGE_EAST | OTB_FLAG_FLOOR_CHANGE_SOUTH
+		| OTB_FLAG_FLOOR_CHANGE_WEST, "ITEM_FLAG_FLOOR_CHANGE" },
+};
+
+#define MAX_ITEMS 0x10000
+#define MAX_MONSTERS 4096
+#define NAME_MAX 32
+
+struct Item{
+	bool present;
+	u8 type;
+	u32 flags;
+	u16 client_id;
+	u16 speed;
+	u8 top_order;
+	char name[NAME_MAX];
+	char *plural;
+	char *description;
+};
+
+struct Outfit{
+	u16 look_type;
+	u8 look_head;
+	u8 look_body;
+	u8 look_legs;
+	u8 look_feet;
+	u8 look_addons;
+};
+
+struct Monster{
+	char name[NAME_MAX];
+	u32 experience;
+	u16 health;
+	u16 speed;
+	Outfit outfit;
+	u16 corpse_id;
+};
+
+static Item items[MAX_ITEMS];
+static u16 client_to_server_id[MAX_ITEMS];
+static i32 num_monsters;
+static Monster monsters[MAX_MONSTERS];
+
+static
+char *string_dup(const char *s){
+	usize len = strlen(s);
+	char *result = (char*)malloc_no_fail(len + 1);
+	memcpy(result, s, len + 1);
+	return result;
+}
+
+static
+void name_copy(char *dst, const char *src, const char *what, u32 id){
+	if(strlen(src) >= NAME_MAX){
+		printf("warning: %s %u name \"%s\" is too long and will be"
+			" truncated to %d characters\n", what, id, src, NAME_MAX - 1);
+	}
+	string_copy(dst, NAME_MAX, src);
+}
+
+static
+u32 parse_u32(const char *s, bool *ok){
+	char *end;
+	unsigned long result = strtoul(s, &end, 10);
+	if(end == s || *end != 0)
+		*ok = false;
+	return (u32)result;
+}
+
+// ----------------------------------------------------------------
+// OTB
+// ----------------------------------------------------------------
+
+struct OTB_Reader{
+	u8 *buf;
+	i32 bufend;
+	i32 bufpos;
+};
+
+static
+bool otb_ok(OTB_Reader *r){
+	return r->bufpos <= r->bufend;
+}
+
+static
+bool otb_can_read(OTB_Reader *r, i32 bytes){
+	return (r->bufend - r->bufpos) >= bytes;
+}
+
+static
+void otb_skip(OTB_Reader *r, i32 bytes){
+	r->bufpos += bytes;
+}
+
+static
+u8 otb_read_u8(OTB_Reader *r){
+	u8 result = 0;
+	if(otb_can_read(r, 1))
+		result = buffer_read_u8(r->buf + r->bufpos);
+	r->bufpos += 1;
+	return result;
+}
+
+static
+u16 otb_read_u16(OTB_Reader *r){
+	u16 result = 0;
+	if(otb_can_read(r, 2))
+		result = buffer_read_u16_le(r->buf + r->bufpos);
+	r->bufpos += 2;
+	return result;
+}
+
+static
+u32 otb_read_u32(OTB_Reader *r){
+	u32 result = 0;
+	if(otb_can_read(r, 4))
+		result = buffer_read_u32_le(r->buf + r->bufpos);
+	r->bufpos += 4;
+	return result;
+}
+
+static
+u8 otb_group_to_type(u8 group){
+	switch(group){
+		case OTB_GROUP_GROUND:		return ITEM_TYPE_GROUND;
+		case OTB_GROUP_CONTAINER:	return ITEM_TYPE_CONTAINER;
+		case OTB_GROUP_SPLASH:		return ITEM_TYPE_SPLASH;
+		case OTB_GROUP_FLUID:		return ITEM_TYPE_FLUID;
+		default:					return ITEM_TYPE_NONE;
+	}
+}
+
+static
+bool load_otb(const char *filename){
+	enum{
+		OTB_ESCAPE = 0xFD,
+		OTB_NODE_START = 0xFE,
+		OTB_NODE_END = 0xFF,
+	};
+
+	OTB_Reader otb = {};
+	otb.buf = (u8*)read_entire_file(filename, 0, &otb.bufend);
+	if(!otb.buf){
+		printf("failed to open file \"%s\"\n", filename);
+		return false;
+	}
+
+	{
+		// NOTE: Remove all OTB_ESCAPE characters (see otb_list.cc).
+		i32 insert_pos = 0;
+		i32 scan_pos = 0;
+		while(scan_pos < (otb.bufend - 1)){
+			if(otb.buf[scan_pos] == OTB_ESCAPE){
+				otb.buf[insert_pos] = otb.buf[scan_pos + 1];
+				scan_pos += 2;
+			}else{
+				otb.buf[insert_pos] = otb.buf[scan_pos];
+				scan_pos += 1;
+			}
+			insert_pos += 1;
+		}
+		if(scan_pos < otb.bufend && otb.buf[scan_pos] != OTB_ESCAPE){
+			otb.buf[insert_pos] = otb.buf[scan_pos];
+			insert_pos += 1;
+		}
+		otb.bufend = insert_pos;
+	}
+
+	if(otb_read_u32(&otb) != 0
+	|| otb_read_u8(&otb) != OTB_NODE_START
+	|| otb_read_u8(&otb) != OTB_GROUP_NONE
+	|| otb_read_u32(&otb) != 0
+	|| otb_read_u8(&otb) != 1
+	|| otb_read_u16(&otb) != 140){
+		printf("\"%s\": invalid OTB format\n", filename);
+		return false;
+	}
+
+	u32 version = otb_read_u32(&otb);
+	u32 client_version = otb_read_u32(&otb);
+	otb_read_u32(&otb);
+	otb_skip(&otb, 128);
+	if(version != 3 && client_version != OTB_CLIENT_VERSION_870){
+		printf("\"%s\": invalid OTB version\n", filename);
+		return false;
+	}
+
+	i32 num_items = 0;
+	while(otb_read_u8(&otb) == OTB_NODE_START && otb_ok(&otb)){
+		u8 group = otb_read_u8(&otb);
+		u32 flags = otb_read_u32(&otb);
+
+		Item item = {};
+		u16 server_id = 0;
+		item.type = otb_group_to_type(group);
+		for(i32 i = 0; i < NARRAY(item_flags); i += 1){
+			if(flags & item_flags[i].otb_flags)
+				item.flags |= (1 << i);
+		}
+
+		while(otb_ok(&otb)){
+			u8 attrib = otb_read_u8(&otb);
+			if(attrib == OTB_NODE_END)
+				break;
+			u16 attrib_size = otb_read_u16(&otb);
+			if(attrib == OTB_ATTRIB_SERVER_ID && attrib_size == 2){
+				server_id = otb_read_u16(&otb);
+			}else if(attrib == OTB_ATTRIB_CLIENT_ID && attrib_size == 2){
+				item.client_id = otb_read_u16(&otb);
+			}else if(attrib == OTB_ATTRIB_SPEED && attrib_size == 2){
+				item.speed = otb_read_u16(&otb);
+			}else if(attrib == OTB_ATTRIB_TOP_ORDER && attrib_size == 1){
+				item.top_order = otb_read_u8(&otb);
+			}else{
+				otb_skip(&otb, attrib_size);
+			}
+		}
+
+		// NOTE: Deprecated items still take a server id but have no
+		// client id. They're left out so they map to an empty entry.
+		if(group == OTB_GROUP_DEPRECATED || server_id == 0 || item.client_id == 0)
+			continue;
+
+		if(items[server_id].present){
+			printf("\"%s\": duplicate server id %u\n", filename, server_id);
+			return false;
+		}
+		item.present = true;
+		items[server_id] = item;
+		if(client_to_server_id[item.client_id] == 0)
+			client_to_server_id[item.client_id] = server_id;
+		num_items += 1;
+	}
+
+	if(!otb_ok(&otb)){
+		printf("\"%s\": unexpected end of file\n", filename);
+		return false;
+	}
+
+	printf("\"%s\": %d items\n", filename, num_items);
+	free(otb.buf);
+	return true;
+}
+
+// ----------------------------------------------------------------
+// XML
+// ----------------------------------------------------------------
+
+static
+const char *xml_attr(XML_NodeAttributes *attr, const char *key){
+	for(i32 i = 0; i < attr->num_attributes && i < NARRAY(attr->attributes); i += 1){
+		if(string_eq(attr->attributes[i].key, key))
+			return attr->attributes[i].value;
+	}
+	return NULL;
+}
+
+static
+u32 xml_attr_u32(XML_NodeAttributes *attr, const char *key, u32 def, bool *ok){
+	const char *value = xml_attr(attr, key);
+	return value ? parse_u32(value, ok) : def;
+}
+
+static
+bool xml_skip_node(XML_State *xml, XML_NodeTag *tag, XML_NodeAttributes *attr){
+	if(!attr->self_closed){
+		XML_NodeTag child_tag;
+		XML_NodeAttributes child_attr;
+		while(xml_read_node(xml, &child_tag, &child_attr)){
+			if(!xml_skip_node(xml, &child_tag, &child_attr))
+				return false;
+		}
+		if(!xml_close_node(xml, tag))
+			return false;
+	}
+	return true;
+}
+
+static
+bool xml_read_root(XML_State *xml, const char *filename,
+		const char *expected, XML_NodeTag *tag, XML_NodeAttributes *attr){
+	if(!xml_read_node(xml, tag, attr)){
+		if(xml_error(xml))
+			printf("%s\n", xml_error_string(xml));
+		else
+			printf("\"%s\": root node not found\n", filename);
+		return false;
+	}
+	if(!string_eq(tag->text, expected)){
+		printf("\"%s\": unexpected root node (expected = %s, got = %s)\n",
+			filename, expected, tag->text);
+		return false;
+	}
+	return true;
+}
+
+static
+bool load_items_xml(const char *filename){
+	XML_State *xml = xml_init_from_file(filename);
+	if(!xml){
+		printf("failed to open file \"%s\"\n", filename);
+		return false;
+	}
+
+	XML_NodeTag items_tag;
+	XML_NodeAttributes items_attr;
+	if(!xml_read_root(xml, filename, "items", &items_tag, &items_attr)){
+		xml_free(xml);
+		return false;
+	}
+
+	i32 num_unknown = 0;
+	XML_NodeTag item_tag;
+	XML_NodeAttributes item_attr;
+	while(xml_read_node(xml, &item_tag, &item_attr)){
+		if(!string_eq(item_tag.text, "item")){
+			printf("\"%s\": unexpected <items> child <%s>\n", filename, item_tag.text);
+			xml_free(xml);
+			return false;
+		}
+
+		// NOTE: An item node is either a single id or a range of ids
+		// sharing the same attributes.
+		bool ok = true;
+		u32 from_id = xml_attr_u32(&item_attr, "id", 0, &ok);
+		u32 to_id = from_id;
+		if(from_id == 0){
+			from_id = xml_attr_u32(&item_attr, "fromid", 0, &ok);
+			to_id = xml_attr_u32(&item_attr, "toid", 0, &ok);
+		}
+		if(!ok || from_id == 0 || to_id < from_id || to_id >= MAX_ITEMS){
+			printf("\"%s\": invalid item id range (%u - %u)\n",
+				filename, from_id, to_id);
+			xml_free(xml);
+			return false;
+		}
+
+		const char *name = xml_attr(&item_attr, "name");
+		const char *plural = xml_attr(&item_attr, "plural");
+		const char *description = NULL;
+		if(!item_attr.self_closed){
+			XML_NodeTag attr_tag;
+			XML_NodeAttributes attr_attr;
+			while(xml_read_node(xml, &attr_tag, &attr_attr)){
+				const char *key = xml_attr(&attr_attr, "key");
+				const char *value = xml_attr(&attr_attr, "value");
+				if(string_eq(attr_tag.text, "attribute") && key && value){
+					// NOTE: The attribute values live in the node we just
+					// read so they must be copied before the next one.
+					if(string_eq(key, "description"))
+						description = string_dup(value);
+					else if(string_eq(key, "plural"))
+						plural = string_dup(value);
+				}
+				if(!xml_skip_node(xml, &attr_tag, &attr_attr)){
+					xml_free(xml);
+					return false;
+				}
+			}
+			if(!xml_close_node(xml, &item_tag))
+				break;
+		}
+
+		for(u32 id = from_id; id <= to_id; id += 1){
+			Item *item = &items[id];
+			if(!item->present){
+				num_unknown += 1;
+				continue;
+			}
+			if(name)
+				name_copy(item->name, name, "item", id);
+			if(plural)
+				item->plural = string_dup(plural);
+			if(description)
+				item->description = string_dup(description);
+		}
+	}
+	xml_close_node(xml, &items_tag);
+
+	bool result = !xml_error(xml);
+	if(!result)
+		printf("%s\n", xml_error_string(xml));
+	if(num_unknown > 0)
+		printf("\"%s\": %d items not in the OTB were ignored\n", filename, num_unknown);
+	xml_free(xml);
+	return result;
+}
+
+static
+bool load_monster_xml(const char *filename, Monster *monster){
+	XML_State *xml = xml_init_from_file(filename);
+	if(!xml){
+		printf("failed to open file \"%s\"\n", filename);
+		return false;
+	}
+
+	XML_NodeTag monster_tag;
+	XML_NodeAttributes monster_attr;
+	if(!xml_read_root(xml, filename, "monster", &monster_tag, &monster_attr)){
+		xml_free(xml);
+		return false;
+	}
+
+	bool ok = true;
+	const char *name = xml_attr(&monster_attr, "name");
+	if(!name){
+		printf("\"%s\": monster without a name\n", filename);
+		xml_free(xml);
+		return false;
+	}
+	name_copy(monster->name, name, "monster", (u32)num_monsters);
+	monster->experience = xml_attr_u32(&monster_attr, "experience", 0, &ok);
+	monster->speed = (u16)xml_attr_u32(&monster_attr, "speed", 0, &ok);
+
+	if(!monster_attr.self_closed){
+		XML_NodeTag tag;
+		XML_NodeAttributes attr;
+		while(xml_read_node(xml, &tag, &attr)){
+			if(string_eq(tag.text, "health")){
+				monster->health = (u16)xml_attr_u32(&attr, "max", 0, &ok);
+			}else if(string_eq(tag.text, "look")){
+				monster->outfit.look_type = (u16)xml_attr_u32(&attr, "type", 0, &ok);
+				monster->outfit.look_head = (u8)xml_attr_u32(&attr, "head", 0, &ok);
+				monster->outfit.look_body = (u8)xml_attr_u32(&attr, "body", 0, &ok);
+				monster->outfit.look_legs = (u8)xml_attr_u32(&attr, "legs", 0, &ok);
+				monster->outfit.look_feet = (u8)xml_attr_u32(&attr, "feet", 0, &ok);
+				monster->outfit.look_addons = (u8)xml_attr_u32(&attr, "addons", 0, &ok);
+				monster->corpse_id = (u16)xml_attr_u32(&attr, "corpse", 0, &ok);
+			}
+			if(!xml_skip_node(xml, &tag, &attr))
+				break;
+		}
+		xml_close_node(xml, &monster_tag);
+	}
+
+	bool result = ok && !xml_error(xml);
+	if(xml_error(xml))
+		printf("%s\n", xml_error_string(xml));
+	else if(!ok)
+		printf("\"%s\": invalid number in monster attributes\n", filename);
+	xml_free(xml);
+	return result;
+}
+
+static
+bool load_monsters_xml(const char *filename){
+	XML_State *xml = xml_init_from_file(filename);
+	if(!xml){
+		printf("failed to open file \"%s\"\n", filename);
+		return false;
+	}
+
+	XML_NodeTag monsters_tag;
+	XML_NodeAttributes monsters_attr;
+	if(!xml_read_root(xml, filename, "monsters", &monsters_tag, &monsters_attr)){
+		xml_free(xml);
+		return false;
+	}
+
+	// NOTE: Monster files are relative to the monsters.xml directory.
+	char dir[256];
+	string_copy(dir, sizeof(dir), filename);
+	{
+		char *sep = NULL;
+		for(char *p = dir; *p; p += 1){
+			if(*p == '/' || *p == '\\')
+				sep = p;
+		}
+		if(sep)
+			sep[1] = 0;
+		else
+			dir[0] = 0;
+	}
+
+	bool result = true;
+	XML_NodeTag tag;
+	XML_NodeAttributes attr;
+	while(result && xml_read_node(xml, &tag, &attr)){
+		const char *file = xml_attr(&attr, "file");
+		if(!string_eq(tag.text, "monster") || !file){
+			printf("\"%s\": unexpected <monsters> child <%s>\n", filename, tag.text);
+			result = false;
+			break;
+		}
+		if(num_monsters >= MAX_MONSTERS){
+			printf("\"%s\": too many monsters (max = %d)\n", filename, MAX_MONSTERS);
+			result = false;
+			break;
+		}
+
+		char monster_file[512];
+		snprintf(monster_file, sizeof(monster_file), "%s%s", dir, file);
+		if(!load_monster_xml(monster_file, &monsters[num_monsters]))
+			result = false;
+		num_monsters += 1;
+
+		if(!xml_skip_node(xml, &tag, &attr))
+			break;
+	}
+	xml_close_node(xml, &monsters_tag);
+
+	if(xml_error(xml)){
+		printf("%s\n", xml_error_string(xml));
+		result = false;
+	}
+	if(result)
+		printf("\"%s\": %d monsters\n", filename, num_monsters);
+	xml_free(xml);
+	return result;
+}
+
+// ----------------------------------------------------------------
+// Output
+// ----------------------------------------------------------------
+
+static
+void write_string(FILE *f, const char *s){
+	if(!s){
+		fputs("NULL", f);
+		return;
+	}
+
+	// NOTE: Anything outside printable ASCII is written as an octal escape
+	// which, unlike hex escapes, can't run into the next character.
+	fputc('"', f);
+	for(const u8 *p = (const u8*)s; *p; p += 1){
+		if(*p == '"' || *p == '\\')
+			fprintf(f, "\\%c", *p);
+		else if(*p >= 0x20 && *p <= 0x7E)
+			fputc(*p, f);
+		else
+			fprintf(f, "\\%03o", *p);
+	}
+	fputc('"', f);
+}
+
+// NOTE: Hot arrays are written as plain numbers, 16 per line, with the id
+// of the first element of each line in a comment.
+static
+void write_array(FILE *f, const char *type, const char *name,
+		u32 count, u32 (*get)(u32 id), const char *format){
+	fprintf(f, "static constexpr %s %s[%u] = {", type, name, count);
+	for(u32 id = 0; id < count; id += 1){
+		if((id & 15) == 0)
+			fprintf(f, "\n	/* %5u */ ", id);
+		fprintf(f, format, get(id));
+		bool line_end = (id & 15) == 15 || (id + 1) == count;
+		fputs((line_end ? "," : ", "), f);
+	}
+	fprintf(f, "\n};\n\n");
+}
+
+static u32 get_flags(u32 id){ return items[id].flags; }
+static u32 get_speed(u32 id){ return items[id].speed; }
+static u32 get_client_id(u32 id){ return items[id].client_id; }
+static u32 get_top_order(u32 id){ return items[id].top_order; }
+static u32 get_server_id(u32 id){ return client_to_server_id[id]; }
+
+static
+bool write_base_data(const char *filename, const char **inputs, i32 num_inputs,
+		bool placeholder){
+	FILE *f = fopen(filename, "wb");
+	if(!f){
+		printf("failed to open file \"%s\"\n", filename);
+		return false;
+	}
+
+	u32 num_items = 1;
+	u32 max_client_id = 1;
+	for(u32 id = 0; id < MAX_ITEMS; id += 1){
+		if(items[id].present){
+			num_items = id + 1;
+			if(items[id].client_id >= max_client_id)
+				max_client_id = items[id].client_id + 1;
+		}
+	}
+
+	if(placeholder){
+		fprintf(f, "// NOTE: This is a placeholder generated from a minimal items.otb, items.xml\n");
+		fprintf(f, "// and monsters.xml with only the items used by the flat test world and the\n");
+		fprintf(f, "// example module. Replace it with one generated from the real data files.\n\n");
+	}
+	fprintf(f, "// NOTE: This file was generated by otcvt (dg.exe) from:\n");
+	for(i32 i = 0; i < num_inputs; i += 1)
+		fprintf(f, "//	%s\n", inputs[i]);
+	fprintf(f, "// Don't edit it by hand, regenerate it instead.\n\n");
+	fprintf(f, "#include \"base_data.hh\"\n\n");
+	fprintf(f, "#include <stddef.h>\n\n");
+
+	// NOTE: Layout checks. Members are initialized in declaration order so
+	// checking their offsets are increasing is enough to catch reordering.
+	fprintf(f, "static_assert(");
+	for(i32 i = 0; i < NARRAY(item_flags); i += 1){
+		fprintf(f, "%s%s == 0x%08X", (i == 0 ? "" : "\n		&& "),
+			item_flags[i].name, (1u << i));
+	}
+	fprintf(f, ",\n	\"ItemFlags changed, update otcvt/data_gen.cc"
+		" and regenerate this file\");\n");
+	fprintf(f,
+		"static_assert(sizeof(((BaseItemInfo*)0)->name) == %d\n"
+		"		&& offsetof(BaseItemInfo, name) < offsetof(BaseItemInfo, plural)\n"
+		"		&& offsetof(BaseItemInfo, plural) < offsetof(BaseItemInfo, description)\n"
+		"		&& offsetof(BaseItemInfo, description) < offsetof(BaseItemInfo, type),\n"
+		"	\"BaseItemInfo changed, update otcvt/data_gen.cc and regenerate this file\");\n",
+		NAME_MAX);
+	fprintf(f,
+		"static_assert(offsetof(BaseItemTable, num_items) < offsetof(BaseItemTable, flags)\n"
+		"		&& offsetof(BaseItemTable, flags) < offsetof(BaseItemTable, ground_speed)\n"
+		"		&& offsetof(BaseItemTable, ground_speed) < offsetof(BaseItemTable, client_id)\n"
+		"		&& offsetof(BaseItemTable, client_id) < offsetof(BaseItemTable, top_order)\n"
+		"		&& offsetof(BaseItemTable, top_order) < offsetof(BaseItemTable, info),\n"
+		"	\"BaseItemTable changed, update otcvt/data_gen.cc and regenerate this file\");\n");
+	fprintf(f,
+		"static_assert(sizeof(((BaseMonster*)0)->name) == %d\n"
+		"		&& offsetof(BaseMonster, name) < offsetof(BaseMonster, experience)\n"
+		"		&& offsetof(BaseMonster, experience) < offsetof(BaseMonster, health)\n"
+		"		&& offsetof(BaseMonster, health) < offsetof(BaseMonster, speed)\n"
+		"		&& offsetof(BaseMonster, speed) < offsetof(BaseMonster, outfit)\n"
+		"		&& offsetof(BaseMonster, outfit) < offsetof(BaseMonster, corpse_id)\n"
+		"		&& sizeof(Outfit) == 8,\n"
+		"	\"BaseMonster changed, update otcvt/data_gen.cc and regenerate this file\");\n\n",
+		NAME_MAX);
+
+	write_array(f, "u32", "item_flags", num_items, get_flags, "0x%X");
+	write_array(f, "u16", "item_ground_speed", num_items, get_speed, "%u");
+	write_array(f, "u16", "item_client_id", num_items, get_client_id, "%u");
+	write_array(f, "u8", "item_top_order", num_items, get_top_order, "%u");
+
+	fprintf(f, "static constexpr BaseItemInfo item_info[%u] = {\n", num_items);
+	for(u32 id = 0; id < num_items; id += 1){
+		Item *item = &items[id];
+		if(!item->present){
+			// NOTE: Runs of missing items are grouped to keep the file
+			// at a reasonable size.
+			fprintf(f, "	/* %5u */ {},", id);
+			for(i32 n = 1; n < 16 && (id + 1) < num_items
+					&& !items[id + 1].present; n += 1){
+				fputs(" {},", f);
+				id += 1;
+			}
+			fputc('\n', f);
+			continue;
+		}
+
+		fprintf(f, "	/* %5u */ { ", id);
+		write_string(f, item->name);
+		fputs(", ", f);
+		write_string(f, item->plural);
+		fputs(", ", f);
+		write_string(f, item->description);
+		fprintf(f, ", %s },\n", item_type_names[item->type]);
+	}
+	fprintf(f, "};\n\n");
+
+	write_array(f, "u16", "client_to_server_id", max_client_id, get_server_id, "%u");
+
+	// NOTE: Always emit at least one monster since zero sized arrays
+	// aren't allowed.
+	fprintf(f, "static constexpr BaseMonster base_monsters[%d] = {\n",
+		(num_monsters > 0 ? num_monsters : 1));
+	for(i32 i = 0; i < num_monsters; i += 1){
+		Monster *m = &monsters[i];
+		fputs("	{ ", f);
+		write_string(f, m->name);
+		fprintf(f, ", %u, %u, %u, { %u, %u, %u, %u, %u, %u }, %u },\n",
+			m->experience, m->health, m->speed, m->outfit.look_type,
+			m->outfit.look_head, m->outfit.look_body, m->outfit.look_legs,
+			m->outfit.look_feet, m->outfit.look_addons, m->corpse_id);
+	}
+	if(num_monsters == 0)
+		fputs("	{},\n", f);
+	fprintf(f, "};\n\n");
+
+	fprintf(f,
+		"extern const BaseData base_data = {\n"
+		"	{\n"
+		"		%u, // num_items\n"
+		"		item_flags,\n"
+		"		item_ground_speed,\n"
+		"		item_client_id,\n"
+		"		item_top_order,\n"
+		"		item_info,\n"
+		"	},\n"
+		"	%u, // max_client_id\n"
+		"	client_to_server_id,\n"
+		"	%d, // num_monsters\n"
+		"	base_monsters,\n"
+		"};\n", num_items, max_client_id, num_monsters);
+
+	bool result = ferror(f) == 0;
+	fclose(f);
+	if(!result)
+		printf("failed to write file \"%s\"\n", filename);
+	return result;
+}
+
+int main(int argc, char **argv){
+	const char *otb_file = "items.otb";
+	const char *items_file = "items.xml";
+	const char *monsters_file = "monsters.xml";
+	const char *output_file = "base_data.cc";
+	bool placeholder = false;
+	if(argc >= 2 && strcmp(argv[1], "-placeholder") == 0){
+		placeholder = true;
+		argc -= 1;
+		argv += 1;
+	}
+	if(argc >= 2) otb_file = argv[1];
+	if(argc >= 3) items_file = argv[2];
+	if(argc >= 4) monsters_file = argv[3];
+	if(argc >= 5) output_file = argv[4];
+
+	if(!load_otb(otb_file)
+	|| !load_items_xml(items_file)
+	|| !load_monsters_xml(monsters_file))
+		return -1;
+
+	const char *inputs[] = { otb_file, items_file, monsters_file };
+	if(!write_base_data(output_file, inputs, NARRAY(inputs), placeholder))
+		return -1;
+
+	printf("\"%s\": done\n", output_file);
+	return 0;
+}
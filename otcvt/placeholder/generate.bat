@@ -0,0 +1,10 @@
+@SETLOCAL
+
+@REM NOTE: Regenerates the placeholder "src/base_data.cc" from the minimal
+@REM data files in this directory. Build otcvt first.
+
+pushd %~dp0
+..\build\dg.exe -placeholder items.otb items.xml monsters.xml ..\..\src\base_data.cc
+popd
+
+@ENDLOCAL
@@ -0,0 +1,33 @@
+#ifndef KAPLAR_BASE_DATA_HH_
+#define KAPLAR_BASE_DATA_HH_ 1
+
+#include "common.hh"
+#include "world.hh"
+
+// ----------------------------------------------------------------
+// Base Data
+// ----------------------------------------------------------------
+
+// NOTE: Item and monster data is converted from the OT formats (items.otb,
+// items.xml, monster XMLs) into a C++ source file by otcvt (dg.exe) and
+// compiled into the server. The tables are constant initialized so loading
+// them at startup is just taking their address, with no parsing involved.
+//	The generated file positionally initializes BaseItemTable, BaseItemInfo
+// and BaseMonster and checks their layout and the ItemFlags values with
+// static asserts, so changing any of them breaks the build until
+// otcvt/data_gen.cc is updated and the file is regenerated.
+
+// NOTE: `client_to_server_id` has `max_client_id` entries. Ids without an
+// item map to zero.
+struct BaseData{
+	BaseItemTable items;
+	u16 max_client_id;
+	const u16 *client_to_server_id;
+	i32 num_monsters;
+	const BaseMonster *monsters;
+};
+
+// NOTE: Defined in the generated base_data.cc.
+extern const BaseData base_data;
+
+#endif //KAPLAR_BASE_DATA_HH_
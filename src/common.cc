@@ -1,47 +1,494 @@
 #include "common.hh"
+#include "metrics.hh"
 #include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 
 #if OS_WINDOWS
 #	define WIN32_LEAN_AND_MEAN 1
 #	include <windows.h>
+#	include <timeapi.h>
+#	include <io.h>
+#	include <bcrypt.h>
 #else
+#	include <dlfcn.h>
+#	include <pthread.h>
 #	include <time.h>
 #	include <unistd.h>
 #	include <sys/mman.h>
+#	include <sys/stat.h>
 #endif
 
 // ----------------------------------------------------------------
 // Logging
 // ----------------------------------------------------------------
 
-void log_info(const char *file, i32 line,
-		const char *function, const char *fmt, ...){
-	fprintf(stdout, "%s: ", function);
-	va_list ap;
-	va_start(ap, fmt);
-	vfprintf(stdout, fmt, ap);
-	va_end(ap);
-	fputc('\n', stdout);
+#define LOG_RING_SIZE (256 * 1024)
+#define LOG_MAX_THREADS 32
+#define LOG_MAX_MODULE_FILTERS 32
+#define LOG_MODULE_NAME_MAX 32
+#define LOG_LINE_MAX 2048
+#define LOG_STRING_ARG_MAX 256
+
+// NOTE: Records are 8 byte aligned and start with a LogRecord, followed by
+// the arguments, followed by the contents of string arguments. The `u`
+// field of a string argument holds the offset of its contents from the
+// start of the record. A record with zero size means the rest of the ring
+// is unused and the next record is at the start of the ring.
+struct LogRecord{
+	u32 size;
+	i32 num_args;
+	LogSite *site;
+	const char *fmt;
+};
+
+// NOTE: Each ring has a single writer (the thread that owns it) and a
+// single reader (the log thread). Positions only grow.
+struct LogRing{
+	std::atomic<u64> write_pos;
+	std::atomic<u64> read_pos;
+	std::atomic<i64> num_dropped;
+	u8 data[LOG_RING_SIZE];
+};
+
+struct LogModuleFilter{
+	char module[LOG_MODULE_NAME_MAX];
+	LogLevel level;
+};
+
+static std::atomic<LogRing*> log_rings[LOG_MAX_THREADS];
+static std::atomic<i32> log_rings_count;
+static thread_local LogRing *log_thread_ring;
+static thread_local bool log_is_log_thread;
+static std::atomic<bool> log_thread_running;
+
+std::atomic<u32> log_filter_generation(1);
+static LogLevel log_default_level = LOG_LEVEL_INFO;
+static LogModuleFilter log_module_filters[LOG_MAX_MODULE_FILTERS];
+static i32 log_num_module_filters;
+
+static
+LogRing *log_get_thread_ring(void){
+	LogRing *ring = log_thread_ring;
+	if(!ring){
+		i32 index = log_rings_count.fetch_add(1);
+		if(index >= LOG_MAX_THREADS)
+			PANIC("too many logging threads (max = %d)", LOG_MAX_THREADS);
+
+		// NOTE: Rings are never freed so messages from threads that
+		// already exited are still written.
+		ring = (LogRing*)malloc_no_fail(sizeof(LogRing));
+		ring->write_pos.store(0, std::memory_order_relaxed);
+		ring->read_pos.store(0, std::memory_order_relaxed);
+		ring->num_dropped.store(0, std::memory_order_relaxed);
+		log_rings[index].store(ring, std::memory_order_release);
+		log_thread_ring = ring;
+	}
+	return ring;
 }
-void log_error(const char *file, i32 line,
-		const char *function, const char *fmt, ...){
-	fprintf(stdout, "[ERROR] %s:%d %s: ", file, line, function);
-	va_list ap;
-	va_start(ap, fmt);
-	vfprintf(stdout, fmt, ap);
-	va_end(ap);
-	fputc('\n', stdout);
+
+// ----------------------------------------------------------------
+// Formatting
+
+template<typename T>
+static
+i32 log_format_spec(char *buf, i32 bufsize, const char *spec,
+		i32 *stars, i32 num_stars, T value){
+	i32 ret;
+	if(num_stars == 0)
+		ret = snprintf(buf, bufsize, spec, value);
+	else if(num_stars == 1)
+		ret = snprintf(buf, bufsize, spec, stars[0], value);
+	else
+		ret = snprintf(buf, bufsize, spec, stars[0], stars[1], value);
+	return (ret < 0) ? 0 : ret;
+}
+
+static INLINE
+bool log_is_integer_arg(LogArg *arg){
+	return arg->type == LOG_ARG_SIGNED || arg->type == LOG_ARG_UNSIGNED;
+}
+
+static INLINE
+u64 log_arg_unsigned_value(LogArg *arg){
+	// NOTE: Print negative values of narrow types the same way printf
+	// would, e.g. "%X" of (i32)-1 is FFFFFFFF.
+	if(arg->type == LOG_ARG_SIGNED && arg->size < 8)
+		return arg->u & (((u64)1 << (arg->size * 8)) - 1);
+	return arg->u;
+}
+
+// NOTE: Formats `fmt` with binary arguments by splitting it into plain text
+// and conversion specifications, with each specification formatted by
+// snprintf with the length modifier replaced to match the stored value.
+static
+i32 log_format(char *buf, i32 bufsize, const char *fmt,
+		LogArg *args, i32 num_args){
+	ASSERT(bufsize > 0);
+	i32 len = 0;
+	i32 next_arg = 0;
+	const char *p = fmt;
+	while(*p && len < (bufsize - 1)){
+		if(p[0] != '%'){
+			buf[len++] = *p++;
+			continue;
+		}
+		if(p[1] == '%'){
+			buf[len++] = '%';
+			p += 2;
+			continue;
+		}
+
+		char spec[32];
+		i32 speclen = 0;
+		i32 stars[2];
+		i32 num_stars = 0;
+		spec[speclen++] = *p++;
+		while(*p && strchr("-+ #0", *p) && speclen < 8)
+			spec[speclen++] = *p++;
+		for(i32 i = 0; i < 2; i += 1){
+			// NOTE: Width then precision.
+			if(i == 1){
+				if(*p != '.')
+					break;
+				spec[speclen++] = *p++;
+			}
+			if(*p == '*'){
+				spec[speclen++] = *p++;
+				i64 star = 0;
+				if(next_arg < num_args && log_is_integer_arg(&args[next_arg]))
+					star = args[next_arg].i;
+				next_arg += 1;
+				stars[num_stars++] = (i32)star;
+			}else{
+				while(*p >= '0' && *p <= '9' && speclen < 20)
+					spec[speclen++] = *p++;
+			}
+		}
+		while(*p && strchr("hlLzjtqI6", *p))
+			p += 1;
+
+		char conv = *p;
+		if(!conv)
+			break;
+		p += 1;
+
+		char *out = buf + len;
+		i32 outsize = bufsize - len;
+		LogArg *arg = (next_arg < num_args) ? &args[next_arg] : NULL;
+		next_arg += 1;
+		if(!arg){
+			len += snprintf(out, outsize, "<missing>");
+		}else if(strchr("di", conv) && log_is_integer_arg(arg)){
+			memcpy(spec + speclen, "lld", 4);
+			len += log_format_spec(out, outsize, spec, stars, num_stars, (long long)arg->i);
+		}else if(strchr("uxXo", conv) && log_is_integer_arg(arg)){
+			spec[speclen++] = 'l';
+			spec[speclen++] = 'l';
+			spec[speclen++] = conv;
+			spec[speclen] = 0;
+			len += log_format_spec(out, outsize, spec, stars, num_stars,
+				(unsigned long long)log_arg_unsigned_value(arg));
+		}else if(conv == 'c' && log_is_integer_arg(arg)){
+			memcpy(spec + speclen, "c", 2);
+			len += log_format_spec(out, outsize, spec, stars, num_stars, (int)arg->i);
+		}else if(strchr("eEfFgGaA", conv) && arg->type == LOG_ARG_DOUBLE){
+			spec[speclen++] = conv;
+			spec[speclen] = 0;
+			len += log_format_spec(out, outsize, spec, stars, num_stars, arg->f);
+		}else if(conv == 's' && arg->type == LOG_ARG_STRING){
+			memcpy(spec + speclen, "s", 2);
+			len += log_format_spec(out, outsize, spec, stars, num_stars, arg->s);
+		}else if(conv == 'p' && (arg->type == LOG_ARG_POINTER || arg->type == LOG_ARG_STRING)){
+			memcpy(spec + speclen, "p", 2);
+			len += log_format_spec(out, outsize, spec, stars, num_stars, arg->p);
+		}else{
+			len += snprintf(out, outsize, "<bad %%%c>", conv);
+		}
+
+		if(len > (bufsize - 1))
+			len = bufsize - 1;
+	}
+	buf[len] = 0;
+	return len;
+}
+
+static
+i32 log_format_message(char *buf, i32 bufsize, LogSite *site,
+		const char *fmt, LogArg *args, i32 num_args){
+	i32 len;
+	if(site->level == LOG_LEVEL_ERROR){
+		len = snprintf(buf, bufsize, "[ERROR] %s:%d %s: ",
+			site->file, site->line, site->function);
+	}else if(site->level == LOG_LEVEL_DEBUG){
+		len = snprintf(buf, bufsize, "[DEBUG] %s: ", site->function);
+	}else{
+		len = snprintf(buf, bufsize, "%s: ", site->function);
+	}
+	if(len < 0 || len >= (bufsize - 2))
+		len = 0;
+
+	// NOTE: Keep one byte for the newline.
+	len += log_format(buf + len, bufsize - len - 1, fmt, args, num_args);
+	buf[len++] = '\n';
+	return len;
+}
+
+// ----------------------------------------------------------------
+// Filters
+
+static
+void log_module_from_file(const char *file, char *module, i32 module_size){
+	const char *start = file;
+	for(const char *p = file; *p; p += 1){
+		if(*p == '/' || *p == '\\')
+			start = p + 1;
+	}
+	i32 len = 0;
+	while(start[len] && start[len] != '.' && len < (module_size - 1)){
+		module[len] = start[len];
+		len += 1;
+	}
+	module[len] = 0;
+}
+
+bool log_site_enabled_slow(LogSite *site){
+	u32 generation = log_filter_generation.load(std::memory_order_acquire);
+	char module[LOG_MODULE_NAME_MAX];
+	log_module_from_file(site->file, module, sizeof(module));
+
+	LogLevel level = log_default_level;
+	for(i32 i = 0; i < log_num_module_filters; i += 1){
+		if(strcmp(log_module_filters[i].module, module) == 0){
+			level = log_module_filters[i].level;
+			break;
+		}
+	}
+
+	bool enabled = site->level >= level;
+	site->filter_state.store((generation << 1) | (enabled ? 1 : 0),
+		std::memory_order_relaxed);
+	return enabled;
+}
+
+// NOTE: Sets the minimum level of messages from `module`, or of every
+// module without its own level if `module` is NULL. Filters are meant to
+// be set at startup, before other threads start logging. Errors are never
+// filtered out.
+void log_set_module_level(const char *module, LogLevel level){
+	ASSERT(level < LOG_LEVEL_COUNT);
+	if(level > LOG_LEVEL_ERROR)
+		level = LOG_LEVEL_ERROR;
+
+	if(!module){
+		log_default_level = level;
+	}else{
+		i32 index = 0;
+		while(index < log_num_module_filters
+				&& strcmp(log_module_filters[index].module, module) != 0)
+			index += 1;
+		if(index == log_num_module_filters){
+			if(log_num_module_filters >= LOG_MAX_MODULE_FILTERS)
+				PANIC("too many log module filters (max = %d)", LOG_MAX_MODULE_FILTERS);
+			log_num_module_filters += 1;
+		}
+		LogModuleFilter *filter = &log_module_filters[index];
+		snprintf(filter->module, sizeof(filter->module), "%s", module);
+		filter->level = level;
+	}
+	log_filter_generation.fetch_add(1, std::memory_order_release);
+}
+
+// ----------------------------------------------------------------
+// Writing
+
+void log_push(LogSite *site, const char *fmt, LogArg *args, i32 num_args){
+	if(!log_thread_running.load(std::memory_order_acquire)){
+		char line[LOG_LINE_MAX];
+		i32 len = log_format_message(line, sizeof(line), site, fmt, args, num_args);
+		fwrite(line, 1, len, stdout);
+		return;
+	}
+
+	// NOTE: Arguments past the ones we have room for are dropped and show
+	// up as "<missing>" when the record is formatted.
+	i32 string_lens[16];
+	if(num_args > (i32)NARRAY(string_lens))
+		num_args = (i32)NARRAY(string_lens);
+
+	usize size = sizeof(LogRecord) + num_args * sizeof(LogArg);
+	for(i32 i = 0; i < num_args; i += 1){
+		if(args[i].type == LOG_ARG_STRING){
+			i32 slen = 0;
+			if(args[i].s){
+				while(slen < LOG_STRING_ARG_MAX && args[i].s[slen])
+					slen += 1;
+			}
+			string_lens[i] = slen;
+			size += slen + 1;
+		}
+	}
+	size = (size + 7) & ~(usize)7;
+	ASSERT(size < LOG_RING_SIZE);
+
+	LogRing *ring = log_get_thread_ring();
+	u64 write_pos = ring->write_pos.load(std::memory_order_relaxed);
+	u64 read_pos = ring->read_pos.load(std::memory_order_acquire);
+	u64 offset = write_pos & (LOG_RING_SIZE - 1);
+	u64 skip = ((offset + size) > LOG_RING_SIZE) ? (LOG_RING_SIZE - offset) : 0;
+	if((write_pos + skip + size - read_pos) > LOG_RING_SIZE){
+		ring->num_dropped.store(ring->num_dropped.load(std::memory_order_relaxed) + 1,
+			std::memory_order_relaxed);
+		return;
+	}
+
+	if(skip > 0){
+		((LogRecord*)(ring->data + offset))->size = 0;
+		write_pos += skip;
+		offset = 0;
+	}
+
+	u8 *ptr = ring->data + offset;
+	LogRecord *record = (LogRecord*)ptr;
+	record->size = (u32)size;
+	record->num_args = num_args;
+	record->site = site;
+	record->fmt = fmt;
+
+	LogArg *record_args = (LogArg*)(ptr + sizeof(LogRecord));
+	u32 string_offset = (u32)(sizeof(LogRecord) + num_args * sizeof(LogArg));
+	for(i32 i = 0; i < num_args; i += 1){
+		record_args[i] = args[i];
+		if(args[i].type == LOG_ARG_STRING){
+			i32 slen = string_lens[i];
+			if(slen > 0)
+				memcpy(ptr + string_offset, args[i].s, slen);
+			ptr[string_offset + slen] = 0;
+			record_args[i].u = string_offset;
+			string_offset += slen + 1;
+		}
+	}
+	ring->write_pos.store(write_pos + size, std::memory_order_release);
+}
+
+static
+bool log_drain_ring(LogRing *ring, char *line, i32 line_size){
+	u64 write_pos = ring->write_pos.load(std::memory_order_acquire);
+	u64 read_pos = ring->read_pos.load(std::memory_order_relaxed);
+	if(read_pos == write_pos)
+		return false;
+
+	while(read_pos < write_pos){
+		u64 offset = read_pos & (LOG_RING_SIZE - 1);
+		u8 *ptr = ring->data + offset;
+		LogRecord *record = (LogRecord*)ptr;
+		if(record->size == 0){
+			read_pos += LOG_RING_SIZE - offset;
+			continue;
+		}
+
+		LogArg *args = (LogArg*)(ptr + sizeof(LogRecord));
+		for(i32 i = 0; i < record->num_args; i += 1){
+			if(args[i].type == LOG_ARG_STRING)
+				args[i].s = (const char*)(ptr + args[i].u);
+		}
+		i32 len = log_format_message(line, line_size, record->site,
+			record->fmt, args, record->num_args);
+		fwrite(line, 1, len, stdout);
+		read_pos += record->size;
+	}
+
+	// NOTE: Only release the space after the messages were written so
+	// log_flush can wait for the rings to be empty.
+	ring->read_pos.store(read_pos, std::memory_order_release);
+	return true;
+}
+
+static
+void log_thread(void *arg){
+	log_is_log_thread = true;
+	char line[LOG_LINE_MAX];
+	i64 num_dropped_reported = 0;
+	while(1){
+		bool idle = true;
+		i32 num_rings = log_rings_count.load(std::memory_order_acquire);
+		if(num_rings > LOG_MAX_THREADS)
+			num_rings = LOG_MAX_THREADS;
+		for(i32 i = 0; i < num_rings; i += 1){
+			LogRing *ring = log_rings[i].load(std::memory_order_acquire);
+			if(ring && log_drain_ring(ring, line, sizeof(line)))
+				idle = false;
+		}
+
+		i64 num_dropped = log_num_dropped();
+		if(num_dropped != num_dropped_reported){
+			fprintf(stdout, "[ERROR] %lld log messages dropped\n",
+				(long long)(num_dropped - num_dropped_reported));
+			num_dropped_reported = num_dropped;
+		}
+
+		if(idle){
+			fflush(stdout);
+			sys_sleep_msec(1);
+		}
+	}
+}
+
+void log_init(void){
+	if(!log_thread_running.load(std::memory_order_relaxed)){
+		log_thread_running.store(true, std::memory_order_release);
+		sys_thread_start(log_thread, NULL);
+	}
+}
+
+i64 log_num_dropped(void){
+	i32 num_rings = log_rings_count.load(std::memory_order_acquire);
+	if(num_rings > LOG_MAX_THREADS)
+		num_rings = LOG_MAX_THREADS;
+	i64 result = 0;
+	for(i32 i = 0; i < num_rings; i += 1){
+		LogRing *ring = log_rings[i].load(std::memory_order_acquire);
+		if(ring)
+			result += ring->num_dropped.load(std::memory_order_relaxed);
+	}
+	return result;
+}
+
+// NOTE: Wait (for at most a second) for the log thread to write every
+// message that was logged before the call.
+void log_flush(void){
+	if(log_thread_running.load(std::memory_order_acquire) && !log_is_log_thread){
+		for(i32 attempt = 0; attempt < 1000; attempt += 1){
+			bool empty = true;
+			i32 num_rings = log_rings_count.load(std::memory_order_acquire);
+			if(num_rings > LOG_MAX_THREADS)
+				num_rings = LOG_MAX_THREADS;
+			for(i32 i = 0; i < num_rings; i += 1){
+				LogRing *ring = log_rings[i].load(std::memory_order_acquire);
+				if(ring && ring->read_pos.load(std::memory_order_acquire)
+						!= ring->write_pos.load(std::memory_order_relaxed)){
+					empty = false;
+					break;
+				}
+			}
+			if(empty)
+				break;
+			sys_sleep_msec(1);
+		}
+	}
+	fflush(stdout);
 }
 
 void panic(const char *file, i32 line,
 		const char *function, const char *fmt, ...){
-	fprintf(stdout, "==== PANIC ====\n");
+	log_flush();
+	fprintf(stdout, "==== PANIC ====\n%s:%d %s: ", file, line, function);
 	va_list ap;
 	va_start(ap, fmt);
 	vfprintf(stdout, fmt, ap);
 	va_end(ap);
 	fputc('\n', stdout);
+	fflush(stdout);
 	abort();
 }
 
@@ -71,7 +518,7 @@ void *ptr_align_up(void *ptr, usize alignment){
 
 static
 void arena_commit(MemArena *arena){
-	LOG("arena->memend = %p", arena->memend);
+	LOG_DEBUG("arena->memend = %p", arena->memend);
 	usize granularity = arena->granularity;
 	usize virtual_size = arena->virtual_size;
 	usize committed_size = arena->committed_size;
@@ -92,6 +539,9 @@ void arena_commit(MemArena *arena){
 		PANIC("mprotect failed (error = %d)", errno);
 #endif
 	arena->memend += granularity;
+	arena->committed_size = new_committed_size;
+	metrics_add(METRIC_ARENA_COMMITS, 1);
+	metrics_add(METRIC_ARENA_COMMITTED_BYTES, (i64)granularity);
 }
 
 void *arena_alloc_raw(MemArena *arena, usize size, usize alignment){
@@ -168,6 +618,26 @@ i64 sys_clock_monotonic_msec(void){
 #endif
 }
 
+i64 sys_clock_monotonic_nsec(void){
+#if OS_WINDOWS
+	static i64 frequency = 0;
+	if(frequency == 0){
+		LARGE_INTEGER tmp;
+		QueryPerformanceFrequency(&tmp);
+		frequency = (i64)tmp.QuadPart;
+	}
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	i64 ticks = (i64)counter.QuadPart;
+	return (ticks / frequency) * 1000000000
+		+ ((ticks % frequency) * 1000000000) / frequency;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (i64)ts.tv_sec * 1000000000 + (i64)ts.tv_nsec;
+#endif
+}
+
 void sys_sleep_msec(i64 ms){
 #if OS_WINDOWS
 	ASSERT(ms < MAXDWORD && "windows limitation");
@@ -180,11 +650,191 @@ void sys_sleep_msec(i64 ms){
 #endif
 }
 
+// NOTE: Sleep until the monotonic clock (sys_clock_monotonic_nsec) reaches
+// `deadline`. Sleeping to an absolute deadline instead of for a duration
+// means the time spent before getting here and any wake up latency don't
+// accumulate from one frame to the next.
+void sys_sleep_until_nsec(i64 deadline){
+#if OS_WINDOWS
+	// NOTE: Windows has no absolute monotonic sleep and Sleep has the
+	// resolution of the system timer, so we raise it to 1ms, sleep until
+	// we're close to the deadline, and yield for the rest.
+	static bool timer_resolution_set = false;
+	if(!timer_resolution_set){
+		timeBeginPeriod(1);
+		timer_resolution_set = true;
+	}
+
+	i64 remaining = deadline - sys_clock_monotonic_nsec();
+	if(remaining > 2000000)
+		Sleep((DWORD)((remaining - 2000000) / 1000000));
+	while(sys_clock_monotonic_nsec() < deadline)
+		SwitchToThread();
+#else
+	struct timespec ts;
+	ts.tv_sec = deadline / 1000000000;
+	ts.tv_nsec = deadline % 1000000000;
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		continue;
+#endif
+}
+
+// NOTE: Flush `fp` and make sure its contents reached the disk.
+bool sys_fsync(FILE *fp){
+	if(fflush(fp) != 0)
+		return false;
+#if OS_WINDOWS
+	return _commit(_fileno(fp)) == 0;
+#else
+	return fsync(fileno(fp)) == 0;
+#endif
+}
+
+// NOTE: Same as fseek from the start of the file but with a 64-bit offset
+// (long is 32 bits with MSVC).
+bool sys_fseek(FILE *fp, i64 offset){
+#if OS_WINDOWS
+	return _fseeki64(fp, offset, SEEK_SET) == 0;
+#else
+	return fseeko(fp, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+// NOTE: Atomically replace `dst` with `src`.
+bool sys_file_replace(const char *src, const char *dst){
+#if OS_WINDOWS
+	return MoveFileExA(src, dst,
+		MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return rename(src, dst) == 0;
+#endif
+}
+
+// NOTE: Fill `buf` with cryptographically secure random bytes.
+bool sys_random_bytes(u8 *buf, usize len){
+#if OS_WINDOWS
+	return BCryptGenRandom(NULL, buf, (ULONG)len,
+		BCRYPT_USE_SYSTEM_PREFERRED_RNG) == 0;
+#else
+	FILE *fp = fopen("/dev/urandom", "rb");
+	if(!fp)
+		return false;
+	bool result = fread(buf, 1, len, fp) == len;
+	fclose(fp);
+	return result;
+#endif
+}
+
+// NOTE: Last modification time of a file in an unspecified unit. It's only
+// meant to be compared with a previous value to tell whether it changed.
+bool sys_file_mtime(const char *filename, i64 *out_mtime){
+#if OS_WINDOWS
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if(!GetFileAttributesExA(filename, GetFileExInfoStandard, &data))
+		return false;
+	*out_mtime = ((i64)data.ftLastWriteTime.dwHighDateTime << 32)
+		| (i64)data.ftLastWriteTime.dwLowDateTime;
+	return true;
+#else
+	struct stat st;
+	if(stat(filename, &st) != 0)
+		return false;
+	*out_mtime = (i64)st.st_mtim.tv_sec * 1000000000 + (i64)st.st_mtim.tv_nsec;
+	return true;
+#endif
+}
+
+bool sys_file_copy(const char *src, const char *dst){
+#if OS_WINDOWS
+	return CopyFileA(src, dst, FALSE) != 0;
+#else
+	FILE *in = fopen(src, "rb");
+	if(!in)
+		return false;
+	FILE *out = fopen(dst, "wb");
+	if(!out){
+		fclose(in);
+		return false;
+	}
+
+	u8 buf[16 * 1024];
+	bool result = true;
+	usize len;
+	while(result && (len = fread(buf, 1, sizeof(buf), in)) > 0)
+		result = fwrite(buf, 1, len, out) == len;
+	result = result && !ferror(in);
+	fclose(in);
+	result = (fclose(out) == 0) && result;
+	return result;
+#endif
+}
+
+void *sys_library_load(const char *filename){
+#if OS_WINDOWS
+	return (void*)LoadLibraryA(filename);
+#else
+	return dlopen(filename, RTLD_NOW | RTLD_LOCAL);
+#endif
+}
+
+void *sys_library_symbol(void *library, const char *name){
+#if OS_WINDOWS
+	return (void*)GetProcAddress((HMODULE)library, name);
+#else
+	return dlsym(library, name);
+#endif
+}
+
+void sys_library_unload(void *library){
+#if OS_WINDOWS
+	FreeLibrary((HMODULE)library);
+#else
+	dlclose(library);
+#endif
+}
+
+// NOTE: Starts a detached thread. Threads live until the process exits.
+void sys_thread_start(SysThreadProc proc, void *arg){
+	struct ThreadStart{
+		SysThreadProc proc;
+		void *arg;
+	};
+	ThreadStart *start = (ThreadStart*)malloc_no_fail(sizeof(ThreadStart));
+	start->proc = proc;
+	start->arg = arg;
+
+	struct Trampoline{
+#if OS_WINDOWS
+		static DWORD WINAPI run(LPVOID param){
+#else
+		static void *run(void *param){
+#endif
+			ThreadStart tmp = *(ThreadStart*)param;
+			free(param);
+			tmp.proc(tmp.arg);
+			return 0;
+		}
+	};
+
+#if OS_WINDOWS
+	HANDLE thread = CreateThread(NULL, 0, Trampoline::run, start, 0, NULL);
+	if(thread == NULL)
+		PANIC("CreateThread failed (error = %d)", GetLastError());
+	CloseHandle(thread);
+#else
+	pthread_t thread;
+	int ret = pthread_create(&thread, NULL, Trampoline::run, start);
+	if(ret != 0)
+		PANIC("pthread_create failed (error = %d)", ret);
+	pthread_detach(thread);
+#endif
+}
+
 // ----------------------------------------------------------------
 // Debug Utility
 // ----------------------------------------------------------------
 
-void debug_printf(char *fmt, ...){
+void debug_printf(const char *fmt, ...){
 	va_list ap;
 	va_start(ap, fmt);
 	vprintf(fmt, ap);
@@ -250,3 +900,23 @@ u8 *read_entire_file(MemArena *arena, const char *filename, i32 *out_size){
 		*out_size = size;
 	return mem;
 }
+
+// NOTE: For files that are only needed while loading. The buffer is
+// allocated with malloc instead of the arena and must be freed.
+u8 *read_entire_file_temp(const char *filename, i32 *out_size){
+	FILE *fp = fopen(filename, "rb");
+	if(!fp)
+		return NULL;
+
+	fseek(fp, 0, SEEK_END);
+	i32 size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	u8 *buf = (u8*)malloc_no_fail(size > 0 ? size : 1);
+	if(fread(buf, 1, size, fp) != (usize)size){
+		PANIC("error while reading file \"%s\" (ferror = %d, feof = %d)",
+			filename, ferror(fp), feof(fp));
+	}
+	fclose(fp);
+	*out_size = size;
+	return buf;
+}
@@ -9,8 +9,10 @@
 static_assert(sizeof(void*) == 8, "sizeof(void*) != 8");
 
 // stdlib base
+#include <atomic>
 #include <stdarg.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -44,8 +46,7 @@ typedef size_t		usize;
 #endif
 #define ASSERT(expr)									\
 	do{ if(!(expr)){									\
-		LOG_ERROR("assertion failed \"%s\"", #expr);	\
-		abort();										\
+		PANIC("assertion failed \"%s\"", #expr);		\
 	} } while(0)
 
 // compiler settings
@@ -53,10 +54,13 @@ typedef size_t		usize;
 #	define INLINE __forceinline
 #	define UNREACHABLE abort()
 #	define FALLTHROUGH ((void)0)
+#	define PRINTF_FORMAT(fmt_index, args_index)
 #elif defined(__GNUC__)
 #	define INLINE __attribute__((always_inline)) inline
 #	define UNREACHABLE abort()
 #	define FALLTHROUGH __attribute__((fallthrough))
+#	define PRINTF_FORMAT(fmt_index, args_index) \
+		__attribute__((format(printf, fmt_index, args_index)))
 #else
 #	error "add compiler settings"
 #endif
@@ -68,16 +72,141 @@ typedef size_t		usize;
 // ----------------------------------------------------------------
 // Logging
 // ----------------------------------------------------------------
-void log_info(const char *file, i32 line,
-		const char *function, const char *fmt, ...);
-void log_error(const char *file, i32 line,
-		const char *function, const char *fmt, ...);
-void panic(const char *file, i32 line,
-		const char *function, const char *fmt, ...);
-#define LOG(...)		log_info(__FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
-#define LOG_ERROR(...)	log_error(__FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+
+// NOTE: Logging doesn't format anything on the calling thread. The format
+// string pointer and the arguments, in binary form, are pushed into a ring
+// buffer owned by the calling thread, and a background thread started by
+// log_init formats and writes them. If the ring is full the message is
+// dropped instead of blocking, so a slow terminal or disk never stalls a
+// frame. Before log_init, messages are written synchronously.
+//	Format strings must be string literals because only the pointer is
+// kept. String arguments are copied.
+//	Each call site has a static LogSite used to filter messages by level
+// and module (the source file name, e.g. "game_server"). Debug messages
+// and module filters are compiled out in release builds.
+
+enum LogLevel : u8 {
+	LOG_LEVEL_DEBUG = 0,
+	LOG_LEVEL_INFO,
+	LOG_LEVEL_ERROR,
+	LOG_LEVEL_COUNT,
+};
+
+struct LogSite{
+	const char *file;
+	i32 line;
+	const char *function;
+	LogLevel level;
+
+	// NOTE: Cached result of the module filter. It's recomputed whenever
+	// the filters change (see log_site_enabled).
+	std::atomic<u32> filter_state;
+};
+
+enum LogArgType : u8 {
+	LOG_ARG_SIGNED = 0,
+	LOG_ARG_UNSIGNED,
+	LOG_ARG_DOUBLE,
+	LOG_ARG_POINTER,
+	LOG_ARG_STRING,
+};
+
+struct LogArg{
+	LogArgType type;
+	u8 size;
+	union{
+		i64 i;
+		u64 u;
+		double f;
+		const void *p;
+		const char *s;
+	};
+};
+
+static INLINE LogArg log_arg_signed(i64 value, u8 size){
+	LogArg arg; arg.type = LOG_ARG_SIGNED; arg.size = size; arg.i = value; return arg;
+}
+static INLINE LogArg log_arg_unsigned(u64 value, u8 size){
+	LogArg arg; arg.type = LOG_ARG_UNSIGNED; arg.size = size; arg.u = value; return arg;
+}
+static INLINE LogArg log_arg(char v){ return log_arg_signed(v, 1); }
+static INLINE LogArg log_arg(signed char v){ return log_arg_signed(v, 1); }
+static INLINE LogArg log_arg(short v){ return log_arg_signed(v, 2); }
+static INLINE LogArg log_arg(int v){ return log_arg_signed(v, 4); }
+static INLINE LogArg log_arg(long v){ return log_arg_signed(v, sizeof(long)); }
+static INLINE LogArg log_arg(long long v){ return log_arg_signed(v, 8); }
+static INLINE LogArg log_arg(bool v){ return log_arg_unsigned(v, 1); }
+static INLINE LogArg log_arg(unsigned char v){ return log_arg_unsigned(v, 1); }
+static INLINE LogArg log_arg(unsigned short v){ return log_arg_unsigned(v, 2); }
+static INLINE LogArg log_arg(unsigned int v){ return log_arg_unsigned(v, 4); }
+static INLINE LogArg log_arg(unsigned long v){ return log_arg_unsigned(v, sizeof(long)); }
+static INLINE LogArg log_arg(unsigned long long v){ return log_arg_unsigned(v, 8); }
+static INLINE LogArg log_arg(double v){
+	LogArg arg; arg.type = LOG_ARG_DOUBLE; arg.size = 8; arg.f = v; return arg;
+}
+static INLINE LogArg log_arg(const char *v){
+	LogArg arg; arg.type = LOG_ARG_STRING; arg.size = 8; arg.s = v; return arg;
+}
+static INLINE LogArg log_arg(char *v){ return log_arg((const char*)v); }
+template<typename T>
+static INLINE LogArg log_arg(T *v){
+	LogArg arg; arg.type = LOG_ARG_POINTER; arg.size = 8; arg.p = v; return arg;
+}
+
+extern std::atomic<u32> log_filter_generation;
+bool log_site_enabled_slow(LogSite *site);
+void log_push(LogSite *site, const char *fmt, LogArg *args, i32 num_args);
+
+static INLINE
+bool log_site_enabled(LogSite *site){
+#if BUILD_DEBUG
+	u32 state = site->filter_state.load(std::memory_order_relaxed);
+	if((state >> 1) == log_filter_generation.load(std::memory_order_relaxed))
+		return (state & 1) != 0;
+	return log_site_enabled_slow(site);
+#else
+	return true;
+#endif
+}
+
+template<typename... Args>
+static INLINE
+void log_write(LogSite *site, const char *fmt, Args... args){
+	// NOTE: One extra element so the array isn't empty without arguments.
+	LogArg packed[sizeof...(Args) + 1] = { log_arg(args)... };
+	log_push(site, fmt, packed, (i32)sizeof...(Args));
+}
+
+// NOTE: Never called. Log calls go through a template so the compiler
+// can't check their format strings, but it still checks this call which is
+// compiled out.
+static inline PRINTF_FORMAT(1, 2)
+void log_check_format(const char *fmt, ...){}
+
+#define LOG_AT(log_level, ...)											\
+	do{																	\
+		static LogSite log_site_ = { __FILE__, __LINE__, __FUNCTION__, log_level, {0} };	\
+		if(0) log_check_format(__VA_ARGS__);							\
+		if(log_site_enabled(&log_site_))								\
+			log_write(&log_site_, __VA_ARGS__);							\
+	} while(0)
+
+#if BUILD_DEBUG
+#	define LOG_DEBUG(...)	LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#	define LOG_DEBUG(...)	((void)0)
+#endif
+#define LOG(...)		LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_ERROR(...)	LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
 #define PANIC(...)		panic(__FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
 
+void log_init(void);
+void log_flush(void);
+void log_set_module_level(const char *module, LogLevel level);
+i64 log_num_dropped(void);
+void panic(const char *file, i32 line,
+		const char *function, const char *fmt, ...) PRINTF_FORMAT(4, 5);
+
 // ----------------------------------------------------------------
 // Memory Arena
 // ----------------------------------------------------------------
@@ -114,12 +243,28 @@ static INLINE T *arena_alloc_init(MemArena *arena, usize num, T initial_value){
 // ----------------------------------------------------------------
 void *malloc_no_fail(usize size);
 i64 sys_clock_monotonic_msec(void);
+i64 sys_clock_monotonic_nsec(void);
 void sys_sleep_msec(i64 ms);
+void sys_sleep_until_nsec(i64 deadline);
+
+bool sys_fsync(FILE *fp);
+bool sys_fseek(FILE *fp, i64 offset);
+bool sys_file_replace(const char *src, const char *dst);
+bool sys_random_bytes(u8 *buf, usize len);
+bool sys_file_mtime(const char *filename, i64 *out_mtime);
+bool sys_file_copy(const char *src, const char *dst);
+
+void *sys_library_load(const char *filename);
+void *sys_library_symbol(void *library, const char *name);
+void sys_library_unload(void *library);
+
+typedef void (*SysThreadProc)(void *arg);
+void sys_thread_start(SysThreadProc proc, void *arg);
 
 // ----------------------------------------------------------------
 // Debug Utility
 // ----------------------------------------------------------------
-void debug_printf(char *fmt, ...);
+void debug_printf(const char *fmt, ...) PRINTF_FORMAT(1, 2);
 void debug_print_buf(char *debug_name, u8 *buf, i32 buflen);
 void debug_print_buf_hex(char *debug_name, u8 *buf, i32 buflen);
 
@@ -127,6 +272,7 @@ void debug_print_buf_hex(char *debug_name, u8 *buf, i32 buflen);
 // File Utility
 // ----------------------------------------------------------------
 u8 *read_entire_file(MemArena *arena, const char *filename, i32 *out_size);
+u8 *read_entire_file_temp(const char *filename, i32 *out_size);
 
 // ----------------------------------------------------------------
 // Config
@@ -141,10 +287,48 @@ struct Config{
 
 	//const char *game_rsa_pem_file;
 	const char *game_world_file;
+	const char *game_world_delta_file;
+	i64 game_world_save_interval;
+	i32 game_world_save_max_chunks;
+	i64 game_world_delta_max_size;
 	//const char *game_client_data_file;
 	u16 game_port;
 	u16 game_max_connections;
+	i32 game_max_creatures;
 	i64 game_frame_interval;
+	i32 game_frame_max_catch_up;
+	i64 game_save_interval;
+	i32 game_save_max_per_frame;
+	i64 game_pathfind_budget;
+	i32 game_pathfind_max_nodes;
+	i32 game_pathfind_max_requests;
+	i32 game_pathfind_cache_frames;
+
+	const char *db_snapshot_file;
+	const char *db_wal_file;
+	i32 db_max_accounts;
+	i32 db_max_characters;
+	i64 db_compact_wal_size;
+	bool db_create_default_account;
+
+	i32 password_log2_n;
+	i32 password_r;
+	i32 password_p;
+	i32 password_workers;
+	i32 password_max_jobs;
+	i32 password_max_jobs_per_ip;
+
+	const char *const *module_files;
+	i32 num_module_files;
+	i64 module_poll_interval;
+
+	u16 metrics_port;
+	u16 metrics_max_connections;
+
+	const char *profile_trace_path;
+	i64 profile_trace_slow_frame;
+	i64 profile_trace_max_file_size;
+	i32 profile_trace_max_files;
 };
 
 #endif //KAPLAR_COMMON_HH_
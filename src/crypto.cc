@@ -1,5 +1,7 @@
 #include "crypto.hh"
 #include "buffer_util.hh"
+#include "metrics.hh"
+#include "profile.hh"
 
 // ----------------------------------------------------------------
 // CHECKSUM - ADLER32
@@ -150,6 +152,8 @@ bool rsa_encode(RSA *r, u8 *data, usize *len, usize maxlen){
 }
 
 bool rsa_decode(RSA *r, u8 *data, usize *len, usize maxlen){
+	PROFILE_ZONE("rsa_decode");
+	i64 decode_start = sys_clock_monotonic_nsec();
 	mpz_import(r->x0, *len, 1, 1, 0, 0, data);		// x0 = import(data)
 	mpz_powm(r->x1, r->x0, r->dp, r->p);			// x1 = (x0 ^ dp) mod p
 	mpz_powm(r->x2, r->x0, r->dq, r->q);			// x2 = (x0 ^ dq) mod q
@@ -159,6 +163,8 @@ bool rsa_decode(RSA *r, u8 *data, usize *len, usize maxlen){
 	mpz_mul(r->x3, r->x3, r->qi);					//
 	mpz_mod(r->x3, r->x3, r->p);					// x3 = (x3 * qi) mod p
 	mpz_addmul(r->x2, r->x3, r->q);					// x2 = x2 + x3 * q
+	metrics_add(METRIC_RSA_DECODES, 1);
+	metrics_add(METRIC_RSA_DECODE_NSEC, sys_clock_monotonic_nsec() - decode_start);
 
 	// NOTE: The maximum message length that can be encoded with
 	// this key is roughly:
@@ -245,3 +251,320 @@ void xtea_decode(u32 *k, u8 *data, usize len){
 		len -= 8; data += 8;
 	}
 }
+
+// ----------------------------------------------------------------
+// SHA256
+// ----------------------------------------------------------------
+
+static const u32 sha256_k[64] = {
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+};
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROTL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static
+void sha256_compress(u32 *state, const u8 *block){
+	u32 w[64];
+	for(i32 i = 0; i < 16; i += 1)
+		w[i] = buffer_read_u32_be((u8*)block + i * 4);
+	for(i32 i = 16; i < 64; i += 1){
+		u32 s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		u32 s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	u32 a = state[0], b = state[1], c = state[2], d = state[3];
+	u32 e = state[4], f = state[5], g = state[6], h = state[7];
+	for(i32 i = 0; i < 64; i += 1){
+		u32 s1 = ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25);
+		u32 ch = (e & f) ^ (~e & g);
+		u32 t1 = h + s1 + ch + sha256_k[i] + w[i];
+		u32 s0 = ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22);
+		u32 maj = (a & b) ^ (a & c) ^ (b & c);
+		u32 t2 = s0 + maj;
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+	state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void sha256_init(SHA256 *ctx){
+	ctx->state[0] = 0x6A09E667;
+	ctx->state[1] = 0xBB67AE85;
+	ctx->state[2] = 0x3C6EF372;
+	ctx->state[3] = 0xA54FF53A;
+	ctx->state[4] = 0x510E527F;
+	ctx->state[5] = 0x9B05688C;
+	ctx->state[6] = 0x1F83D9AB;
+	ctx->state[7] = 0x5BE0CD19;
+	ctx->total_len = 0;
+	ctx->block_len = 0;
+}
+
+void sha256_update(SHA256 *ctx, const u8 *data, usize len){
+	ctx->total_len += len;
+	if(ctx->block_len > 0){
+		usize n = SHA256_BLOCK_SIZE - ctx->block_len;
+		if(n > len)
+			n = len;
+		memcpy(ctx->block + ctx->block_len, data, n);
+		ctx->block_len += (i32)n;
+		data += n;
+		len -= n;
+		if(ctx->block_len < SHA256_BLOCK_SIZE)
+			return;
+		sha256_compress(ctx->state, ctx->block);
+		ctx->block_len = 0;
+	}
+	while(len >= SHA256_BLOCK_SIZE){
+		sha256_compress(ctx->state, data);
+		data += SHA256_BLOCK_SIZE;
+		len -= SHA256_BLOCK_SIZE;
+	}
+	if(len > 0){
+		memcpy(ctx->block, data, len);
+		ctx->block_len = (i32)len;
+	}
+}
+
+void sha256_final(SHA256 *ctx, u8 *digest){
+	u64 total_bits = ctx->total_len * 8;
+	u8 pad[SHA256_BLOCK_SIZE + 8];
+	usize pad_len = (ctx->block_len < 56) ? (56 - ctx->block_len) : (120 - ctx->block_len);
+	memset(pad, 0, pad_len);
+	pad[0] = 0x80;
+	buffer_write_u32_be(pad + pad_len, (u32)(total_bits >> 32));
+	buffer_write_u32_be(pad + pad_len + 4, (u32)total_bits);
+	sha256_update(ctx, pad, pad_len + 8);
+	ASSERT(ctx->block_len == 0);
+	for(i32 i = 0; i < 8; i += 1)
+		buffer_write_u32_be(digest + i * 4, ctx->state[i]);
+}
+
+// ----------------------------------------------------------------
+// HMAC / PBKDF2
+// ----------------------------------------------------------------
+
+void hmac_sha256_init(HMAC_SHA256 *ctx, const u8 *key, usize keylen){
+	u8 key_block[SHA256_BLOCK_SIZE];
+	memset(key_block, 0, sizeof(key_block));
+	if(keylen > SHA256_BLOCK_SIZE){
+		SHA256 tmp;
+		sha256_init(&tmp);
+		sha256_update(&tmp, key, keylen);
+		sha256_final(&tmp, key_block);
+	}else{
+		memcpy(key_block, key, keylen);
+	}
+
+	u8 pad[SHA256_BLOCK_SIZE];
+	for(i32 i = 0; i < SHA256_BLOCK_SIZE; i += 1)
+		pad[i] = key_block[i] ^ 0x36;
+	sha256_init(&ctx->inner);
+	sha256_update(&ctx->inner, pad, SHA256_BLOCK_SIZE);
+	for(i32 i = 0; i < SHA256_BLOCK_SIZE; i += 1)
+		pad[i] = key_block[i] ^ 0x5C;
+	sha256_init(&ctx->outer);
+	sha256_update(&ctx->outer, pad, SHA256_BLOCK_SIZE);
+}
+
+void hmac_sha256_update(HMAC_SHA256 *ctx, const u8 *data, usize len){
+	sha256_update(&ctx->inner, data, len);
+}
+
+void hmac_sha256_final(HMAC_SHA256 *ctx, u8 *digest){
+	u8 inner_digest[SHA256_DIGEST_SIZE];
+	sha256_final(&ctx->inner, inner_digest);
+	sha256_update(&ctx->outer, inner_digest, SHA256_DIGEST_SIZE);
+	sha256_final(&ctx->outer, digest);
+}
+
+void pbkdf2_sha256(const u8 *password, usize password_len,
+		const u8 *salt, usize salt_len, u32 iterations,
+		u8 *out, usize out_len){
+	ASSERT(iterations > 0);
+	// NOTE: The keyed state is the same for every block and iteration so
+	// we only hash the key once.
+	HMAC_SHA256 keyed;
+	hmac_sha256_init(&keyed, password, password_len);
+
+	for(u32 block_index = 1; out_len > 0; block_index += 1){
+		u8 index_be[4];
+		buffer_write_u32_be(index_be, block_index);
+
+		u8 u[SHA256_DIGEST_SIZE];
+		u8 t[SHA256_DIGEST_SIZE];
+		HMAC_SHA256 ctx = keyed;
+		hmac_sha256_update(&ctx, salt, salt_len);
+		hmac_sha256_update(&ctx, index_be, 4);
+		hmac_sha256_final(&ctx, u);
+		memcpy(t, u, SHA256_DIGEST_SIZE);
+		for(u32 i = 1; i < iterations; i += 1){
+			ctx = keyed;
+			hmac_sha256_update(&ctx, u, SHA256_DIGEST_SIZE);
+			hmac_sha256_final(&ctx, u);
+			for(i32 j = 0; j < SHA256_DIGEST_SIZE; j += 1)
+				t[j] ^= u[j];
+		}
+
+		usize n = (out_len < SHA256_DIGEST_SIZE) ? out_len : SHA256_DIGEST_SIZE;
+		memcpy(out, t, n);
+		out += n;
+		out_len -= n;
+	}
+}
+
+// ----------------------------------------------------------------
+// SCRYPT
+// ----------------------------------------------------------------
+
+static
+void salsa20_8(u32 *b){
+	u32 x[16];
+	memcpy(x, b, sizeof(x));
+	for(i32 i = 0; i < 8; i += 2){
+		x[ 4] ^= ROTL32(x[ 0] + x[12],  7);	x[ 8] ^= ROTL32(x[ 4] + x[ 0],  9);
+		x[12] ^= ROTL32(x[ 8] + x[ 4], 13);	x[ 0] ^= ROTL32(x[12] + x[ 8], 18);
+		x[ 9] ^= ROTL32(x[ 5] + x[ 1],  7);	x[13] ^= ROTL32(x[ 9] + x[ 5],  9);
+		x[ 1] ^= ROTL32(x[13] + x[ 9], 13);	x[ 5] ^= ROTL32(x[ 1] + x[13], 18);
+		x[14] ^= ROTL32(x[10] + x[ 6],  7);	x[ 2] ^= ROTL32(x[14] + x[10],  9);
+		x[ 6] ^= ROTL32(x[ 2] + x[14], 13);	x[10] ^= ROTL32(x[ 6] + x[ 2], 18);
+		x[ 3] ^= ROTL32(x[15] + x[11],  7);	x[ 7] ^= ROTL32(x[ 3] + x[15],  9);
+		x[11] ^= ROTL32(x[ 7] + x[ 3], 13);	x[15] ^= ROTL32(x[11] + x[ 7], 18);
+
+		x[ 1] ^= ROTL32(x[ 0] + x[ 3],  7);	x[ 2] ^= ROTL32(x[ 1] + x[ 0],  9);
+		x[ 3] ^= ROTL32(x[ 2] + x[ 1], 13);	x[ 0] ^= ROTL32(x[ 3] + x[ 2], 18);
+		x[ 6] ^= ROTL32(x[ 5] + x[ 4],  7);	x[ 7] ^= ROTL32(x[ 6] + x[ 5],  9);
+		x[ 4] ^= ROTL32(x[ 7] + x[ 6], 13);	x[ 5] ^= ROTL32(x[ 4] + x[ 7], 18);
+		x[11] ^= ROTL32(x[10] + x[ 9],  7);	x[ 8] ^= ROTL32(x[11] + x[10],  9);
+		x[ 9] ^= ROTL32(x[ 8] + x[11], 13);	x[10] ^= ROTL32(x[ 9] + x[ 8], 18);
+		x[12] ^= ROTL32(x[15] + x[14],  7);	x[13] ^= ROTL32(x[12] + x[15],  9);
+		x[14] ^= ROTL32(x[13] + x[12], 13);	x[15] ^= ROTL32(x[14] + x[13], 18);
+	}
+	for(i32 i = 0; i < 16; i += 1)
+		b[i] += x[i];
+}
+
+// NOTE: Blocks are 2 * r chunks of 16 words. `y` is a temporary block.
+static
+void scrypt_block_mix(u32 *b, u32 *y, u32 r){
+	u32 x[16];
+	memcpy(x, &b[(2 * r - 1) * 16], 64);
+	for(u32 i = 0; i < 2 * r; i += 1){
+		for(i32 j = 0; j < 16; j += 1)
+			x[j] ^= b[i * 16 + j];
+		salsa20_8(x);
+		// NOTE: Even chunks go to the first half and odd ones to the
+		// second half.
+		memcpy(&y[((i & 1) * r + (i >> 1)) * 16], x, 64);
+	}
+	memcpy(b, y, 128 * r);
+}
+
+static
+void scrypt_ro_mix(u8 *block, u32 log2_n, u32 r, u32 *v, u32 *xy){
+	u32 n = (u32)1 << log2_n;
+	u32 words = 32 * r;
+	u32 *x = xy;
+	u32 *y = xy + words;
+	for(u32 i = 0; i < words; i += 1)
+		x[i] = buffer_read_u32_le(block + i * 4);
+
+	for(u32 i = 0; i < n; i += 1){
+		memcpy(&v[i * words], x, words * 4);
+		scrypt_block_mix(x, y, r);
+	}
+	for(u32 i = 0; i < n; i += 1){
+		u32 j = x[(2 * r - 1) * 16] & (n - 1);
+		for(u32 k = 0; k < words; k += 1)
+			x[k] ^= v[j * words + k];
+		scrypt_block_mix(x, y, r);
+	}
+
+	for(u32 i = 0; i < words; i += 1)
+		buffer_write_u32_le(block + i * 4, x[i]);
+}
+
+usize scrypt_scratch_size(u32 log2_n, u32 r, u32 p){
+	// B + XY + V
+	return (usize)128 * r * p + (usize)256 * r
+		+ ((usize)128 * r << log2_n);
+}
+
+void scrypt(const u8 *password, usize password_len,
+		const u8 *salt, usize salt_len,
+		u32 log2_n, u32 r, u32 p,
+		u8 *scratch, usize scratch_size,
+		u8 *out, usize out_len){
+	ASSERT(log2_n > 0 && log2_n < 32 && r > 0 && p > 0);
+	ASSERT(scratch_size >= scrypt_scratch_size(log2_n, r, p));
+	ASSERT(((usize)scratch & 3) == 0);
+	usize block_size = (usize)128 * r;
+	u8 *b = scratch;
+	u32 *xy = (u32*)(scratch + block_size * p);
+	u32 *v = xy + 64 * r;
+
+	pbkdf2_sha256(password, password_len, salt, salt_len, 1, b, block_size * p);
+	for(u32 i = 0; i < p; i += 1)
+		scrypt_ro_mix(b + i * block_size, log2_n, r, v, xy);
+	pbkdf2_sha256(password, password_len, b, block_size * p, 1, out, out_len);
+
+	// NOTE: The scratch memory has everything needed to get the password
+	// hash back so don't leave it around.
+	memset(scratch, 0, scratch_size);
+}
+
+#if BUILD_TEST
+static
+bool crypto_test_hex(const char *name, u8 *got, const char *expected_hex){
+	usize len = strlen(expected_hex) / 2;
+	bool passed = true;
+	for(usize i = 0; i < len; i += 1){
+		u32 byte;
+		sscanf(expected_hex + i * 2, "%2x", &byte);
+		if(got[i] != (u8)byte)
+			passed = false;
+	}
+	debug_printf("%s test: %s\n", name, (passed ? "passed" : "failed"));
+	return passed;
+}
+
+bool scrypt_test(void){
+	bool passed = true;
+	u8 out[64];
+
+	SHA256 sha;
+	sha256_init(&sha);
+	sha256_update(&sha, (const u8*)"abc", 3);
+	sha256_final(&sha, out);
+	passed = crypto_test_hex("SHA256", out,
+		"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad") && passed;
+
+	pbkdf2_sha256((const u8*)"passwd", 6, (const u8*)"salt", 4, 1, out, 64);
+	passed = crypto_test_hex("PBKDF2", out,
+		"55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc"
+		"49ca9cccf179b645991664b39d77ef317c71b845b1e30bd509112041d3a19783") && passed;
+
+	usize scratch_size = scrypt_scratch_size(10, 8, 16);
+	u8 *scratch = (u8*)malloc_no_fail(scratch_size);
+	scrypt((const u8*)"", 0, (const u8*)"", 0, 4, 1, 1, scratch, scratch_size, out, 64);
+	passed = crypto_test_hex("SCRYPT 1", out,
+		"77d6576238657b203b19ca42c18a0497f16b4844e3074ae8dfdffa3fede21442"
+		"fcd0069ded0948f8326a753a0fc81f17e8d3e0fb2e0d3628cf35e20c38d18906") && passed;
+	scrypt((const u8*)"password", 8, (const u8*)"NaCl", 4, 10, 8, 16, scratch, scratch_size, out, 64);
+	passed = crypto_test_hex("SCRYPT 2", out,
+		"fdbabe1c9d3472007856e7190d01e9fe7c6ad7cbc8237830e77376634b373162"
+		"2eaf30d92e22a3886ff109279d9830dac727afb94a83ee6d8360cbdfa2cc0640") && passed;
+	free(scratch);
+	return passed;
+}
+#endif //BUILD_TEST
@@ -29,4 +29,53 @@ bool rsa_decode(RSA *r, u8 *data, usize *len, usize maxlen);
 void xtea_encode(u32 *k, u8 *data, usize len);
 void xtea_decode(u32 *k, u8 *data, usize len);
 
+// ----------------------------------------------------------------
+// SHA256 / HMAC / PBKDF2
+// ----------------------------------------------------------------
+#define SHA256_BLOCK_SIZE 64
+#define SHA256_DIGEST_SIZE 32
+
+struct SHA256{
+	u32 state[8];
+	u64 total_len;
+	u8 block[SHA256_BLOCK_SIZE];
+	i32 block_len;
+};
+
+void sha256_init(SHA256 *ctx);
+void sha256_update(SHA256 *ctx, const u8 *data, usize len);
+void sha256_final(SHA256 *ctx, u8 *digest);
+
+struct HMAC_SHA256{
+	SHA256 inner;
+	SHA256 outer;
+};
+
+void hmac_sha256_init(HMAC_SHA256 *ctx, const u8 *key, usize keylen);
+void hmac_sha256_update(HMAC_SHA256 *ctx, const u8 *data, usize len);
+void hmac_sha256_final(HMAC_SHA256 *ctx, u8 *digest);
+
+void pbkdf2_sha256(const u8 *password, usize password_len,
+		const u8 *salt, usize salt_len, u32 iterations,
+		u8 *out, usize out_len);
+
+// ----------------------------------------------------------------
+// SCRYPT
+// ----------------------------------------------------------------
+// NOTE: The cost is N = 2^log2_n, the block size r, and the parallelism
+// p. It uses 128 * r * N bytes of memory for each of the p lanes, which
+// run one after the other here. The scratch memory is given by the caller
+// so it can be reused between calls and must have at least
+// scrypt_scratch_size bytes.
+usize scrypt_scratch_size(u32 log2_n, u32 r, u32 p);
+void scrypt(const u8 *password, usize password_len,
+		const u8 *salt, usize salt_len,
+		u32 log2_n, u32 r, u32 p,
+		u8 *scratch, usize scratch_size,
+		u8 *out, usize out_len);
+
+#if BUILD_TEST
+bool scrypt_test(void);
+#endif
+
 #endif //KAPLAR_CRYPTO_HH_
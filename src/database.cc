@@ -0,0 +1,862 @@
+#include "database.hh"
+
+#include "buffer_util.hh"
+#include "crypto.hh"
+#include "file.hh"
+
+#include <stdio.h>
+
+#define DB_VERSION 2
+
+// NOTE: Record sizes, including the trailing adler32.
+#define DB_INFO_RECORD_SIZE (2 + 4 + 4 + 4)
+#define DB_PASSWORD_RECORD_SIZE (3 + PASSWORD_SALT_SIZE + PASSWORD_HASH_SIZE)
+#define DB_ACCOUNT_RECORD_SIZE (4 + DB_NAME_MAX + DB_PASSWORD_RECORD_SIZE + 2 + 4)
+#define DB_CHARACTER_RECORD_SIZE (4 + 4 + DB_NAME_MAX + 2 + 2 + 1 + 1 + 2 + 5 + 4)
+#define DB_CHARACTER_POSITION_RECORD_SIZE (4 + 2 + 2 + 1 + 1 + 4)
+#define DB_CHARACTER_OUTFIT_RECORD_SIZE (4 + 2 + 5 + 4)
+#define DB_MAX_RECORD_SIZE (8 + DB_ACCOUNT_RECORD_SIZE)
+static_assert(DB_ACCOUNT_RECORD_SIZE >= DB_CHARACTER_RECORD_SIZE
+	&& DB_ACCOUNT_RECORD_SIZE >= DB_INFO_RECORD_SIZE,
+	"DB_MAX_RECORD_SIZE should use the largest record");
+
+// NOTE: Nanoseconds to wait before retrying a failed compaction.
+#define DB_COMPACT_MIN_BACKOFF (1000 * 1000000LL)
+#define DB_COMPACT_MAX_BACKOFF (60 * 1000 * 1000000LL)
+
+struct Database{
+	char snapshot_file[256];
+	char wal_file[256];
+	FILE *wal;
+	i64 wal_size;
+	bool wal_uncommitted;
+	i64 compact_wal_size;
+	i64 compact_retry_time;
+	i64 compact_backoff;
+
+	// NOTE: Cost for new password hashes.
+	u32 password_log2_n;
+	u32 password_r;
+	u32 password_p;
+
+	i32 max_accounts;
+	i32 num_accounts;
+	DBAccount *accounts;
+	u32 account_table_mask;
+	u32 *account_table;
+
+	i32 max_characters;
+	i32 num_characters;
+	DBCharacter *characters;
+	u32 character_table_mask;
+	u32 *character_table;
+};
+
+// ----------------------------------------------------------------
+// Index
+// ----------------------------------------------------------------
+
+// NOTE: Names are case insensitive, like in the client.
+static INLINE
+char db_name_lower(char c){
+	return (c >= 'A' && c <= 'Z') ? (c - 'A' + 'a') : c;
+}
+
+static
+u32 db_name_hash(const char *name){
+	// FNV-1a
+	u32 hash = 0x811C9DC5;
+	for(const char *p = name; *p; p += 1){
+		hash ^= (u8)db_name_lower(*p);
+		hash *= 0x01000193;
+	}
+	return hash;
+}
+
+static
+bool db_name_equal(const char *a, const char *b){
+	while(*a && db_name_lower(*a) == db_name_lower(*b)){
+		a += 1;
+		b += 1;
+	}
+	return db_name_lower(*a) == db_name_lower(*b);
+}
+
+static
+bool db_name_valid(const char *name){
+	usize len = strlen(name);
+	return len > 0 && len < DB_NAME_MAX;
+}
+
+// NOTE: Tables store ids (index + 1) with zero for empty slots. There are
+// no deletions so there are no tombstones and a lookup stops at the first
+// empty slot.
+static
+u32 *db_table_slot(u32 *table, u32 mask, const char *name,
+		const char *(*get_name)(Database*, u32), Database *db){
+	u32 slot = db_name_hash(name) & mask;
+	while(table[slot] != 0){
+		if(db_name_equal(get_name(db, table[slot]), name))
+			break;
+		slot = (slot + 1) & mask;
+	}
+	return &table[slot];
+}
+
+static
+const char *db_account_name(Database *db, u32 id){
+	return db->accounts[id - 1].name;
+}
+
+static
+const char *db_character_name(Database *db, u32 id){
+	return db->characters[id - 1].name;
+}
+
+static
+u32 db_table_mask(i32 max_entries){
+	// NOTE: Keep the load factor at or below 50%.
+	u32 capacity = 16;
+	while(capacity < (u32)max_entries * 2)
+		capacity *= 2;
+	return capacity - 1;
+}
+
+DBAccount *database_find_account(Database *db, const char *name){
+	u32 id = *db_table_slot(db->account_table, db->account_table_mask,
+		name, db_account_name, db);
+	return id ? &db->accounts[id - 1] : NULL;
+}
+
+DBCharacter *database_find_character(Database *db, const char *name){
+	u32 id = *db_table_slot(db->character_table, db->character_table_mask,
+		name, db_character_name, db);
+	return id ? &db->characters[id - 1] : NULL;
+}
+
+DBCharacter *database_get_character(Database *db, u32 character_id){
+	if(character_id == 0 || character_id > (u32)db->num_characters)
+		return NULL;
+	return &db->characters[character_id - 1];
+}
+
+// NOTE: Account and character names are case insensitive.
+bool database_name_equal(const char *a, const char *b){
+	return db_name_equal(a, b);
+}
+
+// ----------------------------------------------------------------
+// Records
+// ----------------------------------------------------------------
+
+// NOTE: Records are written as KPB elements whose last four bytes are the
+// adler32 of the rest of the element data.
+static
+i32 db_record_begin(u8 *buf, u32 elem_id, i32 size){
+	buffer_write_u32_le(buf + 0, elem_id);
+	buffer_write_u32_le(buf + 4, (u32)size);
+	return 8;
+}
+
+static
+i32 db_record_end(u8 *buf, i32 pos){
+	u32 checksum = adler32(buf + 8, pos - 8);
+	buffer_write_u32_le(buf + pos, checksum);
+	return pos + 4;
+}
+
+static
+i32 db_write_name(u8 *buf, const char *name, i32 size){
+	memset(buf, 0, size);
+	strncpy((char*)buf, name, size - 1);
+	return size;
+}
+
+static
+i32 db_encode_account(u8 *buf, DBAccount *account){
+	i32 pos = db_record_begin(buf, KPB_ID_DB_ACCOUNT, DB_ACCOUNT_RECORD_SIZE);
+	buffer_write_u32_le(buf + pos, account->id);						pos += 4;
+	pos += db_write_name(buf + pos, account->name, DB_NAME_MAX);
+	buffer_write_u8(buf + pos, account->password.log2_n);				pos += 1;
+	buffer_write_u8(buf + pos, account->password.r);					pos += 1;
+	buffer_write_u8(buf + pos, account->password.p);					pos += 1;
+	memcpy(buf + pos, account->password.salt, PASSWORD_SALT_SIZE);		pos += PASSWORD_SALT_SIZE;
+	memcpy(buf + pos, account->password.hash, PASSWORD_HASH_SIZE);		pos += PASSWORD_HASH_SIZE;
+	buffer_write_u16_le(buf + pos, account->premium_days);				pos += 2;
+	pos = db_record_end(buf, pos);
+	ASSERT(pos == 8 + DB_ACCOUNT_RECORD_SIZE);
+	return pos;
+}
+
+static
+i32 db_encode_character(u8 *buf, DBCharacter *character){
+	i32 pos = db_record_begin(buf, KPB_ID_DB_CHARACTER, DB_CHARACTER_RECORD_SIZE);
+	buffer_write_u32_le(buf + pos, character->id);						pos += 4;
+	buffer_write_u32_le(buf + pos, character->account_id);				pos += 4;
+	pos += db_write_name(buf + pos, character->name, DB_NAME_MAX);
+	buffer_write_u16_le(buf + pos, character->pos_x);					pos += 2;
+	buffer_write_u16_le(buf + pos, character->pos_y);					pos += 2;
+	buffer_write_u8(buf + pos, character->pos_z);						pos += 1;
+	buffer_write_u8(buf + pos, character->direction);					pos += 1;
+	buffer_write_u16_le(buf + pos, character->look_type);				pos += 2;
+	buffer_write_u8(buf + pos, character->look_head);					pos += 1;
+	buffer_write_u8(buf + pos, character->look_body);					pos += 1;
+	buffer_write_u8(buf + pos, character->look_legs);					pos += 1;
+	buffer_write_u8(buf + pos, character->look_feet);					pos += 1;
+	buffer_write_u8(buf + pos, character->look_addons);					pos += 1;
+	pos = db_record_end(buf, pos);
+	ASSERT(pos == 8 + DB_CHARACTER_RECORD_SIZE);
+	return pos;
+}
+
+static
+i32 db_encode_character_position(u8 *buf, DBCharacter *character){
+	i32 pos = db_record_begin(buf, KPB_ID_DB_CHARACTER_POSITION,
+		DB_CHARACTER_POSITION_RECORD_SIZE);
+	buffer_write_u32_le(buf + pos, character->id);						pos += 4;
+	buffer_write_u16_le(buf + pos, character->pos_x);					pos += 2;
+	buffer_write_u16_le(buf + pos, character->pos_y);					pos += 2;
+	buffer_write_u8(buf + pos, character->pos_z);						pos += 1;
+	buffer_write_u8(buf + pos, character->direction);					pos += 1;
+	pos = db_record_end(buf, pos);
+	ASSERT(pos == 8 + DB_CHARACTER_POSITION_RECORD_SIZE);
+	return pos;
+}
+
+static
+i32 db_encode_character_outfit(u8 *buf, DBCharacter *character){
+	i32 pos = db_record_begin(buf, KPB_ID_DB_CHARACTER_OUTFIT,
+		DB_CHARACTER_OUTFIT_RECORD_SIZE);
+	buffer_write_u32_le(buf + pos, character->id);						pos += 4;
+	buffer_write_u16_le(buf + pos, character->look_type);				pos += 2;
+	buffer_write_u8(buf + pos, character->look_head);					pos += 1;
+	buffer_write_u8(buf + pos, character->look_body);					pos += 1;
+	buffer_write_u8(buf + pos, character->look_legs);					pos += 1;
+	buffer_write_u8(buf + pos, character->look_feet);					pos += 1;
+	buffer_write_u8(buf + pos, character->look_addons);					pos += 1;
+	pos = db_record_end(buf, pos);
+	ASSERT(pos == 8 + DB_CHARACTER_OUTFIT_RECORD_SIZE);
+	return pos;
+}
+
+static
+bool db_record_checksum_ok(KPB_Element *elem){
+	i32 size = kpb_element_remainder(elem);
+	if(size < 4)
+		return false;
+	u32 checksum = buffer_read_u32_le(elem->buf + size - 4);
+	return adler32(elem->buf, size - 4) == checksum;
+}
+
+static
+void db_read_bytes(KPB_Element *elem, u8 *out, i32 size){
+	if(kpb_element_can_read(elem, size))
+		memcpy(out, elem->buf + elem->bufpos, size);
+	elem->bufpos += size;
+}
+
+static
+void db_read_name(KPB_Element *elem, char *out, i32 size){
+	db_read_bytes(elem, (u8*)out, size);
+	out[size - 1] = 0;
+}
+
+static
+bool db_link_character(Database *db, DBCharacter *character){
+	if(character->account_id == 0 || character->account_id > (u32)db->num_accounts)
+		return false;
+	DBAccount *account = &db->accounts[character->account_id - 1];
+	for(i32 i = 0; i < account->num_characters; i += 1){
+		if(account->character_ids[i] == character->id)
+			return true;
+	}
+	if(account->num_characters >= DB_ACCOUNT_MAX_CHARACTERS)
+		return false;
+	account->character_ids[account->num_characters] = character->id;
+	account->num_characters += 1;
+	return true;
+}
+
+// NOTE: Records carry their whole state so applying one is an insert if
+// its id is the next one or an update if it already exists. Names can't
+// change because they're indexed.
+static
+bool db_apply_account(Database *db, KPB_Element *elem){
+	if(kpb_element_remainder(elem) != DB_ACCOUNT_RECORD_SIZE
+	|| !db_record_checksum_ok(elem))
+		return false;
+
+	DBAccount tmp;
+	memset(&tmp, 0, sizeof(DBAccount));
+	tmp.id = kpb_element_read_u32(elem);
+	db_read_name(elem, tmp.name, DB_NAME_MAX);
+	tmp.password.log2_n = kpb_element_read_u8(elem);
+	tmp.password.r = kpb_element_read_u8(elem);
+	tmp.password.p = kpb_element_read_u8(elem);
+	db_read_bytes(elem, tmp.password.salt, PASSWORD_SALT_SIZE);
+	db_read_bytes(elem, tmp.password.hash, PASSWORD_HASH_SIZE);
+	tmp.premium_days = kpb_element_read_u16(elem);
+	if(!db_name_valid(tmp.name))
+		return false;
+
+	u32 *slot = db_table_slot(db->account_table, db->account_table_mask,
+		tmp.name, db_account_name, db);
+	if(tmp.id == (u32)db->num_accounts + 1){
+		if(*slot != 0 || db->num_accounts >= db->max_accounts)
+			return false;
+		db->accounts[db->num_accounts] = tmp;
+		db->num_accounts += 1;
+		*slot = tmp.id;
+	}else if(tmp.id != 0 && tmp.id <= (u32)db->num_accounts && *slot == tmp.id){
+		DBAccount *account = &db->accounts[tmp.id - 1];
+		account->password = tmp.password;
+		account->premium_days = tmp.premium_days;
+	}else{
+		return false;
+	}
+	return true;
+}
+
+static
+bool db_apply_character(Database *db, KPB_Element *elem){
+	if(kpb_element_remainder(elem) != DB_CHARACTER_RECORD_SIZE
+	|| !db_record_checksum_ok(elem))
+		return false;
+
+	DBCharacter tmp;
+	memset(&tmp, 0, sizeof(DBCharacter));
+	tmp.id = kpb_element_read_u32(elem);
+	tmp.account_id = kpb_element_read_u32(elem);
+	db_read_name(elem, tmp.name, DB_NAME_MAX);
+	tmp.pos_x = kpb_element_read_u16(elem);
+	tmp.pos_y = kpb_element_read_u16(elem);
+	tmp.pos_z = kpb_element_read_u8(elem);
+	tmp.direction = kpb_element_read_u8(elem);
+	tmp.look_type = kpb_element_read_u16(elem);
+	tmp.look_head = kpb_element_read_u8(elem);
+	tmp.look_body = kpb_element_read_u8(elem);
+	tmp.look_legs = kpb_element_read_u8(elem);
+	tmp.look_feet = kpb_element_read_u8(elem);
+	tmp.look_addons = kpb_element_read_u8(elem);
+	if(!db_name_valid(tmp.name))
+		return false;
+
+	u32 *slot = db_table_slot(db->character_table, db->character_table_mask,
+		tmp.name, db_character_name, db);
+	if(tmp.id == (u32)db->num_characters + 1){
+		if(*slot != 0 || db->num_characters >= db->max_characters)
+			return false;
+		if(!db_link_character(db, &tmp))
+			return false;
+		db->characters[db->num_characters] = tmp;
+		db->num_characters += 1;
+		*slot = tmp.id;
+	}else if(tmp.id != 0 && tmp.id <= (u32)db->num_characters && *slot == tmp.id){
+		DBCharacter *character = &db->characters[tmp.id - 1];
+		if(character->account_id != tmp.account_id)
+			return false;
+		*character = tmp;
+	}else{
+		return false;
+	}
+	return true;
+}
+
+// NOTE: Section records only update a character that already exists.
+static
+DBCharacter *db_section_character(Database *db, KPB_Element *elem, i32 record_size){
+	if(kpb_element_remainder(elem) != record_size
+	|| !db_record_checksum_ok(elem))
+		return NULL;
+	u32 id = kpb_element_read_u32(elem);
+	return database_get_character(db, id);
+}
+
+static
+bool db_apply_character_position(Database *db, KPB_Element *elem){
+	DBCharacter *character = db_section_character(db, elem,
+		DB_CHARACTER_POSITION_RECORD_SIZE);
+	if(!character)
+		return false;
+	character->pos_x = kpb_element_read_u16(elem);
+	character->pos_y = kpb_element_read_u16(elem);
+	character->pos_z = kpb_element_read_u8(elem);
+	character->direction = kpb_element_read_u8(elem);
+	return true;
+}
+
+static
+bool db_apply_character_outfit(Database *db, KPB_Element *elem){
+	DBCharacter *character = db_section_character(db, elem,
+		DB_CHARACTER_OUTFIT_RECORD_SIZE);
+	if(!character)
+		return false;
+	character->look_type = kpb_element_read_u16(elem);
+	character->look_head = kpb_element_read_u8(elem);
+	character->look_body = kpb_element_read_u8(elem);
+	character->look_legs = kpb_element_read_u8(elem);
+	character->look_feet = kpb_element_read_u8(elem);
+	character->look_addons = kpb_element_read_u8(elem);
+	return true;
+}
+
+// ----------------------------------------------------------------
+// Files
+// ----------------------------------------------------------------
+
+static
+void db_load_snapshot(Database *db){
+	i32 fsize;
+	u8 *fbuf = read_entire_file_temp(db->snapshot_file, &fsize);
+	if(!fbuf){
+		LOG("no snapshot file \"%s\", starting empty", db->snapshot_file);
+		return;
+	}
+
+	// NOTE: Unlike the log, a bad snapshot isn't something we can recover
+	// from by dropping records so don't try to start with it.
+	KPB_Element top = kpb_top_level(fbuf, fsize);
+	KPB_Element elem;
+	if(!kpb_next_element(&top, &elem) || elem.elem_id != KPB_ID_DB_INFO
+	|| kpb_element_remainder(&elem) != DB_INFO_RECORD_SIZE
+	|| !db_record_checksum_ok(&elem))
+		PANIC("\"%s\": invalid snapshot header", db->snapshot_file);
+
+	u16 version = kpb_element_read_u16(&elem);
+	u32 num_accounts = kpb_element_read_u32(&elem);
+	u32 num_characters = kpb_element_read_u32(&elem);
+	if(version != DB_VERSION)
+		PANIC("\"%s\": unsupported version %d", db->snapshot_file, version);
+	if(num_accounts > (u32)db->max_accounts || num_characters > (u32)db->max_characters){
+		PANIC("\"%s\": snapshot has %u accounts and %u characters"
+			" (max = %d and %d)", db->snapshot_file, num_accounts,
+			num_characters, db->max_accounts, db->max_characters);
+	}
+
+	bool checksum_found = false;
+	while(kpb_next_element(&top, &elem)){
+		bool ok = false;
+		switch(elem.elem_id){
+			case KPB_ID_DB_ACCOUNT: ok = db_apply_account(db, &elem); break;
+			case KPB_ID_DB_CHARACTER: ok = db_apply_character(db, &elem); break;
+			case KPB_ID_CHECKSUM: {
+				u32 checksum = kpb_element_read_u32(&elem);
+				i32 checked_size = top.bufpos - 12;
+				ok = kpb_element_remainder(&elem) == 0
+					&& adler32(fbuf, checked_size) == checksum;
+				checksum_found = true;
+				break;
+			}
+		}
+		if(!ok)
+			PANIC("\"%s\": invalid element at offset %d", db->snapshot_file, top.bufpos);
+		if(checksum_found)
+			break;
+	}
+
+	if(!checksum_found || kpb_element_remainder(&top) != 0
+	|| (u32)db->num_accounts != num_accounts
+	|| (u32)db->num_characters != num_characters)
+		PANIC("\"%s\": truncated snapshot", db->snapshot_file);
+	free(fbuf);
+}
+
+// NOTE: Returns false if the log has a bad record, in which case the
+// records before it were applied and the rest were dropped.
+static
+bool db_replay_wal(Database *db, i64 *out_size){
+	*out_size = 0;
+	i32 fsize;
+	u8 *fbuf = read_entire_file_temp(db->wal_file, &fsize);
+	if(!fbuf)
+		return true;
+	*out_size = fsize;
+
+	i32 num_records = 0;
+	KPB_Element top = kpb_top_level(fbuf, fsize);
+	KPB_Element elem;
+	while(kpb_next_element(&top, &elem)){
+		bool ok = false;
+		switch(elem.elem_id){
+			case KPB_ID_DB_ACCOUNT: ok = db_apply_account(db, &elem); break;
+			case KPB_ID_DB_CHARACTER: ok = db_apply_character(db, &elem); break;
+			case KPB_ID_DB_CHARACTER_POSITION: ok = db_apply_character_position(db, &elem); break;
+			case KPB_ID_DB_CHARACTER_OUTFIT: ok = db_apply_character_outfit(db, &elem); break;
+		}
+		if(!ok){
+			// NOTE: Step back to the start of the bad element.
+			top.bufpos -= elem.bufend + 8;
+			break;
+		}
+		num_records += 1;
+	}
+
+	bool result = kpb_element_remainder(&top) == 0;
+	if(!result){
+		LOG_ERROR("\"%s\": dropping %d bytes after record %d",
+			db->wal_file, kpb_element_remainder(&top), num_records);
+	}
+	LOG("replayed %d records from \"%s\"", num_records, db->wal_file);
+	free(fbuf);
+	return result;
+}
+
+static
+bool db_wal_append(Database *db, u8 *buf, i32 len){
+	if(fwrite(buf, 1, len, db->wal) != (usize)len){
+		LOG_ERROR("failed to write to \"%s\"", db->wal_file);
+		return false;
+	}
+	db->wal_size += len;
+	db->wal_uncommitted = true;
+	return true;
+}
+
+// NOTE: Make every record appended so far durable.
+bool database_commit(Database *db){
+	if(!db->wal_uncommitted)
+		return true;
+	if(!sys_fsync(db->wal)){
+		LOG_ERROR("failed to sync \"%s\"", db->wal_file);
+		return false;
+	}
+	db->wal_uncommitted = false;
+	return true;
+}
+
+bool database_compact(Database *db){
+	char tmp_file[256 + 4];
+	snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", db->snapshot_file);
+	FILE *fp = fopen(tmp_file, "wb");
+	if(!fp){
+		LOG_ERROR("failed to open \"%s\"", tmp_file);
+		return false;
+	}
+
+	u32 checksum = 1;
+	bool ok = true;
+	u8 buf[DB_MAX_RECORD_SIZE];
+	i32 pos = db_record_begin(buf, KPB_ID_DB_INFO, DB_INFO_RECORD_SIZE);
+	buffer_write_u16_le(buf + pos, DB_VERSION);						pos += 2;
+	buffer_write_u32_le(buf + pos, (u32)db->num_accounts);			pos += 4;
+	buffer_write_u32_le(buf + pos, (u32)db->num_characters);		pos += 4;
+	pos = db_record_end(buf, pos);
+	checksum = adler32_accumulate(checksum, buf, pos);
+	ok = ok && fwrite(buf, 1, pos, fp) == (usize)pos;
+
+	for(i32 i = 0; i < db->num_accounts && ok; i += 1){
+		pos = db_encode_account(buf, &db->accounts[i]);
+		checksum = adler32_accumulate(checksum, buf, pos);
+		ok = fwrite(buf, 1, pos, fp) == (usize)pos;
+	}
+	for(i32 i = 0; i < db->num_characters && ok; i += 1){
+		pos = db_encode_character(buf, &db->characters[i]);
+		checksum = adler32_accumulate(checksum, buf, pos);
+		ok = fwrite(buf, 1, pos, fp) == (usize)pos;
+	}
+
+	pos = db_record_begin(buf, KPB_ID_CHECKSUM, 4);
+	buffer_write_u32_le(buf + pos, checksum);						pos += 4;
+	ok = ok && fwrite(buf, 1, pos, fp) == (usize)pos;
+	ok = ok && sys_fsync(fp);
+	fclose(fp);
+
+	// NOTE: The snapshot replaces the old one atomically and only then the
+	// log is truncated. If we crash in between, the log is replayed over
+	// the new snapshot which gives the same state.
+	if(!ok || !sys_file_replace(tmp_file, db->snapshot_file)){
+		LOG_ERROR("failed to write snapshot \"%s\"", db->snapshot_file);
+		return false;
+	}
+
+	if(db->wal)
+		fclose(db->wal);
+	db->wal = fopen(db->wal_file, "wb");
+	if(!db->wal || !sys_fsync(db->wal))
+		PANIC("failed to truncate \"%s\"", db->wal_file);
+	db->wal_uncommitted = false;
+	LOG("compacted %lld bytes of log into \"%s\"", (long long)db->wal_size, db->snapshot_file);
+	db->wal_size = 0;
+	return true;
+}
+
+// NOTE: Called by the storage worker whenever it's idle. A failed compaction
+// is retried later, backing off up to DB_COMPACT_MAX_BACKOFF, so a full
+// disk doesn't turn into an error every millisecond.
+void database_maybe_compact(Database *db){
+	if(db->wal_size < db->compact_wal_size)
+		return;
+
+	i64 now = sys_clock_monotonic_nsec();
+	if(now < db->compact_retry_time)
+		return;
+
+	if(database_compact(db)){
+		db->compact_backoff = DB_COMPACT_MIN_BACKOFF;
+	}else{
+		LOG_ERROR("compaction failed, retrying in %lld ms",
+			(long long)(db->compact_backoff / 1000000));
+		db->compact_retry_time = now + db->compact_backoff;
+		db->compact_backoff *= 2;
+		if(db->compact_backoff > DB_COMPACT_MAX_BACKOFF)
+			db->compact_backoff = DB_COMPACT_MAX_BACKOFF;
+	}
+}
+
+// ----------------------------------------------------------------
+// Changes
+// ----------------------------------------------------------------
+
+DBAccount *database_create_account(Database *db,
+		const char *name, const char *password){
+	if(!db_name_valid(name) || strlen(password) >= PASSWORD_MAX)
+		return NULL;
+	if(db->num_accounts >= db->max_accounts){
+		LOG_ERROR("account limit reached (%d)", db->max_accounts);
+		return NULL;
+	}
+
+	u32 *slot = db_table_slot(db->account_table, db->account_table_mask,
+		name, db_account_name, db);
+	if(*slot != 0)
+		return NULL;
+
+	DBAccount tmp;
+	memset(&tmp, 0, sizeof(DBAccount));
+	tmp.id = (u32)db->num_accounts + 1;
+	strncpy(tmp.name, name, DB_NAME_MAX - 1);
+	password_hash(password, db->password_log2_n,
+		db->password_r, db->password_p, &tmp.password);
+
+	// NOTE: Only change the in-memory state after the record is in the
+	// log so we never hand out something that wouldn't survive a restart.
+	u8 buf[DB_MAX_RECORD_SIZE];
+	i32 len = db_encode_account(buf, &tmp);
+	if(!db_wal_append(db, buf, len) || !database_commit(db))
+		return NULL;
+
+	DBAccount *account = &db->accounts[db->num_accounts];
+	*account = tmp;
+	db->num_accounts += 1;
+	*slot = account->id;
+	return account;
+}
+
+DBCharacter *database_create_character(Database *db,
+		DBAccount *account, const char *name){
+	if(!db_name_valid(name))
+		return NULL;
+	if(account->num_characters >= DB_ACCOUNT_MAX_CHARACTERS)
+		return NULL;
+	if(db->num_characters >= db->max_characters){
+		LOG_ERROR("character limit reached (%d)", db->max_characters);
+		return NULL;
+	}
+
+	u32 *slot = db_table_slot(db->character_table, db->character_table_mask,
+		name, db_character_name, db);
+	if(*slot != 0)
+		return NULL;
+
+	// TODO: These should come from the world (temple position) and from
+	// the vocation once we have them.
+	DBCharacter tmp;
+	memset(&tmp, 0, sizeof(DBCharacter));
+	tmp.id = (u32)db->num_characters + 1;
+	tmp.account_id = account->id;
+	strncpy(tmp.name, name, DB_NAME_MAX - 1);
+	tmp.pos_x = 100;
+	tmp.pos_y = 100;
+	tmp.pos_z = 7;
+	tmp.direction = 2;
+	tmp.look_type = 136;
+	tmp.look_head = 10;
+	tmp.look_body = 10;
+	tmp.look_legs = 10;
+	tmp.look_feet = 10;
+	tmp.look_addons = 0;
+
+	u8 buf[DB_MAX_RECORD_SIZE];
+	i32 len = db_encode_character(buf, &tmp);
+	if(!db_wal_append(db, buf, len) || !database_commit(db))
+		return NULL;
+
+	DBCharacter *character = &db->characters[db->num_characters];
+	*character = tmp;
+	db->num_characters += 1;
+	*slot = character->id;
+	db_link_character(db, character);
+	return character;
+}
+
+bool database_update_character(Database *db, DBCharacter *character, u32 sections){
+	ASSERT(database_get_character(db, character->id) == character);
+	u8 buf[DB_MAX_RECORD_SIZE];
+	bool result = true;
+	if(sections & DB_CHARACTER_SECTION_POSITION){
+		i32 len = db_encode_character_position(buf, character);
+		result = result && db_wal_append(db, buf, len);
+	}
+	if(sections & DB_CHARACTER_SECTION_OUTFIT){
+		i32 len = db_encode_character_outfit(buf, character);
+		result = result && db_wal_append(db, buf, len);
+	}
+	return result;
+}
+
+// ----------------------------------------------------------------
+
+Database *database_init(MemArena *arena, Config *cfg){
+	ASSERT(cfg->db_snapshot_file && cfg->db_wal_file);
+	ASSERT(cfg->db_max_accounts > 0 && cfg->db_max_characters > 0);
+
+	Database *db = arena_alloc<Database>(arena, 1);
+	memset(db, 0, sizeof(Database));
+	snprintf(db->snapshot_file, sizeof(db->snapshot_file), "%s", cfg->db_snapshot_file);
+	snprintf(db->wal_file, sizeof(db->wal_file), "%s", cfg->db_wal_file);
+	db->compact_wal_size = cfg->db_compact_wal_size;
+	db->compact_retry_time = 0;
+	db->compact_backoff = DB_COMPACT_MIN_BACKOFF;
+	if(!password_params_valid(cfg->password_log2_n, cfg->password_r, cfg->password_p)){
+		PANIC("invalid password hash params (log2_n = %d, r = %d, p = %d)",
+			cfg->password_log2_n, cfg->password_r, cfg->password_p);
+	}
+	db->password_log2_n = cfg->password_log2_n;
+	db->password_r = cfg->password_r;
+	db->password_p = cfg->password_p;
+
+	db->max_accounts = cfg->db_max_accounts;
+	db->accounts = arena_alloc<DBAccount>(arena, db->max_accounts);
+	db->account_table_mask = db_table_mask(db->max_accounts);
+	db->account_table = arena_alloc_init<u32>(arena, db->account_table_mask + 1, 0);
+
+	db->max_characters = cfg->db_max_characters;
+	db->characters = arena_alloc<DBCharacter>(arena, db->max_characters);
+	db->character_table_mask = db_table_mask(db->max_characters);
+	db->character_table = arena_alloc_init<u32>(arena, db->character_table_mask + 1, 0);
+
+	db_load_snapshot(db);
+	// NOTE: The size of the log comes from the replay because the position
+	// of an append stream isn't reliable until something is written to it
+	// (it's zero on the MSVC CRT).
+	i64 wal_size;
+	bool wal_ok = db_replay_wal(db, &wal_size);
+
+	db->wal = fopen(db->wal_file, "ab");
+	if(!db->wal)
+		PANIC("failed to open \"%s\"", db->wal_file);
+	db->wal_size = wal_size;
+
+	// NOTE: Drop whatever was bad at the end of the log by writing the
+	// state we have into a new snapshot, which also truncates the log.
+	if(!wal_ok && !database_compact(db))
+		PANIC("failed to recover from a bad log");
+
+	if(cfg->db_create_default_account && db->num_accounts == 0){
+		DBAccount *account = database_create_account(db, "account", "password");
+		if(!account || !database_create_character(db, account, "Player"))
+			PANIC("failed to create the default account");
+		LOG("created default account \"account\" with character \"Player\"");
+	}
+
+	LOG("database: %d accounts, %d characters",
+		db->num_accounts, db->num_characters);
+	return db;
+}
+
+#if BUILD_TEST
+bool database_test(void){
+	Config cfg = {};
+	cfg.db_snapshot_file = "database_test.kdb";
+	cfg.db_wal_file = "database_test.wal";
+	cfg.db_max_accounts = 100;
+	cfg.db_max_characters = 100;
+	cfg.db_compact_wal_size = 1024 * 1024;
+	cfg.password_log2_n = 4;
+	cfg.password_r = 1;
+	cfg.password_p = 1;
+	remove(cfg.db_snapshot_file);
+	remove(cfg.db_wal_file);
+
+	bool passed = true;
+	#define DB_TEST_CHECK(expr)												\
+		do{ if(!(expr)){													\
+			debug_printf("database test failed: %s (line %d)\n", #expr, __LINE__);	\
+			passed = false;													\
+		} } while(0)
+
+	// NOTE: The default account is only created when asked for.
+	Database *db = database_init(arena_init(64 << 20, 1 << 20), &cfg);
+	DB_TEST_CHECK(database_find_account(db, "account") == NULL);
+	fclose(db->wal);
+	remove(cfg.db_snapshot_file);
+	remove(cfg.db_wal_file);
+
+	// NOTE: Each step reloads everything into a new arena.
+	cfg.db_create_default_account = true;
+	db = database_init(arena_init(64 << 20, 1 << 20), &cfg);
+	DB_TEST_CHECK(database_find_account(db, "account") != NULL);
+	DB_TEST_CHECK(database_find_character(db, "player") != NULL);
+	DBAccount *account = database_create_account(db, "test", "secret");
+	DB_TEST_CHECK(account != NULL);
+	DB_TEST_CHECK(database_create_account(db, "TEST", "other") == NULL);
+	DBCharacter *alice = database_create_character(db, account, "Alice");
+	DBCharacter *bob = database_create_character(db, account, "Bob");
+	DB_TEST_CHECK(alice && bob);
+	DB_TEST_CHECK(database_create_character(db, account, "alice") == NULL);
+	if(alice){
+		alice->pos_x = 321;
+		alice->look_type = 130;
+		DB_TEST_CHECK(database_update_character(db, alice, DB_CHARACTER_SECTION_ALL));
+	}
+	DB_TEST_CHECK(database_commit(db));
+	i64 wal_size = db->wal_size;
+
+	// replay from the log
+	db = database_init(arena_init(64 << 20, 1 << 20), &cfg);
+	account = database_find_account(db, "Test");
+	DB_TEST_CHECK(account && account->num_characters == 2);
+	DB_TEST_CHECK(account && password_verify("secret", &account->password));
+	DB_TEST_CHECK(account && !password_verify("secret2", &account->password));
+	DB_TEST_CHECK(db->wal_size == wal_size);
+	alice = database_find_character(db, "ALICE");
+	DB_TEST_CHECK(alice && alice->pos_x == 321 && alice->look_type == 130);
+	DB_TEST_CHECK(alice && account && alice->account_id == account->id);
+
+	// torn write at the end of the log
+	FILE *fp = fopen(cfg.db_wal_file, "ab");
+	u8 garbage[20] = { 0x02, 0x44, 0x42, 0x4B, 57, 0, 0, 0, 1, 2, 3 };
+	fwrite(garbage, 1, sizeof(garbage), fp);
+	fclose(fp);
+	db = database_init(arena_init(64 << 20, 1 << 20), &cfg);
+	alice = database_find_character(db, "Alice");
+	DB_TEST_CHECK(alice && alice->pos_x == 321);
+	DB_TEST_CHECK(db->wal_size == 0);
+
+	// snapshot plus log
+	bob = database_find_character(db, "Bob");
+	DB_TEST_CHECK(bob);
+	if(bob){
+		bob->pos_y = 555;
+		DB_TEST_CHECK(database_update_character(db, bob, DB_CHARACTER_SECTION_POSITION));
+		DB_TEST_CHECK(database_compact(db));
+		bob->pos_y = 556;
+		bob->look_feet = 77;
+		DB_TEST_CHECK(database_update_character(db, bob, DB_CHARACTER_SECTION_POSITION));
+		DB_TEST_CHECK(database_commit(db));
+	}
+	db = database_init(arena_init(64 << 20, 1 << 20), &cfg);
+	bob = database_find_character(db, "bob");
+	DB_TEST_CHECK(bob && bob->pos_y == 556);
+	// NOTE: Only the position section was written.
+	DB_TEST_CHECK(bob && bob->look_feet == 10);
+	DB_TEST_CHECK(db->num_accounts == 2 && db->num_characters == 3);
+
+	#undef DB_TEST_CHECK
+	fclose(db->wal);
+	remove(cfg.db_snapshot_file);
+	remove(cfg.db_wal_file);
+	debug_printf("database test: %s\n", (passed ? "passed" : "failed"));
+	return passed;
+}
+#endif //BUILD_TEST
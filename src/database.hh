@@ -0,0 +1,82 @@
+#ifndef KAPLAR_DATABASE_HH_
+#define KAPLAR_DATABASE_HH_ 1
+
+#include "common.hh"
+#include "password.hh"
+
+// ----------------------------------------------------------------
+// Database
+// ----------------------------------------------------------------
+
+// NOTE: Accounts and characters are kept in memory, in arena arrays indexed
+// by id - 1, with open addressing hash tables from name to id so logins
+// don't need to go anywhere else.
+//	Every change is appended to a write-ahead log as the full record, so
+// replaying the log over the last snapshot in order always gives the
+// latest state. Once the log grows over `db_compact_wal_size`, a new
+// snapshot is written and the log is truncated. Both files are sequences
+// of KPB elements (see file.hh) where each record ends with its adler32 so
+// a torn write at the end of the log is detected and dropped on load.
+//	Character updates only write the sections that changed and aren't on
+// disk until database_commit is called, so a batch of updates can share a
+// single fsync. Creating accounts and characters commits right away.
+
+#define DB_NAME_MAX 32
+#define DB_ACCOUNT_MAX_CHARACTERS 8
+
+struct DBAccount{
+	u32 id;
+	char name[DB_NAME_MAX];
+	PasswordHash password;
+	u16 premium_days;
+
+	// NOTE: Derived from the characters' account ids when loading so it
+	// isn't stored with the account.
+	i32 num_characters;
+	u32 character_ids[DB_ACCOUNT_MAX_CHARACTERS];
+};
+
+struct DBCharacter{
+	u32 id;
+	u32 account_id;
+	char name[DB_NAME_MAX];
+	u16 pos_x;
+	u16 pos_y;
+	u8 pos_z;
+	u8 direction;
+	u16 look_type;
+	u8 look_head;
+	u8 look_body;
+	u8 look_legs;
+	u8 look_feet;
+	u8 look_addons;
+};
+
+// NOTE: Inventory, skills, and containers will get their own sections once
+// players have them.
+enum DBCharacterSection : u32 {
+	DB_CHARACTER_SECTION_POSITION	= 0x01,
+	DB_CHARACTER_SECTION_OUTFIT		= 0x02,
+	DB_CHARACTER_SECTION_ALL		= 0x03,
+};
+
+struct Database;
+Database *database_init(MemArena *arena, Config *cfg);
+DBAccount *database_find_account(Database *db, const char *name);
+DBCharacter *database_find_character(Database *db, const char *name);
+DBCharacter *database_get_character(Database *db, u32 character_id);
+bool database_name_equal(const char *a, const char *b);
+DBAccount *database_create_account(Database *db,
+		const char *name, const char *password);
+DBCharacter *database_create_character(Database *db,
+		DBAccount *account, const char *name);
+bool database_update_character(Database *db, DBCharacter *character, u32 sections);
+bool database_commit(Database *db);
+bool database_compact(Database *db);
+void database_maybe_compact(Database *db);
+
+#if BUILD_TEST
+bool database_test(void);
+#endif
+
+#endif //KAPLAR_DATABASE_HH_
@@ -117,8 +117,18 @@ bool kpb_next_element(KPB_Element *parent, KPB_Element *out_elem){
 #define KPB_ID_WORLD_DENSE_DATA		0x0252574B
 #define KPB_ID_WORLD_SPAWN			0x0352574B
 #define KPB_ID_WORLD_TEMPLE			0x0452574B
+#define KPB_ID_WORLD_DELTA_BEGIN	0x0552574B
+#define KPB_ID_WORLD_DELTA_CHUNK	0x0652574B
+#define KPB_ID_WORLD_DELTA_END		0x0752574B
 
 // Client Data IDs (0x??44434B)
 #define KPB_ID_CLDATA				0x0044434B
 
+// Database IDs (0x??42444B)
+#define KPB_ID_DB_INFO				0x0042444B
+#define KPB_ID_DB_ACCOUNT			0x0142444B
+#define KPB_ID_DB_CHARACTER			0x0242444B
+#define KPB_ID_DB_CHARACTER_POSITION	0x0342444B
+#define KPB_ID_DB_CHARACTER_OUTFIT		0x0442444B
+
 #endif // KAPLAR_FILE_HH_
@@ -0,0 +1,143 @@
+#include "frame.hh"
+
+#include "metrics.hh"
+
+static const char *frame_phase_names[FRAME_PHASE_COUNT] = {
+	"net_in",
+	"player_input",
+	"creature_ai",
+	"movement",
+	"combat",
+	"save",
+	"net_out",
+};
+
+const char *frame_phase_name(FramePhase phase){
+	ASSERT(phase < FRAME_PHASE_COUNT);
+	return frame_phase_names[phase];
+}
+
+static INLINE
+void frame_time_add(FrameTimeStats *stats, i64 time){
+	stats->last = time;
+	stats->window_total += time;
+	if(stats->window_max < time)
+		stats->window_max = time;
+	stats->total += time;
+	profile_histogram_add(&stats->window_histogram, time);
+}
+
+static INLINE
+void frame_time_reset_window(FrameTimeStats *stats){
+	stats->window_total = 0;
+	stats->window_max = 0;
+	profile_histogram_reset(&stats->window_histogram);
+}
+
+void frame_scheduler_init(FrameScheduler *frame, i64 interval_nsec, i32 max_catch_up){
+	ASSERT(interval_nsec > 0);
+	ASSERT(max_catch_up >= 0);
+	memset(frame, 0, sizeof(FrameScheduler));
+	frame->interval = interval_nsec;
+	frame->max_catch_up = max_catch_up;
+	frame->next_deadline = sys_clock_monotonic_nsec();
+}
+
+void frame_begin(FrameScheduler *frame){
+	i64 now = sys_clock_monotonic_nsec();
+	frame->frame_start = now;
+	frame->phase = FRAME_PHASE_NET_IN;
+	frame->phase_start = now;
+	frame->next_deadline += frame->interval;
+	profile_zone_begin(frame_phase_names[FRAME_PHASE_NET_IN]);
+}
+
+void frame_phase(FrameScheduler *frame, FramePhase phase){
+	ASSERT(phase < FRAME_PHASE_COUNT);
+	ASSERT(phase >= frame->phase);
+	i64 now = sys_clock_monotonic_nsec();
+	frame_time_add(&frame->phase_time[frame->phase], now - frame->phase_start);
+	frame->phase = phase;
+	frame->phase_start = now;
+	profile_zone_end();
+	profile_zone_begin(frame_phase_names[phase]);
+}
+
+void frame_end(FrameScheduler *frame){
+	profile_zone_end();
+	i64 now = sys_clock_monotonic_nsec();
+	i64 frame_time = now - frame->frame_start;
+	frame_time_add(&frame->phase_time[frame->phase], now - frame->phase_start);
+	frame_time_add(&frame->frame_time, frame_time);
+	profile_frame_end(frame->frame_number, frame_time, frame->interval);
+	frame->frame_number += 1;
+	frame->window_frames += 1;
+	metrics_add(METRIC_FRAMES, 1);
+
+	i64 deadline = frame->next_deadline;
+	if(now <= deadline){
+		sys_sleep_until_nsec(deadline);
+		frame_time_add(&frame->idle_time, deadline - now);
+		return;
+	}
+
+	i64 overrun = now - deadline;
+	frame->num_overruns += 1;
+	metrics_add(METRIC_FRAME_OVERRUNS, 1);
+	if(frame->max_overrun < overrun)
+		frame->max_overrun = overrun;
+	frame_time_add(&frame->idle_time, 0);
+
+	// NOTE: If we're only a few frames behind, start the next frame right
+	// away and keep the deadlines so we catch up. Otherwise drop the missed
+	// frames and realign to the next deadline in the future, keeping the
+	// original phase so the schedule doesn't drift.
+	i64 frames_behind = overrun / frame->interval;
+	if(frames_behind >= frame->max_catch_up){
+		i64 frames_dropped = frames_behind + 1;
+		frame->next_deadline += frames_dropped * frame->interval;
+		frame->num_dropped_frames += frames_dropped;
+		metrics_add(METRIC_FRAMES_DROPPED, frames_dropped);
+		LOG_ERROR("frame %lld overran by %lld us, dropping %lld frames",
+			(long long)frame->frame_number, (long long)(overrun / 1000),
+			(long long)frames_dropped);
+		sys_sleep_until_nsec(frame->next_deadline);
+		frame->next_deadline -= frame->interval;
+	}
+}
+
+void frame_stats_reset_window(FrameScheduler *frame){
+	frame->window_frames = 0;
+	frame_time_reset_window(&frame->frame_time);
+	frame_time_reset_window(&frame->idle_time);
+	for(i32 i = 0; i < (i32)FRAME_PHASE_COUNT; i += 1)
+		frame_time_reset_window(&frame->phase_time[i]);
+}
+
+static
+void frame_log_time(const char *name, FrameTimeStats *stats, i64 window_frames){
+	ProfileHistogram *hist = &stats->window_histogram;
+	LOG("    %-14s avg = %6lld us, p50 = %6lld us, p99 = %6lld us,"
+		" p99.9 = %6lld us, max = %6lld us", name,
+		(long long)(stats->window_total / window_frames / 1000),
+		(long long)(profile_histogram_percentile(hist, 50.0) / 1000),
+		(long long)(profile_histogram_percentile(hist, 99.0) / 1000),
+		(long long)(profile_histogram_percentile(hist, 99.9) / 1000),
+		(long long)(stats->window_max / 1000));
+}
+
+void frame_log_stats(FrameScheduler *frame){
+	i64 window_frames = frame->window_frames;
+	if(window_frames <= 0)
+		return;
+
+	LOG("frame stats over %lld frames (%lld overruns, %lld dropped, max overrun = %lld us)",
+		(long long)window_frames, (long long)frame->num_overruns,
+		(long long)frame->num_dropped_frames, (long long)(frame->max_overrun / 1000));
+	frame_log_time("frame", &frame->frame_time, window_frames);
+	frame_log_time("idle", &frame->idle_time, window_frames);
+	for(i32 i = 0; i < (i32)FRAME_PHASE_COUNT; i += 1){
+		frame_log_time(frame_phase_names[i],
+			&frame->phase_time[i], window_frames);
+	}
+}
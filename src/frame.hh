@@ -0,0 +1,76 @@
+#ifndef KAPLAR_FRAME_HH_
+#define KAPLAR_FRAME_HH_ 1
+
+#include "common.hh"
+#include "profile.hh"
+
+// ----------------------------------------------------------------
+// Frame Scheduler
+// ----------------------------------------------------------------
+
+// NOTE: The game runs at a fixed timestep. Each frame is split into phases
+// and the time spent in each phase is recorded so it can be logged or
+// exposed as metrics. Frames are scheduled against absolute deadlines
+// (frame N should start at start + N * interval) so they don't drift
+// because of sleep latency.
+//
+//	When a frame overruns its deadline the next frames run back to back
+// to catch up, as long as we're behind by at most `max_catch_up` frames.
+// If we're further behind than that, the missed frames are dropped and
+// the schedule skips ahead to the next deadline in the future.
+//
+//	Each phase is also recorded as a profiler zone and frames that take
+// longer than the interval get their zone tree dumped to the log.
+
+enum FramePhase : u32 {
+	FRAME_PHASE_NET_IN = 0,
+	FRAME_PHASE_PLAYER_INPUT,
+	FRAME_PHASE_CREATURE_AI,
+	FRAME_PHASE_MOVEMENT,
+	FRAME_PHASE_COMBAT,
+	FRAME_PHASE_SAVE,
+	FRAME_PHASE_NET_OUT,
+	FRAME_PHASE_COUNT,
+};
+
+struct FrameTimeStats{
+	i64 last;
+	i64 window_total;
+	i64 window_max;
+	i64 total;
+	ProfileHistogram window_histogram;
+};
+
+struct FrameScheduler{
+	i64 interval;
+	i32 max_catch_up;
+
+	i64 frame_number;
+	i64 frame_start;
+	i64 next_deadline;
+	FramePhase phase;
+	i64 phase_start;
+
+	// NOTE: Times are in nanoseconds. `window_*` stats are accumulated
+	// until frame_stats_reset_window is called, while the totals are
+	// never reset. The histograms are about 4KB each so the scheduler
+	// shouldn't live on the stack.
+	i64 window_frames;
+	FrameTimeStats frame_time;
+	FrameTimeStats idle_time;
+	FrameTimeStats phase_time[FRAME_PHASE_COUNT];
+
+	i64 num_overruns;
+	i64 num_dropped_frames;
+	i64 max_overrun;
+};
+
+const char *frame_phase_name(FramePhase phase);
+void frame_scheduler_init(FrameScheduler *frame, i64 interval_nsec, i32 max_catch_up);
+void frame_begin(FrameScheduler *frame);
+void frame_phase(FrameScheduler *frame, FramePhase phase);
+void frame_end(FrameScheduler *frame);
+void frame_stats_reset_window(FrameScheduler *frame);
+void frame_log_stats(FrameScheduler *frame);
+
+#endif //KAPLAR_FRAME_HH_
@@ -1,50 +1,95 @@
 #include "game.hh"
 
+#include "base_data.hh"
 static
 void game_load_base_items(Game *game){
-	MemArena *arena = game->arena;
-	u16 max_server_id = 5000;
-	u16 max_client_id = 5000;
-
-	//game->max_server_id = max_server_id;
-	//game->max_client_id = max_client_id;
-	//game->base_items = arena_allocz<BaseItem>(arena, max_server_id);
-	//game->client_to_server_id = arena_allocz<u16>(arena, max_client_id);
-
-	// TODO: load items from tables or files
+	// NOTE: The tables are compiled in so there is nothing to parse or
+	// allocate here.
+	game->base_items = &base_data.items;
+	game->max_client_id = base_data.max_client_id;
+	game->client_to_server_id = base_data.client_to_server_id;
+	LOG("base items: %u items, max client id = %u",
+		game->base_items->num_items, game->max_client_id);
 }
 
 static
 void game_load_base_monsters(Game *game){
-	// TODO: load monsters from tables or files
+	game->num_base_monsters = base_data.num_monsters;
+	game->base_monsters = base_data.monsters;
+	LOG("base monsters: %d", game->num_base_monsters);
 }
 
 
+#include "pathfind.hh"
 #include "world.hh"
+#include "world_save.hh"
 static
-void game_load_world(Game *game){
-	// TODO: load map from file
-	//game->world = arena_alloc<World>(game->arena, 1);
+void game_load_world(Game *game, Config *cfg){
+	game->world = arena_alloc<World>(game->arena, 1);
+	if(cfg->game_world_file){
+		world_load(game->arena, game->world, cfg->game_world_file);
+	}else{
+		// NOTE: We don't have a way to convert maps yet so fallback to
+		// a flat grass world to have something to show to the client.
+		LOG("no world file set, using a flat world");
+		world_init_flat(game->arena, game->world, 4526);
+	}
+
+	game->world_saver = NULL;
+	if(cfg->game_world_delta_file)
+		game->world_saver = world_saver_init(game->arena, game->world, cfg);
+
+	// NOTE: Tile flags are built after the delta is applied.
+	world_set_base_items(game->world, game->base_items);
+	game->pathfinder = pathfinder_init(game->arena, game->world, cfg);
+
+	game->creature_index = creature_index_init(game->arena,
+			game->world, cfg->game_max_creatures);
+	game->next_player_id = 0x10000000;
 }
 
-Game *game_init(MemArena *arena, Config *cfg, RSA *game_rsa){
+Game *game_init(MemArena *arena, Config *cfg, RSA *game_rsa,
+		Storage *storage, PasswordPool *passwords){
 	Game *game = arena_alloc<Game>(arena, 1);
 	game->arena = arena;
 
 	game_load_base_items(game);
 	game_load_base_monsters(game);
-	game_load_world(game);
-	game_init_server(game, cfg, game_rsa);
-	//world_load(arena,
+	game_load_world(game, cfg);
+	game_init_server(game, cfg, game_rsa, storage, passwords);
 	return game;
 }
 
+#include "frame.hh"
+#include "module.hh"
 #include "server.hh"
-void game_update(Game *game){
+void game_update(Game *game, FrameScheduler *frame){
+	// NOTE: The frame starts in the net_in phase. Player input is currently
+	// handled as messages are read by server_poll, inside this phase.
+	//	Modules are only reloaded here, before anything can call into them.
+	module_system_poll(game->modules);
 	server_poll(game->server, game);
+	game_handle_storage(game);
+	game_handle_passwords(game);
+
+	frame_phase(frame, FRAME_PHASE_PLAYER_INPUT);
 	// player_update
+
+	frame_phase(frame, FRAME_PHASE_CREATURE_AI);
 	// creature_update
-	// pathfind_update (?)
+	game_handle_paths(game);
+
+	frame_phase(frame, FRAME_PHASE_MOVEMENT);
+	game_walk_players(game);
+	frame_phase(frame, FRAME_PHASE_COMBAT);
+
+	frame_phase(frame, FRAME_PHASE_SAVE);
+	game_save_players(game);
+	if(game->world_saver)
+		world_saver_update(game->world_saver);
+
+	frame_phase(frame, FRAME_PHASE_NET_OUT);
+	server_flush(game->server, game);
 }
 
 
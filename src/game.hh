@@ -3,19 +3,38 @@
 
 #include "common.hh"
 
+struct BaseItemTable;
+struct BaseMonster;
 struct Client;
+struct CreatureIndex;
+struct FrameScheduler;
 struct Game;
+struct ModuleSystem;
 struct OutPacket;
+struct OutPacketPool;
+struct PasswordPool;
+struct Pathfinder;
 struct RSA;
 struct Server;
+struct Storage;
+struct StorageQueue;
+struct StorageRequest;
 struct World;
+struct WorldSaver;
 
 // ----------------------------------------------------------------
 // Game Protocol
 // ----------------------------------------------------------------
-void game_init_server(Game *game, Config *cfg, RSA *game_rsa);
+void game_init_server(Game *game, Config *cfg, RSA *game_rsa,
+		Storage *storage, PasswordPool *passwords);
+void game_handle_storage(Game *game);
+void game_handle_passwords(Game *game);
+void game_save_players(Game *game);
+void game_handle_paths(Game *game);
+void game_walk_players(Game *game);
 Client *game_get_client(Game *game, u32 client_id);
 void game_send_disconnect(Game *game, Client *client, const char *message);
+void game_log_output_stats(Game *game);
 
 // ----------------------------------------------------------------
 // Game - game.cc
@@ -29,28 +48,42 @@ struct Game{
 	Client *clients;
 	//Player *players;
 	RSA *rsa;
+	StorageQueue *storage_queue;
+	i64 save_interval;
+	i32 save_max_per_frame;
+	u32 save_cursor;
+	StorageRequest *pending_saves;
+	i32 num_pending_saves;
+	i32 max_pending_saves;
+	PasswordPool *passwords;
 	Server *server;
 	MemArena *output_arena;
-	OutPacket *output_head;
+	OutPacketPool *output_pool;
+	u8 *broadcast_buf;
+	ModuleSystem *modules;
 
 	// game
 
 	//ItemAllocator
 	//CreatureAllocator
 
-	//u16 max_server_id;
-	//u16 max_client_id;
-	//BaseItem *base_items;
-	//u16 *client_to_server_id;
+	// NOTE: These point into the compiled base data (see base_data.hh).
+	const BaseItemTable *base_items;
+	u16 max_client_id;
+	const u16 *client_to_server_id;
 
-	//i32 max_base_monsters;
-	//i32 num_base_monsters;
-	//BaseMonster *base_monsters;
+	i32 num_base_monsters;
+	const BaseMonster *base_monsters;
 
 	World *world;
+	WorldSaver *world_saver;
+	CreatureIndex *creature_index;
+	Pathfinder *pathfinder;
+	u32 next_player_id;
 };
 
-Game *game_init(MemArena *arena, Config *cfg, RSA *game_rsa);
-void game_update(Game *game);
+Game *game_init(MemArena *arena, Config *cfg, RSA *game_rsa,
+		Storage *storage, PasswordPool *passwords);
+void game_update(Game *game, FrameScheduler *frame);
 
 #endif //KAPLAR_GAME_HH_
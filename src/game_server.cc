@@ -2,14 +2,23 @@
 
 #include "common.hh"
 #include "crypto.hh"
+#include "metrics.hh"
+#include "module.hh"
 #include "packet.hh"
+#include "password.hh"
+#include "pathfind.hh"
+#include "profile.hh"
+#include "protocol.hh"
 #include "server.hh"
+#include "storage.hh"
+#include "world.hh"
 
 enum ClientState : u16 {
 	CLIENT_STATE_HANDSHAKE_WRITING = 0,
 	CLIENT_STATE_HANDSHAKE_WAITING_WRITE,
 	CLIENT_STATE_HANDSHAKE_READING,
-	//CLIENT_STATE_HANDSHAKE_AUTHENTICATING,
+	CLIENT_STATE_HANDSHAKE_AUTHENTICATING,
+	CLIENT_STATE_HANDSHAKE_VERIFYING_PASSWORD,
 	CLIENT_STATE_NORMAL,
 	CLIENT_STATE_DISCONNECT_WRITING,
 	CLIENT_STATE_DISCONNECT_WAITING_WRITE,
@@ -23,8 +32,28 @@ struct Client{
 	ClientState state;
 	u32 xtea[4];
 	char accname[32];
-	char password[32];
+	char password[PASSWORD_MAX];
 	char character[32];
+	StorageStatus character_status;
+	DBCharacter db_character;
+	// NOTE: DBCharacterSection bits that changed since the last save and
+	// when it was (sys_clock_monotonic_nsec).
+	u32 dirty_sections;
+	i64 last_save;
+	Creature player;
+	KnownCreatures known_creatures;
+
+	// NOTE: Auto walk, used to walk up to things that are out of reach.
+	// The path arrives from the pathfinder at least a frame after it was
+	// requested (`walk_pending`) and is walked one step at a time. Once
+	// the player gets there, the pending use (if any) is done.
+	bool walk_pending;
+	bool walk_use;
+	WorldPosition walk_use_pos;
+	u8 walk_use_stackpos;
+	i32 walk_step;
+	i64 walk_next_step;
+	PathResult walk_path;
 
 	// NOTE: Instead of a single write buffer like in the
 	// login server, we need at least two buffers to avoid
@@ -52,6 +81,7 @@ struct Client{
 	OutPacket *out_writing;
 	OutPacket *out_queue_head;
 	OutPacket *out_queue_tail;
+	i32 out_queued_bytes;
 };
 
 
@@ -81,32 +111,142 @@ Client *game_get_client(Game *game, u32 client_id){
 	return client;
 }
 
-#define OUT_PACKET_BUFFER_SIZE (16 * 1024)
+// NOTE: Out packets come in a few size classes so that small messages
+// like a cancel walk don't pin a whole 16KB buffer. Each class has its own
+// free list and buffers are never returned to the arena, so the pool only
+// grows to the peak number of packets in flight.
+//	Each packet reserves 8 bytes for the header and up to 7 bytes of XTEA
+// padding so a class can hold messages of up to (size - 15) bytes.
+#define OUT_PACKET_NUM_SIZE_CLASSES 3
+#define OUT_PACKET_OVERHEAD (8 + 7)
+#define OUT_PACKET_MAX_SIZE (16 * 1024)
+#define OUT_PACKET_MAX_MESSAGE_SIZE (OUT_PACKET_MAX_SIZE - OUT_PACKET_OVERHEAD)
+static const i32 out_packet_size_classes[OUT_PACKET_NUM_SIZE_CLASSES] = {
+	512,
+	4 * 1024,
+	OUT_PACKET_MAX_SIZE,
+};
+
+// NOTE: A client that doesn't read its output (slow connection or a slow
+// loris attack) would otherwise make its queue grow without bound. Once
+// the buffers held by a client go over this limit it is disconnected and
+// anything else written to it is discarded.
+#define CLIENT_MAX_QUEUED_BYTES (128 * 1024)
+
+struct OutPacketPool{
+	OutPacket *free_head[OUT_PACKET_NUM_SIZE_CLASSES];
+	i32 num_allocated[OUT_PACKET_NUM_SIZE_CLASSES];
+	i32 num_free[OUT_PACKET_NUM_SIZE_CLASSES];
+	i32 peak_in_use[OUT_PACKET_NUM_SIZE_CLASSES];
+	i64 num_requests;
+	i64 num_coalesced;
+	i64 num_overflow_disconnects;
+
+	// NOTE: Packet handed out to writers when the client is over its
+	// queue limit or already disconnecting. It is never queued.
+	OutPacket discard;
+};
+
+static
+i32 out_packet_size_class(i32 bufend){
+	for(i32 i = 0; i < OUT_PACKET_NUM_SIZE_CLASSES; i += 1){
+		if(out_packet_size_classes[i] == bufend)
+			return i;
+	}
+	PANIC("invalid out packet size %d", bufend);
+	return -1;
+}
+
+static
+OutPacket *alloc_out_packet(Game *game, i32 size_class){
+	OutPacketPool *pool = game->output_pool;
+	OutPacket *outp = pool->free_head[size_class];
+	if(outp){
+		pool->free_head[size_class] = outp->next;
+		pool->num_free[size_class] -= 1;
+	}else{
+		MemArena *output_arena = game->output_arena;
+		i32 bufsize = out_packet_size_classes[size_class];
+		outp = arena_alloc<OutPacket>(output_arena, 1);
+		outp->buf = arena_alloc<u8>(output_arena, bufsize);
+		outp->bufend = bufsize;
+		pool->num_allocated[size_class] += 1;
+		metrics_add(METRIC_GAME_OUT_PACKET_BYTES_ALLOCATED, bufsize);
+	}
+	metrics_add(METRIC_GAME_OUT_PACKETS_IN_USE, 1);
+	metrics_add(METRIC_GAME_OUT_PACKET_BYTES_IN_USE, outp->bufend);
+
+	i32 in_use = pool->num_allocated[size_class] - pool->num_free[size_class];
+	if(pool->peak_in_use[size_class] < in_use)
+		pool->peak_in_use[size_class] = in_use;
+	return outp;
+}
+
+static
+void release_out_packet(Game *game, OutPacket *outp){
+	ASSERT(outp);
+	OutPacketPool *pool = game->output_pool;
+	ASSERT(outp != &pool->discard);
+	i32 size_class = out_packet_size_class(outp->bufend);
+	outp->next = pool->free_head[size_class];
+	pool->free_head[size_class] = outp;
+	pool->num_free[size_class] += 1;
+	metrics_add(METRIC_GAME_OUT_PACKETS_IN_USE, -1);
+	metrics_add(METRIC_GAME_OUT_PACKET_BYTES_IN_USE, -outp->bufend);
+}
+
+static
+void disconnect(Client *client){
+	client->state = CLIENT_STATE_DISCONNECTING;
+}
 
 static
 OutPacket *get_out_packet(Game *game, Client *client, u32 size){
 	ASSERT((client->out_queue_head != NULL && client->out_queue_tail != NULL)
 		|| (client->out_queue_head == NULL && client->out_queue_tail == NULL));
 
+	ASSERT(size > 0);
+	OutPacketPool *pool = game->output_pool;
+	pool->num_requests += 1;
+	metrics_add(METRIC_GAME_OUT_PACKET_REQUESTS, 1);
+	if(client->state == CLIENT_STATE_DISCONNECTING){
+		pool->discard.bufpos = 8;
+		return &pool->discard;
+	}
+
 	if(client->out_queue_tail){
 		// NOTE: Check for size + 7 so that if the writer doesn't surpass
 		// `size` bytes, it should be enough for any packet_wrap padding.
 		OutPacket *outp = client->out_queue_tail;
-		if(size > 0 && packet_can_write(outp, size + 7))
+		if(packet_can_write(outp, size + 7)){
+			pool->num_coalesced += 1;
+			metrics_add(METRIC_GAME_OUT_PACKET_COALESCED, 1);
 			return outp;
+		}
 	}
 
-	OutPacket *outp;
-	if(game->output_head){
-		outp = game->output_head;
-		game->output_head = outp->next;
-	}else{
-		MemArena *output_arena = game->output_arena;
-		outp = arena_alloc<OutPacket>(output_arena, 1);
-		outp->buf = arena_alloc<u8>(output_arena, OUT_PACKET_BUFFER_SIZE);
-		outp->bufend = OUT_PACKET_BUFFER_SIZE;
+	// NOTE: Writers that don't know how much they'll write should ask
+	// for OUT_PACKET_MAX_MESSAGE_SIZE.
+	i32 size_class = OUT_PACKET_NUM_SIZE_CLASSES - 1;
+	i32 required = (i32)size + OUT_PACKET_OVERHEAD;
+	if(size > OUT_PACKET_MAX_MESSAGE_SIZE)
+		PANIC("out packet request too large (%u)", size);
+	while(size_class > 0 && required <= out_packet_size_classes[size_class - 1])
+		size_class -= 1;
+
+	i32 bufsize = out_packet_size_classes[size_class];
+	if((client->out_queued_bytes + bufsize) > CLIENT_MAX_QUEUED_BYTES){
+		LOG_ERROR("client output queue is full (%d bytes), disconnecting",
+			client->out_queued_bytes);
+		pool->num_overflow_disconnects += 1;
+		metrics_add(METRIC_GAME_OUT_PACKET_OVERFLOWS, 1);
+		disconnect(client);
+		pool->discard.bufpos = 8;
+		return &pool->discard;
 	}
 
+	OutPacket *outp = alloc_out_packet(game, size_class);
+	client->out_queued_bytes += bufsize;
 	if(client->out_queue_tail){
 		client->out_queue_tail->next = outp;
 		client->out_queue_tail = outp;
@@ -119,156 +259,87 @@ OutPacket *get_out_packet(Game *game, Client *client, u32 size){
 	return outp;
 }
 
-static
-void release_out_packet(Game *game, OutPacket *outp){
-	ASSERT(outp);
-	ASSERT(outp->bufend == OUT_PACKET_BUFFER_SIZE);
-	outp->next = game->output_head;
-	game->output_head = outp;
+// NOTE: Get an out packet with enough space for any message with the
+// given schema, so it can be written with packet_store_*.
+template<typename Schema>
+static INLINE
+OutPacket *get_out_packet(Game *game, Client *client){
+	static_assert(Schema::max_size <= OUT_PACKET_MAX_MESSAGE_SIZE,
+		"message schema doesn't fit in an out packet");
+	return get_out_packet(game, client, Schema::max_size);
 }
 
-static
-bool packet_wrap(OutPacket *p, u32 *xtea){
-	u8 *buf = packet_buf(p);
-	i32 len = packet_written_len(p);
-
-	i32 payload_len = len - 8;
-	if(payload_len <= 0) // PARANOID
-		PANIC("trying to send empty message");
-
-	// xtea encode
-	u8 *xtea_payload = buf + 6;
-	i32 xtea_payload_len = len - 6;
-	i32 padding = -xtea_payload_len & 7;
-	// NOTE: If padding ends up being zero, packet_can_write(p, 0)
-	// is the same as packet_ok(p).
-	if(!packet_can_write(p, padding))
-		return false;
-	buffer_write_u16_le(xtea_payload, payload_len);
-	xtea_payload_len += padding;
-	while(padding-- > 0)
-		packet_write_u8(p, 0x33);
-	xtea_encode(xtea, xtea_payload, xtea_payload_len);
-
-	// add message length and checksum
-	u32 checksum = adler32(xtea_payload, xtea_payload_len);
-	buffer_write_u16_le(buf, xtea_payload_len + 4);
-	buffer_write_u32_le(buf + 2, checksum);
-	return true;
+void game_log_output_stats(Game *game){
+	OutPacketPool *pool = game->output_pool;
+	LOG("out packet pool: %lld requests, %lld coalesced, %lld overflow disconnects",
+		(long long)pool->num_requests, (long long)pool->num_coalesced,
+		(long long)pool->num_overflow_disconnects);
+	for(i32 i = 0; i < OUT_PACKET_NUM_SIZE_CLASSES; i += 1){
+		LOG("    %5d bytes: allocated = %d, free = %d, peak in use = %d",
+			out_packet_size_classes[i], pool->num_allocated[i],
+			pool->num_free[i], pool->peak_in_use[i]);
+	}
 }
 
-static
-bool packet_unwrap(u8 *buf, i32 len, u32 *xtea, InPacket *p){
-	// NOTE: Different from wrapping a packet, the message length
-	// shouldn't be considered as it is discarded earlier when
-	// reading from the socket.
-
-	// NOTE: We need at least 4 bytes for the checksum and 8 bytes
-	// for the smallest XTEA encoded message.
-	if(len < 12)
-		return false;
-
-	u8 *xtea_payload = buf + 4;
-	i32 xtea_payload_len = len - 4;
-
-	// check that xtea_payload_len is a multiple of 8
-	if(xtea_payload_len & 7)
-		return false;
-
-	// verify checksum
-	u32 checksum = adler32(xtea_payload, xtea_payload_len);
-	if(buffer_read_u32_le(buf) != checksum)
-		return false;
-
-	// decode message
-	xtea_decode(xtea, xtea_payload, xtea_payload_len);
-
-	// check that the encoded payload length doesn't
-	// overflow the packet length
-	u8 *payload = xtea_payload + 2;
-	i32 max_payload_len = xtea_payload_len - 2;
-	i32 payload_len = buffer_read_u16_le(xtea_payload);
-	if(payload_len > max_payload_len)
-		return false;
+typedef PacketSchema<PacketFieldU16, PacketFieldU16, PacketFieldU8> PacketFieldPosition;
 
-	p->buf = payload;
-	p->bufend = payload_len;
-	p->bufpos = 0;
-	return true;
+static
+void packet_write_position(OutPacket *p, WorldPosition pos){
+	packet_write_u16(p, pos.x);
+	packet_write_u16(p, pos.y);
+	packet_write_u8(p, pos.z);
 }
 
-static
-void disconnect(Client *client){
-	client->state = CLIENT_STATE_DISCONNECTING;
+static INLINE
+void packet_store_position(OutPacket *p, WorldPosition pos){
+	packet_store_u16(p, pos.x);
+	packet_store_u16(p, pos.y);
+	packet_store_u8(p, pos.z);
 }
 
+#define DISCONNECT_MESSAGE_MAX_LEN 255
+
 static
 void send_disconnect(Game *game, Client *client, const char *message){
+	typedef PacketSchema<
+		PacketFieldU8,
+		PacketFieldStr<DISCONNECT_MESSAGE_MAX_LEN>
+	> Schema;
+
 	client->state = CLIENT_STATE_DISCONNECT_WRITING;
 
-	OutPacket *p = get_out_packet(game, client, 256);
-	packet_write_u8(p, 0x14);
-	packet_write_str(p, message);
+	OutPacket *p = get_out_packet<Schema>(game, client);
+	packet_store_u8(p, 0x14);
+	packet_store_str(p, message, DISCONNECT_MESSAGE_MAX_LEN);
 }
 
 static
 void send_login(Game *game, Client *client){
 	client->state = CLIENT_STATE_NORMAL;
 
-	OutPacket *p = get_out_packet(game, client, 0);
+	// NOTE: The login message is sent once per session and its size is
+	// only known after writing the map description so we just ask for the
+	// biggest packet and keep using the checked writers.
+	OutPacket *p = get_out_packet(game, client, OUT_PACKET_MAX_MESSAGE_SIZE);
 
 	// NOTE: The comments on the side are old annotations from another
 	// implementation I did that I didn't check. So they may/will be wrong.
 
 	// login message
-	u32 player_id = 0x10000000;
+	Creature *player = &client->player;
+	WorldPosition pos = player->pos;
 	packet_write_u8(p, 0x0A);
-	packet_write_u32(p, player_id);			// creature id (?)
+	packet_write_u32(p, player->id);			// creature id (?)
 	packet_write_u16(p, 0x0032);				// related to client drawing speed
 	packet_write_u8(p, 0x00);					// can report bugs
 
 	// map description
 	packet_write_u8(p, 0x64);
-	packet_write_u16(p, 100);					// posx
-	packet_write_u16(p, 100);					// posy
-	packet_write_u8(p, 7);						// posz
-
-	for(i32 z = 7; z >= 0; z -= 1)
-	for(i32 x = 0; x < 18; x += 1)
-	for(i32 y = 0; y < 14; y += 1){
-		packet_write_u16(p, 106);				// grass tile
-		// add player at the center
-		if(x == 8 && y == 6 && z == 7){
-			packet_write_u16(p, 0x61);
-
-			packet_write_u32(p, 0);			// remove known
-			packet_write_u32(p, player_id);	// creature id (?)
-
-			packet_write_str(p, client->character);	// creature name
-			packet_write_u8(p, 100);			// health %
-			packet_write_u8(p, 2);				// direction
-
-			packet_write_u16(p, 136);			// outfit
-			packet_write_u8(p, 10);			// look head
-			packet_write_u8(p, 10);			// look body
-			packet_write_u8(p, 10);			// look legs
-			packet_write_u8(p, 10);			// look feet
-			packet_write_u8(p, 0);				// look addons
-
-			packet_write_u8(p, 0);				// light level
-			packet_write_u8(p, 0);				// light color
-			packet_write_u16(p, 100);			// step speed
-			packet_write_u8(p, 3);				// skull
-			packet_write_u8(p, 3);				// party shield
-			packet_write_u8(p, 1);				// war emblem
-			packet_write_u8(p, 1);				// will block path
-		}else if(x == 9 && y == 6 && z == 7){
-			packet_write_u16(p, 1998);
-		}else{
-			packet_write_u16(p, 2400);
-		}
-		packet_write_u16(p, 0xFF00);
-	}
+	packet_write_position(p, pos);
+	world_get_area_description(game->world, game->creature_index,
+		&client->known_creatures, (i32)pos.x - VIEWPORT_MIN_X,
+		(i32)pos.y - VIEWPORT_MIN_Y, (i32)pos.z,
+		VIEWPORT_WIDTH, VIEWPORT_HEIGHT, p);
 
 	// inventory (no items)
 	packet_write_u16(p, 0x0179);				// head
@@ -337,30 +408,624 @@ void send_login(Game *game, Client *client){
 }
 
 static
-void send_inventory_item(Game *game, Client *client, u8 slot, u16 client_id){
-	OutPacket *p = get_out_packet(game, client, 4);
-	packet_write_u8(p, 0x78);
-	packet_write_u8(p, slot);
-	packet_write_u16(p, client_id);
+void send_cancel_walk(Game *game, Client *client, u8 direction){
+	typedef PacketSchema<PacketFieldU8, PacketFieldU8> Schema;
+	OutPacket *p = get_out_packet<Schema>(game, client);
+	packet_store_u8(p, 0xB5);
+	packet_store_u8(p, direction);
+}
+
+#define TEXT_MESSAGE_MAX_LEN 255
+#define TEXT_MESSAGE_INFO 0x19		// green, in the middle of the screen
+#define TEXT_MESSAGE_STATUS 0x1A	// white, at the bottom of the screen
+
+static
+void send_text_message(Game *game, Client *client, u8 type, const char *text){
+	typedef PacketSchema<
+		PacketFieldU8,
+		PacketFieldU8,
+		PacketFieldStr<TEXT_MESSAGE_MAX_LEN>
+	> Schema;
+	OutPacket *p = get_out_packet<Schema>(game, client);
+	packet_store_u8(p, 0xB4);
+	packet_store_u8(p, type);
+	packet_store_str(p, text, TEXT_MESSAGE_MAX_LEN);
+}
+
+static
+void send_add_creature(Game *game, Client *client, Creature *creature){
+	typedef PacketSchema<PacketFieldU8, PacketFieldPosition> Schema;
+	OutPacket *p = get_out_packet(game, client,
+			Schema::max_size + PACKET_CREATURE_MAX_SIZE);
+	packet_store_u8(p, 0x6A);
+	packet_store_position(p, creature->pos);
+	packet_write_creature(p, &client->known_creatures, creature);
+}
+
+// ----------------------------------------------------------------
+// Broadcast Messages
+// ----------------------------------------------------------------
+
+// NOTE: Messages that are the same for every spectator (creature moves,
+// removals, speech) are encoded once into the game's broadcast buffer and
+// the resulting bytes are then copied into each spectator's out packet,
+// before XTEA which is still per client. With a crowded depot this turns
+// one serialization per spectator into a single serialization plus a
+// memcpy per spectator.
+//	The bytes are fanned out right after being encoded so each broadcast
+// can reuse the buffer from the start.
+
+#define BROADCAST_BUFFER_SIZE 1024
+#define SAY_MAX_LEN 255
+
+struct Broadcast{
+	u8 *data;
+	i32 len;
+};
+
+template<typename Schema>
+static
+OutPacket broadcast_begin(Game *game){
+	static_assert(Schema::max_size <= BROADCAST_BUFFER_SIZE,
+		"broadcast message doesn't fit in the broadcast buffer");
+	OutPacket result;
+	result.next = NULL;
+	result.buf = game->broadcast_buf;
+	result.bufend = BROADCAST_BUFFER_SIZE;
+	result.bufpos = 0;
+	return result;
+}
+
+static
+Broadcast broadcast_end(OutPacket *p){
+	Broadcast result;
+	result.data = p->buf;
+	result.len = p->bufpos;
+	return result;
+}
+
+static
+void send_broadcast(Game *game, Client *client, Broadcast *msg){
+	OutPacket *p = get_out_packet(game, client, (u32)msg->len);
+	packet_write_bytes(p, msg->data, msg->len);
+}
+
+static
+Broadcast broadcast_creature_move(Game *game,
+		WorldPosition from, i32 stackpos, WorldPosition to){
+	typedef PacketSchema<
+		PacketFieldU8,
+		PacketFieldPosition,
+		PacketFieldU8,
+		PacketFieldPosition
+	> Schema;
+	OutPacket p = broadcast_begin<Schema>(game);
+	packet_store_u8(&p, 0x6D);
+	packet_store_position(&p, from);
+	packet_store_u8(&p, (u8)stackpos);
+	packet_store_position(&p, to);
+	return broadcast_end(&p);
+}
+
+static
+Broadcast broadcast_remove_creature(Game *game, WorldPosition pos, i32 stackpos){
+	typedef PacketSchema<PacketFieldU8, PacketFieldPosition, PacketFieldU8> Schema;
+	OutPacket p = broadcast_begin<Schema>(game);
+	packet_store_u8(&p, 0x6C);
+	packet_store_position(&p, pos);
+	packet_store_u8(&p, (u8)stackpos);
+	return broadcast_end(&p);
+}
+
+static
+Broadcast broadcast_creature_say(Game *game, Creature *creature, const char *text){
+	typedef PacketSchema<
+		PacketFieldU8,
+		PacketFieldU32,
+		PacketFieldStr<31>,
+		PacketFieldU16,
+		PacketFieldU8,
+		PacketFieldPosition,
+		PacketFieldStr<SAY_MAX_LEN>
+	> Schema;
+	OutPacket p = broadcast_begin<Schema>(game);
+	packet_store_u8(&p, 0xAA);
+	packet_store_u32(&p, 0);					// statement id
+	packet_store_str(&p, creature->name, 31);
+	packet_store_u16(&p, 0);					// level
+	packet_store_u8(&p, 0x01);					// speak class (say)
+	packet_store_position(&p, creature->pos);
+	packet_store_str(&p, text, SAY_MAX_LEN);
+	return broadcast_end(&p);
+}
+
+// NOTE: Map slices are a single row or column of tiles on each floor but
+// each tile can hold up to 10 things and an unknown creature takes up to
+// PACKET_CREATURE_MAX_SIZE bytes, so a slice through a crowded area can
+// take more than a whole packet (18 tiles * 8 floors * 10 * 60 bytes). Same
+// as the full map, reserve the largest message. The rest of the buffer is
+// still used by the messages that come after it.
+static
+void send_map_slice(Game *game, Client *client, u8 message,
+		i32 x, i32 y, i32 z, i32 width, i32 height){
+	OutPacket *p = get_out_packet(game, client, OUT_PACKET_MAX_MESSAGE_SIZE);
+	packet_store_u8(p, message);
+	world_get_area_description(game->world, game->creature_index,
+		&client->known_creatures, x, y, z, width, height, p);
+}
+
+static
+void send_full_map(Game *game, Client *client){
+	WorldPosition pos = client->player.pos;
+	OutPacket *p = get_out_packet(game, client, OUT_PACKET_MAX_MESSAGE_SIZE);
+	packet_store_u8(p, 0x64);
+	packet_store_position(p, pos);
+	world_get_area_description(game->world, game->creature_index,
+		&client->known_creatures, (i32)pos.x - VIEWPORT_MIN_X,
+		(i32)pos.y - VIEWPORT_MIN_Y, (i32)pos.z,
+		VIEWPORT_WIDTH, VIEWPORT_HEIGHT, p);
+}
+
+static
+void send_player_move(Game *game, Client *client, Broadcast *move,
+		WorldPosition from, i32 stackpos, WorldPosition to){
+	// NOTE: If the player wasn't visible on its own tile or it changed
+	// floors, just send the whole map again. Otherwise the client already
+	// has most of the map and we only need to send the strip of tiles that
+	// just came into view.
+	if(stackpos < 0 || from.z != to.z){
+		send_full_map(game, client);
+		return;
+	}
+
+	send_broadcast(game, client, move);
+
+	i32 z = (i32)to.z;
+	if(from.y > to.y){
+		send_map_slice(game, client, 0x65,		// north
+			(i32)from.x - VIEWPORT_MIN_X, (i32)to.y - VIEWPORT_MIN_Y,
+			z, VIEWPORT_WIDTH, 1);
+	}else if(from.y < to.y){
+		send_map_slice(game, client, 0x67,		// south
+			(i32)from.x - VIEWPORT_MIN_X, (i32)to.y + VIEWPORT_MAX_Y,
+			z, VIEWPORT_WIDTH, 1);
+	}
+
+	if(from.x < to.x){
+		send_map_slice(game, client, 0x66,		// east
+			(i32)to.x + VIEWPORT_MAX_X, (i32)to.y - VIEWPORT_MIN_Y,
+			z, 1, VIEWPORT_HEIGHT);
+	}else if(from.x > to.x){
+		send_map_slice(game, client, 0x68,		// west
+			(i32)to.x - VIEWPORT_MIN_X, (i32)to.y - VIEWPORT_MIN_Y,
+			z, 1, VIEWPORT_HEIGHT);
+	}
+}
+
+// ----------------------------------------------------------------
+
+// NOTE: A viewer can see positions up to 8 floors away above ground, each
+// shifted by one tile per floor, so we query a generous area around the
+// given positions and let world_position_in_view filter the spectators.
+#define SPECTATOR_MARGIN 16
+#define MAX_SPECTATORS 1024
+
+static
+i32 query_spectators(Game *game, WorldPosition a, WorldPosition b,
+		CreatureQueryResult *results, i32 max_results){
+	i32 x0 = ((a.x < b.x) ? a.x : b.x) - SPECTATOR_MARGIN;
+	i32 y0 = ((a.y < b.y) ? a.y : b.y) - SPECTATOR_MARGIN;
+	i32 x1 = ((a.x > b.x) ? a.x : b.x) + SPECTATOR_MARGIN;
+	i32 y1 = ((a.y > b.y) ? a.y : b.y) + SPECTATOR_MARGIN;
+	WorldArea area;
+	area.min.x = (u16)((x0 > 0) ? x0 : 0);
+	area.min.y = (u16)((y0 > 0) ? y0 : 0);
+	area.min.z = 0;
+	area.max.x = (u16)((x1 < 0xFFFF) ? x1 : 0xFFFF);
+	area.max.y = (u16)((y1 < 0xFFFF) ? y1 : 0xFFFF);
+	area.max.z = 15;
+	return creature_index_query(game->creature_index, area, results, max_results);
+}
+
+static
+void creature_move(Game *game, Creature *creature, WorldPosition to, u8 direction){
+	PROFILE_ZONE("creature_move");
+	WorldPosition from = creature->pos;
+	i32 stackpos = world_get_creature_stackpos(game->world,
+			game->creature_index, creature);
+	creature_index_move(game->creature_index, creature, to);
+	creature->direction = direction;
+	if(creature->client)
+		creature->client->dirty_sections |= DB_CHARACTER_SECTION_POSITION;
+
+	// NOTE: The move and remove messages are the same for every spectator
+	// but only one of them can live in the broadcast buffer at a time, so
+	// we encode the move now and the remove only if some spectator needs it.
+	Broadcast move = broadcast_creature_move(game, from, stackpos, to);
+	CreatureQueryResult spectators[MAX_SPECTATORS];
+	i32 num_spectators = query_spectators(game, from, to,
+			spectators, NARRAY(spectators));
+	i32 num_removes = 0;
+	for(i32 i = 0; i < num_spectators; i += 1){
+		Creature *spectator = spectators[i].creature;
+		Client *client = spectator->client;
+		if(!client || client->state != CLIENT_STATE_NORMAL)
+			continue;
+
+		if(spectator == creature){
+			send_player_move(game, client, &move, from, stackpos, to);
+			continue;
+		}
+
+		bool saw_from = world_position_in_view(spectator->pos, from);
+		bool sees_to = world_position_in_view(spectator->pos, to);
+		if(saw_from && sees_to && stackpos >= 0){
+			send_broadcast(game, client, &move);
+		}else{
+			if(saw_from && stackpos >= 0){
+				// NOTE: Mark spectators that need the remove message by
+				// moving them to the front of the array.
+				spectators[num_removes] = spectators[i];
+				num_removes += 1;
+			}
+			if(sees_to)
+				send_add_creature(game, client, creature);
+		}
+	}
+
+	if(num_removes > 0){
+		Broadcast remove = broadcast_remove_creature(game, from, stackpos);
+		for(i32 i = 0; i < num_removes; i += 1)
+			send_broadcast(game, spectators[i].creature->client, &remove);
+	}
+
+	module_step_tile(game->modules, creature, to,
+		world_get_tile_fast(game->world, to.x, to.y, to.z));
+}
+
+// NOTE: Copies the dirty sections of the player into the character and
+// fills the save request for them.
+static
+void player_save_request(Client *client, StorageRequest *request){
+	Creature *player = &client->player;
+	DBCharacter *character = &client->db_character;
+	if(client->dirty_sections & DB_CHARACTER_SECTION_POSITION){
+		character->pos_x = player->pos.x;
+		character->pos_y = player->pos.y;
+		character->pos_z = player->pos.z;
+		character->direction = player->direction;
+	}
+	if(client->dirty_sections & DB_CHARACTER_SECTION_OUTFIT){
+		character->look_type = player->outfit.look_type;
+		character->look_head = player->outfit.look_head;
+		character->look_body = player->outfit.look_body;
+		character->look_legs = player->outfit.look_legs;
+		character->look_feet = player->outfit.look_feet;
+		character->look_addons = player->outfit.look_addons;
+	}
+
+	memset(request, 0, sizeof(StorageRequest));
+	request->op = STORAGE_OP_CHARACTER_SAVE;
+	request->character = *character;
+	request->sections = client->dirty_sections;
+}
+
+// NOTE: Asks the storage worker to save the dirty sections of the player.
+// Returns false if the storage queue is full, in which case nothing was
+// submitted and the sections are still dirty.
+static
+bool player_save(Game *game, Client *client){
+	StorageRequest request;
+	player_save_request(client, &request);
+	if(!storage_submit(game->storage_queue, &request))
+		return false;
+
+	client->dirty_sections = 0;
+	client->last_save = sys_clock_monotonic_nsec();
+	return true;
+}
+
+static
+bool player_enter_world(Game *game, Client *client){
+	DBCharacter *character = &client->db_character;
+	Creature *player = &client->player;
+	memset(player, 0, sizeof(Creature));
+	player->id = game->next_player_id;
+	player->pos.x = character->pos_x;
+	player->pos.y = character->pos_y;
+	player->pos.z = character->pos_z;
+	player->index_node = -1;
+	player->client = client;
+
+	strncpy(player->name, character->name, sizeof(player->name) - 1);
+	player->health_percent = 100;
+	player->direction = character->direction;
+	player->outfit.look_type = character->look_type;
+	player->outfit.look_head = character->look_head;
+	player->outfit.look_body = character->look_body;
+	player->outfit.look_legs = character->look_legs;
+	player->outfit.look_feet = character->look_feet;
+	player->outfit.look_addons = character->look_addons;
+	player->light_level = 0;
+	player->light_color = 0;
+	player->speed = 100;
+	player->skull = 3;
+	player->party_shield = 3;
+	player->war_emblem = 1;
+	player->blocks_path = 1;
+	client->dirty_sections = 0;
+	client->last_save = sys_clock_monotonic_nsec();
+
+	if(!creature_index_insert(game->creature_index, player)){
+		player->index_node = -1;
+		return false;
+	}
+	game->next_player_id += 1;
+
+	CreatureQueryResult spectators[MAX_SPECTATORS];
+	i32 num_spectators = query_spectators(game, player->pos, player->pos,
+			spectators, NARRAY(spectators));
+	for(i32 i = 0; i < num_spectators; i += 1){
+		Creature *spectator = spectators[i].creature;
+		Client *other = spectator->client;
+		if(!other || other == client || other->state != CLIENT_STATE_NORMAL)
+			continue;
+		if(world_position_in_view(spectator->pos, player->pos))
+			send_add_creature(game, other, player);
+	}
+	return true;
+}
+
+static
+void player_leave_world(Game *game, Client *client){
+	Creature *player = &client->player;
+	if(player->index_node == -1)
+		return;
+
+	i32 stackpos = world_get_creature_stackpos(game->world,
+			game->creature_index, player);
+	creature_index_remove(game->creature_index, player);
+
+	// NOTE: Save whatever changed since the last save. This one can't be
+	// dropped, so if the storage queue is full the request is kept in the
+	// pending saves and retried by `game_save_players`. The client slot is
+	// cleared after this so the request has to be built now. Logins are
+	// held back so there is always room for one pending save per player
+	// (see `game_can_login`).
+	if(client->dirty_sections != 0 && !player_save(game, client)){
+		if(game->num_pending_saves < game->max_pending_saves){
+			LOG_ERROR("storage queue full, deferring save of \"%s\"",
+				client->db_character.name);
+			player_save_request(client,
+				&game->pending_saves[game->num_pending_saves]);
+			game->num_pending_saves += 1;
+		}else{
+			LOG_ERROR("storage queue and pending saves full, dropping save of \"%s\"",
+				client->db_character.name);
+		}
+		client->dirty_sections = 0;
+	}
 
-	// NOTE: Sending items that are countable or have a subtype will
-	// result in a crash because we're not addressing an extra byte
-	// needed in those cases.
-	//if(item->countable || item->has_subtype)
-	//	packet_write_u8(p, item->count_or_subtype);
+	if(stackpos < 0)
+		return;
+
+	Broadcast remove = broadcast_remove_creature(game, player->pos, stackpos);
+	CreatureQueryResult spectators[MAX_SPECTATORS];
+	i32 num_spectators = query_spectators(game, player->pos, player->pos,
+			spectators, NARRAY(spectators));
+	for(i32 i = 0; i < num_spectators; i += 1){
+		Creature *spectator = spectators[i].creature;
+		Client *other = spectator->client;
+		if(!other || other == client || other->state != CLIENT_STATE_NORMAL)
+			continue;
+		if(world_position_in_view(spectator->pos, player->pos))
+			send_broadcast(game, other, &remove);
+	}
 }
 
+// NOTE: Submits the saves deferred by `player_leave_world`, in the order
+// they were made, until the storage queue is full.
 static
-void send_relogin_window(Game *game, Client *client){
-	OutPacket *p = get_out_packet(game, client, 1);
-	packet_write_u8(p, 0x28);
+void game_flush_pending_saves(Game *game){
+	i32 num_submitted = 0;
+	while(num_submitted < game->num_pending_saves
+	&& storage_submit(game->storage_queue, &game->pending_saves[num_submitted]))
+		num_submitted += 1;
+	if(num_submitted > 0){
+		game->num_pending_saves -= num_submitted;
+		memmove(game->pending_saves, game->pending_saves + num_submitted,
+			game->num_pending_saves * sizeof(StorageRequest));
+	}
 }
 
+// NOTE: A deferred save must reach the storage worker before its character
+// is loaded again, so a login for a character with a pending save has to
+// wait. Other logins only wait if the players that could leave (including
+// the one logging in) wouldn't fit in the pending saves.
 static
-void send_cancel_walk(Game *game, Client *client){
-	OutPacket *p = get_out_packet(game, client, 1);
-	packet_write_u8(p, 0xB5);
-	packet_write_u8(p, 0x02); // direction
+bool game_can_login(Game *game, const char *name){
+	game_flush_pending_saves(game);
+	if(game->num_pending_saves == 0)
+		return true;
+
+	for(i32 i = 0; i < game->num_pending_saves; i += 1){
+		if(database_name_equal(game->pending_saves[i].character.name, name))
+			return false;
+	}
+
+	i32 num_players = 1;
+	for(u32 i = 0; i < game->max_clients; i += 1){
+		ClientState state = game->clients[i].state;
+		if(state == CLIENT_STATE_HANDSHAKE_AUTHENTICATING
+		|| state == CLIENT_STATE_HANDSHAKE_VERIFYING_PASSWORD
+		|| state == CLIENT_STATE_NORMAL)
+			num_players += 1;
+	}
+	return (game->num_pending_saves + num_players) <= game->max_pending_saves;
+}
+
+static
+void creature_say(Game *game, Creature *creature, const char *text){
+	// NOTE: Normal speech is only heard on the same floor.
+	Broadcast say = broadcast_creature_say(game, creature, text);
+	CreatureQueryResult spectators[MAX_SPECTATORS];
+	i32 num_spectators = query_spectators(game, creature->pos, creature->pos,
+			spectators, NARRAY(spectators));
+	for(i32 i = 0; i < num_spectators; i += 1){
+		Creature *spectator = spectators[i].creature;
+		Client *client = spectator->client;
+		if(!client || client->state != CLIENT_STATE_NORMAL)
+			continue;
+		if(spectator->pos.z == creature->pos.z
+		&& world_position_in_view(spectator->pos, creature->pos))
+			send_broadcast(game, client, &say);
+	}
+}
+
+static
+bool player_walk(Game *game, Client *client, u8 direction){
+	Creature *player = &client->player;
+	WorldPosition to = player->pos;
+	switch(direction){
+		case DIRECTION_NORTH:	to.y -= 1; break;
+		case DIRECTION_EAST:	to.x += 1; break;
+		case DIRECTION_SOUTH:	to.y += 1; break;
+		case DIRECTION_WEST:	to.x -= 1; break;
+		default:				UNREACHABLE;
+	}
+
+	// TODO: Check walking speed with the ground speed once players have a
+	// proper step duration.
+	if(!world_tile_walkable(game->world, to.x, to.y, to.z)
+	|| creature_index_occupied(game->creature_index, to)){
+		send_cancel_walk(game, client, direction);
+		return false;
+	}
+
+	creature_move(game, player, to, direction);
+	return true;
+}
+
+static
+void player_stop_walk(Client *client){
+	client->walk_pending = false;
+	client->walk_use = false;
+	client->walk_step = 0;
+	client->walk_path.num_steps = 0;
+}
+
+// NOTE: Returns false if the pathfinder queue is full.
+static
+bool player_walk_to_use(Game *game, Client *client, WorldPosition pos, u8 stackpos){
+	PathRequest request;
+	request.requester = make_client_id(client->counter, (u16)(client - game->clients));
+	request.start = client->player.pos;
+	request.goal = pos;
+	request.flags = PATH_FLAG_ADJACENT;
+	if(!pathfinder_request(game->pathfinder, request))
+		return false;
+
+	client->walk_pending = true;
+	client->walk_use = true;
+	client->walk_use_pos = pos;
+	client->walk_use_stackpos = stackpos;
+	return true;
+}
+
+static
+void player_use_item(Game *game, Client *client, WorldPosition pos, u8 stackpos){
+	// TODO: Using items from the inventory or containers (x = 0xFFFF).
+	Creature *player = &client->player;
+	if(pos.x == 0xFFFF)
+		return;
+
+	if(pos.z != player->pos.z
+	|| (i32)pos.x < ((i32)player->pos.x - 1) || (i32)pos.x > ((i32)player->pos.x + 1)
+	|| (i32)pos.y < ((i32)player->pos.y - 1) || (i32)pos.y > ((i32)player->pos.y + 1)){
+		// NOTE: Things on the same floor can be walked up to.
+		if(pos.z != player->pos.z || !player_walk_to_use(game, client, pos, stackpos)){
+			send_text_message(game, client, TEXT_MESSAGE_STATUS,
+				"Destination is out of reach.");
+		}
+		return;
+	}
+
+	Tile *tile = world_get_tile(game->world, pos.x, pos.y, pos.z);
+	if(!tile || stackpos >= tile->num_items)
+		return;
+
+	if(!module_use_item(game->modules, player, pos, tile->items[stackpos].id)){
+		send_text_message(game, client, TEXT_MESSAGE_STATUS,
+			"You cannot use this object.");
+	}
+}
+
+// ----------------------------------------------------------------
+// Module Host
+// ----------------------------------------------------------------
+
+// NOTE: Module callbacks only run on the game thread, from inside the
+// game frame, so the host functions can use the game directly.
+struct GameModuleHost{
+	ModuleHost host;
+	Game *game;
+};
+
+static
+Game *module_host_game(ModuleHost *host){
+	return ((GameModuleHost*)host)->game;
+}
+
+static
+void module_host_log(ModuleHost *host, const char *message){
+	LOG("%s", message);
+}
+
+static
+u32 module_host_creature_id(ModuleHost *host, ModuleCreature *creature){
+	return ((Creature*)creature)->id;
+}
+
+static
+const char *module_host_creature_name(ModuleHost *host, ModuleCreature *creature){
+	return ((Creature*)creature)->name;
+}
+
+static
+ModulePosition module_host_creature_position(ModuleHost *host, ModuleCreature *creature){
+	return module_position(((Creature*)creature)->pos);
+}
+
+static
+int module_host_creature_is_player(ModuleHost *host, ModuleCreature *creature){
+	return ((Creature*)creature)->client != NULL;
+}
+
+static
+void module_host_creature_say(ModuleHost *host, ModuleCreature *creature, const char *text){
+	creature_say(module_host_game(host), (Creature*)creature, text);
+}
+
+static
+void module_host_player_send_message(ModuleHost *host, ModuleCreature *player, const char *text){
+	Client *client = ((Creature*)player)->client;
+	if(client && client->state == CLIENT_STATE_NORMAL)
+		send_text_message(module_host_game(host), client, TEXT_MESSAGE_INFO, text);
+}
+
+static
+ModuleHost *game_module_host(Game *game){
+	GameModuleHost *host = arena_alloc<GameModuleHost>(game->arena, 1);
+	host->host.api_version = MODULE_API_VERSION;
+	host->host.log = module_host_log;
+	host->host.creature_id = module_host_creature_id;
+	host->host.creature_name = module_host_creature_name;
+	host->host.creature_position = module_host_creature_position;
+	host->host.creature_is_player = module_host_creature_is_player;
+	host->host.creature_say = module_host_creature_say;
+	host->host.player_send_message = module_host_player_send_message;
+	host->game = game;
+	return &host->host;
 }
 
 // ----------------------------------------------------------------
@@ -370,9 +1035,11 @@ void game_on_accept(void *userdata, u32 index){
 	Game *game = (Game*)userdata;
 	Client *client = game_get_client_by_index(game, index);
 	client->state = CLIENT_STATE_HANDSHAKE_WRITING;
+	client->player.index_node = -1;
 	client->out_writing = NULL;
 	client->out_queue_head = NULL;
 	client->out_queue_tail = NULL;
+	client->out_queued_bytes = 0;
 }
 
 static
@@ -381,14 +1048,16 @@ void game_on_drop(void *userdata, u32 index){
 	Client *client = game_get_client_by_index(game, index);
 	u32 next_counter = client->counter + 1;
 
+	player_leave_world(game, client);
+
 	// NOTE: Release any out packet we're using here.
 	ASSERT((client->out_queue_head != NULL && client->out_queue_tail != NULL)
 		|| (client->out_queue_head == NULL && client->out_queue_tail == NULL));
 	if(client->out_writing)
 		release_out_packet(game, client->out_writing);
-	while(client->out_queue_tail){
-		OutPacket *tmp = client->out_queue_tail;
-		client->out_queue_tail = tmp->next;
+	while(client->out_queue_head){
+		OutPacket *tmp = client->out_queue_head;
+		client->out_queue_head = tmp->next;
 		release_out_packet(game, tmp);
 	}
 
@@ -399,6 +1068,7 @@ void game_on_drop(void *userdata, u32 index){
 
 static
 void game_on_read(void *userdata, u32 index, u8 *data, i32 datalen){
+	PROFILE_ZONE("game_on_read");
 	Game *game = (Game*)userdata;
 	Client *client = game_get_client_by_index(game, index);
 	switch(client->state){
@@ -439,13 +1109,17 @@ void game_on_read(void *userdata, u32 index, u8 *data, i32 datalen){
 				return;
 			}
 
-			debug_print_buf("decoded", decoded, 127);
-			debug_print_buf_hex("decoded", decoded, 127);
+			typedef PacketSchema<
+				PacketFieldU32, PacketFieldU32,	// xtea key
+				PacketFieldU32, PacketFieldU32
+			> KeySchema;
+			static_assert(KeySchema::max_size <= 127, "");
+
 			InPacket p = in_packet(decoded, 127);
-			client->xtea[0] = packet_read_u32(&p);
-			client->xtea[1] = packet_read_u32(&p);
-			client->xtea[2] = packet_read_u32(&p);
-			client->xtea[3] = packet_read_u32(&p);
+			client->xtea[0] = packet_fetch_u32(&p);
+			client->xtea[1] = packet_fetch_u32(&p);
+			client->xtea[2] = packet_fetch_u32(&p);
+			client->xtea[3] = packet_fetch_u32(&p);
 
 			if(version != 860){
 				send_disconnect(game, client,
@@ -458,22 +1132,41 @@ void game_on_read(void *userdata, u32 index, u8 *data, i32 datalen){
 			packet_read_string(&p, sizeof(client->character), client->character);
 			packet_read_string(&p, sizeof(client->password), client->password);
 
-			LOG("player_login");
-			LOG("xtea = {%08X, %08X, %08X, %08X}",
-				client->xtea[0], client->xtea[1],
-				client->xtea[2], client->xtea[3]);
-			LOG("accname = \"%s\", password = \"%s\", character = \"%s\"",
-				client->accname, client->password, client->character);
+			LOG_DEBUG("player login \"%s\" (account \"%s\")",
+				client->character, client->accname);
+
+			// NOTE: Same as the login server, the character is loaded by the
+			// storage worker and the password checked by the password pool.
+			// The client waits for the reply so nothing else should come in
+			// the meantime.
+			if(!game_can_login(game, client->character)){
+				send_disconnect(game, client,
+					"The server is busy. Please try again later.");
+				break;
+			}
 
-			if(strcmp(client->accname, "account") == 0){
-				send_login(game, client);
+			StorageRequest request;
+			memset(&request, 0, sizeof(StorageRequest));
+			request.op = STORAGE_OP_CHARACTER_LOGIN;
+			request.connection_index = index;
+			request.connection_counter = client->counter;
+			strncpy(request.accname, client->accname, sizeof(request.accname) - 1);
+			strncpy(request.character_name, client->character, sizeof(request.character_name) - 1);
+			if(storage_submit(game->storage_queue, &request)){
+				client->state = CLIENT_STATE_HANDSHAKE_AUTHENTICATING;
 			}else{
 				send_disconnect(game, client,
-					"Invalid account.");
+					"The server is busy. Please try again later.");
 			}
 			break;
 		}
 
+		case CLIENT_STATE_HANDSHAKE_AUTHENTICATING:
+		case CLIENT_STATE_HANDSHAKE_VERIFYING_PASSWORD: {
+			disconnect(client);
+			break;
+		}
+
 		case CLIENT_STATE_NORMAL: {
 			InPacket p;
 			if(!packet_unwrap(data, datalen, client->xtea, &p)){
@@ -482,10 +1175,9 @@ void game_on_read(void *userdata, u32 index, u8 *data, i32 datalen){
 			}
 
 			if(packet_remainder(&p) > 0){
-				debug_print_buf_hex("client message",
-					packet_buf(&p), packet_remainder(&p));
-
 				u8 message = packet_read_u8(&p);
+				LOG_DEBUG("client message 0x%02X (%d bytes)",
+					message, packet_remainder(&p) + 1);
 
 				switch(message){
 					case 0x14: {	// logout
@@ -499,21 +1191,43 @@ void game_on_read(void *userdata, u32 index, u8 *data, i32 datalen){
 							return;
 						}
 
-						char say_str[256];
+						char say_str[SAY_MAX_LEN + 1];
 						packet_read_string(&p, sizeof(say_str), say_str);
 
-						u16 client_id = (u16)atoi(say_str);
-						if(client_id >= 100)
-							send_inventory_item(game, client, 0x06, client_id);
-						else if(client_id == 14)
-							send_disconnect(game, client, "test");
-						else if(client_id == 15)
-							send_relogin_window(game, client);
+						if(say_str[0] != 0
+						&& !module_say(game->modules, &client->player, say_str))
+							creature_say(game, &client->player, say_str);
+						break;
+					}
+
+					case 0x82: {	// use item
+						WorldPosition pos;
+						pos.x = packet_read_u16(&p);
+						pos.y = packet_read_u16(&p);
+						pos.z = packet_read_u8(&p);
+						packet_read_u16(&p);	// client id
+						u8 stackpos = packet_read_u8(&p);
+						packet_read_u8(&p);		// container index
+						if(!packet_ok(&p)){
+							disconnect(client);
+							return;
+						}
+						player_stop_walk(client);
+						player_use_item(game, client, pos, stackpos);
+						break;
+					}
+
+					case 0x65:		// move north
+					case 0x66:		// move east
+					case 0x67:		// move south
+					case 0x68: {	// move west
+						player_stop_walk(client);
+						player_walk(game, client, (u8)(message - 0x65));
 						break;
 					}
 
 					default:
-						send_cancel_walk(game, client);
+						send_cancel_walk(game, client, client->player.direction);
 						break;
 				}
 			}
@@ -530,6 +1244,7 @@ void game_on_read(void *userdata, u32 index, u8 *data, i32 datalen){
 static
 void game_request_output(void *userdata,
 		u32 index, u8 **output, i32 *output_len){
+	PROFILE_ZONE("game_request_output");
 	Game *game = (Game*)userdata;
 	Client *client = game_get_client_by_index(game, index);
 	switch(client->state){
@@ -553,12 +1268,23 @@ void game_request_output(void *userdata,
 			break;
 		}
 
+		// NOTE: Nothing to write while waiting for the login message, the
+		// storage worker, or the password pool, or after the connection
+		// was closed.
+		case CLIENT_STATE_HANDSHAKE_READING:
+		case CLIENT_STATE_HANDSHAKE_AUTHENTICATING:
+		case CLIENT_STATE_HANDSHAKE_VERIFYING_PASSWORD:
+		case CLIENT_STATE_DISCONNECTING: {
+			break;
+		}
+
 		case CLIENT_STATE_NORMAL:
 		case CLIENT_STATE_DISCONNECT_WRITING: {
 			ASSERT((client->out_queue_head != NULL && client->out_queue_tail != NULL)
 				|| (client->out_queue_head == NULL && client->out_queue_tail == NULL));
 
 			if(client->out_writing){
+				client->out_queued_bytes -= client->out_writing->bufend;
 				release_out_packet(game, client->out_writing);
 				client->out_writing = NULL;
 			}
@@ -572,7 +1298,6 @@ void game_request_output(void *userdata,
 						client->out_queue_tail = NULL;
 					*output = packet_buf(outp);
 					*output_len = packet_written_len(outp);
-					LOG("writing %d\n", packet_written_len(outp));
 					if(client->state == CLIENT_STATE_DISCONNECT_WRITING)
 						client->state = CLIENT_STATE_DISCONNECT_WAITING_WRITE;
 				}else{
@@ -599,7 +1324,185 @@ void game_request_status(void *userdata, u32 index, ConnectionStatus *out_status
 
 // ----------------------------------------------------------------
 
-void game_init_server(Game *game, Config *cfg, RSA *game_rsa){
+void game_handle_storage(Game *game){
+	StorageResult result;
+	while(storage_next_result(game->storage_queue, &result)){
+		if(result.op == STORAGE_OP_CHARACTER_SAVE){
+			if(result.status != STORAGE_STATUS_OK){
+				LOG_ERROR("failed to save character \"%s\" (status = %u)",
+					result.character.name, result.status);
+			}
+			continue;
+		}
+
+		ASSERT(result.op == STORAGE_OP_CHARACTER_LOGIN);
+		Client *client = game_get_client_by_index(game, (u16)result.connection_index);
+		// NOTE: The connection was dropped while waiting.
+		if(client->counter != (u16)result.connection_counter
+		|| client->state != CLIENT_STATE_HANDSHAKE_AUTHENTICATING)
+			continue;
+
+		// NOTE: Check the password even if the account doesn't exist, same
+		// as in the login server.
+		PasswordRequest request;
+		request.owner = game;
+		request.ip = server_connection_ip(game->server, result.connection_index);
+		request.connection_index = result.connection_index;
+		request.connection_counter = result.connection_counter;
+		memcpy(request.password, client->password, PASSWORD_MAX);
+		PasswordHash *hash = (result.status != STORAGE_STATUS_INVALID_ACCOUNT) ? &result.password : NULL;
+		PasswordSubmitStatus status = password_pool_submit(game->passwords, &request, hash);
+		memset(request.password, 0, PASSWORD_MAX);
+		memset(client->password, 0, PASSWORD_MAX);
+		if(status == PASSWORD_SUBMIT_OK){
+			client->character_status = result.status;
+			client->db_character = result.character;
+			client->state = CLIENT_STATE_HANDSHAKE_VERIFYING_PASSWORD;
+		}else{
+			send_disconnect(game, client,
+				"Too many login attempts. Please try again later.");
+		}
+	}
+}
+
+void game_handle_passwords(Game *game){
+	PasswordResult result;
+	while(password_pool_next_result(game->passwords, game, &result)){
+		Client *client = game_get_client_by_index(game, (u16)result.connection_index);
+		if(client->counter != (u16)result.connection_counter
+		|| client->state != CLIENT_STATE_HANDSHAKE_VERIFYING_PASSWORD)
+			continue;
+
+		// NOTE: Only say the character wasn't found to someone that got
+		// the password right.
+		if(!result.verified){
+			send_disconnect(game, client,
+				"Invalid account name or password.");
+		}else if(client->character_status != STORAGE_STATUS_OK){
+			send_disconnect(game, client,
+				"Character not found.");
+		}else if(player_enter_world(game, client)){
+			send_login(game, client);
+		}else{
+			send_disconnect(game, client,
+				"The world is full.");
+		}
+	}
+}
+
+// NOTE: Periodic saves for players that are online. Clients are visited
+// round robin from where the last call stopped, so when more players are
+// due than `save_max_per_frame` (or the storage queue fills up) the rest
+// are saved in the next frames. Saves deferred when a player left the world
+// go first, in the order they were made.
+void game_save_players(Game *game){
+	PROFILE_ZONE("game_save_players");
+	game_flush_pending_saves(game);
+	if(game->num_pending_saves > 0)
+		return;
+
+	i64 now = sys_clock_monotonic_nsec();
+	i32 num_saved = 0;
+	for(u32 i = 0; i < game->max_clients; i += 1){
+		if(num_saved >= game->save_max_per_frame)
+			break;
+
+		u32 index = (game->save_cursor + i) % game->max_clients;
+		Client *client = &game->clients[index];
+		if(client->state != CLIENT_STATE_NORMAL
+		|| client->dirty_sections == 0
+		|| (now - client->last_save) < game->save_interval)
+			continue;
+
+		if(!player_save(game, client)){
+			game->save_cursor = index;
+			return;
+		}
+		num_saved += 1;
+		game->save_cursor = index + 1;
+	}
+}
+
+// NOTE: Paths are searched in the creature AI phase, under the pathfinder's
+// frame budget, and handed to the players that asked for them. Results for
+// players that moved or changed their minds since are dropped.
+void game_handle_paths(Game *game){
+	PROFILE_ZONE("game_handle_paths");
+	pathfinder_update(game->pathfinder);
+
+	PathRequest request;
+	PathResult result;
+	while(pathfinder_pop_result(game->pathfinder, &request, &result)){
+		Client *client = game_get_client(game, request.requester);
+		if(!client || client->state != CLIENT_STATE_NORMAL
+		|| !client->walk_pending
+		|| !world_position_equals(client->player.pos, request.start)
+		|| !world_position_equals(client->walk_use_pos, request.goal))
+			continue;
+
+		client->walk_pending = false;
+		if(result.status != PATH_FOUND){
+			client->walk_use = false;
+			send_text_message(game, client, TEXT_MESSAGE_STATUS, "There is no way.");
+			continue;
+		}
+
+		memcpy(&client->walk_path, &result, sizeof(PathResult));
+		client->walk_step = 0;
+		client->walk_next_step = sys_clock_monotonic_nsec();
+	}
+}
+
+// NOTE: A step takes `1000 * ground speed / creature speed` milliseconds.
+static
+i64 player_step_duration(Game *game, Creature *player){
+	Tile *tile = world_get_tile_fast(game->world, player->pos.x, player->pos.y, player->pos.z);
+	const BaseItemTable *items = game->base_items;
+	i64 ground_speed = 0;
+	if(tile->num_items > 0 && tile->items[0].id < items->num_items)
+		ground_speed = (i64)items->ground_speed[tile->items[0].id];
+	if(ground_speed == 0)
+		ground_speed = 150;
+	i64 speed = player->speed > 0 ? (i64)player->speed : 220;
+	return ground_speed * 1000000000 / speed;
+}
+
+// NOTE: Moves players that are auto walking. A step that fails (something
+// got in the way) stops the walk and the player has to try again.
+void game_walk_players(Game *game){
+	PROFILE_ZONE("game_walk_players");
+	i64 now = sys_clock_monotonic_nsec();
+	for(u32 i = 0; i < game->max_clients; i += 1){
+		Client *client = &game->clients[i];
+		if(client->state != CLIENT_STATE_NORMAL || client->walk_pending)
+			continue;
+
+		if(client->walk_step < client->walk_path.num_steps){
+			if(now < client->walk_next_step)
+				continue;
+
+			u8 direction = client->walk_path.steps[client->walk_step];
+			if(!player_walk(game, client, direction)){
+				player_stop_walk(client);
+				continue;
+			}
+
+			client->walk_step += 1;
+			client->walk_next_step = now + player_step_duration(game, &client->player);
+			if(client->walk_step < client->walk_path.num_steps)
+				continue;
+		}
+
+		if(client->walk_use){
+			client->walk_use = false;
+			player_use_item(game, client,
+				client->walk_use_pos, client->walk_use_stackpos);
+		}
+	}
+}
+
+void game_init_server(Game *game, Config *cfg, RSA *game_rsa,
+		Storage *storage, PasswordPool *passwords){
 	u16 port = cfg->game_port;
 	u16 max_connections = cfg->game_max_connections;
 
@@ -609,13 +1512,33 @@ void game_init_server(Game *game, Config *cfg, RSA *game_rsa){
 	game->max_clients = max_connections;
 	game->clients = arena_alloc<Client>(arena, max_connections);
 	game->rsa = game_rsa;
+	// NOTE: Room for a login and a save per client, so a client slot can
+	// be reused while the previous player is still being saved.
+	game->storage_queue = storage_queue_init(arena, storage, 2 * max_connections);
+	game->save_interval = cfg->game_save_interval * 1000000;
+	game->save_max_per_frame = cfg->game_save_max_per_frame;
+	game->save_cursor = 0;
+	// NOTE: Logins are held back so there's room for a pending save for
+	// every player (see `game_can_login`).
+	game->pending_saves = arena_alloc<StorageRequest>(arena, max_connections);
+	game->num_pending_saves = 0;
+	game->max_pending_saves = max_connections;
+	game->passwords = passwords;
 	game->output_arena = arena;
-	game->output_head = NULL;
+	game->output_pool = arena_alloc<OutPacketPool>(arena, 1);
+	memset(game->output_pool, 0, sizeof(OutPacketPool));
+	game->output_pool->discard.buf = arena_alloc<u8>(arena,
+		out_packet_size_classes[OUT_PACKET_NUM_SIZE_CLASSES - 1]);
+	game->output_pool->discard.bufend =
+		out_packet_size_classes[OUT_PACKET_NUM_SIZE_CLASSES - 1];
+	game->broadcast_buf = arena_alloc<u8>(arena, BROADCAST_BUFFER_SIZE);
+	game->modules = module_system_init(arena, cfg, game_module_host(game));
 
 	ServerParams server_params;
 	server_params.port = port;
 	server_params.max_connections = max_connections;
 	server_params.readbuf_size = 2048;
+	server_params.flags = 0;
 	server_params.on_accept = game_on_accept;
 	server_params.on_drop = game_on_drop;
 	server_params.on_read = game_on_read;
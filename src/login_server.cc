@@ -3,23 +3,33 @@
 #include "common.hh"
 #include "crypto.hh"
 #include "packet.hh"
+#include "password.hh"
+#include "protocol.hh"
 #include "server.hh"
+#include "storage.hh"
 
 enum LoginState : u32 {
 	LOGIN_STATE_READING = 0,
-	//TODO: LOGIN_STATE_WAITING_DATABASE,
+	LOGIN_STATE_WAITING_DATABASE,
+	LOGIN_STATE_WAITING_PASSWORD,
 	LOGIN_STATE_WRITING,
 	LOGIN_STATE_WAITING_WRITE,
 	LOGIN_STATE_DISCONNECTING,
 };
 
 struct Login{
+	// NOTE: Same as the game client counter, it's used to tell whether
+	// a storage result belongs to the connection currently in this slot.
+	u32 counter;
 	LoginState state;
 	u32 xtea[4];
 	char accname[32];
-	char password[32];
+	char password[PASSWORD_MAX];
 
-	u8 writebuf[512];
+	// NOTE: The account lookup result, kept until the password is checked.
+	StorageResult account;
+
+	u8 writebuf[1024];
 	i32 writelen;
 };
 
@@ -30,7 +40,10 @@ struct LoginServer{
 	i32 max_logins;
 	Login *logins;
 	RSA *rsa;
+	StorageQueue *storage_queue;
+	PasswordPool *passwords;
 	Server *server;
+	u16 game_port;
 };
 
 static
@@ -50,47 +63,30 @@ OutPacket packet_prepare(Login *login){
 	return result;
 }
 
-static
-bool packet_wrap(OutPacket *p, u32 *xtea){
-	u8 *buf = packet_buf(p);
-	i32 len = packet_written_len(p);
-
-	i32 payload_len = len - 8;
-	if(payload_len <= 0) // PARANOID
-		PANIC("trying to send empty message");
-
-	// xtea encode
-	u8 *xtea_payload = buf + 6;
-	i32 xtea_payload_len = len - 6;
-	i32 padding = -xtea_payload_len & 7;
-	// NOTE: If padding ends up being zero, packet_can_write(p, 0)
-	// is the same as packet_ok(p).
-	if(!packet_can_write(p, padding))
-		return false;
-	buffer_write_u16_le(xtea_payload, payload_len);
-	xtea_payload_len += padding;
-	while(padding-- > 0)
-		packet_write_u8(p, 0x33);
-	xtea_encode(xtea, xtea_payload, xtea_payload_len);
-
-	// add message length and checksum
-	u32 checksum = adler32(xtea_payload, xtea_payload_len);
-	buffer_write_u16_le(buf, xtea_payload_len + 4);
-	buffer_write_u32_le(buf + 2, checksum);
-	return true;
-}
-
-
 static
 void disconnect(Login *login){
 	login->state = LOGIN_STATE_DISCONNECTING;
 }
 
+// NOTE: Check at compile time that a message with the given schema fits
+// in the login write buffer with the header and XTEA padding.
+#define LOGIN_SCHEMA_CHECK(Schema)									\
+	static_assert((8 + Schema::max_size + 7) <= sizeof(Login::writebuf),	\
+		"message doesn't fit in the login write buffer")
+
+#define LOGIN_MESSAGE_MAX_LEN 255
+
 static
 void send_disconnect(Login *login, const char *message){
+	typedef PacketSchema<
+		PacketFieldU8,
+		PacketFieldStr<LOGIN_MESSAGE_MAX_LEN>
+	> Schema;
+	LOGIN_SCHEMA_CHECK(Schema);
+
 	OutPacket p = packet_prepare(login);
-	packet_write_u8(&p, 0x0A);
-	packet_write_str(&p, message);
+	packet_store_u8(&p, 0x0A);
+	packet_store_str(&p, message, LOGIN_MESSAGE_MAX_LEN);
 
 	if(packet_wrap(&p, login->xtea)){
 		login->writelen = packet_written_len(&p);
@@ -101,19 +97,39 @@ void send_disconnect(Login *login, const char *message){
 }
 
 static
-void send_charlist(Login *login){
+void send_charlist(LoginServer *lserver, Login *login, StorageResult *result){
+	typedef PacketSchema<
+		PacketFieldU8,					// motd
+		PacketFieldStr<LOGIN_MESSAGE_MAX_LEN>,
+		PacketFieldU8,					// charlist
+		PacketFieldU8
+	> HeaderSchema;
+	typedef PacketSchema<
+		PacketFieldStr<DB_NAME_MAX - 1>,
+		PacketFieldStr<31>,
+		PacketFieldU32,
+		PacketFieldU16
+	> CharacterSchema;
+	typedef PacketSchema<PacketFieldU16> FooterSchema;
+	static_assert((8 + HeaderSchema::max_size
+			+ DB_ACCOUNT_MAX_CHARACTERS * CharacterSchema::max_size
+			+ FooterSchema::max_size + 7) <= sizeof(Login::writebuf),
+		"charlist doesn't fit in the login write buffer");
+
 	OutPacket p = packet_prepare(login);
 	// motd
-	packet_write_u8(&p, 0x14);
-	packet_write_str(&p, "1\nKaplar!");
+	packet_store_u8(&p, 0x14);
+	packet_store_str(&p, "1\nKaplar!", LOGIN_MESSAGE_MAX_LEN);
 	// charlist
-	packet_write_u8(&p, 0x64);
-	packet_write_u8(&p, 1); // num_characters
-		packet_write_str(&p, "Player");	// player_name
-		packet_write_str(&p, "World");	// world_name
-		packet_write_u32(&p, 16777343); // game_server_addr
-		packet_write_u16(&p, 7172);		// game_server_port
-	packet_write_u16(&p, 1); // premium_days
+	packet_store_u8(&p, 0x64);
+	packet_store_u8(&p, (u8)result->num_characters);
+	for(i32 i = 0; i < result->num_characters; i += 1){
+		packet_store_str(&p, result->character_names[i], DB_NAME_MAX - 1);	// player_name
+		packet_store_str(&p, "World", 31);			// world_name
+		packet_store_u32(&p, 16777343);				// game_server_addr
+		packet_store_u16(&p, lserver->game_port);	// game_server_port
+	}
+	packet_store_u16(&p, result->premium_days);
 
 	if(packet_wrap(&p, login->xtea)){
 		login->writelen = packet_written_len(&p);
@@ -134,8 +150,10 @@ static
 void login_server_on_drop(void *userdata, u32 index){
 	LoginServer *lserver = (LoginServer*)userdata;
 	Login *login = lserver_get_login(lserver, index);
+	u32 next_counter = login->counter + 1;
 	// NOTE: Zero out login memory because it may contain sensible information.
 	memset(login, 0, sizeof(Login));
+	login->counter = next_counter;
 }
 
 static
@@ -195,11 +213,17 @@ void login_server_on_read(void *userdata, u32 index, u8 *data, i32 datalen){
 		return;
 	}
 
+	typedef PacketSchema<
+		PacketFieldU32, PacketFieldU32,	// xtea key
+		PacketFieldU32, PacketFieldU32
+	> KeySchema;
+	static_assert(KeySchema::max_size <= 127, "");
+
 	InPacket p = in_packet(decoded, 127);
-	login->xtea[0] = packet_read_u32(&p);
-	login->xtea[1] = packet_read_u32(&p);
-	login->xtea[2] = packet_read_u32(&p);
-	login->xtea[3] = packet_read_u32(&p);
+	login->xtea[0] = packet_fetch_u32(&p);
+	login->xtea[1] = packet_fetch_u32(&p);
+	login->xtea[2] = packet_fetch_u32(&p);
+	login->xtea[3] = packet_fetch_u32(&p);
 
 	if(version != 860){
 		send_disconnect(login,
@@ -210,18 +234,73 @@ void login_server_on_read(void *userdata, u32 index, u8 *data, i32 datalen){
 	packet_read_string(&p, sizeof(login->accname), login->accname);
 	packet_read_string(&p, sizeof(login->password), login->password);
 
-	LOG("account_login");
-	LOG("xtea = {%08X, %08X, %08X, %08X}",
-		login->xtea[0], login->xtea[1],
-		login->xtea[2], login->xtea[3]);
-	LOG("accname = \"%s\", password = \"%s\"",
-		login->accname, login->password);
-
-	if(strcmp(login->accname, "account") == 0){
-		send_charlist(login);
+	LOG_DEBUG("account login \"%s\"", login->accname);
+
+	// NOTE: Looking up the account may hit the disk so it's done by the
+	// storage worker and we continue when the result comes back in a later
+	// login_server_poll.
+	StorageRequest request;
+	memset(&request, 0, sizeof(StorageRequest));
+	request.op = STORAGE_OP_ACCOUNT_LOGIN;
+	request.connection_index = index;
+	request.connection_counter = login->counter;
+	strncpy(request.accname, login->accname, sizeof(request.accname) - 1);
+	if(storage_submit(lserver->storage_queue, &request)){
+		login->state = LOGIN_STATE_WAITING_DATABASE;
 	}else{
 		send_disconnect(login,
-			"Invalid account name or password.");
+			"The server is busy. Please try again later.");
+	}
+}
+
+static
+void login_server_handle_storage(LoginServer *lserver){
+	StorageResult result;
+	while(storage_next_result(lserver->storage_queue, &result)){
+		ASSERT(result.op == STORAGE_OP_ACCOUNT_LOGIN);
+		Login *login = lserver_get_login(lserver, result.connection_index);
+		// NOTE: The connection was dropped while waiting.
+		if(login->counter != result.connection_counter
+		|| login->state != LOGIN_STATE_WAITING_DATABASE)
+			continue;
+
+		// NOTE: The password is checked even if the account doesn't exist
+		// so both cases take the same time and count towards the limits.
+		PasswordRequest request;
+		request.owner = lserver;
+		request.ip = server_connection_ip(lserver->server, result.connection_index);
+		request.connection_index = result.connection_index;
+		request.connection_counter = result.connection_counter;
+		memcpy(request.password, login->password, PASSWORD_MAX);
+		PasswordHash *hash = (result.status == STORAGE_STATUS_OK) ? &result.password : NULL;
+		PasswordSubmitStatus status = password_pool_submit(lserver->passwords, &request, hash);
+		memset(request.password, 0, PASSWORD_MAX);
+		memset(login->password, 0, PASSWORD_MAX);
+		if(status == PASSWORD_SUBMIT_OK){
+			login->account = result;
+			login->state = LOGIN_STATE_WAITING_PASSWORD;
+		}else{
+			send_disconnect(login,
+				"Too many login attempts. Please try again later.");
+		}
+	}
+}
+
+static
+void login_server_handle_passwords(LoginServer *lserver){
+	PasswordResult result;
+	while(password_pool_next_result(lserver->passwords, lserver, &result)){
+		Login *login = lserver_get_login(lserver, result.connection_index);
+		if(login->counter != result.connection_counter
+		|| login->state != LOGIN_STATE_WAITING_PASSWORD)
+			continue;
+
+		if(result.verified && login->account.status == STORAGE_STATUS_OK){
+			send_charlist(lserver, login, &login->account);
+		}else{
+			send_disconnect(login,
+				"Invalid account name or password.");
+		}
 	}
 }
 
@@ -234,7 +313,6 @@ void login_server_request_output(void *userdata,
 		*output = login->writebuf;
 		*output_len = login->writelen;
 		login->state = LOGIN_STATE_WAITING_WRITE;
-		LOG("writing: %d", login->writelen);
 	}else if(login->state == LOGIN_STATE_WAITING_WRITE){
 		disconnect(login);
 	}
@@ -250,7 +328,8 @@ void login_server_request_status(void *userdata, u32 index, ConnectionStatus *ou
 
 // ----------------------------------------------------------------
 
-LoginServer *login_server_init(MemArena *arena, Config *cfg, RSA *login_rsa){
+LoginServer *login_server_init(MemArena *arena, Config *cfg,
+		RSA *login_rsa, Storage *storage, PasswordPool *passwords){
 	u16 port = cfg->login_port;
 	u16 max_connections = cfg->login_max_connections;
 
@@ -258,11 +337,16 @@ LoginServer *login_server_init(MemArena *arena, Config *cfg, RSA *login_rsa){
 	lserver->max_logins = max_connections;
 	lserver->logins = arena_alloc<Login>(arena, max_connections);
 	lserver->rsa = login_rsa;
+	// NOTE: Each login has at most one request in flight.
+	lserver->storage_queue = storage_queue_init(arena, storage, max_connections);
+	lserver->passwords = passwords;
+	lserver->game_port = cfg->game_port;
 
 	ServerParams server_params;
 	server_params.port = port;
 	server_params.max_connections = max_connections;
 	server_params.readbuf_size = 256;
+	server_params.flags = 0;
 	server_params.on_accept = login_server_on_accept;
 	server_params.on_drop = login_server_on_drop;
 	server_params.on_read = login_server_on_read;
@@ -275,5 +359,7 @@ LoginServer *login_server_init(MemArena *arena, Config *cfg, RSA *login_rsa){
 }
 
 void login_server_poll(LoginServer *lserver){
+	login_server_handle_storage(lserver);
+	login_server_handle_passwords(lserver);
 	server_poll(lserver->server, lserver);
 }
@@ -3,9 +3,12 @@
 
 #include "common.hh"
 
+struct PasswordPool;
 struct RSA;
+struct Storage;
 struct LoginServer;
-LoginServer *login_server_init(MemArena *arena, Config *cfg, RSA *login_rsa);
+LoginServer *login_server_init(MemArena *arena, Config *cfg,
+		RSA *login_rsa, Storage *storage, PasswordPool *passwords);
 void login_server_poll(LoginServer *lserver);
 
 #endif //KAPLAR_LOGIN_SERVER_HH_
@@ -1,7 +1,12 @@
 #include "common.hh"
 #include "crypto.hh"
+#include "database.hh"
+#include "frame.hh"
 #include "game.hh"
 #include "login_server.hh"
+#include "metrics_server.hh"
+#include "password.hh"
+#include "storage.hh"
 
 static
 RSA *rsa_default_init(void){
@@ -26,41 +31,15 @@ RSA *rsa_default_init(void){
 }
 
 #if BUILD_DEBUG
+// NOTE: Log frame stats every FRAME_STATS_INTERVAL frames.
+#define FRAME_STATS_INTERVAL 300
 static
-void calc_stats(i64 *data, int datalen,
-		i64 *out_avg, i64 *out_min, i64 *out_max){
-	ASSERT(datalen > 0);
-	i64 avg, min, max;
-	avg = min = max = data[0];
-	for(int i = 1; i < datalen; i += 1){
-		if(data[i] < min)
-			min = data[i];
-		else if(data[i] > max)
-			max = data[i];
-		avg += data[i];
+void frame_stats(FrameScheduler *frame, Game *game){
+	if(frame->window_frames >= FRAME_STATS_INTERVAL){
+		frame_log_stats(frame);
+		game_log_output_stats(game);
+		frame_stats_reset_window(frame);
 	}
-	*out_avg = avg / datalen;
-	*out_min = min;
-	*out_max = max;
-}
-
-static
-void frame_stats(i64 frame_start, i64 frame_end, i64 next_frame){
-	static i64 frame_user_time[120];
-	static i64 frame_idle_time[120];
-	static int num_frames = 0;
-	if(num_frames >= 120){
-		i64 avg, min, max;
-		LOG("frame stats over %d frames", num_frames);
-		calc_stats(frame_user_time, num_frames, &avg, &min, &max);
-		LOG("    user time: avg = %lld, min = %lld, max = %lld", avg, min, max);
-		calc_stats(frame_idle_time, num_frames, &avg, &min, &max);
-		LOG("    idle time: avg = %lld, min = %lld, max = %lld", avg, min, max);
-		num_frames = 0;
-	}
-	frame_user_time[num_frames] = frame_end - frame_start;
-	frame_idle_time[num_frames] = (next_frame > frame_end) ? (next_frame - frame_end) : 0;
-	num_frames += 1;
 }
 #endif
 
@@ -77,39 +56,126 @@ int main(int argc, char **argv){
 	cfg.login_port = 7171;
 	cfg.login_max_connections = 10;
 
+	cfg.db_snapshot_file = "kaplar.kdb";
+	cfg.db_wal_file = "kaplar.wal";
+	cfg.db_max_accounts = 10000;
+	cfg.db_max_characters = 50000;
+	// NOTE: Write a new snapshot once the log grows over this size.
+	cfg.db_compact_wal_size = 16 * 1024 * 1024;
+	// NOTE: Debug builds create an "account" account (password "password")
+	// with a "Player" character when the database is empty, so there's
+	// something to log in with.
+#if BUILD_DEBUG
+	cfg.db_create_default_account = true;
+#endif
+
+	// NOTE: Passwords are hashed with scrypt which uses 128 * r * 2^log2_n
+	// bytes (16MB here) and takes around 50ms per hash. It's done by the
+	// password workers and each IP can only have a few hashes in flight so
+	// a burst of login attempts only slows down logins.
+	cfg.password_log2_n = 14;
+	cfg.password_r = 8;
+	cfg.password_p = 1;
+	cfg.password_workers = 2;
+	cfg.password_max_jobs = 32;
+	cfg.password_max_jobs_per_ip = 2;
+
+	// NOTE: Game modules (see module_api.hh) are checked for changes every
+	// `module_poll_interval` milliseconds and reloaded between frames.
+	static const char *const module_files[] = {
+		"modules/build/example.dll",
+	};
+	cfg.module_files = module_files;
+	cfg.num_module_files = NARRAY(module_files);
+	cfg.module_poll_interval = 1000;
+
+	// NOTE: The metrics server only listens on the loopback interface.
+	cfg.metrics_port = 9171;
+	cfg.metrics_max_connections = 4;
+
 	cfg.game_port = 7172;
 	cfg.game_max_connections = 100;
+	cfg.game_max_creatures = 10000;
 	// game frame interval in milliseconds:
 	//	16 is ~60fps
 	//	33 is ~30fps
 	//	66 is ~15fps
 	cfg.game_frame_interval = 33;
+	// NOTE: How many frames behind we can be and still catch up by
+	// running frames back to back, before dropping them.
+	cfg.game_frame_max_catch_up = 3;
+	// NOTE: Players are saved at most every `game_save_interval`
+	// milliseconds while online, and only what changed since the last
+	// save is written. `game_save_max_per_frame` spreads the saves out
+	// over a few frames when many players are due at once.
+	cfg.game_save_interval = 30000;
+	cfg.game_save_max_per_frame = 16;
+	// NOTE: Changes to the map are saved to the delta file every
+	// `game_world_save_interval` milliseconds, at most
+	// `game_world_save_max_chunks` chunks at a time (each chunk takes
+	// ~3KB in the snapshot buffer). Set the file to NULL to disable it.
+	// When the file grows past `game_world_delta_max_size` bytes it's
+	// compacted, keeping only the last copy of each chunk. It's loaded in
+	// a single read so keep it well under 2GB.
+	cfg.game_world_delta_file = "world_delta.kwr";
+	cfg.game_world_save_interval = 60000;
+	cfg.game_world_save_max_chunks = 4096;
+	cfg.game_world_delta_max_size = 256 * 1024 * 1024;
+	// NOTE: Path requests are serviced for up to `game_pathfind_budget`
+	// microseconds per frame and the rest wait for the next frame. A
+	// search gives up after `game_pathfind_max_nodes` nodes (~32 bytes
+	// each) and results are reused for `game_pathfind_cache_frames` frames.
+	cfg.game_pathfind_budget = 2000;
+	cfg.game_pathfind_max_nodes = 8192;
+	cfg.game_pathfind_max_requests = 1024;
+	cfg.game_pathfind_cache_frames = 4;
+
+	// NOTE: Frames slower than `profile_trace_slow_frame` milliseconds are
+	// written to the trace files. Set the path to NULL to disable tracing.
+	cfg.profile_trace_path = "trace";
+	cfg.profile_trace_slow_frame = 100;
+	cfg.profile_trace_max_file_size = 64 * 1024 * 1024;
+	cfg.profile_trace_max_files = 4;
 
 	usize arena_vsize = cfg.arena_vsize;
 	usize arena_granularity = cfg.arena_granularity;
 	i64 game_frame_interval = cfg.game_frame_interval;
+	i32 game_frame_max_catch_up = cfg.game_frame_max_catch_up;
+
+	log_init();
+	profile_init();
+	profile_thread_name("main");
+	if(cfg.profile_trace_path){
+		profile_trace_init(cfg.profile_trace_path,
+			cfg.profile_trace_slow_frame * 1000000,
+			cfg.profile_trace_max_file_size,
+			cfg.profile_trace_max_files);
+	}
 
 	MemArena *arena = arena_init(arena_vsize, arena_granularity);
 
 	// TODO: Load RSA key from PEM file given by the CFG.
 	RSA *login_rsa = rsa_default_init();
 	RSA *game_rsa = login_rsa;
-	LoginServer *lserver = login_server_init(arena, &cfg, login_rsa);
-	Game *game = game_init(arena, &cfg, game_rsa);
+	Database *db = database_init(arena, &cfg);
+	Storage *storage = storage_init(arena, db);
+	PasswordPool *passwords = password_pool_init(arena, &cfg);
+	LoginServer *lserver = login_server_init(arena, &cfg, login_rsa, storage, passwords);
+	Game *game = game_init(arena, &cfg, game_rsa, storage, passwords);
+	MetricsServer *mserver = metrics_server_init(arena, &cfg);
 
+	FrameScheduler *frame = arena_alloc<FrameScheduler>(arena, 1);
+	frame_scheduler_init(frame, game_frame_interval * 1000000,
+		game_frame_max_catch_up);
 	while(1){
-		i64 frame_start = sys_clock_monotonic_msec();
-		i64 next_frame = frame_start + game_frame_interval;
-
+		frame_begin(frame);
 		login_server_poll(lserver);
-		game_update(game);
-
-		i64 frame_end = sys_clock_monotonic_msec();
-		if(frame_end < next_frame)
-			sys_sleep_msec(next_frame - frame_end);
+		metrics_server_poll(mserver);
+		game_update(game, frame);
+		frame_end(frame);
 
 #if 0 && BUILD_DEBUG
-		frame_stats(frame_start, frame_end, next_frame);
+		frame_stats(frame, game);
 #endif
 	}
 	return 0;
@@ -0,0 +1,178 @@
+#include "metrics.hh"
+
+#include <atomic>
+#include <stdio.h>
+
+struct MetricInfo{
+	const char *name;
+	const char *help;
+	MetricType type;
+};
+
+static const MetricInfo metric_infos[METRIC_COUNT] = {
+	// server
+	{ "kaplar_server_polls_total",
+		"Number of server_poll calls.", METRIC_TYPE_COUNTER },
+	{ "kaplar_server_poll_nanoseconds_total",
+		"Time spent in server_poll.", METRIC_TYPE_COUNTER },
+	{ "kaplar_server_connections",
+		"Number of open connections.", METRIC_TYPE_GAUGE },
+	{ "kaplar_server_accepted_total",
+		"Number of accepted connections.", METRIC_TYPE_COUNTER },
+	{ "kaplar_server_rejected_total",
+		"Number of connections rejected due to the connection limit.", METRIC_TYPE_COUNTER },
+	{ "kaplar_server_bytes_in_total",
+		"Number of bytes read from connections.", METRIC_TYPE_COUNTER },
+	{ "kaplar_server_bytes_out_total",
+		"Number of bytes written to connections.", METRIC_TYPE_COUNTER },
+	{ "kaplar_server_messages_in_total",
+		"Number of messages read from connections.", METRIC_TYPE_COUNTER },
+
+	// game output
+	{ "kaplar_game_out_packet_requests_total",
+		"Number of get_out_packet calls.", METRIC_TYPE_COUNTER },
+	{ "kaplar_game_out_packet_coalesced_total",
+		"Number of get_out_packet calls served by the tail of the queue.", METRIC_TYPE_COUNTER },
+	{ "kaplar_game_out_packet_overflows_total",
+		"Number of clients disconnected for going over the queue limit.", METRIC_TYPE_COUNTER },
+	{ "kaplar_game_out_packets_in_use",
+		"Number of out packets held by clients.", METRIC_TYPE_GAUGE },
+	{ "kaplar_game_out_packet_bytes_in_use",
+		"Size of the out packets held by clients.", METRIC_TYPE_GAUGE },
+	{ "kaplar_game_out_packet_bytes_allocated",
+		"Size of every out packet allocated, including the free ones.", METRIC_TYPE_GAUGE },
+
+	// frames
+	{ "kaplar_frames_total",
+		"Number of game frames.", METRIC_TYPE_COUNTER },
+	{ "kaplar_frame_overruns_total",
+		"Number of game frames that overran their deadline.", METRIC_TYPE_COUNTER },
+	{ "kaplar_frames_dropped_total",
+		"Number of game frames dropped to catch up.", METRIC_TYPE_COUNTER },
+
+	// crypto
+	{ "kaplar_rsa_decodes_total",
+		"Number of RSA decodes.", METRIC_TYPE_COUNTER },
+	{ "kaplar_rsa_decode_nanoseconds_total",
+		"Time spent decoding RSA.", METRIC_TYPE_COUNTER },
+
+	// storage
+	{ "kaplar_storage_requests_total",
+		"Number of requests handled by the storage worker.", METRIC_TYPE_COUNTER },
+	{ "kaplar_storage_request_nanoseconds_total",
+		"Time spent handling storage requests.", METRIC_TYPE_COUNTER },
+	{ "kaplar_storage_requests_pending",
+		"Number of storage requests whose results weren't read yet.", METRIC_TYPE_GAUGE },
+	{ "kaplar_storage_commits_total",
+		"Number of log fsyncs done by the storage worker.", METRIC_TYPE_COUNTER },
+	{ "kaplar_storage_commit_nanoseconds_total",
+		"Time spent in log fsyncs.", METRIC_TYPE_COUNTER },
+
+	// world saves
+	{ "kaplar_world_snapshots_total",
+		"Number of world snapshots taken.", METRIC_TYPE_COUNTER },
+	{ "kaplar_world_snapshot_chunks_total",
+		"Number of changed chunks copied into world snapshots.", METRIC_TYPE_COUNTER },
+	{ "kaplar_world_snapshot_nanoseconds_total",
+		"Time spent by the game taking world snapshots.", METRIC_TYPE_COUNTER },
+	{ "kaplar_world_save_nanoseconds_total",
+		"Time spent writing world snapshots to the delta file.", METRIC_TYPE_COUNTER },
+
+	// passwords
+	{ "kaplar_password_verifies_total",
+		"Number of password hashes checked by the password pool.", METRIC_TYPE_COUNTER },
+	{ "kaplar_password_verify_nanoseconds_total",
+		"Time spent checking password hashes.", METRIC_TYPE_COUNTER },
+	{ "kaplar_password_rejected_total",
+		"Number of logins rejected because the password pool or the IP limit was full.", METRIC_TYPE_COUNTER },
+
+	// pathfinding
+	{ "kaplar_pathfind_requests_total",
+		"Number of paths requested.", METRIC_TYPE_COUNTER },
+	{ "kaplar_pathfind_cache_hits_total",
+		"Number of path requests answered from the path cache.", METRIC_TYPE_COUNTER },
+	{ "kaplar_pathfind_searches_total",
+		"Number of path searches done.", METRIC_TYPE_COUNTER },
+	{ "kaplar_pathfind_nodes_total",
+		"Number of nodes expanded by path searches.", METRIC_TYPE_COUNTER },
+	{ "kaplar_pathfind_nanoseconds_total",
+		"Time spent searching for paths.", METRIC_TYPE_COUNTER },
+	{ "kaplar_pathfind_requests_pending",
+		"Number of path requests waiting for the next frames.", METRIC_TYPE_GAUGE },
+
+	// memory
+	{ "kaplar_arena_commits_total",
+		"Number of arena commits.", METRIC_TYPE_COUNTER },
+	{ "kaplar_arena_committed_bytes",
+		"Memory committed by every arena.", METRIC_TYPE_GAUGE },
+};
+
+// NOTE: The values are atomics only so reads from other threads are well
+// defined. The owning thread is the only writer so it doesn't need a
+// read-modify-write.
+struct MetricsBlock{
+	std::atomic<i64> values[METRIC_COUNT];
+};
+
+#define METRICS_MAX_THREADS 32
+
+static std::atomic<MetricsBlock*> metrics_blocks[METRICS_MAX_THREADS];
+static std::atomic<i32> metrics_blocks_count;
+static thread_local MetricsBlock *metrics_thread_block;
+
+static
+MetricsBlock *metrics_get_thread_block(void){
+	MetricsBlock *block = metrics_thread_block;
+	if(!block){
+		i32 index = metrics_blocks_count.fetch_add(1);
+		if(index >= METRICS_MAX_THREADS)
+			PANIC("too many threads using metrics (max = %d)", METRICS_MAX_THREADS);
+
+		// NOTE: Blocks are never freed so the values of threads that
+		// already exited are still counted.
+		block = (MetricsBlock*)malloc_no_fail(sizeof(MetricsBlock));
+		for(i32 i = 0; i < (i32)METRIC_COUNT; i += 1)
+			block->values[i].store(0, std::memory_order_relaxed);
+		metrics_blocks[index].store(block, std::memory_order_release);
+		metrics_thread_block = block;
+	}
+	return block;
+}
+
+void metrics_add(Metric metric, i64 delta){
+	ASSERT(metric < METRIC_COUNT);
+	std::atomic<i64> *value = &metrics_get_thread_block()->values[metric];
+	value->store(value->load(std::memory_order_relaxed) + delta,
+		std::memory_order_relaxed);
+}
+
+i64 metrics_read(Metric metric){
+	ASSERT(metric < METRIC_COUNT);
+	i32 num_blocks = metrics_blocks_count.load(std::memory_order_acquire);
+	if(num_blocks > METRICS_MAX_THREADS)
+		num_blocks = METRICS_MAX_THREADS;
+
+	i64 result = 0;
+	for(i32 i = 0; i < num_blocks; i += 1){
+		MetricsBlock *block = metrics_blocks[i].load(std::memory_order_acquire);
+		if(block)
+			result += block->values[metric].load(std::memory_order_relaxed);
+	}
+	return result;
+}
+
+i32 metrics_write_text(char *buf, i32 bufsize){
+	i32 written = 0;
+	for(i32 i = 0; i < (i32)METRIC_COUNT; i += 1){
+		const MetricInfo *info = &metric_infos[i];
+		const char *type = (info->type == METRIC_TYPE_GAUGE) ? "gauge" : "counter";
+		i32 ret = snprintf(buf + written, bufsize - written,
+			"# HELP %s %s\n# TYPE %s %s\n%s %lld\n",
+			info->name, info->help, info->name, type,
+			info->name, (long long)metrics_read((Metric)i));
+		if(ret < 0 || ret >= (bufsize - written))
+			return -1;
+		written += ret;
+	}
+	return written;
+}
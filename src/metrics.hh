@@ -0,0 +1,92 @@
+#ifndef KAPLAR_METRICS_HH_
+#define KAPLAR_METRICS_HH_ 1
+
+#include "common.hh"
+
+// ----------------------------------------------------------------
+// Metrics
+// ----------------------------------------------------------------
+
+// NOTE: The set of metrics is fixed at compile time so there is nothing to
+// register or look up at runtime. Each thread that touches a metric gets
+// its own block of values that only it writes to, so updating a metric is
+// a plain load and store without locks or atomic read-modify-writes. Reads
+// sum the blocks of every thread.
+//	Gauges are updated with deltas just like counters (e.g. +1 when a
+// connection is accepted and -1 when it's dropped) so they aggregate the
+// same way. The type only changes how they're exported.
+
+enum MetricType : u32 {
+	METRIC_TYPE_COUNTER = 0,
+	METRIC_TYPE_GAUGE,
+};
+
+enum Metric : u32 {
+	// server
+	METRIC_SERVER_POLLS = 0,
+	METRIC_SERVER_POLL_NSEC,
+	METRIC_SERVER_CONNECTIONS,
+	METRIC_SERVER_ACCEPTED,
+	METRIC_SERVER_REJECTED,
+	METRIC_SERVER_BYTES_IN,
+	METRIC_SERVER_BYTES_OUT,
+	METRIC_SERVER_MESSAGES_IN,
+
+	// game output
+	METRIC_GAME_OUT_PACKET_REQUESTS,
+	METRIC_GAME_OUT_PACKET_COALESCED,
+	METRIC_GAME_OUT_PACKET_OVERFLOWS,
+	METRIC_GAME_OUT_PACKETS_IN_USE,
+	METRIC_GAME_OUT_PACKET_BYTES_IN_USE,
+	METRIC_GAME_OUT_PACKET_BYTES_ALLOCATED,
+
+	// frames
+	METRIC_FRAMES,
+	METRIC_FRAME_OVERRUNS,
+	METRIC_FRAMES_DROPPED,
+
+	// crypto
+	METRIC_RSA_DECODES,
+	METRIC_RSA_DECODE_NSEC,
+
+	// storage
+	METRIC_STORAGE_REQUESTS,
+	METRIC_STORAGE_REQUEST_NSEC,
+	METRIC_STORAGE_PENDING,
+	METRIC_STORAGE_COMMITS,
+	METRIC_STORAGE_COMMIT_NSEC,
+
+	// world saves
+	METRIC_WORLD_SNAPSHOTS,
+	METRIC_WORLD_SNAPSHOT_CHUNKS,
+	METRIC_WORLD_SNAPSHOT_NSEC,
+	METRIC_WORLD_SAVE_NSEC,
+
+	// passwords
+	METRIC_PASSWORD_VERIFIES,
+	METRIC_PASSWORD_VERIFY_NSEC,
+	METRIC_PASSWORD_REJECTED,
+
+	// pathfinding
+	METRIC_PATHFIND_REQUESTS,
+	METRIC_PATHFIND_CACHE_HITS,
+	METRIC_PATHFIND_SEARCHES,
+	METRIC_PATHFIND_NODES,
+	METRIC_PATHFIND_NSEC,
+	METRIC_PATHFIND_PENDING,
+
+	// memory
+	METRIC_ARENA_COMMITS,
+	METRIC_ARENA_COMMITTED_BYTES,
+
+	METRIC_COUNT,
+};
+
+void metrics_add(Metric metric, i64 delta);
+i64 metrics_read(Metric metric);
+
+// NOTE: Writes every metric in the Prometheus text exposition format.
+// Returns the number of bytes written or -1 if `buf` is too small.
+i32 metrics_write_text(char *buf, i32 bufsize);
+
+#endif //KAPLAR_METRICS_HH_
@@ -0,0 +1,168 @@
+#include "metrics_server.hh"
+
+#include "common.hh"
+#include "metrics.hh"
+#include "server.hh"
+
+#include <stdio.h>
+
+// NOTE: Minimal HTTP/1.0 server that answers `GET /metrics` with every
+// metric in the Prometheus text format so a local Prometheus can scrape
+// it. It only listens on the loopback interface and closes the connection
+// after each response.
+
+#define METRICS_REQUEST_MAX_SIZE 1024
+#define METRICS_RESPONSE_MAX_SIZE (16 * 1024)
+#define METRICS_HEADER_MAX_SIZE 128
+
+enum MetricsState : u32 {
+	METRICS_STATE_READING = 0,
+	METRICS_STATE_WRITING,
+	METRICS_STATE_WAITING_WRITE,
+	METRICS_STATE_DISCONNECTING,
+};
+
+struct MetricsRequest{
+	MetricsState state;
+	i32 request_len;
+	char request[METRICS_REQUEST_MAX_SIZE];
+
+	u8 *writeptr;
+	i32 writelen;
+	u8 writebuf[METRICS_RESPONSE_MAX_SIZE];
+};
+
+struct MetricsServer{
+	// NOTE: Same as the login server, requests have a one-to-one
+	// relation with connections.
+	i32 max_requests;
+	MetricsRequest *requests;
+	Server *server;
+};
+
+static
+MetricsRequest *mserver_get_request(MetricsServer *mserver, u32 index){
+	ASSERT(index < (u32)mserver->max_requests);
+	return &mserver->requests[index];
+}
+
+static
+void send_response(MetricsRequest *request, const char *status, bool metrics){
+	// NOTE: Write the body first, leaving room for the header, so the
+	// header can include the content length.
+	char *body = (char*)request->writebuf + METRICS_HEADER_MAX_SIZE;
+	i32 body_size = METRICS_RESPONSE_MAX_SIZE - METRICS_HEADER_MAX_SIZE;
+	i32 body_len = metrics ? metrics_write_text(body, body_size)
+		: snprintf(body, body_size, "%s\n", status);
+	if(body_len < 0){
+		LOG_ERROR("metrics response doesn't fit in %d bytes", body_size);
+		status = "500 Internal Server Error";
+		body_len = snprintf(body, body_size, "%s\n", status);
+	}
+
+	char header[METRICS_HEADER_MAX_SIZE];
+	i32 header_len = snprintf(header, sizeof(header),
+		"HTTP/1.0 %s\r\n"
+		"Content-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: %d\r\n"
+		"Connection: close\r\n"
+		"\r\n", status, body_len);
+	ASSERT(header_len > 0 && header_len < METRICS_HEADER_MAX_SIZE);
+
+	request->writeptr = (u8*)body - header_len;
+	memcpy(request->writeptr, header, header_len);
+	request->writelen = header_len + body_len;
+	request->state = METRICS_STATE_WRITING;
+}
+
+static
+void metrics_server_on_accept(void *userdata, u32 index){
+	MetricsServer *mserver = (MetricsServer*)userdata;
+	MetricsRequest *request = mserver_get_request(mserver, index);
+	request->state = METRICS_STATE_READING;
+	request->request_len = 0;
+}
+
+static
+void metrics_server_on_drop(void *userdata, u32 index){
+	// no-op
+}
+
+static
+void metrics_server_on_read(void *userdata, u32 index, u8 *data, i32 datalen){
+	MetricsServer *mserver = (MetricsServer*)userdata;
+	MetricsRequest *request = mserver_get_request(mserver, index);
+	if(request->state != METRICS_STATE_READING)
+		return;
+
+	// NOTE: Keep one byte for the nul terminator.
+	if((request->request_len + datalen) >= METRICS_REQUEST_MAX_SIZE){
+		send_response(request, "413 Request Entity Too Large", false);
+		return;
+	}
+	memcpy(request->request + request->request_len, data, datalen);
+	request->request_len += datalen;
+	request->request[request->request_len] = 0;
+
+	// NOTE: Wait for the end of the request header. We don't accept
+	// requests with a body so that's the whole request.
+	if(!strstr(request->request, "\r\n\r\n"))
+		return;
+
+	if(strncmp(request->request, "GET /metrics ", 13) == 0)
+		send_response(request, "200 OK", true);
+	else
+		send_response(request, "404 Not Found", false);
+}
+
+static
+void metrics_server_request_output(void *userdata,
+		u32 index, u8 **output, i32 *output_len){
+	MetricsServer *mserver = (MetricsServer*)userdata;
+	MetricsRequest *request = mserver_get_request(mserver, index);
+	if(request->state == METRICS_STATE_WRITING){
+		*output = request->writeptr;
+		*output_len = request->writelen;
+		request->state = METRICS_STATE_WAITING_WRITE;
+	}else if(request->state == METRICS_STATE_WAITING_WRITE){
+		request->state = METRICS_STATE_DISCONNECTING;
+	}
+}
+
+static
+void metrics_server_request_status(void *userdata, u32 index, ConnectionStatus *out_status){
+	MetricsServer *mserver = (MetricsServer*)userdata;
+	MetricsRequest *request = mserver_get_request(mserver, index);
+	if(request->state == METRICS_STATE_DISCONNECTING)
+		*out_status = CONNECTION_STATUS_CLOSING;
+}
+
+// ----------------------------------------------------------------
+
+MetricsServer *metrics_server_init(MemArena *arena, Config *cfg){
+	u16 port = cfg->metrics_port;
+	u16 max_connections = cfg->metrics_max_connections;
+
+	MetricsServer *mserver = arena_alloc<MetricsServer>(arena, 1);
+	mserver->max_requests = max_connections;
+	mserver->requests = arena_alloc<MetricsRequest>(arena, max_connections);
+
+	ServerParams server_params;
+	server_params.port = port;
+	server_params.max_connections = max_connections;
+	server_params.readbuf_size = 512;
+	server_params.flags = SERVER_FLAG_STREAM | SERVER_FLAG_LOOPBACK;
+	server_params.on_accept = metrics_server_on_accept;
+	server_params.on_drop = metrics_server_on_drop;
+	server_params.on_read = metrics_server_on_read;
+	server_params.request_output = metrics_server_request_output;
+	server_params.request_status = metrics_server_request_status;
+	mserver->server = server_init(arena, &server_params);
+	if(!mserver->server)
+		PANIC("failed to initialize metrics server");
+	return mserver;
+}
+
+void metrics_server_poll(MetricsServer *mserver){
+	server_poll(mserver->server, mserver);
+}
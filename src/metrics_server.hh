@@ -0,0 +1,10 @@
+#ifndef KAPLAR_METRICS_SERVER_HH_
+#define KAPLAR_METRICS_SERVER_HH_ 1
+
+#include "common.hh"
+
+struct MetricsServer;
+MetricsServer *metrics_server_init(MemArena *arena, Config *cfg);
+void metrics_server_poll(MetricsServer *mserver);
+
+#endif //KAPLAR_METRICS_SERVER_HH_
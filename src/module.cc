@@ -0,0 +1,314 @@
+#include "module.hh"
+
+#include "profile.hh"
+
+#include <stdio.h>
+
+#define MODULE_MAX_ITEMS 0x10000
+
+// ----------------------------------------------------------------
+// Spell Words
+// ----------------------------------------------------------------
+
+// NOTE: Words are matched without case, like names in the database.
+static INLINE
+char module_lower(char c){
+	return (c >= 'A' && c <= 'Z') ? (c - 'A' + 'a') : c;
+}
+
+static
+u32 module_words_hash(const char *words){
+	// FNV-1a
+	u32 hash = 0x811C9DC5;
+	for(const char *p = words; *p; p += 1){
+		hash ^= (u8)module_lower(*p);
+		hash *= 0x01000193;
+	}
+	return hash;
+}
+
+static
+bool module_words_equal(const char *a, const char *b){
+	while(*a && module_lower(*a) == module_lower(*b)){
+		a += 1;
+		b += 1;
+	}
+	return module_lower(*a) == module_lower(*b);
+}
+
+static
+u16 *module_spell_slot(ModuleSystem *modules, const char *words){
+	u32 slot = module_words_hash(words) & modules->spell_table_mask;
+	while(modules->spell_table[slot] != 0){
+		ModuleSpellEntry *spell = &modules->spells[modules->spell_table[slot] - 1];
+		if(module_words_equal(spell->words, words))
+			break;
+		slot = (slot + 1) & modules->spell_table_mask;
+	}
+	return &modules->spell_table[slot];
+}
+
+// ----------------------------------------------------------------
+// Dispatch Tables
+// ----------------------------------------------------------------
+
+// NOTE: Checks everything the module registers before any of it is used,
+// so a bad module is rejected and the previous version keeps running.
+static
+bool module_desc_valid(Module *module, const ModuleDesc *desc){
+	if(desc->api_version != MODULE_API_VERSION){
+		LOG_ERROR("\"%s\": module was built for api version %u (expected %u)",
+			module->file, desc->api_version, MODULE_API_VERSION);
+		return false;
+	}
+	if(desc->num_item_handlers > 0 && !desc->item_handlers){
+		LOG_ERROR("\"%s\": missing item handlers", module->file);
+		return false;
+	}
+	if(desc->num_spells > 0 && !desc->spells){
+		LOG_ERROR("\"%s\": missing spells", module->file);
+		return false;
+	}
+	for(u32 i = 0; i < desc->num_spells; i += 1){
+		const ModuleSpell *spell = &desc->spells[i];
+		if(spell->spell_id >= MODULE_MAX_SPELLS || !spell->on_cast || !spell->words
+		|| spell->words[0] == 0 || strlen(spell->words) >= MODULE_SPELL_WORDS_MAX){
+			LOG_ERROR("\"%s\": invalid spell %u (max id = %d, max words = %d)",
+				module->file, spell->spell_id, MODULE_MAX_SPELLS - 1,
+				MODULE_SPELL_WORDS_MAX - 1);
+			return false;
+		}
+	}
+	return true;
+}
+
+// NOTE: Handlers from modules loaded first win when two modules register
+// the same item or spell.
+static
+void module_rebuild_tables(ModuleSystem *modules){
+	PROFILE_ZONE("module_rebuild_tables");
+	memset(modules->items, 0, sizeof(ModuleItemEntry) * MODULE_MAX_ITEMS);
+	memset(modules->spells, 0, sizeof(ModuleSpellEntry) * MODULE_MAX_SPELLS);
+	memset(modules->spell_table, 0, sizeof(u16) * (modules->spell_table_mask + 1));
+	for(i32 i = 0; i < modules->num_modules; i += 1){
+		Module *module = &modules->modules[i];
+		const ModuleDesc *desc = module->desc;
+		if(!desc)
+			continue;
+
+		for(u32 j = 0; j < desc->num_item_handlers; j += 1){
+			const ModuleItemHandler *handler = &desc->item_handlers[j];
+			ModuleItemEntry *entry = &modules->items[handler->item_id];
+			if(handler->on_use){
+				if(entry->on_use){
+					LOG_ERROR("\"%s\": item %u already has a use handler",
+						module->file, handler->item_id);
+				}else{
+					entry->on_use = handler->on_use;
+					entry->use_module = (u8)i;
+				}
+			}
+			if(handler->on_step){
+				if(entry->on_step){
+					LOG_ERROR("\"%s\": item %u already has a step handler",
+						module->file, handler->item_id);
+				}else{
+					entry->on_step = handler->on_step;
+					entry->step_module = (u8)i;
+				}
+			}
+		}
+
+		for(u32 j = 0; j < desc->num_spells; j += 1){
+			const ModuleSpell *spell = &desc->spells[j];
+			ModuleSpellEntry *entry = &modules->spells[spell->spell_id];
+			u16 *slot = module_spell_slot(modules, spell->words);
+			if(entry->on_cast || *slot != 0){
+				LOG_ERROR("\"%s\": spell %u (\"%s\") is already registered",
+					module->file, spell->spell_id, spell->words);
+				continue;
+			}
+
+			// NOTE: The words are copied since the module's memory goes
+			// away when it's reloaded.
+			entry->on_cast = spell->on_cast;
+			entry->module = (u8)i;
+			strcpy(entry->words, spell->words);
+			*slot = spell->spell_id + 1;
+		}
+	}
+}
+
+// ----------------------------------------------------------------
+// Loading
+// ----------------------------------------------------------------
+
+static
+void module_unload(ModuleSystem *modules, Module *module){
+	if(!module->library)
+		return;
+	if(module->desc && module->desc->on_unload)
+		module->desc->on_unload(modules->host, module->state);
+	sys_library_unload(module->library);
+	remove(module->loaded_file);
+	module->library = NULL;
+	module->desc = NULL;
+}
+
+// NOTE: The library is loaded from a copy so the original can be rebuilt
+// while it's loaded (Windows won't let you overwrite a loaded dll) and so
+// the new version never has the same path as the old one.
+static
+bool module_load(ModuleSystem *modules, Module *module){
+	char loaded_file[sizeof(module->loaded_file)];
+	i32 len = snprintf(loaded_file, sizeof(loaded_file), "%s.%u.loaded",
+		module->file, module->generation);
+	if(len < 0 || len >= (i32)sizeof(loaded_file)){
+		LOG_ERROR("\"%s\": module file name is too long", module->file);
+		return false;
+	}
+	if(!sys_file_copy(module->file, loaded_file)){
+		LOG_ERROR("failed to copy \"%s\" to \"%s\"", module->file, loaded_file);
+		return false;
+	}
+
+	void *library = sys_library_load(loaded_file);
+	if(!library){
+		LOG_ERROR("failed to load module \"%s\"", module->file);
+		remove(loaded_file);
+		return false;
+	}
+
+	ModuleGetProc get = (ModuleGetProc)sys_library_symbol(library, MODULE_ENTRY_POINT);
+	const ModuleDesc *desc = get ? get(MODULE_API_VERSION) : NULL;
+	if(!desc || !module_desc_valid(module, desc)){
+		if(!desc)
+			LOG_ERROR("\"%s\": missing or failed " MODULE_ENTRY_POINT, module->file);
+		sys_library_unload(library);
+		remove(loaded_file);
+		return false;
+	}
+
+	// NOTE: The state is kept unless its layout changed. If it grew, the
+	// old block is left in the arena, which is fine since it only happens
+	// when a module is changed.
+	module_unload(modules, module);
+	bool fresh_state = module->state == NULL
+		|| desc->state_version != module->state_version
+		|| desc->state_size > module->state_capacity;
+	if(desc->state_size > module->state_capacity){
+		module->state = arena_alloc<u8>(modules->arena, desc->state_size);
+		module->state_capacity = desc->state_size;
+	}
+	if(fresh_state && module->state)
+		memset(module->state, 0, module->state_capacity);
+	module->state_version = desc->state_version;
+
+	module->library = library;
+	module->desc = desc;
+	memcpy(module->loaded_file, loaded_file, sizeof(loaded_file));
+	module->generation += 1;
+	module_rebuild_tables(modules);
+	if(desc->on_load)
+		desc->on_load(modules->host, module->state, fresh_state ? 1 : 0);
+
+	LOG("loaded module \"%s\" from \"%s\" (generation = %u, fresh state = %d)",
+		(desc->name ? desc->name : "?"), module->file,
+		module->generation, (i32)fresh_state);
+	return true;
+}
+
+ModuleSystem *module_system_init(MemArena *arena, Config *cfg, ModuleHost *host){
+	if(cfg->num_module_files > MODULE_MAX_MODULES)
+		PANIC("too many modules (max = %d)", MODULE_MAX_MODULES);
+
+	ModuleSystem *modules = arena_alloc<ModuleSystem>(arena, 1);
+	memset(modules, 0, sizeof(ModuleSystem));
+	modules->arena = arena;
+	modules->host = host;
+	modules->poll_interval = cfg->module_poll_interval * 1000000;
+	modules->last_poll = sys_clock_monotonic_nsec();
+	modules->items = arena_alloc<ModuleItemEntry>(arena, MODULE_MAX_ITEMS);
+	modules->spells = arena_alloc<ModuleSpellEntry>(arena, MODULE_MAX_SPELLS);
+	// NOTE: Keep the load factor at or below 50%.
+	modules->spell_table_mask = (MODULE_MAX_SPELLS * 2) - 1;
+	modules->spell_table = arena_alloc<u16>(arena, modules->spell_table_mask + 1);
+	module_rebuild_tables(modules);
+
+	// NOTE: Modules that fail to load now are retried when their file
+	// changes.
+	for(i32 i = 0; i < cfg->num_module_files; i += 1){
+		Module *module = &modules->modules[i];
+		if(strlen(cfg->module_files[i]) >= sizeof(module->file))
+			PANIC("module file name is too long");
+		strcpy(module->file, cfg->module_files[i]);
+		modules->num_modules += 1;
+		if(sys_file_mtime(module->file, &module->mtime))
+			module_load(modules, module);
+		else
+			LOG_ERROR("module \"%s\" not found", module->file);
+	}
+	return modules;
+}
+
+// NOTE: Must be called between frames.
+void module_system_poll(ModuleSystem *modules){
+	i64 now = sys_clock_monotonic_nsec();
+	if((now - modules->last_poll) < modules->poll_interval)
+		return;
+	modules->last_poll = now;
+
+	PROFILE_ZONE("module_system_poll");
+	for(i32 i = 0; i < modules->num_modules; i += 1){
+		Module *module = &modules->modules[i];
+		i64 mtime;
+		if(!sys_file_mtime(module->file, &mtime) || mtime == module->mtime)
+			continue;
+
+		// NOTE: If the new version fails to load, the previous one keeps
+		// running and we only try again once the file changes again.
+		module->mtime = mtime;
+		module_load(modules, module);
+	}
+}
+
+// ----------------------------------------------------------------
+// Dispatch
+// ----------------------------------------------------------------
+
+// NOTE: Returns false if the item has no use handler.
+bool module_use_item(ModuleSystem *modules, Creature *user, WorldPosition pos, u16 item_id){
+	ModuleItemEntry *entry = &modules->items[item_id];
+	if(!entry->on_use)
+		return false;
+	Module *module = &modules->modules[entry->use_module];
+	entry->on_use(modules->host, module->state,
+		(ModuleCreature*)user, module_position(pos), item_id);
+	return true;
+}
+
+// NOTE: Returns true if the text was a spell or a module handled it.
+bool module_say(ModuleSystem *modules, Creature *speaker, const char *text){
+	if(strlen(text) < MODULE_SPELL_WORDS_MAX){
+		u16 spell_id = *module_spell_slot(modules, text);
+		if(spell_id != 0){
+			spell_id -= 1;
+			ModuleSpellEntry *spell = &modules->spells[spell_id];
+			if(spell->on_cast){
+				Module *module = &modules->modules[spell->module];
+				spell->on_cast(modules->host, module->state,
+					(ModuleCreature*)speaker, spell_id);
+			}
+			return true;
+		}
+	}
+
+	for(i32 i = 0; i < modules->num_modules; i += 1){
+		Module *module = &modules->modules[i];
+		if(module->desc && module->desc->on_say
+		&& module->desc->on_say(modules->host, module->state,
+				(ModuleCreature*)speaker, text))
+			return true;
+	}
+	return false;
+}
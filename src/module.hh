@@ -0,0 +1,101 @@
+#ifndef KAPLAR_MODULE_HH_
+#define KAPLAR_MODULE_HH_ 1
+
+#include "common.hh"
+#include "module_api.hh"
+#include "world.hh"
+
+// ----------------------------------------------------------------
+// Modules
+// ----------------------------------------------------------------
+
+// NOTE: Game logic that isn't part of the engine (item uses, step events,
+// spells, etc) lives in compiled modules (see module_api.hh). Modules are
+// polled for changes and reloaded between frames, so a callback is never
+// running while its module is swapped.
+//	Events are dispatched through tables indexed by item id and spell id
+// that are rebuilt every time a module is loaded, so the game never looks
+// anything up by name. The only string lookup is matching spell words,
+// which only happens when a player says something.
+
+#define MODULE_MAX_MODULES 16
+#define MODULE_MAX_SPELLS 1024
+#define MODULE_SPELL_WORDS_MAX 32
+
+// NOTE: The loaded copy has a ".<generation>.loaded" suffix (at most 18
+// characters) after the module's file name.
+#define MODULE_FILE_MAX 256
+#define MODULE_LOADED_FILE_MAX (MODULE_FILE_MAX + 32)
+
+struct Module{
+	char file[MODULE_FILE_MAX];
+	char loaded_file[MODULE_LOADED_FILE_MAX];
+	i64 mtime;
+	u32 generation;
+	void *library;
+	const ModuleDesc *desc;
+
+	// NOTE: Owned by the server so it survives reloads.
+	void *state;
+	u32 state_capacity;
+	u32 state_version;
+};
+
+struct ModuleItemEntry{
+	ModuleUseProc on_use;
+	ModuleStepProc on_step;
+	u8 use_module;
+	u8 step_module;
+};
+
+struct ModuleSpellEntry{
+	ModuleCastProc on_cast;
+	u8 module;
+	char words[MODULE_SPELL_WORDS_MAX];
+};
+
+struct ModuleSystem{
+	MemArena *arena;
+	ModuleHost *host;
+	i64 poll_interval;
+	i64 last_poll;
+	i32 num_modules;
+	Module modules[MODULE_MAX_MODULES];
+
+	// NOTE: Dispatch tables. `spell_table` maps the hash of the words to
+	// spell ids (plus one, zero being an empty slot).
+	ModuleItemEntry *items;
+	ModuleSpellEntry *spells;
+	u32 spell_table_mask;
+	u16 *spell_table;
+};
+
+ModuleSystem *module_system_init(MemArena *arena, Config *cfg, ModuleHost *host);
+void module_system_poll(ModuleSystem *modules);
+bool module_use_item(ModuleSystem *modules, Creature *user, WorldPosition pos, u16 item_id);
+bool module_say(ModuleSystem *modules, Creature *speaker, const char *text);
+
+static INLINE
+ModulePosition module_position(WorldPosition pos){
+	ModulePosition result;
+	result.x = pos.x;
+	result.y = pos.y;
+	result.z = pos.z;
+	return result;
+}
+
+// NOTE: Called every time a creature steps on a tile so the common case
+// (no item on the tile has a step handler) should stay cheap.
+static INLINE
+void module_step_tile(ModuleSystem *modules, Creature *creature, WorldPosition pos, Tile *tile){
+	for(i32 i = 0; i < tile->num_items; i += 1){
+		ModuleItemEntry *entry = &modules->items[tile->items[i].id];
+		if(entry->on_step){
+			Module *module = &modules->modules[entry->step_module];
+			entry->on_step(modules->host, module->state,
+				(ModuleCreature*)creature, module_position(pos), tile->items[i].id);
+		}
+	}
+}
+
+#endif //KAPLAR_MODULE_HH_
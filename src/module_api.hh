@@ -0,0 +1,111 @@
+#ifndef KAPLAR_MODULE_API_HH_
+#define KAPLAR_MODULE_API_HH_ 1
+
+// NOTE: This is the only header a game module needs to include. It's plain
+// C and doesn't depend on any other server header, so the server internals
+// can change without breaking modules and modules can be built separately
+// with any compiler for the platform.
+//	A module is a shared library (.dll/.so) exporting MODULE_ENTRY_POINT,
+// which returns a ModuleDesc describing its callbacks. The server loads it
+// at startup and reloads it between frames whenever the file changes.
+//	Modules must not keep any state of their own (globals, statics) since
+// they're gone after a reload. Instead they declare the size of their state
+// and the server keeps a block of that size that is passed to every
+// callback and survives reloads. If the layout of the state changes, bump
+// `state_version` and the server will hand the module a zeroed block.
+//	Any change to the structures or function types below must bump
+// MODULE_API_VERSION. The server refuses modules built for other versions.
+
+#include <stdint.h>
+
+#define MODULE_API_VERSION 1
+#define MODULE_ENTRY_POINT "kaplar_module_get"
+
+#if defined(_WIN32)
+#	define MODULE_EXPORT __declspec(dllexport)
+#else
+#	define MODULE_EXPORT __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// NOTE: Creatures are opaque handles that are only valid for the duration
+// of the callback they're passed to.
+typedef struct ModuleCreature ModuleCreature;
+
+typedef struct ModulePosition{
+	uint16_t x;
+	uint16_t y;
+	uint8_t z;
+} ModulePosition;
+
+// NOTE: Functions the server provides to modules.
+typedef struct ModuleHost ModuleHost;
+struct ModuleHost{
+	uint32_t api_version;
+	void (*log)(ModuleHost *host, const char *message);
+	uint32_t (*creature_id)(ModuleHost *host, ModuleCreature *creature);
+	const char *(*creature_name)(ModuleHost *host, ModuleCreature *creature);
+	ModulePosition (*creature_position)(ModuleHost *host, ModuleCreature *creature);
+	int (*creature_is_player)(ModuleHost *host, ModuleCreature *creature);
+	void (*creature_say)(ModuleHost *host, ModuleCreature *creature, const char *text);
+	// NOTE: Does nothing if the creature isn't a player.
+	void (*player_send_message)(ModuleHost *host, ModuleCreature *player, const char *text);
+};
+
+typedef void (*ModuleLoadProc)(ModuleHost *host, void *state, int fresh_state);
+typedef void (*ModuleUnloadProc)(ModuleHost *host, void *state);
+typedef void (*ModuleUseProc)(ModuleHost *host, void *state,
+		ModuleCreature *user, ModulePosition pos, uint16_t item_id);
+typedef void (*ModuleStepProc)(ModuleHost *host, void *state,
+		ModuleCreature *creature, ModulePosition pos, uint16_t item_id);
+typedef void (*ModuleCastProc)(ModuleHost *host, void *state,
+		ModuleCreature *caster, uint16_t spell_id);
+// NOTE: Returns non zero if the text was handled, in which case it isn't
+// said out loud.
+typedef int (*ModuleSayProc)(ModuleHost *host, void *state,
+		ModuleCreature *speaker, const char *text);
+
+typedef struct ModuleItemHandler{
+	uint16_t item_id;
+	ModuleUseProc on_use;
+	ModuleStepProc on_step;
+} ModuleItemHandler;
+
+// NOTE: Spell ids are shared by every module and must be below the
+// server's MODULE_MAX_SPELLS. Words are matched against the whole text
+// without case.
+typedef struct ModuleSpell{
+	uint16_t spell_id;
+	const char *words;
+	ModuleCastProc on_cast;
+} ModuleSpell;
+
+typedef struct ModuleDesc{
+	uint32_t api_version;
+	const char *name;
+	uint32_t state_size;
+	uint32_t state_version;
+
+	// NOTE: All callbacks are optional.
+	ModuleLoadProc on_load;
+	ModuleUnloadProc on_unload;
+	ModuleSayProc on_say;
+
+	uint32_t num_item_handlers;
+	const ModuleItemHandler *item_handlers;
+	uint32_t num_spells;
+	const ModuleSpell *spells;
+} ModuleDesc;
+
+// NOTE: The signature of MODULE_ENTRY_POINT. Modules built for a different
+// version should return NULL.
+typedef const ModuleDesc *(*ModuleGetProc)(uint32_t host_api_version);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //KAPLAR_MODULE_API_HH_
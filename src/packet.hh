@@ -144,6 +144,13 @@ void packet_write_u32(OutPacket *p, u32 val){
 	p->bufpos += 4;
 }
 
+static INLINE
+void packet_write_bytes(OutPacket *p, const u8 *data, i32 len){
+	if(len > 0 && packet_can_write(p, len))
+		memcpy(p->buf + p->bufpos, data, len);
+	p->bufpos += len;
+}
+
 static INLINE
 void packet_write_lstr(OutPacket *p, const char *s, u16 len){
 	// NOTE: Either write the whole string or none of it.
@@ -160,4 +167,124 @@ void packet_write_str(OutPacket *p, const char *s){
 	packet_write_lstr(p, s, (u16)strlen(s));
 }
 
+// ----------------------------------------------------------------
+// Packet Schema
+// ----------------------------------------------------------------
+
+// NOTE: Messages with a known layout can describe their fields with a
+// schema so the maximum encoded size is computed at compile time. Then a
+// single check covers the whole message and the fields are written with
+// the unchecked packet_store_* functions, instead of a bounds check per
+// field like with packet_write_*.
+//	The size is also what should be passed when requesting an out packet
+// so it can't get out of sync with what is actually written.
+//
+//	typedef PacketSchema<PacketFieldU8, PacketFieldStr<64>> Schema;
+//	if(packet_reserve<Schema>(p)){
+//		packet_store_u8(p, 0x14);
+//		packet_store_str(p, message, 64);
+//	}
+
+struct PacketFieldU8{ enum { max_size = 1 }; };
+struct PacketFieldU16{ enum { max_size = 2 }; };
+struct PacketFieldU32{ enum { max_size = 4 }; };
+
+template<u16 MAXLEN>
+struct PacketFieldStr{ enum { max_size = 2 + MAXLEN }; };
+
+template<typename... Fields>
+struct PacketSchema;
+
+template<>
+struct PacketSchema<>{ enum { max_size = 0 }; };
+
+template<typename Field, typename... Rest>
+struct PacketSchema<Field, Rest...>{
+	enum { max_size = Field::max_size + PacketSchema<Rest...>::max_size };
+};
+
+// NOTE: Returns whether there is enough space for any message with the
+// given schema. If there isn't, the packet is marked as overflowed the same
+// way packet_write_* would have done and nothing should be stored.
+template<typename Schema>
+static INLINE
+bool packet_reserve(OutPacket *p){
+	if(packet_can_write(p, Schema::max_size))
+		return true;
+	p->bufpos += Schema::max_size;
+	return false;
+}
+
+template<typename Schema>
+static INLINE
+bool packet_can_read(InPacket *p){
+	return packet_can_read(p, Schema::max_size);
+}
+
+#if BUILD_DEBUG
+#	define PACKET_STORE_CHECK(p, bytes) ASSERT(packet_can_write(p, bytes))
+#	define PACKET_FETCH_CHECK(p, bytes) ASSERT(packet_can_read(p, bytes))
+#else
+#	define PACKET_STORE_CHECK(p, bytes) ((void)0)
+#	define PACKET_FETCH_CHECK(p, bytes) ((void)0)
+#endif
+
+static INLINE
+void packet_store_u8(OutPacket *p, u8 val){
+	PACKET_STORE_CHECK(p, 1);
+	buffer_write_u8(p->buf + p->bufpos, val);
+	p->bufpos += 1;
+}
+
+static INLINE
+void packet_store_u16(OutPacket *p, u16 val){
+	PACKET_STORE_CHECK(p, 2);
+	buffer_write_u16_le(p->buf + p->bufpos, val);
+	p->bufpos += 2;
+}
+
+static INLINE
+void packet_store_u32(OutPacket *p, u32 val){
+	PACKET_STORE_CHECK(p, 4);
+	buffer_write_u32_le(p->buf + p->bufpos, val);
+	p->bufpos += 4;
+}
+
+// NOTE: Strings longer than `maxlen` are truncated. `maxlen` should match
+// the PacketFieldStr of the schema.
+static INLINE
+void packet_store_str(OutPacket *p, const char *s, u16 maxlen){
+	usize len = strlen(s);
+	if(len > maxlen)
+		len = maxlen;
+	PACKET_STORE_CHECK(p, 2 + (i32)len);
+	buffer_write_u16_le(p->buf + p->bufpos, (u16)len);
+	memcpy(p->buf + p->bufpos + 2, s, len);
+	p->bufpos += 2 + (i32)len;
+}
+
+static INLINE
+u8 packet_fetch_u8(InPacket *p){
+	PACKET_FETCH_CHECK(p, 1);
+	u8 result = buffer_read_u8(p->buf + p->bufpos);
+	p->bufpos += 1;
+	return result;
+}
+
+static INLINE
+u16 packet_fetch_u16(InPacket *p){
+	PACKET_FETCH_CHECK(p, 2);
+	u16 result = buffer_read_u16_le(p->buf + p->bufpos);
+	p->bufpos += 2;
+	return result;
+}
+
+static INLINE
+u32 packet_fetch_u32(InPacket *p){
+	PACKET_FETCH_CHECK(p, 4);
+	u32 result = buffer_read_u32_le(p->buf + p->bufpos);
+	p->bufpos += 4;
+	return result;
+}
+
 #endif //KAPLAR_PACKET_HH_
\ No newline at end of file
@@ -0,0 +1,275 @@
+#include "password.hh"
+
+#include "crypto.hh"
+#include "metrics.hh"
+#include "profile.hh"
+
+#include <atomic>
+
+#define PASSWORD_POOL_MAX_WORKERS 16
+
+bool password_params_valid(u32 log2_n, u32 r, u32 p){
+	return log2_n > 0 && log2_n <= PASSWORD_MAX_LOG2_N
+		&& r > 0 && r <= PASSWORD_MAX_R
+		&& p > 0 && p <= PASSWORD_MAX_P;
+}
+
+static
+void password_scrypt(const char *password, PasswordHash *params,
+		u8 *scratch, usize scratch_size, u8 *out){
+	scrypt((const u8*)password, strlen(password),
+		params->salt, PASSWORD_SALT_SIZE,
+		params->log2_n, params->r, params->p,
+		scratch, scratch_size, out, PASSWORD_HASH_SIZE);
+}
+
+// NOTE: Compare the whole hash so the time doesn't depend on where the
+// hashes differ.
+static
+bool password_hash_equal(const u8 *a, const u8 *b){
+	u8 diff = 0;
+	for(i32 i = 0; i < PASSWORD_HASH_SIZE; i += 1)
+		diff |= a[i] ^ b[i];
+	return diff == 0;
+}
+
+void password_hash(const char *password, u32 log2_n, u32 r, u32 p, PasswordHash *out){
+	ASSERT(password_params_valid(log2_n, r, p));
+	out->log2_n = (u8)log2_n;
+	out->r = (u8)r;
+	out->p = (u8)p;
+	if(!sys_random_bytes(out->salt, PASSWORD_SALT_SIZE))
+		PANIC("failed to generate password salt");
+
+	usize scratch_size = scrypt_scratch_size(log2_n, r, p);
+	u8 *scratch = (u8*)malloc_no_fail(scratch_size);
+	password_scrypt(password, out, scratch, scratch_size, out->hash);
+	free(scratch);
+}
+
+bool password_verify(const char *password, PasswordHash *hash){
+	if(!password_params_valid(hash->log2_n, hash->r, hash->p))
+		return false;
+
+	usize scratch_size = scrypt_scratch_size(hash->log2_n, hash->r, hash->p);
+	u8 *scratch = (u8*)malloc_no_fail(scratch_size);
+	u8 tmp[PASSWORD_HASH_SIZE];
+	password_scrypt(password, hash, scratch, scratch_size, tmp);
+	free(scratch);
+	return password_hash_equal(tmp, hash->hash);
+}
+
+// ----------------------------------------------------------------
+// Password Pool
+// ----------------------------------------------------------------
+
+enum PasswordJobState : u32 {
+	PASSWORD_JOB_FREE = 0,
+	PASSWORD_JOB_PENDING,
+	PASSWORD_JOB_RUNNING,
+	PASSWORD_JOB_DONE,
+};
+
+// NOTE: The submitting thread owns FREE and DONE jobs and the workers own
+// PENDING and RUNNING jobs. A worker claims a PENDING job with a CAS since
+// there may be more than one looking at it.
+struct PasswordJob{
+	std::atomic<u32> state;
+	// NOTE: Jobs using the dummy hash always fail. It's used when the
+	// account doesn't exist so that takes as long as a wrong password.
+	bool dummy;
+	bool verified;
+	PasswordRequest request;
+	PasswordHash hash;
+};
+
+struct PasswordPool{
+	i32 max_jobs;
+	i32 max_jobs_per_ip;
+	PasswordJob *jobs;
+	PasswordHash dummy_hash;
+};
+
+struct PasswordWorker{
+	PasswordPool *pool;
+	i32 first_job;
+	usize scratch_size;
+	u8 *scratch;
+};
+
+static
+bool password_worker_verify(PasswordWorker *worker, PasswordJob *job){
+	PasswordHash *hash = job->dummy ? &worker->pool->dummy_hash : &job->hash;
+	if(!password_params_valid(hash->log2_n, hash->r, hash->p)){
+		LOG_ERROR("invalid password hash params (log2_n = %d, r = %d, p = %d)",
+			hash->log2_n, hash->r, hash->p);
+		return false;
+	}
+
+	// NOTE: Hashes made with a different cost may need more memory.
+	usize scratch_size = scrypt_scratch_size(hash->log2_n, hash->r, hash->p);
+	if(scratch_size > worker->scratch_size){
+		free(worker->scratch);
+		worker->scratch = (u8*)malloc_no_fail(scratch_size);
+		worker->scratch_size = scratch_size;
+	}
+
+	u8 tmp[PASSWORD_HASH_SIZE];
+	password_scrypt(job->request.password, hash,
+		worker->scratch, worker->scratch_size, tmp);
+	return password_hash_equal(tmp, hash->hash) && !job->dummy;
+}
+
+static
+void password_worker_thread(void *arg){
+	PasswordWorker *worker = (PasswordWorker*)arg;
+	PasswordPool *pool = worker->pool;
+	profile_thread_name("password");
+	while(1){
+		// NOTE: Each worker starts scanning at a different job so they
+		// don't all fight over the first pending one.
+		bool idle = true;
+		for(i32 i = 0; i < pool->max_jobs; i += 1){
+			PasswordJob *job = &pool->jobs[(worker->first_job + i) % pool->max_jobs];
+			u32 expected = PASSWORD_JOB_PENDING;
+			if(!job->state.compare_exchange_strong(expected, PASSWORD_JOB_RUNNING,
+					std::memory_order_acquire, std::memory_order_relaxed))
+				continue;
+
+			i64 start = sys_clock_monotonic_nsec();
+			{
+				PROFILE_ZONE("password_verify");
+				job->verified = password_worker_verify(worker, job);
+			}
+			memset(job->request.password, 0, PASSWORD_MAX);
+			job->state.store(PASSWORD_JOB_DONE, std::memory_order_release);
+			metrics_add(METRIC_PASSWORD_VERIFIES, 1);
+			metrics_add(METRIC_PASSWORD_VERIFY_NSEC, sys_clock_monotonic_nsec() - start);
+			idle = false;
+		}
+
+		if(idle)
+			sys_sleep_msec(1);
+	}
+}
+
+PasswordPool *password_pool_init(MemArena *arena, Config *cfg){
+	ASSERT(cfg->password_workers > 0 && cfg->password_workers <= PASSWORD_POOL_MAX_WORKERS);
+	ASSERT(cfg->password_max_jobs > 0 && cfg->password_max_jobs_per_ip > 0);
+	if(!password_params_valid(cfg->password_log2_n, cfg->password_r, cfg->password_p)){
+		PANIC("invalid password hash params (log2_n = %d, r = %d, p = %d)",
+			cfg->password_log2_n, cfg->password_r, cfg->password_p);
+	}
+
+	PasswordPool *pool = arena_alloc<PasswordPool>(arena, 1);
+	pool->max_jobs = cfg->password_max_jobs;
+	pool->max_jobs_per_ip = cfg->password_max_jobs_per_ip;
+	pool->jobs = arena_alloc<PasswordJob>(arena, pool->max_jobs);
+	for(i32 i = 0; i < pool->max_jobs; i += 1)
+		pool->jobs[i].state.store(PASSWORD_JOB_FREE, std::memory_order_relaxed);
+
+	// NOTE: Use the configured cost so it takes as long as a real one.
+	u8 dummy_password[PASSWORD_MAX / 2];
+	char dummy_password_hex[PASSWORD_MAX];
+	if(!sys_random_bytes(dummy_password, sizeof(dummy_password)))
+		PANIC("failed to generate dummy password");
+	for(i32 i = 0; i < (i32)NARRAY(dummy_password) - 1; i += 1)
+		snprintf(dummy_password_hex + i * 2, 3, "%02X", dummy_password[i]);
+	password_hash(dummy_password_hex, cfg->password_log2_n,
+		cfg->password_r, cfg->password_p, &pool->dummy_hash);
+
+	usize scratch_size = scrypt_scratch_size(cfg->password_log2_n,
+		cfg->password_r, cfg->password_p);
+	for(i32 i = 0; i < cfg->password_workers; i += 1){
+		PasswordWorker *worker = arena_alloc<PasswordWorker>(arena, 1);
+		worker->pool = pool;
+		worker->first_job = (i * pool->max_jobs) / cfg->password_workers;
+		worker->scratch_size = scratch_size;
+		worker->scratch = (u8*)malloc_no_fail(scratch_size);
+		sys_thread_start(password_worker_thread, worker);
+	}
+	return pool;
+}
+
+// NOTE: `hash` is NULL if the account doesn't exist.
+PasswordSubmitStatus password_pool_submit(PasswordPool *pool,
+		PasswordRequest *request, PasswordHash *hash){
+	// NOTE: Jobs in any state other than FREE count towards the limit,
+	// including the ones whose results weren't read yet.
+	PasswordJob *free_job = NULL;
+	i32 ip_jobs = 0;
+	for(i32 i = 0; i < pool->max_jobs; i += 1){
+		PasswordJob *job = &pool->jobs[i];
+		if(job->state.load(std::memory_order_acquire) == PASSWORD_JOB_FREE){
+			if(!free_job)
+				free_job = job;
+		}else if(job->request.ip == request->ip){
+			ip_jobs += 1;
+		}
+	}
+
+	if(ip_jobs >= pool->max_jobs_per_ip){
+		metrics_add(METRIC_PASSWORD_REJECTED, 1);
+		return PASSWORD_SUBMIT_IP_LIMIT;
+	}
+	if(!free_job){
+		metrics_add(METRIC_PASSWORD_REJECTED, 1);
+		return PASSWORD_SUBMIT_BUSY;
+	}
+
+	free_job->request = *request;
+	free_job->request.password[PASSWORD_MAX - 1] = 0;
+	free_job->dummy = (hash == NULL);
+	free_job->verified = false;
+	if(hash)
+		free_job->hash = *hash;
+	free_job->state.store(PASSWORD_JOB_PENDING, std::memory_order_release);
+	return PASSWORD_SUBMIT_OK;
+}
+
+bool password_pool_next_result(PasswordPool *pool, void *owner, PasswordResult *out_result){
+	for(i32 i = 0; i < pool->max_jobs; i += 1){
+		PasswordJob *job = &pool->jobs[i];
+		if(job->request.owner != owner
+		|| job->state.load(std::memory_order_acquire) != PASSWORD_JOB_DONE)
+			continue;
+
+		out_result->connection_index = job->request.connection_index;
+		out_result->connection_counter = job->request.connection_counter;
+		out_result->verified = job->verified;
+		job->state.store(PASSWORD_JOB_FREE, std::memory_order_release);
+		return true;
+	}
+	return false;
+}
+
+// NOTE: Number of jobs submitted by `owner` whose results weren't read yet.
+i32 password_pool_num_jobs(PasswordPool *pool, void *owner){
+	i32 result = 0;
+	for(i32 i = 0; i < pool->max_jobs; i += 1){
+		PasswordJob *job = &pool->jobs[i];
+		if(job->request.owner == owner
+		&& job->state.load(std::memory_order_acquire) != PASSWORD_JOB_FREE)
+			result += 1;
+	}
+	return result;
+}
+
+#if BUILD_TEST
+bool password_test(void){
+	bool passed = true;
+	PasswordHash hash;
+	password_hash("secret", 10, 8, 1, &hash);
+	passed = passed && password_verify("secret", &hash);
+	passed = passed && !password_verify("Secret", &hash);
+	passed = passed && !password_verify("", &hash);
+
+	// NOTE: Same password, different salt.
+	PasswordHash other;
+	password_hash("secret", 10, 8, 1, &other);
+	passed = passed && memcmp(hash.hash, other.hash, PASSWORD_HASH_SIZE) != 0;
+	passed = passed && password_verify("secret", &other);
+	debug_printf("password test: %s\n", (passed ? "passed" : "failed"));
+	return passed;
+}
+#endif //BUILD_TEST
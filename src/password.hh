@@ -0,0 +1,82 @@
+#ifndef KAPLAR_PASSWORD_HH_
+#define KAPLAR_PASSWORD_HH_ 1
+
+#include "common.hh"
+
+// ----------------------------------------------------------------
+// Password
+// ----------------------------------------------------------------
+
+// NOTE: Passwords are stored as scrypt hashes with a random salt and the
+// cost they were hashed with, so the cost can be raised without breaking
+// the existing hashes.
+#define PASSWORD_MAX 32
+#define PASSWORD_SALT_SIZE 16
+#define PASSWORD_HASH_SIZE 32
+
+// NOTE: Upper bounds for the stored cost so a bad record can't make us
+// allocate an absurd amount of memory (128 * r * 2^log2_n bytes).
+#define PASSWORD_MAX_LOG2_N 20
+#define PASSWORD_MAX_R 32
+#define PASSWORD_MAX_P 16
+
+struct PasswordHash{
+	u8 log2_n;
+	u8 r;
+	u8 p;
+	u8 salt[PASSWORD_SALT_SIZE];
+	u8 hash[PASSWORD_HASH_SIZE];
+};
+
+bool password_params_valid(u32 log2_n, u32 r, u32 p);
+void password_hash(const char *password, u32 log2_n, u32 r, u32 p, PasswordHash *out);
+bool password_verify(const char *password, PasswordHash *hash);
+
+// ----------------------------------------------------------------
+// Password Pool
+// ----------------------------------------------------------------
+
+// NOTE: Checking a password is expensive by design so it's done by a
+// fixed number of worker threads. The pool has a fixed number of jobs and
+// a limit of jobs in flight per IP address, so a burst of login attempts
+// only makes logins wait (or get rejected) instead of eating into the
+// game frame or starving logins from everyone else.
+//	Submitting and reading results must be done from a single thread
+// (the one polling the servers). Each user passes itself as the owner and
+// only gets its own results back.
+
+enum PasswordSubmitStatus : u32 {
+	PASSWORD_SUBMIT_OK = 0,
+	PASSWORD_SUBMIT_BUSY,
+	PASSWORD_SUBMIT_IP_LIMIT,
+};
+
+struct PasswordRequest{
+	void *owner;
+	u32 ip;
+
+	// NOTE: Not used by the pool, same as in StorageRequest.
+	u32 connection_index;
+	u32 connection_counter;
+
+	char password[PASSWORD_MAX];
+};
+
+struct PasswordResult{
+	u32 connection_index;
+	u32 connection_counter;
+	bool verified;
+};
+
+struct PasswordPool;
+PasswordPool *password_pool_init(MemArena *arena, Config *cfg);
+PasswordSubmitStatus password_pool_submit(PasswordPool *pool,
+		PasswordRequest *request, PasswordHash *hash);
+bool password_pool_next_result(PasswordPool *pool, void *owner, PasswordResult *out_result);
+i32 password_pool_num_jobs(PasswordPool *pool, void *owner);
+
+#if BUILD_TEST
+bool password_test(void);
+#endif
+
+#endif //KAPLAR_PASSWORD_HH_
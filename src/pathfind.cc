@@ -0,0 +1,817 @@
+#include "pathfind.hh"
+
+#include "metrics.hh"
+#include "profile.hh"
+
+// NOTE: Tiles without a ground speed (which shouldn't happen on a walkable
+// tile but the world and the base items come from different files) cost
+// the same as regular grass.
+#define PATH_DEFAULT_STEP_COST 150
+#define PATH_CACHE_SIZE 256
+#define PATH_NODE_CLOSED -1
+#define PATH_TILE_BLOCKED (TILE_FLAGS_NOT_WALKABLE | TILE_FLAG_BLOCK_PATH)
+
+struct PathNode{
+	u16 x;
+	u16 y;
+	i32 g;
+	i32 f;
+	i32 parent;
+	i32 heap_index;
+	u8 direction;
+};
+
+struct PathResultEntry{
+	PathRequest request;
+	PathResult result;
+};
+
+// NOTE: Entries are keyed by the whole request minus the requester and
+// are only valid for `cache_frames` frames after they were written.
+struct PathCacheEntry{
+	bool valid;
+	u8 flags;
+	WorldPosition start;
+	WorldPosition goal;
+	u32 frame;
+	PathResult result;
+};
+
+struct Pathfinder{
+	World *world;
+	i32 min_step_cost;
+	i64 budget;
+	u32 cache_frames;
+	u32 frame;
+
+	// NOTE: Search state. A node exists for the current search only if its
+	// slot in `node_table` has the current `stamp`, so starting a search
+	// doesn't need to clear the table.
+	i32 max_nodes;
+	i32 num_nodes;
+	PathNode *nodes;
+	u32 stamp;
+	u32 node_table_mask;
+	i32 *node_table;
+	u32 *node_table_stamps;
+	i32 heap_size;
+	i32 *heap;
+
+	// NOTE: Request and result rings. The counters only grow and are
+	// masked when indexing.
+	u32 queue_mask;
+	u32 request_read;
+	u32 request_write;
+	PathRequest *requests;
+	u32 result_read;
+	u32 result_write;
+	PathResultEntry *results;
+
+	PathCacheEntry *cache;
+};
+
+// ----------------------------------------------------------------
+// Search
+// ----------------------------------------------------------------
+
+static const i32 path_direction_dx[4] = { 0, 1, 0, -1 };
+static const i32 path_direction_dy[4] = { -1, 0, 1, 0 };
+
+static INLINE
+i32 path_abs(i32 x){
+	return x < 0 ? -x : x;
+}
+
+static INLINE
+bool path_goal_reached(i32 x, i32 y, WorldPosition goal, bool adjacent){
+	i32 dx = path_abs(x - (i32)goal.x);
+	i32 dy = path_abs(y - (i32)goal.y);
+	if(adjacent)
+		return dx <= 1 && dy <= 1;
+	return dx == 0 && dy == 0;
+}
+
+// NOTE: The number of steps left times the cheapest step, which never
+// overestimates. In adjacent mode any tile around the goal will do so one
+// step is taken off each axis.
+static INLINE
+i32 path_heuristic(Pathfinder *pf, i32 x, i32 y, WorldPosition goal, bool adjacent){
+	i32 dx = path_abs(x - (i32)goal.x);
+	i32 dy = path_abs(y - (i32)goal.y);
+	if(adjacent){
+		dx = dx > 0 ? dx - 1 : 0;
+		dy = dy > 0 ? dy - 1 : 0;
+	}
+	return (dx + dy) * pf->min_step_cost;
+}
+
+static INLINE
+i32 path_step_cost(Pathfinder *pf, u16 x, u16 y, u8 z){
+	const BaseItemTable *items = pf->world->base_items;
+	Tile *tile = world_get_tile_fast(pf->world, x, y, z);
+	u16 id = tile->items[0].id;
+	i32 cost = (id < items->num_items) ? (i32)items->ground_speed[id] : 0;
+	return cost > 0 ? cost : PATH_DEFAULT_STEP_COST;
+}
+
+static INLINE
+bool path_node_less(PathNode *a, PathNode *b){
+	// NOTE: On ties prefer the node that is further along since it's
+	// usually closer to the goal.
+	return a->f < b->f || (a->f == b->f && a->g > b->g);
+}
+
+static
+void path_heap_up(Pathfinder *pf, i32 pos){
+	i32 node_index = pf->heap[pos];
+	PathNode *node = &pf->nodes[node_index];
+	while(pos > 0){
+		i32 parent_pos = (pos - 1) / 2;
+		i32 parent_index = pf->heap[parent_pos];
+		if(!path_node_less(node, &pf->nodes[parent_index]))
+			break;
+		pf->heap[pos] = parent_index;
+		pf->nodes[parent_index].heap_index = pos;
+		pos = parent_pos;
+	}
+	pf->heap[pos] = node_index;
+	node->heap_index = pos;
+}
+
+static
+void path_heap_down(Pathfinder *pf, i32 pos){
+	i32 node_index = pf->heap[pos];
+	PathNode *node = &pf->nodes[node_index];
+	while(true){
+		i32 child_pos = pos * 2 + 1;
+		if(child_pos >= pf->heap_size)
+			break;
+		if((child_pos + 1) < pf->heap_size
+		&& path_node_less(&pf->nodes[pf->heap[child_pos + 1]], &pf->nodes[pf->heap[child_pos]]))
+			child_pos += 1;
+		i32 child_index = pf->heap[child_pos];
+		if(!path_node_less(&pf->nodes[child_index], node))
+			break;
+		pf->heap[pos] = child_index;
+		pf->nodes[child_index].heap_index = pos;
+		pos = child_pos;
+	}
+	pf->heap[pos] = node_index;
+	node->heap_index = pos;
+}
+
+static
+void path_heap_push(Pathfinder *pf, i32 node_index){
+	i32 pos = pf->heap_size;
+	pf->heap_size += 1;
+	pf->heap[pos] = node_index;
+	path_heap_up(pf, pos);
+}
+
+static
+i32 path_heap_pop(Pathfinder *pf){
+	ASSERT(pf->heap_size > 0);
+	i32 result = pf->heap[0];
+	pf->heap_size -= 1;
+	if(pf->heap_size > 0){
+		pf->heap[0] = pf->heap[pf->heap_size];
+		path_heap_down(pf, 0);
+	}
+	pf->nodes[result].heap_index = PATH_NODE_CLOSED;
+	return result;
+}
+
+// NOTE: Returns the slot for (x, y) in the node table, which is either the
+// slot of its node or the empty slot where it should be inserted.
+static
+u32 path_node_slot(Pathfinder *pf, u16 x, u16 y){
+	u32 hash = ((u32)y << 16 | (u32)x) * 0x9E3779B1;
+	u32 slot = (hash ^ (hash >> 16)) & pf->node_table_mask;
+	while(pf->node_table_stamps[slot] == pf->stamp){
+		PathNode *node = &pf->nodes[pf->node_table[slot]];
+		if(node->x == x && node->y == y)
+			break;
+		slot = (slot + 1) & pf->node_table_mask;
+	}
+	return slot;
+}
+
+static
+void path_search_reset(Pathfinder *pf){
+	pf->num_nodes = 0;
+	pf->heap_size = 0;
+	pf->stamp += 1;
+	if(pf->stamp == 0){
+		memset(pf->node_table_stamps, 0, sizeof(u32) * (pf->node_table_mask + 1));
+		pf->stamp = 1;
+	}
+}
+
+static
+i32 path_node_insert(Pathfinder *pf, u32 slot, u16 x, u16 y){
+	ASSERT(pf->num_nodes < pf->max_nodes);
+	i32 node_index = pf->num_nodes;
+	pf->num_nodes += 1;
+	pf->node_table[slot] = node_index;
+	pf->node_table_stamps[slot] = pf->stamp;
+
+	PathNode *node = &pf->nodes[node_index];
+	node->x = x;
+	node->y = y;
+	node->parent = -1;
+	node->heap_index = PATH_NODE_CLOSED;
+	node->direction = 0;
+	return node_index;
+}
+
+// NOTE: Walks the parents back to the start. Paths longer than
+// PATH_MAX_STEPS are reported as not found since they can't be returned.
+static
+void path_build_result(Pathfinder *pf, i32 end_index, PathResult *result){
+	i32 num_steps = 0;
+	for(i32 i = end_index; pf->nodes[i].parent != -1; i = pf->nodes[i].parent)
+		num_steps += 1;
+	if(num_steps > PATH_MAX_STEPS)
+		return;
+
+	i32 step = num_steps;
+	for(i32 i = end_index; pf->nodes[i].parent != -1; i = pf->nodes[i].parent){
+		step -= 1;
+		result->steps[step] = pf->nodes[i].direction;
+	}
+	result->status = PATH_FOUND;
+	result->num_steps = num_steps;
+	result->cost = pf->nodes[end_index].g;
+}
+
+void pathfinder_search(Pathfinder *pf, PathRequest request, PathResult *result){
+	result->status = PATH_NOT_FOUND;
+	result->num_steps = 0;
+	result->cost = 0;
+
+	World *world = pf->world;
+	WorldPosition start = request.start;
+	WorldPosition goal = request.goal;
+	bool adjacent = (request.flags & PATH_FLAG_ADJACENT) != 0;
+	if(start.z != goal.z)
+		return;
+	if(path_goal_reached(start.x, start.y, goal, adjacent)){
+		result->status = PATH_FOUND;
+		return;
+	}
+	if(!adjacent && (world_get_tile_flags(world, goal.x, goal.y, goal.z) & PATH_TILE_BLOCKED))
+		return;
+
+	metrics_add(METRIC_PATHFIND_SEARCHES, 1);
+	path_search_reset(pf);
+	i32 start_index = path_node_insert(pf,
+		path_node_slot(pf, start.x, start.y), start.x, start.y);
+	pf->nodes[start_index].g = 0;
+	pf->nodes[start_index].f = path_heuristic(pf, start.x, start.y, goal, adjacent);
+	path_heap_push(pf, start_index);
+
+	u8 z = start.z;
+	i32 num_expanded = 0;
+	while(pf->heap_size > 0){
+		i32 node_index = path_heap_pop(pf);
+		i32 x = pf->nodes[node_index].x;
+		i32 y = pf->nodes[node_index].y;
+		i32 g = pf->nodes[node_index].g;
+		num_expanded += 1;
+		if(path_goal_reached(x, y, goal, adjacent)){
+			path_build_result(pf, node_index, result);
+			break;
+		}
+
+		bool out_of_nodes = false;
+		for(i32 dir = 0; dir < 4; dir += 1){
+			i32 next_x = x + path_direction_dx[dir];
+			i32 next_y = y + path_direction_dy[dir];
+			if(next_x < 0 || next_x > 0xFFFF || next_y < 0 || next_y > 0xFFFF)
+				continue;
+			if(world_get_tile_flags(world, (u16)next_x, (u16)next_y, z) & PATH_TILE_BLOCKED)
+				continue;
+
+			i32 next_g = g + path_step_cost(pf, (u16)next_x, (u16)next_y, z);
+			u32 slot = path_node_slot(pf, (u16)next_x, (u16)next_y);
+			i32 next_index;
+			if(pf->node_table_stamps[slot] == pf->stamp){
+				// NOTE: The heuristic is consistent so closed nodes already
+				// have their best cost.
+				next_index = pf->node_table[slot];
+				PathNode *next = &pf->nodes[next_index];
+				if(next->heap_index == PATH_NODE_CLOSED || next_g >= next->g)
+					continue;
+				next->f -= next->g - next_g;
+				next->g = next_g;
+				next->parent = node_index;
+				next->direction = (u8)dir;
+				path_heap_up(pf, next->heap_index);
+			}else{
+				if(pf->num_nodes >= pf->max_nodes){
+					out_of_nodes = true;
+					break;
+				}
+				next_index = path_node_insert(pf, slot, (u16)next_x, (u16)next_y);
+				PathNode *next = &pf->nodes[next_index];
+				next->g = next_g;
+				next->f = next_g + path_heuristic(pf, next_x, next_y, goal, adjacent);
+				next->parent = node_index;
+				next->direction = (u8)dir;
+				path_heap_push(pf, next_index);
+			}
+		}
+
+		// NOTE: Giving up is what bounds the cost of a search, mostly when
+		// the goal is unreachable and we'd otherwise flood the whole floor.
+		if(out_of_nodes)
+			break;
+	}
+	metrics_add(METRIC_PATHFIND_NODES, num_expanded);
+}
+
+// ----------------------------------------------------------------
+// Queue
+// ----------------------------------------------------------------
+
+static
+u32 path_cache_index(PathRequest *request){
+	// FNV-1a
+	u16 key[7] = {
+		request->start.x, request->start.y, (u16)request->start.z,
+		request->goal.x, request->goal.y, (u16)request->goal.z,
+		(u16)request->flags };
+	u32 hash = 0x811C9DC5;
+	for(i32 i = 0; i < (i32)NARRAY(key); i += 1){
+		hash ^= key[i];
+		hash *= 0x01000193;
+	}
+	return hash & (PATH_CACHE_SIZE - 1);
+}
+
+static
+void pathfinder_search_cached(Pathfinder *pf, PathRequest request, PathResult *result){
+	PathCacheEntry *entry = &pf->cache[path_cache_index(&request)];
+	if(entry->valid && (pf->frame - entry->frame) <= pf->cache_frames
+	&& entry->flags == request.flags
+	&& world_position_equals(entry->start, request.start)
+	&& world_position_equals(entry->goal, request.goal)){
+		metrics_add(METRIC_PATHFIND_CACHE_HITS, 1);
+		memcpy(result, &entry->result, sizeof(PathResult));
+		return;
+	}
+
+	pathfinder_search(pf, request, result);
+	if(pf->cache_frames > 0){
+		entry->valid = true;
+		entry->flags = request.flags;
+		entry->start = request.start;
+		entry->goal = request.goal;
+		entry->frame = pf->frame;
+		memcpy(&entry->result, result, sizeof(PathResult));
+	}
+}
+
+Pathfinder *pathfinder_init(MemArena *arena, World *world, Config *cfg){
+	ASSERT(world->base_items);
+	if(cfg->game_pathfind_max_nodes <= 0 || cfg->game_pathfind_max_requests <= 0)
+		PANIC("invalid pathfinder limits");
+
+	Pathfinder *pf = arena_alloc<Pathfinder>(arena, 1);
+	memset(pf, 0, sizeof(Pathfinder));
+	pf->world = world;
+	pf->budget = cfg->game_pathfind_budget * 1000;
+	pf->cache_frames = (u32)cfg->game_pathfind_cache_frames;
+
+	// NOTE: The heuristic must use the cheapest step for paths to be
+	// optimal, so look for the lowest ground speed.
+	const BaseItemTable *items = world->base_items;
+	pf->min_step_cost = PATH_DEFAULT_STEP_COST;
+	for(u32 id = 0; id < items->num_items; id += 1){
+		i32 cost = (i32)items->ground_speed[id];
+		if(cost > 0 && cost < pf->min_step_cost)
+			pf->min_step_cost = cost;
+	}
+
+	// NOTE: Keep the load factor of the node table at or below 50%.
+	u32 table_size = 16;
+	while(table_size < (u32)cfg->game_pathfind_max_nodes * 2)
+		table_size *= 2;
+	pf->max_nodes = cfg->game_pathfind_max_nodes;
+	pf->nodes = arena_alloc<PathNode>(arena, pf->max_nodes);
+	pf->heap = arena_alloc<i32>(arena, pf->max_nodes);
+	pf->node_table_mask = table_size - 1;
+	pf->node_table = arena_alloc<i32>(arena, table_size);
+	pf->node_table_stamps = arena_alloc_init<u32>(arena, table_size, 0);
+
+	u32 queue_size = 1;
+	while(queue_size < (u32)cfg->game_pathfind_max_requests)
+		queue_size *= 2;
+	pf->queue_mask = queue_size - 1;
+	pf->requests = arena_alloc<PathRequest>(arena, queue_size);
+	pf->results = arena_alloc<PathResultEntry>(arena, queue_size);
+	pf->cache = arena_alloc<PathCacheEntry>(arena, PATH_CACHE_SIZE);
+	memset(pf->cache, 0, sizeof(PathCacheEntry) * PATH_CACHE_SIZE);
+	return pf;
+}
+
+// NOTE: Returns false if the queue is full, in which case the caller should
+// try again later (or give up).
+bool pathfinder_request(Pathfinder *pf, PathRequest request){
+	if((pf->request_write - pf->request_read) > pf->queue_mask)
+		return false;
+	pf->requests[pf->request_write & pf->queue_mask] = request;
+	pf->request_write += 1;
+	metrics_add(METRIC_PATHFIND_REQUESTS, 1);
+	metrics_add(METRIC_PATHFIND_PENDING, 1);
+	return true;
+}
+
+// NOTE: Called once per frame. At least one request is serviced every frame
+// so a budget that is too small still makes progress. Searches aren't split
+// across frames so a frame can go over the budget by up to one search,
+// which is bounded by the size of the node pool.
+void pathfinder_update(Pathfinder *pf){
+	PROFILE_ZONE("pathfinder_update");
+	pf->frame += 1;
+	i64 start = sys_clock_monotonic_nsec();
+	i64 now = start;
+	i32 num_serviced = 0;
+	while(pf->request_read != pf->request_write){
+		if(num_serviced > 0 && (now - start) >= pf->budget)
+			break;
+		if((pf->result_write - pf->result_read) > pf->queue_mask)
+			break;
+
+		PathRequest request = pf->requests[pf->request_read & pf->queue_mask];
+		PathResultEntry *entry = &pf->results[pf->result_write & pf->queue_mask];
+		entry->request = request;
+		pathfinder_search_cached(pf, request, &entry->result);
+		pf->request_read += 1;
+		pf->result_write += 1;
+		num_serviced += 1;
+		now = sys_clock_monotonic_nsec();
+	}
+	metrics_add(METRIC_PATHFIND_PENDING, -num_serviced);
+	metrics_add(METRIC_PATHFIND_NSEC, now - start);
+}
+
+bool pathfinder_pop_result(Pathfinder *pf, PathRequest *request, PathResult *result){
+	if(pf->result_read == pf->result_write)
+		return false;
+	PathResultEntry *entry = &pf->results[pf->result_read & pf->queue_mask];
+	*request = entry->request;
+	memcpy(result, &entry->result, sizeof(PathResult));
+	pf->result_read += 1;
+	return true;
+}
+
+// ----------------------------------------------------------------
+// Test
+// ----------------------------------------------------------------
+
+#if BUILD_TEST
+#include "base_data.hh"
+
+// NOTE: Ground items with different speeds (1, 2, 3), a wall (4) and a
+// field that only blocks paths (5).
+static const u32 pathfind_test_flags[6] = {
+	0, 0, 0, 0, ITEM_FLAG_BLOCK_SOLID, ITEM_FLAG_BLOCK_PATH };
+static const u16 pathfind_test_ground_speed[6] = {
+	0, 100, 150, 250, 0, 0 };
+
+static
+void pathfind_test_world(MemArena *arena, World *world, BaseItemTable *items,
+		u16 x0, u16 y0, i32 dim, i32 wall_percent){
+	memset(items, 0, sizeof(BaseItemTable));
+	items->num_items = NARRAY(pathfind_test_flags);
+	items->flags = pathfind_test_flags;
+	items->ground_speed = pathfind_test_ground_speed;
+	world_init_flat(arena, world, 1);
+	world_set_base_items(world, items);
+
+	// NOTE: Random grounds and obstacles inside the area and a wall around
+	// it so searches can't leave it.
+	for(i32 y = -1; y <= dim; y += 1)
+	for(i32 x = -1; x <= dim; x += 1){
+		u16 tile_x = (u16)(x0 + x);
+		u16 tile_y = (u16)(y0 + y);
+		if(x < 0 || y < 0 || x >= dim || y >= dim){
+			Item wall = { 4 };
+			world_add_item(world, tile_x, tile_y, 7, wall);
+			continue;
+		}
+
+		Tile *tile = world_modify_tile(world, tile_x, tile_y, 7);
+		tile->items[0].id = (u16)(1 + rand() % 3);
+		world_update_tile_flags(world, tile);
+		if((rand() % 100) < wall_percent){
+			Item obstacle = { (u16)(4 + rand() % 2) };
+			world_add_item(world, tile_x, tile_y, 7, obstacle);
+		}
+	}
+}
+
+// NOTE: Plain Dijkstra over the test area without a heap. Returns the cost
+// to every tile in `dist` (-1 if unreachable).
+static
+void pathfind_test_dijkstra(World *world, u16 x0, u16 y0, i32 dim,
+		i32 start_x, i32 start_y, i32 *dist, bool *done){
+	i32 num_tiles = dim * dim;
+	for(i32 i = 0; i < num_tiles; i += 1){
+		dist[i] = -1;
+		done[i] = false;
+	}
+	dist[start_y * dim + start_x] = 0;
+	while(true){
+		i32 best = -1;
+		for(i32 i = 0; i < num_tiles; i += 1){
+			if(!done[i] && dist[i] >= 0 && (best == -1 || dist[i] < dist[best]))
+				best = i;
+		}
+		if(best == -1)
+			break;
+		done[best] = true;
+
+		i32 x = best % dim;
+		i32 y = best / dim;
+		for(i32 dir = 0; dir < 4; dir += 1){
+			i32 next_x = x + path_direction_dx[dir];
+			i32 next_y = y + path_direction_dy[dir];
+			if(next_x < 0 || next_y < 0 || next_x >= dim || next_y >= dim)
+				continue;
+			u16 tile_x = (u16)(x0 + next_x);
+			u16 tile_y = (u16)(y0 + next_y);
+			Tile *tile = world_get_tile(world, tile_x, tile_y, 7);
+			bool blocked = tile->num_items > 1;
+			if(blocked)
+				continue;
+			i32 next_dist = dist[best] + pathfind_test_ground_speed[tile->items[0].id];
+			i32 next = next_y * dim + next_x;
+			if(dist[next] == -1 || next_dist < dist[next])
+				dist[next] = next_dist;
+		}
+	}
+}
+
+// NOTE: Walks the path checking every step and its total cost.
+static
+bool pathfind_test_walk(World *world, PathRequest request, PathResult *result){
+	i32 x = request.start.x;
+	i32 y = request.start.y;
+	i32 cost = 0;
+	for(i32 i = 0; i < result->num_steps; i += 1){
+		u8 dir = result->steps[i];
+		if(dir > DIRECTION_WEST)
+			return false;
+		x += path_direction_dx[dir];
+		y += path_direction_dy[dir];
+		if(!world_tile_walkable(world, (u16)x, (u16)y, 7)
+		|| (world_get_tile_flags(world, (u16)x, (u16)y, 7) & TILE_FLAG_BLOCK_PATH))
+			return false;
+		cost += pathfind_test_ground_speed[world_get_tile(world, (u16)x, (u16)y, 7)->items[0].id];
+	}
+	bool adjacent = (request.flags & PATH_FLAG_ADJACENT) != 0;
+	return cost == result->cost && path_goal_reached(x, y, request.goal, adjacent);
+}
+
+bool pathfind_test(void){
+	bool passed = true;
+	MemArena *arena = arena_init(256 * 1024 * 1024, 4 * 1024 * 1024);
+	World world;
+	BaseItemTable items;
+	u16 x0 = 40;
+	u16 y0 = 40;
+	i32 dim = 24;
+	srand(4321);
+	pathfind_test_world(arena, &world, &items, x0, y0, dim, 25);
+
+	Config cfg = {};
+	cfg.game_pathfind_budget = 0;
+	cfg.game_pathfind_max_nodes = 4096;
+	cfg.game_pathfind_max_requests = 16;
+	cfg.game_pathfind_cache_frames = 4;
+	Pathfinder *pf = pathfinder_init(arena, &world, &cfg);
+	passed = passed && pf->min_step_cost == 100;
+
+	// NOTE: Compare costs against Dijkstra, in both modes.
+	i32 *dist = arena_alloc<i32>(arena, dim * dim);
+	bool *done = arena_alloc<bool>(arena, dim * dim);
+	i32 num_found = 0;
+	i32 num_not_found = 0;
+	for(i32 i = 0; i < 400 && passed; i += 1){
+		i32 start_x = rand() % dim;
+		i32 start_y = rand() % dim;
+		i32 goal_x = rand() % dim;
+		i32 goal_y = rand() % dim;
+		if(world_get_tile(&world, (u16)(x0 + start_x), (u16)(y0 + start_y), 7)->num_items > 1)
+			continue;
+		pathfind_test_dijkstra(&world, x0, y0, dim, start_x, start_y, dist, done);
+
+		PathRequest request = {};
+		request.start = { (u16)(x0 + start_x), (u16)(y0 + start_y), 7 };
+		request.goal = { (u16)(x0 + goal_x), (u16)(y0 + goal_y), 7 };
+		request.flags = (i & 1) ? PATH_FLAG_ADJACENT : 0;
+
+		i32 expected = dist[goal_y * dim + goal_x];
+		if(request.flags & PATH_FLAG_ADJACENT){
+			expected = -1;
+			for(i32 y = goal_y - 1; y <= goal_y + 1; y += 1)
+			for(i32 x = goal_x - 1; x <= goal_x + 1; x += 1){
+				if(x < 0 || y < 0 || x >= dim || y >= dim)
+					continue;
+				i32 d = dist[y * dim + x];
+				if(d >= 0 && (expected == -1 || d < expected))
+					expected = d;
+			}
+		}
+
+		PathResult result;
+		pathfinder_search(pf, request, &result);
+		if(expected == -1){
+			passed = passed && result.status == PATH_NOT_FOUND;
+			num_not_found += 1;
+		}else{
+			passed = passed && result.status == PATH_FOUND
+				&& result.cost == expected
+				&& pathfind_test_walk(&world, request, &result);
+			num_found += 1;
+		}
+	}
+	passed = passed && num_found > 50 && num_not_found > 10;
+
+	// NOTE: Edge cases.
+	PathResult result;
+	PathRequest request = {};
+	request.start = { 10, 10, 7 };
+	request.goal = { 10, 10, 7 };
+	pathfinder_search(pf, request, &result);
+	passed = passed && result.status == PATH_FOUND && result.num_steps == 0;
+	request.goal = { 12, 10, 6 };
+	pathfinder_search(pf, request, &result);
+	passed = passed && result.status == PATH_NOT_FOUND;
+	request.goal = { (u16)(x0 - 1), y0, 7 };
+	pathfinder_search(pf, request, &result);
+	passed = passed && result.status == PATH_NOT_FOUND;
+	request.flags = PATH_FLAG_ADJACENT;
+	pathfinder_search(pf, request, &result);
+	passed = passed && result.status == PATH_FOUND
+		&& result.num_steps == (x0 - 2 - 10) + (y0 - 1 - 10)
+		&& pathfind_test_walk(&world, request, &result);
+
+	// NOTE: Too long to return, and too far for the node pool.
+	request.flags = 0;
+	request.goal = { 10, 10 + PATH_MAX_STEPS + 1, 7 };
+	pathfinder_search(pf, request, &result);
+	passed = passed && result.status == PATH_NOT_FOUND;
+	request.goal = { 10, 10 + PATH_MAX_STEPS, 7 };
+	pathfinder_search(pf, request, &result);
+	passed = passed && result.status == PATH_FOUND && result.num_steps == PATH_MAX_STEPS;
+	Config small_cfg = cfg;
+	small_cfg.game_pathfind_max_nodes = 64;
+	Pathfinder *small_pf = pathfinder_init(arena, &world, &small_cfg);
+	request.goal = { 10, 100, 7 };
+	pathfinder_search(small_pf, request, &result);
+	passed = passed && result.status == PATH_NOT_FOUND;
+
+	// NOTE: With no budget, one request is serviced per frame. The repeated
+	// request is answered from the cache until it expires.
+	PathRequest requests[4] = {};
+	for(i32 i = 0; i < (i32)NARRAY(requests); i += 1){
+		requests[i].requester = (u32)i;
+		requests[i].start = { 10, 10, 7 };
+		requests[i].goal = { (u16)(20 + (i % 3)), 20, 7 };
+		passed = passed && pathfinder_request(pf, requests[i]);
+	}
+	i64 cache_hits = metrics_read(METRIC_PATHFIND_CACHE_HITS);
+	for(i32 i = 0; i < (i32)NARRAY(requests); i += 1){
+		PathRequest popped;
+		passed = passed && !pathfinder_pop_result(pf, &popped, &result);
+		pathfinder_update(pf);
+		passed = passed && pathfinder_pop_result(pf, &popped, &result)
+			&& popped.requester == (u32)i
+			&& result.status == PATH_FOUND
+			&& result.cost == (10 + (i % 3) + 10) * 100;
+	}
+	passed = passed && metrics_read(METRIC_PATHFIND_CACHE_HITS) == (cache_hits + 1);
+	for(i32 i = 0; i < 4; i += 1)
+		pathfinder_update(pf);
+	pathfinder_request(pf, requests[0]);
+	pathfinder_update(pf);
+	passed = passed && pathfinder_pop_result(pf, &request, &result)
+		&& metrics_read(METRIC_PATHFIND_CACHE_HITS) == (cache_hits + 1);
+
+	// NOTE: The queue refuses requests once it's full and results wait
+	// for the caller.
+	i32 num_accepted = 0;
+	for(i32 i = 0; i < 32; i += 1){
+		if(pathfinder_request(pf, requests[1]))
+			num_accepted += 1;
+	}
+	passed = passed && num_accepted == 16;
+	cfg.game_pathfind_budget = 1000000;
+	pf->budget = cfg.game_pathfind_budget * 1000;
+	pathfinder_update(pf);
+	i32 num_results = 0;
+	while(pathfinder_pop_result(pf, &request, &result))
+		num_results += 1;
+	passed = passed && num_results == 16;
+
+	debug_printf("pathfind test: %s\n", (passed ? "passed" : "failed"));
+	return passed;
+}
+
+// NOTE: Searches between random nearby positions on the main floor of a
+// converted world, or on a synthetic 256x256 world with 30% obstacles when
+// no world file is given.
+void pathfind_bench(const char *world_file){
+	MemArena *arena = arena_init(1024 * 1024 * 1024, 16 * 1024 * 1024);
+	World world;
+	BaseItemTable items;
+	srand(1234);
+	if(world_file){
+		world_load(arena, &world, world_file);
+		world_set_base_items(&world, &base_data.items);
+	}else{
+		pathfind_test_world(arena, &world, &items, 1, 1, 254, 30);
+	}
+
+	Config cfg = {};
+	cfg.game_pathfind_budget = 2000;
+	cfg.game_pathfind_max_nodes = 8192;
+	cfg.game_pathfind_max_requests = 4096;
+	cfg.game_pathfind_cache_frames = 0;
+	Pathfinder *pf = pathfinder_init(arena, &world, &cfg);
+
+	// NOTE: Random walkable starts with goals up to 40 tiles away.
+	i32 dim_x = (i32)world.world_dim_in_chunks_x * WORLD_CHUNK_DIM_X;
+	i32 dim_y = (i32)world.world_dim_in_chunks_y * WORLD_CHUNK_DIM_Y;
+	i32 num_requests = 4096;
+	PathRequest *requests = arena_alloc<PathRequest>(arena, num_requests);
+	i32 num_generated = 0;
+	for(i32 tries = 0; tries < 10000000 && num_generated < num_requests; tries += 1){
+		u16 x = (u16)(rand() % dim_x);
+		u16 y = (u16)(rand() % dim_y);
+		i32 goal_x = (i32)x + rand() % 81 - 40;
+		i32 goal_y = (i32)y + rand() % 81 - 40;
+		if(goal_x < 0 || goal_y < 0 || goal_x >= dim_x || goal_y >= dim_y
+		|| !world_tile_walkable(&world, x, y, 7)
+		|| !world_tile_walkable(&world, (u16)goal_x, (u16)goal_y, 7))
+			continue;
+		PathRequest *request = &requests[num_generated];
+		request->requester = (u32)num_generated;
+		request->start = { x, y, 7 };
+		request->goal = { (u16)goal_x, (u16)goal_y, 7 };
+		request->flags = (num_generated & 1) ? PATH_FLAG_ADJACENT : 0;
+		num_generated += 1;
+	}
+	if(num_generated == 0){
+		debug_printf("pathfind bench: no walkable tiles on floor 7\n");
+		return;
+	}
+
+	i64 nodes_before = metrics_read(METRIC_PATHFIND_NODES);
+	i32 num_found = 0;
+	i64 total_steps = 0;
+	i64 max_time = 0;
+	i64 t0 = sys_clock_monotonic_nsec();
+	for(i32 i = 0; i < num_generated; i += 1){
+		i64 s0 = sys_clock_monotonic_nsec();
+		PathResult result;
+		pathfinder_search(pf, requests[i], &result);
+		i64 s1 = sys_clock_monotonic_nsec();
+		if(result.status == PATH_FOUND){
+			num_found += 1;
+			total_steps += result.num_steps;
+		}
+		if((s1 - s0) > max_time)
+			max_time = s1 - s0;
+	}
+	i64 t1 = sys_clock_monotonic_nsec();
+	i64 num_nodes = metrics_read(METRIC_PATHFIND_NODES) - nodes_before;
+
+	// NOTE: Same requests through the queue to see how many fit in a frame.
+	for(i32 i = 0; i < num_generated; i += 1)
+		pathfinder_request(pf, requests[i]);
+	i32 num_frames = 0;
+	while(pf->request_read != pf->request_write){
+		pathfinder_update(pf);
+		PathRequest request;
+		PathResult result;
+		while(pathfinder_pop_result(pf, &request, &result)){}
+		num_frames += 1;
+	}
+
+	debug_printf("pathfind bench (%s, %d searches):\n",
+		(world_file ? world_file : "synthetic"), num_generated);
+	debug_printf("    found:            %.1f%% (avg %.1f steps)\n",
+		100.0 * (double)num_found / (double)num_generated,
+		(double)total_steps / (double)(num_found > 0 ? num_found : 1));
+	debug_printf("    avg search:       %.2f us (%.0f nodes)\n",
+		(double)(t1 - t0) / (1000.0 * (double)num_generated),
+		(double)num_nodes / (double)num_generated);
+	debug_printf("    max search:       %.2f us\n", (double)max_time / 1000.0);
+	debug_printf("    searches / frame: %.1f (%lld us budget)\n",
+		(double)num_generated / (double)num_frames, (long long)cfg.game_pathfind_budget);
+}
+#endif //BUILD_TEST
@@ -0,0 +1,68 @@
+#ifndef KAPLAR_PATHFIND_HH_
+#define KAPLAR_PATHFIND_HH_ 1
+
+#include "common.hh"
+#include "world.hh"
+
+// ----------------------------------------------------------------
+// Pathfinding
+// ----------------------------------------------------------------
+
+// NOTE: A* over the tile grid of a single floor, moving in the four main
+// directions. The cost of stepping on a tile is its ground speed and tiles
+// are blocked by their cached flags (see Tile Flags in world.hh), so a
+// search mostly touches the flags array and the ground of each tile it
+// expands. Creatures aren't taken into account since they'll have moved by
+// the time the path is walked.
+//	Every search reuses the same node pool, node table and binary heap,
+// which are allocated once. A search gives up once it runs out of nodes,
+// which also bounds how long a single search can take.
+//	Requests are queued (pathfinder_request) and serviced once per frame
+// (pathfinder_update) until the frame's budget runs out, with anything
+// left over carried to the next frame. Results are cached per request for
+// a few frames so creatures asking for the same path don't search again.
+
+#define PATH_MAX_STEPS 128
+
+enum PathStatus : u8 {
+	PATH_FOUND = 0,
+	PATH_NOT_FOUND,
+};
+
+// NOTE: With PATH_FLAG_ADJACENT the path ends next to the goal (including
+// diagonals) instead of on it, and the goal itself doesn't need to be
+// walkable. It's used to walk up to things to use them.
+enum PathFlags : u8 {
+	PATH_FLAG_ADJACENT = (1 << 0),
+};
+
+struct PathRequest{
+	// NOTE: `requester` is only passed back with the result so the caller
+	// can find who asked for it (e.g. a client id).
+	u32 requester;
+	WorldPosition start;
+	WorldPosition goal;
+	u8 flags;
+};
+
+// NOTE: `steps` are Direction values from start to goal.
+struct PathResult{
+	PathStatus status;
+	i32 num_steps;
+	i32 cost;
+	u8 steps[PATH_MAX_STEPS];
+};
+
+struct Pathfinder;
+Pathfinder *pathfinder_init(MemArena *arena, World *world, Config *cfg);
+bool pathfinder_request(Pathfinder *pf, PathRequest request);
+void pathfinder_update(Pathfinder *pf);
+bool pathfinder_pop_result(Pathfinder *pf, PathRequest *request, PathResult *result);
+void pathfinder_search(Pathfinder *pf, PathRequest request, PathResult *result);
+
+#if BUILD_TEST
+bool pathfind_test(void);
+void pathfind_bench(const char *world_file);
+#endif
+
+#endif //KAPLAR_PATHFIND_HH_
@@ -0,0 +1,544 @@
+#include "profile.hh"
+
+#include <atomic>
+#include <signal.h>
+#include <stdio.h>
+
+#if defined(_MSC_VER)
+#	include <intrin.h>
+#else
+#	include <x86intrin.h>
+#endif
+
+// ----------------------------------------------------------------
+// Histogram
+// ----------------------------------------------------------------
+
+static INLINE
+i32 u64_msb_index(u64 x){
+	ASSERT(x != 0);
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanReverse64(&index, x);
+	return (i32)index;
+#else
+	return 63 - __builtin_clzll(x);
+#endif
+}
+
+static INLINE
+i32 histogram_bucket(u64 value){
+	if(value < PROFILE_HISTOGRAM_SUB_COUNT)
+		return (i32)value;
+	i32 shift = u64_msb_index(value) - PROFILE_HISTOGRAM_SUB_BITS;
+	i32 sub = (i32)((value >> shift) & (PROFILE_HISTOGRAM_SUB_COUNT - 1));
+	return (shift + 1) * PROFILE_HISTOGRAM_SUB_COUNT + sub;
+}
+
+// NOTE: Returns the highest value that falls into the bucket.
+static INLINE
+u64 histogram_bucket_value(i32 bucket){
+	if(bucket < PROFILE_HISTOGRAM_SUB_COUNT)
+		return (u64)bucket;
+	i32 shift = bucket / PROFILE_HISTOGRAM_SUB_COUNT - 1;
+	u64 sub = (u64)(bucket % PROFILE_HISTOGRAM_SUB_COUNT);
+	u64 lower = (PROFILE_HISTOGRAM_SUB_COUNT + sub) << shift;
+	return lower + (((u64)1 << shift) - 1);
+}
+
+void profile_histogram_add(ProfileHistogram *hist, i64 value){
+	u64 v = (value > 0) ? (u64)value : 0;
+	hist->buckets[histogram_bucket(v)] += 1;
+	hist->count += 1;
+	if(hist->max < v)
+		hist->max = v;
+}
+
+i64 profile_histogram_percentile(ProfileHistogram *hist, double percentile){
+	if(hist->count == 0)
+		return 0;
+
+	u64 target = (u64)((double)hist->count * percentile / 100.0);
+	if(target >= hist->count)
+		target = hist->count - 1;
+
+	u64 seen = 0;
+	for(i32 i = 0; i < PROFILE_HISTOGRAM_BUCKETS; i += 1){
+		seen += hist->buckets[i];
+		if(seen > target){
+			u64 value = histogram_bucket_value(i);
+			return (i64)((value < hist->max) ? value : hist->max);
+		}
+	}
+	return (i64)hist->max;
+}
+
+void profile_histogram_reset(ProfileHistogram *hist){
+	memset(hist, 0, sizeof(ProfileHistogram));
+}
+
+// ----------------------------------------------------------------
+// Zones
+// ----------------------------------------------------------------
+
+struct ProfileRing{
+	// NOTE: `write_pos` and `read_pos` only grow. The ring holds the
+	// events in [max(read_pos, write_pos - PROFILE_RING_SIZE), write_pos).
+	std::atomic<u64> write_pos;
+	std::atomic<u64> read_pos;
+	const char *name;
+	ProfileEvent events[PROFILE_RING_SIZE];
+};
+
+// NOTE: A slot is claimed by bumping `profile_rings_count` and the ring is
+// published right after, so readers may briefly see a NULL ring.
+static std::atomic<ProfileRing*> profile_rings[PROFILE_MAX_THREADS];
+static std::atomic<i32> profile_rings_count;
+static thread_local ProfileRing *profile_thread_ring;
+
+// NOTE: Cycle counter frequency, calibrated against the monotonic clock.
+static double profile_nsec_per_tick;
+static u64 profile_base_timestamp;
+
+static INLINE
+u64 profile_timestamp(void){
+	return __rdtsc();
+}
+
+void profile_init(void){
+	i64 nsec0 = sys_clock_monotonic_nsec();
+	u64 tick0 = profile_timestamp();
+	sys_sleep_msec(20);
+	i64 nsec1 = sys_clock_monotonic_nsec();
+	u64 tick1 = profile_timestamp();
+	profile_nsec_per_tick = (double)(nsec1 - nsec0) / (double)(tick1 - tick0);
+	profile_base_timestamp = tick0;
+	LOG("cycle counter frequency: %.2f MHz", 1000.0 / profile_nsec_per_tick);
+}
+
+i64 profile_ticks_to_nsec(u64 ticks){
+	return (i64)((double)ticks * profile_nsec_per_tick);
+}
+
+static
+ProfileRing *profile_get_thread_ring(void){
+	ProfileRing *ring = profile_thread_ring;
+	if(!ring){
+		i32 index = profile_rings_count.fetch_add(1);
+		if(index >= PROFILE_MAX_THREADS)
+			PANIC("too many profiled threads (max = %d)", PROFILE_MAX_THREADS);
+
+		// NOTE: Rings are never freed so consumers can keep reading from
+		// threads that already exited.
+		ring = (ProfileRing*)malloc_no_fail(sizeof(ProfileRing));
+		ring->write_pos.store(0, std::memory_order_relaxed);
+		ring->read_pos.store(0, std::memory_order_relaxed);
+		ring->name = "unnamed";
+		profile_rings[index].store(ring, std::memory_order_release);
+		profile_thread_ring = ring;
+	}
+	return ring;
+}
+
+static INLINE
+void profile_push_event(const char *name){
+	ProfileRing *ring = profile_get_thread_ring();
+	u64 pos = ring->write_pos.load(std::memory_order_relaxed);
+	ProfileEvent *event = &ring->events[pos & (PROFILE_RING_SIZE - 1)];
+	event->timestamp = profile_timestamp();
+	event->name = name;
+	ring->write_pos.store(pos + 1, std::memory_order_release);
+}
+
+void profile_thread_name(const char *name){
+	profile_get_thread_ring()->name = name;
+}
+
+void profile_zone_begin(const char *name){
+	ASSERT(name != NULL);
+	profile_push_event(name);
+}
+
+void profile_zone_end(void){
+	profile_push_event(NULL);
+}
+
+i32 profile_num_rings(void){
+	i32 result = profile_rings_count.load(std::memory_order_acquire);
+	return (result < PROFILE_MAX_THREADS) ? result : PROFILE_MAX_THREADS;
+}
+
+const char *profile_ring_name(i32 ring_index){
+	ASSERT(ring_index < profile_num_rings());
+	ProfileRing *ring = profile_rings[ring_index].load(std::memory_order_acquire);
+	return ring ? ring->name : "unnamed";
+}
+
+static
+i32 ring_consume(ProfileRing *ring, ProfileEvent *events,
+		i32 max_events, i64 *out_num_lost){
+	u64 write_pos = ring->write_pos.load(std::memory_order_acquire);
+	u64 read_pos = ring->read_pos.load(std::memory_order_relaxed);
+	i64 num_lost = 0;
+	if((write_pos - read_pos) > PROFILE_RING_SIZE){
+		num_lost = (i64)(write_pos - read_pos - PROFILE_RING_SIZE);
+		read_pos = write_pos - PROFILE_RING_SIZE;
+	}
+
+	i32 num_events = 0;
+	while(read_pos < write_pos && num_events < max_events){
+		events[num_events] = ring->events[read_pos & (PROFILE_RING_SIZE - 1)];
+		num_events += 1;
+		read_pos += 1;
+	}
+
+	// NOTE: The writer may have lapped us while we were copying, in which
+	// case the oldest events we copied could be garbage. Drop them.
+	u64 new_write_pos = ring->write_pos.load(std::memory_order_acquire);
+	if((new_write_pos - (read_pos - num_events)) > PROFILE_RING_SIZE){
+		i32 overwritten = (i32)(new_write_pos - (read_pos - num_events) - PROFILE_RING_SIZE);
+		if(overwritten > num_events)
+			overwritten = num_events;
+		memmove(events, events + overwritten, sizeof(ProfileEvent) * (num_events - overwritten));
+		num_events -= overwritten;
+		num_lost += overwritten;
+	}
+
+	ring->read_pos.store(read_pos, std::memory_order_relaxed);
+	if(out_num_lost)
+		*out_num_lost = num_lost;
+	return num_events;
+}
+
+i32 profile_ring_consume(i32 ring_index, ProfileEvent *events,
+		i32 max_events, i64 *out_num_lost){
+	ASSERT(ring_index < profile_num_rings());
+	ProfileRing *ring = profile_rings[ring_index].load(std::memory_order_acquire);
+	if(!ring){
+		if(out_num_lost)
+			*out_num_lost = 0;
+		return 0;
+	}
+	return ring_consume(ring, events, max_events, out_num_lost);
+}
+
+// ----------------------------------------------------------------
+// Trace Export
+// ----------------------------------------------------------------
+
+// NOTE: Frames are written in the Chrome Trace Event JSON format (array
+// form) which can be opened with chrome://tracing or ui.perfetto.dev. The
+// closing bracket is optional in this format so a file that was cut short
+// because the server died is still readable.
+//	Files are named "<path>.<n>.json" and once a file grows over
+// `max_file_size`, the next one is started, overwriting the oldest after
+// `max_files`.
+//	The frame thread only copies the frame's events into a queue and a
+// writer thread formats and writes them, so a slow disk doesn't make the
+// next frame slow too. If the writer falls behind and the queue is full,
+// the frame is dropped from the trace.
+
+#define PROFILE_MAX_FRAME_EVENTS 8192
+#define PROFILE_MAX_DEPTH 32
+#define PROFILE_TRACE_QUEUE_SIZE 4
+
+#if OS_WINDOWS
+#	define PROFILE_TRACE_SIGNAL SIGBREAK
+#else
+#	define PROFILE_TRACE_SIGNAL SIGUSR1
+#endif
+
+struct ProfileTraceFrame{
+	const char *thread_name;
+	i64 frame_number;
+	i64 frame_time;
+	i32 num_events;
+	ProfileEvent events[PROFILE_MAX_FRAME_EVENTS];
+};
+
+struct ProfileTrace{
+	bool enabled;
+	const char *path;
+	i64 slow_frame_threshold;
+	i64 max_file_size;
+	i32 max_files;
+	i32 capture_frames;
+	i64 num_dropped_frames;
+
+	// NOTE: Frames waiting for the writer thread. `queue_write` is only
+	// written by the frame thread and `queue_read` by the writer thread.
+	// Both only grow and are masked when indexing.
+	std::atomic<u32> queue_read;
+	std::atomic<u32> queue_write;
+	std::atomic<bool> open_failed;
+
+	// NOTE: Only used by the writer thread.
+	FILE *fp;
+	i32 file_index;
+	i64 file_size;
+	i64 file_num_events;
+};
+
+static ProfileTrace profile_trace;
+static ProfileTraceFrame profile_trace_queue[PROFILE_TRACE_QUEUE_SIZE];
+static volatile sig_atomic_t profile_trace_signaled;
+
+static
+void profile_trace_signal_handler(int sig){
+	profile_trace_signaled = 1;
+	signal(PROFILE_TRACE_SIGNAL, profile_trace_signal_handler);
+}
+
+static void profile_trace_thread(void *arg);
+
+void profile_trace_init(const char *path, i64 slow_frame_threshold,
+		i64 max_file_size, i32 max_files){
+	ASSERT(path != NULL);
+	ASSERT(max_file_size > 0);
+	ASSERT(max_files > 0);
+	profile_trace.enabled = true;
+	profile_trace.path = path;
+	profile_trace.slow_frame_threshold = slow_frame_threshold;
+	profile_trace.max_file_size = max_file_size;
+	profile_trace.max_files = max_files;
+	signal(PROFILE_TRACE_SIGNAL, profile_trace_signal_handler);
+	sys_thread_start(profile_trace_thread, NULL);
+}
+
+void profile_trace_capture(i32 num_frames){
+	if(profile_trace.capture_frames < num_frames)
+		profile_trace.capture_frames = num_frames;
+}
+
+static
+void trace_write_event(const char *fmt, ...){
+	ProfileTrace *trace = &profile_trace;
+	const char *separator = (trace->file_num_events > 0) ? ",\n" : "";
+	trace->file_size += fprintf(trace->fp, "%s", separator);
+
+	va_list ap;
+	va_start(ap, fmt);
+	trace->file_size += vfprintf(trace->fp, fmt, ap);
+	va_end(ap);
+	trace->file_num_events += 1;
+}
+
+static
+void trace_close_file(void){
+	ProfileTrace *trace = &profile_trace;
+	if(trace->fp){
+		fprintf(trace->fp, "\n]\n");
+		fclose(trace->fp);
+		trace->fp = NULL;
+	}
+}
+
+static
+bool trace_open_file(i32 tid, const char *thread_name){
+	ProfileTrace *trace = &profile_trace;
+	char filename[256];
+	snprintf(filename, sizeof(filename), "%s.%d.json",
+		trace->path, trace->file_index);
+	trace->file_index = (trace->file_index + 1) % trace->max_files;
+
+	trace->fp = fopen(filename, "wb");
+	if(!trace->fp){
+		LOG_ERROR("failed to open trace file \"%s\"", filename);
+		return false;
+	}
+	trace->file_size = fprintf(trace->fp, "[\n");
+	trace->file_num_events = 0;
+	trace_write_event("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+		"\"args\":{\"name\":\"kaplar\"}}");
+	trace_write_event("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+		"\"tid\":%d,\"args\":{\"name\":\"%s\"}}", tid, thread_name);
+	LOG("writing trace to \"%s\"", filename);
+	return true;
+}
+
+static INLINE
+double trace_timestamp_usec(u64 timestamp){
+	return (double)profile_ticks_to_nsec(timestamp - profile_base_timestamp) / 1000.0;
+}
+
+static
+void trace_write_frame(i32 tid, ProfileTraceFrame *frame){
+	ProfileTrace *trace = &profile_trace;
+	ProfileEvent *events = frame->events;
+	i32 num_events = frame->num_events;
+	if(num_events <= 0)
+		return;
+
+	if(!trace->fp && !trace_open_file(tid, frame->thread_name)){
+		// NOTE: Tell the frame thread so it stops the capture instead of
+		// retrying every frame.
+		trace->open_failed.store(true, std::memory_order_relaxed);
+		return;
+	}
+
+	// NOTE: Zone names must be plain literals without characters that need
+	// to be escaped in JSON, which is the case for every zone we have.
+	u64 frame_start = events[0].timestamp;
+	u64 frame_end = events[num_events - 1].timestamp;
+	trace_write_event("{\"name\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+		"\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%lld,\"frame_time_us\":%lld}}",
+		tid, trace_timestamp_usec(frame_start),
+		(double)profile_ticks_to_nsec(frame_end - frame_start) / 1000.0,
+		(long long)frame->frame_number, (long long)(frame->frame_time / 1000));
+
+	i32 depth = 0;
+	const char *stack[PROFILE_MAX_DEPTH];
+	for(i32 i = 0; i < num_events; i += 1){
+		ProfileEvent *event = &events[i];
+		double ts = trace_timestamp_usec(event->timestamp);
+		if(event->name){
+			if(depth < PROFILE_MAX_DEPTH)
+				stack[depth] = event->name;
+			depth += 1;
+			trace_write_event("{\"name\":\"%s\",\"ph\":\"B\",\"pid\":1,"
+				"\"tid\":%d,\"ts\":%.3f}", event->name, tid, ts);
+		}else if(depth > 0){
+			depth -= 1;
+			const char *name = (depth < PROFILE_MAX_DEPTH) ? stack[depth] : "";
+			trace_write_event("{\"name\":\"%s\",\"ph\":\"E\",\"pid\":1,"
+				"\"tid\":%d,\"ts\":%.3f}", name, tid, ts);
+		}
+	}
+	fflush(trace->fp);
+
+	if(trace->file_size >= trace->max_file_size)
+		trace_close_file();
+}
+
+static
+void profile_trace_thread(void *arg){
+	ProfileTrace *trace = &profile_trace;
+	while(1){
+		u32 read = trace->queue_read.load(std::memory_order_relaxed);
+		if(read == trace->queue_write.load(std::memory_order_acquire)){
+			sys_sleep_msec(1);
+			continue;
+		}
+
+		trace_write_frame(0, &profile_trace_queue[read % PROFILE_TRACE_QUEUE_SIZE]);
+		trace->queue_read.store(read + 1, std::memory_order_release);
+	}
+}
+
+// NOTE: Called from the frame thread. Returns false if the queue is full.
+static
+bool trace_queue_frame(const char *thread_name, i64 frame_number,
+		i64 frame_time, ProfileEvent *events, i32 num_events){
+	ProfileTrace *trace = &profile_trace;
+	u32 write = trace->queue_write.load(std::memory_order_relaxed);
+	if((write - trace->queue_read.load(std::memory_order_acquire)) >= PROFILE_TRACE_QUEUE_SIZE)
+		return false;
+
+	ProfileTraceFrame *frame = &profile_trace_queue[write % PROFILE_TRACE_QUEUE_SIZE];
+	frame->thread_name = thread_name;
+	frame->frame_number = frame_number;
+	frame->frame_time = frame_time;
+	frame->num_events = num_events;
+	memcpy(frame->events, events, sizeof(ProfileEvent) * num_events);
+	trace->queue_write.store(write + 1, std::memory_order_release);
+	return true;
+}
+
+// ----------------------------------------------------------------
+// Slow Frame Dump
+// ----------------------------------------------------------------
+
+struct ProfileZoneNode{
+	const char *name;
+	i32 depth;
+	u64 start;
+	u64 end;
+};
+
+static ProfileEvent profile_frame_events[PROFILE_MAX_FRAME_EVENTS];
+static ProfileZoneNode profile_frame_nodes[PROFILE_MAX_FRAME_EVENTS];
+
+void profile_frame_end(i64 frame_number, i64 frame_time, i64 budget){
+	ProfileRing *ring = profile_get_thread_ring();
+
+	// NOTE: Always consume the events, even if the frame was within budget,
+	// so the next frame starts from an empty ring. If the frame recorded
+	// more events than we can hold, the rest are skipped.
+	i64 num_lost = 0;
+	i32 num_events = ring_consume(ring, profile_frame_events,
+			PROFILE_MAX_FRAME_EVENTS, &num_lost);
+	u64 write_pos = ring->write_pos.load(std::memory_order_relaxed);
+	u64 read_pos = ring->read_pos.load(std::memory_order_relaxed);
+	if(read_pos != write_pos){
+		num_lost += (i64)(write_pos - read_pos);
+		ring->read_pos.store(write_pos, std::memory_order_relaxed);
+	}
+
+	if(profile_trace.enabled){
+		if(profile_trace_signaled){
+			profile_trace_signaled = 0;
+			LOG("trace capture requested for %d frames",
+				PROFILE_TRACE_CAPTURE_FRAMES);
+			profile_trace_capture(PROFILE_TRACE_CAPTURE_FRAMES);
+		}
+		if(profile_trace.open_failed.load(std::memory_order_relaxed)){
+			profile_trace.open_failed.store(false, std::memory_order_relaxed);
+			profile_trace.capture_frames = 0;
+		}
+
+		bool slow = profile_trace.slow_frame_threshold > 0
+			&& frame_time > profile_trace.slow_frame_threshold;
+		if(profile_trace.capture_frames > 0 || slow){
+			if(!trace_queue_frame(ring->name, frame_number, frame_time,
+					profile_frame_events, num_events)){
+				profile_trace.num_dropped_frames += 1;
+				LOG_ERROR("trace writer is behind, frame %lld dropped from the trace"
+					" (%lld dropped so far)", (long long)frame_number,
+					(long long)profile_trace.num_dropped_frames);
+			}
+			if(profile_trace.capture_frames > 0)
+				profile_trace.capture_frames -= 1;
+		}
+	}
+
+	if(frame_time <= budget)
+		return;
+
+	// NOTE: Rebuild the zone tree. Nodes are stored in the order their
+	// zones began so printing them in order with their depth gives the
+	// tree. Zones still open at the end of the frame are closed with the
+	// timestamp of the last event.
+	i32 num_nodes = 0;
+	i32 stack[PROFILE_MAX_DEPTH];
+	i32 depth = 0;
+	u64 last_timestamp = 0;
+	for(i32 i = 0; i < num_events; i += 1){
+		ProfileEvent *event = &profile_frame_events[i];
+		last_timestamp = event->timestamp;
+		if(event->name){
+			ProfileZoneNode *node = &profile_frame_nodes[num_nodes];
+			node->name = event->name;
+			node->depth = depth;
+			node->start = event->timestamp;
+			node->end = 0;
+			if(depth < PROFILE_MAX_DEPTH)
+				stack[depth] = num_nodes;
+			depth += 1;
+			num_nodes += 1;
+		}else if(depth > 0){
+			depth -= 1;
+			if(depth < PROFILE_MAX_DEPTH)
+				profile_frame_nodes[stack[depth]].end = event->timestamp;
+		}
+	}
+
+	LOG("slow frame %lld: %lld us (budget = %lld us, %d zones, %lld events lost)",
+		(long long)frame_number, (long long)(frame_time / 1000),
+		(long long)(budget / 1000), num_nodes, (long long)num_lost);
+	for(i32 i = 0; i < num_nodes; i += 1){
+		ProfileZoneNode *node = &profile_frame_nodes[i];
+		u64 end = node->end ? node->end : last_timestamp;
+		LOG("    %*s%s: %lld us", node->depth * 2, "", node->name,
+			(long long)(profile_ticks_to_nsec(end - node->start) / 1000));
+	}
+}
@@ -0,0 +1,98 @@
+#ifndef KAPLAR_PROFILE_HH_
+#define KAPLAR_PROFILE_HH_ 1
+
+#include "common.hh"
+
+// ----------------------------------------------------------------
+// Histogram
+// ----------------------------------------------------------------
+
+// NOTE: Log-linear latency histogram in the spirit of HDR histograms. Each
+// power of two range is split into 16 linear sub buckets so any recorded
+// value is within ~6% of its bucket, while covering the whole u64 range
+// with a fixed 4KB of counters. Values are usually nanoseconds.
+#define PROFILE_HISTOGRAM_SUB_BITS 4
+#define PROFILE_HISTOGRAM_SUB_COUNT (1 << PROFILE_HISTOGRAM_SUB_BITS)
+#define PROFILE_HISTOGRAM_BUCKETS (64 * PROFILE_HISTOGRAM_SUB_COUNT)
+
+struct ProfileHistogram{
+	u64 count;
+	u64 max;
+	u32 buckets[PROFILE_HISTOGRAM_BUCKETS];
+};
+
+void profile_histogram_add(ProfileHistogram *hist, i64 value);
+i64 profile_histogram_percentile(ProfileHistogram *hist, double percentile);
+void profile_histogram_reset(ProfileHistogram *hist);
+
+// ----------------------------------------------------------------
+// Zones
+// ----------------------------------------------------------------
+
+// NOTE: Zones are recorded as begin/end events with a cycle counter
+// timestamp into a per-thread ring buffer. Recording a zone is a couple of
+// stores and no locks so they can be left enabled in production.
+//	Each thread's ring has a single writer (the thread itself) and a single
+// reader. The thread running the frame scheduler consumes its own ring at
+// the end of each frame to dump the zone tree of slow frames. Other
+// threads' rings are available to other consumers through profile_rings.
+//	Zone names must be string literals (or otherwise live forever) because
+// only the pointer is recorded.
+
+#define PROFILE_RING_SIZE (64 * 1024)
+#define PROFILE_MAX_THREADS 32
+
+struct ProfileEvent{
+	u64 timestamp;
+	const char *name;	// NULL for the end of a zone
+};
+
+void profile_init(void);
+void profile_thread_name(const char *name);
+void profile_zone_begin(const char *name);
+void profile_zone_end(void);
+i64 profile_ticks_to_nsec(u64 ticks);
+
+// NOTE: Consumes the events the calling thread recorded since the last call
+// and dumps them as a tree with LOG if `frame_time` is over `budget`.
+void profile_frame_end(i64 frame_number, i64 frame_time, i64 budget);
+
+// NOTE: Copies up to `max_events` events that weren't consumed yet from the
+// given ring, advancing its read position. Returns the number of events
+// copied and how many were overwritten before they could be read. This
+// shouldn't be used on the ring of a thread that calls profile_frame_end.
+i32 profile_num_rings(void);
+const char *profile_ring_name(i32 ring_index);
+i32 profile_ring_consume(i32 ring_index, ProfileEvent *events,
+		i32 max_events, i64 *out_num_lost);
+
+// ----------------------------------------------------------------
+// Trace Export
+// ----------------------------------------------------------------
+
+// NOTE: When enabled, profile_frame_end also writes the zones of selected
+// frames to rotating Chrome Trace Event JSON files. A frame is written if
+// it took longer than `slow_frame_threshold` (nanoseconds, zero disables
+// it) or while a capture is running. A capture of the next
+// PROFILE_TRACE_CAPTURE_FRAMES frames is started with SIGUSR1 (SIGBREAK
+// on Windows) or with profile_trace_capture.
+#define PROFILE_TRACE_CAPTURE_FRAMES 300
+
+void profile_trace_init(const char *path, i64 slow_frame_threshold,
+		i64 max_file_size, i32 max_files);
+void profile_trace_capture(i32 num_frames);
+
+// ----------------------------------------------------------------
+// Scoped Zones
+// ----------------------------------------------------------------
+
+struct ProfileScope{
+	ProfileScope(const char *name){ profile_zone_begin(name); }
+	~ProfileScope(void){ profile_zone_end(); }
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+
+#endif //KAPLAR_PROFILE_HH_
@@ -0,0 +1,365 @@
+#include "protocol.hh"
+
+#include "buffer_util.hh"
+#include "crypto.hh"
+#include "profile.hh"
+
+// ----------------------------------------------------------------
+// Fused XTEA + ADLER32
+// ----------------------------------------------------------------
+
+// NOTE: Wrapping used to pad the message, XTEA encode it, and then compute
+// the adler32 checksum of the encoded data, walking the buffer once for
+// each step. Here each block is encoded and then fed into the checksum
+// straight from registers, so the buffer is walked only once.
+//	Most of the time is spent in XTEA itself, where each round depends on
+// the previous one. The protocol encodes each 8 byte block independently
+// (ECB) so we encode 4 blocks at a time to have independent instructions
+// the CPU can execute in parallel. The round keys (sum + k[...]) also only
+// depend on the key so they are computed once per message.
+
+#define XTEA_DELTA 0x9E3779B9UL
+#define XTEA_ROUNDS 32
+#define XTEA_LANES 4
+
+// NOTE: The adler32 sums need to be reduced at least every 5552 bytes to
+// avoid overflowing. That's 694 blocks of 8 bytes, rounded down to a
+// multiple of XTEA_LANES.
+#define ADLER32_BASE 65521U
+#define ADLER32_NMAX_BLOCKS (5552 / 8 / XTEA_LANES * XTEA_LANES)
+
+static INLINE
+void xtea_key_schedule(u32 *k, u32 *schedule){
+	u32 sum = 0;
+	for(i32 i = 0; i < XTEA_ROUNDS; i += 1){
+		schedule[2 * i + 0] = sum + k[sum & 3];
+		sum += XTEA_DELTA;
+		schedule[2 * i + 1] = sum + k[(sum >> 11) & 3];
+	}
+}
+
+static INLINE
+void adler32_block(u32 *a, u32 *b, u32 v0, u32 v1){
+	// NOTE: This is the same as doing `a += x; b += a;` for each of
+	// the 8 bytes (little endian) of the block.
+	u32 x0 = (v0 >>  0) & 0xFF;
+	u32 x1 = (v0 >>  8) & 0xFF;
+	u32 x2 = (v0 >> 16) & 0xFF;
+	u32 x3 = (v0 >> 24) & 0xFF;
+	u32 x4 = (v1 >>  0) & 0xFF;
+	u32 x5 = (v1 >>  8) & 0xFF;
+	u32 x6 = (v1 >> 16) & 0xFF;
+	u32 x7 = (v1 >> 24) & 0xFF;
+	*b += 8 * (*a) + 8 * x0 + 7 * x1 + 6 * x2 + 5 * x3
+		+ 4 * x4 + 3 * x5 + 2 * x6 + 1 * x7;
+	*a += x0 + x1 + x2 + x3 + x4 + x5 + x6 + x7;
+}
+
+// NOTE: Encodes up to XTEA_LANES consecutive blocks. When inlined with
+// a constant number of lanes the lane loops are unrolled.
+static INLINE
+void xtea_encode_lanes(u32 *schedule, u8 *data, i32 num_lanes, u32 *a, u32 *b){
+	u32 v0[XTEA_LANES];
+	u32 v1[XTEA_LANES];
+	for(i32 j = 0; j < num_lanes; j += 1){
+		v0[j] = buffer_read_u32_le(data + 8 * j);
+		v1[j] = buffer_read_u32_le(data + 8 * j + 4);
+	}
+	for(i32 i = 0; i < XTEA_ROUNDS; i += 1){
+		u32 k0 = schedule[2 * i + 0];
+		u32 k1 = schedule[2 * i + 1];
+		for(i32 j = 0; j < num_lanes; j += 1)
+			v0[j] += ((v1[j] << 4 ^ v1[j] >> 5) + v1[j]) ^ k0;
+		for(i32 j = 0; j < num_lanes; j += 1)
+			v1[j] += ((v0[j] << 4 ^ v0[j] >> 5) + v0[j]) ^ k1;
+	}
+	for(i32 j = 0; j < num_lanes; j += 1){
+		buffer_write_u32_le(data + 8 * j, v0[j]);
+		buffer_write_u32_le(data + 8 * j + 4, v1[j]);
+		adler32_block(a, b, v0[j], v1[j]);
+	}
+}
+
+static INLINE
+void xtea_decode_lanes(u32 *schedule, u8 *data, i32 num_lanes, u32 *a, u32 *b){
+	u32 v0[XTEA_LANES];
+	u32 v1[XTEA_LANES];
+	for(i32 j = 0; j < num_lanes; j += 1){
+		v0[j] = buffer_read_u32_le(data + 8 * j);
+		v1[j] = buffer_read_u32_le(data + 8 * j + 4);
+		adler32_block(a, b, v0[j], v1[j]);
+	}
+	for(i32 i = XTEA_ROUNDS - 1; i >= 0; i -= 1){
+		u32 k0 = schedule[2 * i + 0];
+		u32 k1 = schedule[2 * i + 1];
+		for(i32 j = 0; j < num_lanes; j += 1)
+			v1[j] -= ((v0[j] << 4 ^ v0[j] >> 5) + v0[j]) ^ k1;
+		for(i32 j = 0; j < num_lanes; j += 1)
+			v0[j] -= ((v1[j] << 4 ^ v1[j] >> 5) + v1[j]) ^ k0;
+	}
+	for(i32 j = 0; j < num_lanes; j += 1){
+		buffer_write_u32_le(data + 8 * j, v0[j]);
+		buffer_write_u32_le(data + 8 * j + 4, v1[j]);
+	}
+}
+
+// NOTE: Encodes `data` in place and returns the adler32 checksum of the
+// encoded data.
+static
+u32 xtea_encode_adler32(u32 *k, u8 *data, i32 len){
+	ASSERT((len & 7) == 0);
+	u32 schedule[2 * XTEA_ROUNDS];
+	xtea_key_schedule(k, schedule);
+
+	u32 a = 1;
+	u32 b = 0;
+	i32 num_blocks = len / 8;
+	while(num_blocks > 0){
+		i32 n = (num_blocks > ADLER32_NMAX_BLOCKS) ? ADLER32_NMAX_BLOCKS : num_blocks;
+		num_blocks -= n;
+		while(n >= XTEA_LANES){
+			xtea_encode_lanes(schedule, data, XTEA_LANES, &a, &b);
+			data += 8 * XTEA_LANES;
+			n -= XTEA_LANES;
+		}
+		if(n > 0){
+			xtea_encode_lanes(schedule, data, n, &a, &b);
+			data += 8 * n;
+		}
+		a %= ADLER32_BASE;
+		b %= ADLER32_BASE;
+	}
+	return a | (b << 16);
+}
+
+// NOTE: Decodes `data` in place and returns the adler32 checksum of the
+// data before it was decoded.
+static
+u32 xtea_decode_adler32(u32 *k, u8 *data, i32 len){
+	ASSERT((len & 7) == 0);
+	u32 schedule[2 * XTEA_ROUNDS];
+	xtea_key_schedule(k, schedule);
+
+	u32 a = 1;
+	u32 b = 0;
+	i32 num_blocks = len / 8;
+	while(num_blocks > 0){
+		i32 n = (num_blocks > ADLER32_NMAX_BLOCKS) ? ADLER32_NMAX_BLOCKS : num_blocks;
+		num_blocks -= n;
+		while(n >= XTEA_LANES){
+			xtea_decode_lanes(schedule, data, XTEA_LANES, &a, &b);
+			data += 8 * XTEA_LANES;
+			n -= XTEA_LANES;
+		}
+		if(n > 0){
+			xtea_decode_lanes(schedule, data, n, &a, &b);
+			data += 8 * n;
+		}
+		a %= ADLER32_BASE;
+		b %= ADLER32_BASE;
+	}
+	return a | (b << 16);
+}
+
+// ----------------------------------------------------------------
+// Wrap / Unwrap
+// ----------------------------------------------------------------
+
+bool packet_wrap(OutPacket *p, u32 *xtea){
+	PROFILE_ZONE("packet_wrap");
+	u8 *buf = packet_buf(p);
+	i32 len = packet_written_len(p);
+
+	i32 payload_len = len - 8;
+	if(payload_len <= 0) // PARANOID
+		PANIC("trying to send empty message");
+
+	// NOTE: If padding ends up being zero, packet_can_write(p, 0)
+	// is the same as packet_ok(p).
+	u8 *xtea_payload = buf + 6;
+	i32 xtea_payload_len = len - 6;
+	i32 padding = -xtea_payload_len & 7;
+	if(!packet_can_write(p, padding))
+		return false;
+	buffer_write_u16_le(xtea_payload, payload_len);
+	memset(buf + len, 0x33, padding);
+	p->bufpos += padding;
+	xtea_payload_len += padding;
+
+	u32 checksum = xtea_encode_adler32(xtea, xtea_payload, xtea_payload_len);
+	buffer_write_u16_le(buf, xtea_payload_len + 4);
+	buffer_write_u32_le(buf + 2, checksum);
+	return true;
+}
+
+bool packet_unwrap(u8 *buf, i32 len, u32 *xtea, InPacket *p){
+	PROFILE_ZONE("packet_unwrap");
+	// NOTE: We need at least 4 bytes for the checksum and 8 bytes
+	// for the smallest XTEA encoded message.
+	if(len < 12)
+		return false;
+
+	u8 *xtea_payload = buf + 4;
+	i32 xtea_payload_len = len - 4;
+
+	// check that xtea_payload_len is a multiple of 8
+	if(xtea_payload_len & 7)
+		return false;
+
+	// NOTE: The checksum is accumulated over each encoded block right
+	// before decoding it. If it doesn't match, the buffer is left with
+	// garbage but the message is rejected either way.
+	u32 checksum = xtea_decode_adler32(xtea, xtea_payload, xtea_payload_len);
+	if(buffer_read_u32_le(buf) != checksum)
+		return false;
+
+	// check that the encoded payload length doesn't
+	// overflow the packet length
+	u8 *payload = xtea_payload + 2;
+	i32 max_payload_len = xtea_payload_len - 2;
+	i32 payload_len = buffer_read_u16_le(xtea_payload);
+	if(payload_len > max_payload_len)
+		return false;
+
+	p->buf = payload;
+	p->bufend = payload_len;
+	p->bufpos = 0;
+	return true;
+}
+
+#if BUILD_TEST
+// NOTE: This is the previous version of packet_wrap that pads, encodes,
+// and checksums the message in separate passes. It is only used to
+// compare against.
+static
+bool packet_wrap_reference(OutPacket *p, u32 *xtea){
+	u8 *buf = packet_buf(p);
+	i32 len = packet_written_len(p);
+
+	i32 payload_len = len - 8;
+	if(payload_len <= 0) // PARANOID
+		PANIC("trying to send empty message");
+
+	u8 *xtea_payload = buf + 6;
+	i32 xtea_payload_len = len - 6;
+	i32 padding = -xtea_payload_len & 7;
+	if(!packet_can_write(p, padding))
+		return false;
+	buffer_write_u16_le(xtea_payload, payload_len);
+	xtea_payload_len += padding;
+	while(padding-- > 0)
+		packet_write_u8(p, 0x33);
+	xtea_encode(xtea, xtea_payload, xtea_payload_len);
+
+	u32 checksum = adler32(xtea_payload, xtea_payload_len);
+	buffer_write_u16_le(buf, xtea_payload_len + 4);
+	buffer_write_u32_le(buf + 2, checksum);
+	return true;
+}
+
+static
+bool packet_unwrap_reference(u8 *buf, i32 len, u32 *xtea, InPacket *p){
+	if(len < 12)
+		return false;
+
+	u8 *xtea_payload = buf + 4;
+	i32 xtea_payload_len = len - 4;
+	if(xtea_payload_len & 7)
+		return false;
+
+	u32 checksum = adler32(xtea_payload, xtea_payload_len);
+	if(buffer_read_u32_le(buf) != checksum)
+		return false;
+	xtea_decode(xtea, xtea_payload, xtea_payload_len);
+
+	u8 *payload = xtea_payload + 2;
+	i32 max_payload_len = xtea_payload_len - 2;
+	i32 payload_len = buffer_read_u16_le(xtea_payload);
+	if(payload_len > max_payload_len)
+		return false;
+
+	p->buf = payload;
+	p->bufend = payload_len;
+	p->bufpos = 0;
+	return true;
+}
+
+void packet_wrap_bench(void){
+	static const i32 payload_sizes[] = { 16, 100, 1000, 4000, 16000 };
+	u32 xtea[4] = { 0x01234567, 0x89ABCDEF, 0xFEDCBA98, 0x76543210 };
+	u8 buf1[16 * 1024];
+	u8 buf2[16 * 1024];
+	u8 wrapped[16 * 1024];
+	u8 payload[16 * 1024];
+	for(i32 i = 0; i < (i32)NARRAY(payload); i += 1)
+		payload[i] = (u8)rand();
+
+	for(i32 s = 0; s < (i32)NARRAY(payload_sizes); s += 1){
+		i32 payload_len = payload_sizes[s];
+
+		// NOTE: Check that both versions produce the same bytes and
+		// that unwrapping gives back the original payload.
+		OutPacket p1 = { NULL, buf1, sizeof(buf1), 8 };
+		OutPacket p2 = { NULL, buf2, sizeof(buf2), 8 };
+		packet_write_bytes(&p1, payload, payload_len);
+		packet_write_bytes(&p2, payload, payload_len);
+		ASSERT(packet_wrap_reference(&p1, xtea));
+		ASSERT(packet_wrap(&p2, xtea));
+		ASSERT(p1.bufpos == p2.bufpos);
+		ASSERT(memcmp(buf1, buf2, p1.bufpos) == 0);
+
+		InPacket in1, in2;
+		ASSERT(packet_unwrap_reference(buf1 + 2, p1.bufpos - 2, xtea, &in1));
+		ASSERT(packet_unwrap(buf2 + 2, p2.bufpos - 2, xtea, &in2));
+		ASSERT(in1.bufend == payload_len && in2.bufend == payload_len);
+		ASSERT(memcmp(in2.buf, payload, payload_len) == 0);
+
+		// NOTE: Flipping a single bit should fail the checksum.
+		p2.bufpos = 8;
+		packet_write_bytes(&p2, payload, payload_len);
+		ASSERT(packet_wrap(&p2, xtea));
+		buf2[p2.bufpos - 1] ^= 0x10;
+		ASSERT(!packet_unwrap(buf2 + 2, p2.bufpos - 2, xtea, &in2));
+
+		i32 num_rounds = (4 * 1024 * 1024) / payload_len;
+		i64 bytes = (i64)num_rounds * payload_len;
+		i64 t0 = sys_clock_monotonic_nsec();
+		for(i32 round = 0; round < num_rounds; round += 1){
+			p1.bufpos = 8 + payload_len;
+			packet_wrap_reference(&p1, xtea);
+		}
+		i64 t1 = sys_clock_monotonic_nsec();
+		for(i32 round = 0; round < num_rounds; round += 1){
+			p2.bufpos = 8 + payload_len;
+			packet_wrap(&p2, xtea);
+		}
+		i64 t2 = sys_clock_monotonic_nsec();
+		// NOTE: Unwrapping decodes in place so each round starts from a
+		// copy of the wrapped message. Both versions pay for the copy.
+		i32 wrapped_len = p2.bufpos;
+		memcpy(wrapped, buf2, wrapped_len);
+		i64 t3 = sys_clock_monotonic_nsec();
+		for(i32 round = 0; round < num_rounds; round += 1){
+			memcpy(buf1, wrapped, wrapped_len);
+			packet_unwrap_reference(buf1 + 2, wrapped_len - 2, xtea, &in1);
+		}
+		i64 t4 = sys_clock_monotonic_nsec();
+		for(i32 round = 0; round < num_rounds; round += 1){
+			memcpy(buf1, wrapped, wrapped_len);
+			packet_unwrap(buf1 + 2, wrapped_len - 2, xtea, &in1);
+		}
+		i64 t5 = sys_clock_monotonic_nsec();
+		ASSERT(in1.bufend == payload_len);
+
+		debug_printf("packet wrap/unwrap (payload = %d bytes):\n", payload_len);
+		debug_printf("    wrap reference:   %.2f MB/s\n",
+			(double)bytes * 1000.0 / (double)(t1 - t0));
+		debug_printf("    wrap fused:       %.2f MB/s\n",
+			(double)bytes * 1000.0 / (double)(t2 - t1));
+		debug_printf("    unwrap reference: %.2f MB/s\n",
+			(double)bytes * 1000.0 / (double)(t4 - t3));
+		debug_printf("    unwrap fused:     %.2f MB/s\n",
+			(double)bytes * 1000.0 / (double)(t5 - t4));
+	}
+}
+#endif //BUILD_TEST
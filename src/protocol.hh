@@ -0,0 +1,32 @@
+// NOTE: Framing shared by the login and game protocols. Every message after
+// the handshake has the following layout:
+//
+//	u16		message length (not counting itself)
+//	u32		adler32 checksum of the XTEA encoded data
+//	XTEA encoded data:
+//		u16		payload length
+//		u8[]	payload
+//		u8[]	padding up to a multiple of 8 bytes
+
+#ifndef KAPLAR_PROTOCOL_HH_
+#define KAPLAR_PROTOCOL_HH_ 1
+
+#include "common.hh"
+#include "packet.hh"
+
+// NOTE: The payload should be written starting at offset 8 of the packet
+// with 8 bytes reserved for the header. Wrapping pads, encodes, and
+// checksums the message in place and fails if there is no space left for
+// the padding.
+bool packet_wrap(OutPacket *p, u32 *xtea);
+
+// NOTE: `buf` should point to the checksum, after the message length that
+// is discarded when reading from the socket. The message is decoded in
+// place and `p` will point to the payload inside `buf`.
+bool packet_unwrap(u8 *buf, i32 len, u32 *xtea, InPacket *p);
+
+#if BUILD_TEST
+void packet_wrap_bench(void);
+#endif
+
+#endif //KAPLAR_PROTOCOL_HH_
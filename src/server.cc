@@ -8,6 +8,7 @@
 
 #include "common.hh"
 #include "buffer_util.hh"
+#include "metrics.hh"
 
 #define WIN32_LEAN_AND_MEAN 1
 #include <windows.h>
@@ -38,7 +39,7 @@ int setsock_linger(SOCKET s, int onoff, int seconds){
 }
 
 static
-SOCKET server_socket(int port){
+SOCKET server_socket(int port, bool loopback){
 	SOCKET s = socket(AF_INET, SOCK_STREAM, 0);
 	if(s == INVALID_SOCKET){
 		LOG_ERROR("failed to create socket"
@@ -63,7 +64,7 @@ SOCKET server_socket(int port){
 	sockaddr_in addr;
 	addr.sin_family = AF_INET;
 	addr.sin_port = htons(port);
-	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_addr.s_addr = htonl(loopback ? INADDR_LOOPBACK : INADDR_ANY);
 	if(bind(s, (sockaddr*)&addr, sizeof(sockaddr_in)) == SOCKET_ERROR){
 		LOG_ERROR("failed to bind socket to port %d"
 			" (error = %d)", port, WSAGetLastError());
@@ -116,6 +117,7 @@ struct Server{
 	SOCKET s;
 	u16 port;
 	u16 max_connections;
+	u16 flags;
 	i32 freelist_head;
 	WSAPOLLFD *pollfds;
 	Connection *connections;
@@ -136,8 +138,9 @@ Server *server_init(MemArena *arena, ServerParams *params){
 	u16 port = params->port;
 	u16 max_connections = params->max_connections;
 	u16 readbuf_size = params->readbuf_size;
+	u16 flags = params->flags;
 
-	SOCKET s = server_socket(port);
+	SOCKET s = server_socket(port, (flags & SERVER_FLAG_LOOPBACK) != 0);
 	if(s == INVALID_SOCKET)
 		return NULL;
 
@@ -145,6 +148,7 @@ Server *server_init(MemArena *arena, ServerParams *params){
 	server->s = s;
 	server->port = port;
 	server->max_connections = max_connections;
+	server->flags = flags;
 	server->freelist_head = 0;
 
 	server->pollfds = arena_alloc<WSAPOLLFD>(arena, max_connections);
@@ -184,6 +188,7 @@ void server_free_connection(Server *server, i32 c){
 	server->pollfds[c].fd = INVALID_SOCKET;
 	server->connections[c].freelist_next = server->freelist_head;
 	server->freelist_head = c;
+	metrics_add(METRIC_SERVER_CONNECTIONS, -1);
 }
 
 static
@@ -200,7 +205,7 @@ void server_accept_connections(Server *server,
 			//	return;
 			return;
 		}
-		LOG("accepted socket = %d", s);
+		LOG_DEBUG("accepted socket = %d", s);
 
 		// PARANOID: Can only happen if there is a bug in the OS?
 		if(addrlen != sizeof(sockaddr_in)){
@@ -221,6 +226,7 @@ void server_accept_connections(Server *server,
 
 		i32 c = server_alloc_connection(server);
 		if(c == -1){
+			metrics_add(METRIC_SERVER_REJECTED, 1);
 			tcp_abort(s);
 			LOG_ERROR("new connection rejected due to connection"
 				" number limit (%d)", server->max_connections);
@@ -235,10 +241,12 @@ void server_accept_connections(Server *server,
 		cptr->closed = 0;
 		cptr->closing = 0;
 		cptr->readbuf_pos = 0;
-		cptr->bytes_to_read = 2;
+		cptr->bytes_to_read = (server->flags & SERVER_FLAG_STREAM) ? cptr->readbuf_size : 2;
 		cptr->message_length = 0;
 		cptr->write_ptr = NULL;
 		cptr->bytes_to_write = 0;
+		metrics_add(METRIC_SERVER_ACCEPTED, 1);
+		metrics_add(METRIC_SERVER_CONNECTIONS, 1);
 		on_accept(userdata, c);
 	}
 }
@@ -260,7 +268,7 @@ void connection_abort(Connection *cptr){
 }
 
 static
-void connection_resume_reading(i32 c, Connection *cptr,
+void connection_resume_reading(i32 c, Connection *cptr, bool stream,
 		OnRead on_read, void *userdata){
 	if(cptr->closed)
 		return;
@@ -277,6 +285,13 @@ void connection_resume_reading(i32 c, Connection *cptr,
 			return;
 		}
 
+		metrics_add(METRIC_SERVER_BYTES_IN, ret);
+		if(stream){
+			metrics_add(METRIC_SERVER_MESSAGES_IN, 1);
+			on_read(userdata, c, cptr->readbuf, ret);
+			continue;
+		}
+
 		cptr->readbuf_pos += ret;
 		cptr->bytes_to_read -= ret;
 		if(cptr->bytes_to_read == 0){
@@ -290,6 +305,7 @@ void connection_resume_reading(i32 c, Connection *cptr,
 				cptr->bytes_to_read = message_length;
 				cptr->message_length = message_length;
 			}else{
+				metrics_add(METRIC_SERVER_MESSAGES_IN, 1);
 				on_read(userdata, c, cptr->readbuf, cptr->message_length);
 				cptr->readbuf_pos = 0;
 				cptr->bytes_to_read = 2;
@@ -317,12 +333,14 @@ void connection_resume_writing(i32 c, Connection *cptr,
 				connection_abort(cptr);
 			return;
 		}
+		metrics_add(METRIC_SERVER_BYTES_OUT, ret);
 		cptr->write_ptr += ret;
 		cptr->bytes_to_write -= ret;
 	}
 }
 
 void server_poll(Server *server, void *userdata){
+	i64 poll_start = sys_clock_monotonic_nsec();
 	server_accept_connections(server, server->on_accept, userdata);
 
 	WSAPOLLFD *fds = server->pollfds;
@@ -342,8 +360,11 @@ void server_poll(Server *server, void *userdata){
 			if(fds[c].revents & (POLLHUP | POLLERR)){
 				connection_close(cptr);
 			}else{
-				if(fds[c].revents & POLLIN)
-					connection_resume_reading(c, cptr, server->on_read, userdata);
+				if(fds[c].revents & POLLIN){
+					connection_resume_reading(c, cptr,
+						(server->flags & SERVER_FLAG_STREAM) != 0,
+						server->on_read, userdata);
+				}
 				if(fds[c].revents & POLLOUT)
 					connection_resume_writing(c, cptr, server->request_output, userdata);
 			}
@@ -374,6 +395,29 @@ void server_poll(Server *server, void *userdata){
 			server_free_connection(server, c);
 		}
 	}
+
+	metrics_add(METRIC_SERVER_POLLS, 1);
+	metrics_add(METRIC_SERVER_POLL_NSEC, sys_clock_monotonic_nsec() - poll_start);
+}
+
+// NOTE: Try to write any output that was produced after the connections
+// were polled so it doesn't have to wait for the next server_poll. This
+// doesn't accept, read, or drop connections.
+void server_flush(Server *server, void *userdata){
+	WSAPOLLFD *fds = server->pollfds;
+	i32 nfds = server->max_connections;
+	for(i32 c = 0; c < nfds; c += 1){
+		if(fds[c].fd == INVALID_SOCKET)
+			continue;
+		Connection *cptr = &server->connections[c];
+		connection_resume_writing(c, cptr, server->request_output, userdata);
+	}
+}
+
+// NOTE: IPv4 address of the connection in network byte order.
+u32 server_connection_ip(Server *server, u32 index){
+	ASSERT(index < server->max_connections);
+	return (u32)server->connections[index].addr.sin_addr.s_addr;
 }
 
 // NOTE: This is a windows hack to avoid ever calling
@@ -10,6 +10,15 @@ enum ConnectionStatus : u32 {
 	CONNECTION_STATUS_ALIVE = 0,
 	CONNECTION_STATUS_CLOSING,
 };
+// NOTE: By default messages are framed with a u16 length prefix and
+// on_read is called once per message. With SERVER_FLAG_STREAM, on_read is
+// called with whatever bytes were received, for protocols with their own
+// framing. SERVER_FLAG_LOOPBACK only accepts local connections.
+enum ServerFlags : u16 {
+	SERVER_FLAG_STREAM = 0x01,
+	SERVER_FLAG_LOOPBACK = 0x02,
+};
+
 typedef void (*OnAccept)(void *userdata, u32 index);
 typedef void (*OnDrop)(void *userdata, u32 index);
 typedef void (*OnRead)(void *userdata, u32 index, u8 *data, i32 datalen);
@@ -20,6 +29,7 @@ struct ServerParams{
 	u16 port;
 	u16 max_connections;
 	u16 readbuf_size;
+	u16 flags;
 	OnAccept on_accept;
 	OnDrop on_drop;
 	OnRead on_read;
@@ -30,5 +40,7 @@ struct ServerParams{
 struct Server;
 Server *server_init(MemArena *arena, ServerParams *params);
 void server_poll(Server *server, void *userdata);
+void server_flush(Server *server, void *userdata);
+u32 server_connection_ip(Server *server, u32 index);
 
 #endif // KAPLAR_SERVER_HH_
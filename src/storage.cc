@@ -0,0 +1,283 @@
+#include "storage.hh"
+
+#include "metrics.hh"
+#include "profile.hh"
+
+#include <atomic>
+
+#define STORAGE_MAX_QUEUES 8
+
+// NOTE: Positions only grow and are masked when indexing the rings. The
+// user writes `request_write` and `result_read` and the worker writes
+// `request_read` and `result_write`.
+struct StorageQueue{
+	u32 capacity_mask;
+	StorageRequest *requests;
+	StorageResult *results;
+	std::atomic<u32> request_write;
+	std::atomic<u32> request_read;
+	std::atomic<u32> result_write;
+	std::atomic<u32> result_read;
+};
+
+struct Storage{
+	Database *db;
+	std::atomic<StorageQueue*> queues[STORAGE_MAX_QUEUES];
+	std::atomic<i32> num_queues;
+};
+
+// ----------------------------------------------------------------
+// Worker
+// ----------------------------------------------------------------
+
+static
+void storage_account_login(Database *db, StorageRequest *request, StorageResult *result){
+	DBAccount *account = database_find_account(db, request->accname);
+	if(!account){
+		result->status = STORAGE_STATUS_INVALID_ACCOUNT;
+		return;
+	}
+
+	result->password = account->password;
+	result->premium_days = account->premium_days;
+	result->num_characters = account->num_characters;
+	for(i32 i = 0; i < account->num_characters; i += 1){
+		DBCharacter *character = database_get_character(db, account->character_ids[i]);
+		ASSERT(character != NULL);
+		memcpy(result->character_names[i], character->name, DB_NAME_MAX);
+	}
+}
+
+static
+void storage_character_login(Database *db, StorageRequest *request, StorageResult *result){
+	DBAccount *account = database_find_account(db, request->accname);
+	if(!account){
+		result->status = STORAGE_STATUS_INVALID_ACCOUNT;
+		return;
+	}
+
+	// NOTE: The password hash is returned even if the character isn't
+	// found so the caller can check the password before saying so.
+	result->password = account->password;
+	DBCharacter *character = database_find_character(db, request->character_name);
+	if(!character || character->account_id != account->id){
+		result->status = STORAGE_STATUS_INVALID_CHARACTER;
+		return;
+	}
+	result->character = *character;
+}
+
+static
+void storage_character_save(Database *db, StorageRequest *request, StorageResult *result){
+	// NOTE: Only the sections marked dirty are copied and written to the
+	// log. Everything else (ids and name) must match what we have.
+	DBCharacter *character = database_get_character(db, request->character.id);
+	if(!character || character->account_id != request->character.account_id){
+		result->status = STORAGE_STATUS_INVALID_CHARACTER;
+		return;
+	}
+
+	DBCharacter *src = &request->character;
+	u32 sections = request->sections & DB_CHARACTER_SECTION_ALL;
+	if(sections & DB_CHARACTER_SECTION_POSITION){
+		character->pos_x = src->pos_x;
+		character->pos_y = src->pos_y;
+		character->pos_z = src->pos_z;
+		character->direction = src->direction;
+	}
+	if(sections & DB_CHARACTER_SECTION_OUTFIT){
+		character->look_type = src->look_type;
+		character->look_head = src->look_head;
+		character->look_body = src->look_body;
+		character->look_legs = src->look_legs;
+		character->look_feet = src->look_feet;
+		character->look_addons = src->look_addons;
+	}
+	if(sections != 0 && !database_update_character(db, character, sections))
+		result->status = STORAGE_STATUS_ERROR;
+	result->character = *character;
+}
+
+static
+void storage_process(Database *db, StorageRequest *request, StorageResult *result){
+	i64 start = sys_clock_monotonic_nsec();
+	memset(result, 0, sizeof(StorageResult));
+	result->op = request->op;
+	result->status = STORAGE_STATUS_OK;
+	result->connection_index = request->connection_index;
+	result->connection_counter = request->connection_counter;
+	switch(request->op){
+		case STORAGE_OP_ACCOUNT_LOGIN: {
+			PROFILE_ZONE("storage_account_login");
+			storage_account_login(db, request, result);
+			break;
+		}
+		case STORAGE_OP_CHARACTER_LOGIN: {
+			PROFILE_ZONE("storage_character_login");
+			storage_character_login(db, request, result);
+			break;
+		}
+		case STORAGE_OP_CHARACTER_SAVE: {
+			PROFILE_ZONE("storage_character_save");
+			storage_character_save(db, request, result);
+			break;
+		}
+		default: {
+			LOG_ERROR("invalid storage op %u", request->op);
+			result->status = STORAGE_STATUS_ERROR;
+			break;
+		}
+	}
+
+	metrics_add(METRIC_STORAGE_REQUESTS, 1);
+	metrics_add(METRIC_STORAGE_REQUEST_NSEC, sys_clock_monotonic_nsec() - start);
+}
+
+// NOTE: Processes every request queued at the time without publishing
+// the results. Returns how many were processed.
+static
+u32 storage_process_queue(Database *db, StorageQueue *queue){
+	u32 request_read = queue->request_read.load(std::memory_order_relaxed);
+	u32 request_write = queue->request_write.load(std::memory_order_acquire);
+
+	// NOTE: The user never has more than `capacity` requests in flight
+	// (counting the results it didn't read yet) so there is always room
+	// for the result.
+	u32 result_write = queue->result_write.load(std::memory_order_relaxed);
+	u32 count = request_write - request_read;
+	for(u32 i = 0; i < count; i += 1){
+		StorageRequest *request = &queue->requests[(request_read + i) & queue->capacity_mask];
+		StorageResult *result = &queue->results[(result_write + i) & queue->capacity_mask];
+		storage_process(db, request, result);
+	}
+	return count;
+}
+
+static
+void storage_publish_queue(StorageQueue *queue, u32 count, bool commit_failed){
+	u32 request_read = queue->request_read.load(std::memory_order_relaxed);
+	u32 result_write = queue->result_write.load(std::memory_order_relaxed);
+	if(commit_failed){
+		for(u32 i = 0; i < count; i += 1){
+			StorageResult *result = &queue->results[(result_write + i) & queue->capacity_mask];
+			if(result->op == STORAGE_OP_CHARACTER_SAVE && result->status == STORAGE_STATUS_OK)
+				result->status = STORAGE_STATUS_ERROR;
+		}
+	}
+	queue->request_read.store(request_read + count, std::memory_order_release);
+	queue->result_write.store(result_write + count, std::memory_order_release);
+}
+
+static
+bool storage_commit(Database *db){
+	PROFILE_ZONE("storage_commit");
+	i64 start = sys_clock_monotonic_nsec();
+	bool result = database_commit(db);
+	metrics_add(METRIC_STORAGE_COMMITS, 1);
+	metrics_add(METRIC_STORAGE_COMMIT_NSEC, sys_clock_monotonic_nsec() - start);
+	return result;
+}
+
+static
+void storage_thread(void *arg){
+	Storage *storage = (Storage*)arg;
+	Database *db = storage->db;
+	profile_thread_name("storage");
+	while(1){
+		// NOTE: Process the requests from every queue before committing so
+		// they all share one fsync. The results are only published after
+		// the commit, so the request slots can't be reused before then.
+		bool idle = true;
+		StorageQueue *queues[STORAGE_MAX_QUEUES];
+		u32 counts[STORAGE_MAX_QUEUES];
+		i32 num_queues = storage->num_queues.load(std::memory_order_acquire);
+		if(num_queues > STORAGE_MAX_QUEUES)
+			num_queues = STORAGE_MAX_QUEUES;
+		for(i32 i = 0; i < num_queues; i += 1){
+			queues[i] = storage->queues[i].load(std::memory_order_acquire);
+			counts[i] = queues[i] ? storage_process_queue(db, queues[i]) : 0;
+			if(counts[i] > 0)
+				idle = false;
+		}
+
+		if(!idle){
+			bool commit_failed = !storage_commit(db);
+			for(i32 i = 0; i < num_queues; i += 1){
+				if(counts[i] > 0)
+					storage_publish_queue(queues[i], counts[i], commit_failed);
+			}
+		}else{
+			database_maybe_compact(db);
+			sys_sleep_msec(1);
+		}
+	}
+}
+
+// ----------------------------------------------------------------
+
+// NOTE: The database must not be used by anyone else after this.
+Storage *storage_init(MemArena *arena, Database *db){
+	Storage *storage = arena_alloc<Storage>(arena, 1);
+	storage->db = db;
+	for(i32 i = 0; i < STORAGE_MAX_QUEUES; i += 1)
+		storage->queues[i].store(NULL, std::memory_order_relaxed);
+	storage->num_queues.store(0, std::memory_order_relaxed);
+	sys_thread_start(storage_thread, storage);
+	return storage;
+}
+
+StorageQueue *storage_queue_init(MemArena *arena, Storage *storage, i32 capacity){
+	ASSERT(capacity > 0);
+	u32 rounded_capacity = 1;
+	while(rounded_capacity < (u32)capacity)
+		rounded_capacity *= 2;
+
+	StorageQueue *queue = arena_alloc<StorageQueue>(arena, 1);
+	queue->capacity_mask = rounded_capacity - 1;
+	queue->requests = arena_alloc<StorageRequest>(arena, rounded_capacity);
+	queue->results = arena_alloc<StorageResult>(arena, rounded_capacity);
+	queue->request_write.store(0, std::memory_order_relaxed);
+	queue->request_read.store(0, std::memory_order_relaxed);
+	queue->result_write.store(0, std::memory_order_relaxed);
+	queue->result_read.store(0, std::memory_order_relaxed);
+
+	i32 index = storage->num_queues.load(std::memory_order_relaxed);
+	if(index >= STORAGE_MAX_QUEUES)
+		PANIC("too many storage queues (max = %d)", STORAGE_MAX_QUEUES);
+	storage->queues[index].store(queue, std::memory_order_release);
+	storage->num_queues.store(index + 1, std::memory_order_release);
+	return queue;
+}
+
+// NOTE: Returns false if the queue is full, in which case the request
+// wasn't submitted.
+bool storage_submit(StorageQueue *queue, StorageRequest *request){
+	u32 request_write = queue->request_write.load(std::memory_order_relaxed);
+	u32 result_read = queue->result_read.load(std::memory_order_relaxed);
+	if((request_write - result_read) > queue->capacity_mask)
+		return false;
+
+	queue->requests[request_write & queue->capacity_mask] = *request;
+	queue->request_write.store(request_write + 1, std::memory_order_release);
+	metrics_add(METRIC_STORAGE_PENDING, 1);
+	return true;
+}
+
+bool storage_next_result(StorageQueue *queue, StorageResult *out_result){
+	u32 result_read = queue->result_read.load(std::memory_order_relaxed);
+	u32 result_write = queue->result_write.load(std::memory_order_acquire);
+	if(result_read == result_write)
+		return false;
+
+	*out_result = queue->results[result_read & queue->capacity_mask];
+	queue->result_read.store(result_read + 1, std::memory_order_release);
+	metrics_add(METRIC_STORAGE_PENDING, -1);
+	return true;
+}
+
+// NOTE: Number of requests submitted whose results weren't read yet.
+i32 storage_num_pending(StorageQueue *queue){
+	u32 request_write = queue->request_write.load(std::memory_order_relaxed);
+	u32 result_read = queue->result_read.load(std::memory_order_relaxed);
+	return (i32)(request_write - result_read);
+}
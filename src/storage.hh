@@ -0,0 +1,86 @@
+#ifndef KAPLAR_STORAGE_HH_
+#define KAPLAR_STORAGE_HH_ 1
+
+#include "common.hh"
+#include "database.hh"
+
+// ----------------------------------------------------------------
+// Storage
+// ----------------------------------------------------------------
+
+// NOTE: The storage worker is a thread that owns the database once it's
+// started, so account lookups and the log fsyncs never run on the thread
+// that polls the servers and runs the game frame.
+//	Each user (login server, game) gets its own queue which is a pair of
+// single producer single consumer rings: requests go from the user to the
+// worker and results come back in the same order. A user may only have as
+// many requests in flight as the queue has slots, which is also what keeps
+// the result ring from overflowing.
+//	The worker takes everything queued at the time, appends it to the log,
+// and commits once before publishing the results, so a batch of saves
+// shares a single fsync and a save result with STORAGE_STATUS_OK means the
+// save is on disk.
+
+// NOTE: Logins only look up the account and return its password hash.
+// Checking the password is up to the password pool (see password.hh) so
+// the worker never sees it and isn't held up by it.
+enum StorageOp : u32 {
+	// account -> password hash + character list
+	STORAGE_OP_ACCOUNT_LOGIN = 0,
+	// account + character name -> password hash + character
+	STORAGE_OP_CHARACTER_LOGIN,
+	// character + dirty sections -> status
+	STORAGE_OP_CHARACTER_SAVE,
+};
+
+enum StorageStatus : u32 {
+	STORAGE_STATUS_OK = 0,
+	STORAGE_STATUS_INVALID_ACCOUNT,
+	STORAGE_STATUS_INVALID_CHARACTER,
+	STORAGE_STATUS_ERROR,
+};
+
+struct StorageRequest{
+	StorageOp op;
+
+	// NOTE: Not used by the worker. They're copied into the result so
+	// the user can tell which connection made the request and whether
+	// it's still the same connection.
+	u32 connection_index;
+	u32 connection_counter;
+
+	char accname[DB_NAME_MAX];
+	char character_name[DB_NAME_MAX];
+	DBCharacter character;
+
+	// STORAGE_OP_CHARACTER_SAVE: DBCharacterSection bits to save.
+	u32 sections;
+};
+
+struct StorageResult{
+	StorageOp op;
+	StorageStatus status;
+	u32 connection_index;
+	u32 connection_counter;
+
+	// STORAGE_OP_ACCOUNT_LOGIN and STORAGE_OP_CHARACTER_LOGIN
+	PasswordHash password;
+
+	// STORAGE_OP_ACCOUNT_LOGIN
+	u16 premium_days;
+	i32 num_characters;
+	char character_names[DB_ACCOUNT_MAX_CHARACTERS][DB_NAME_MAX];
+
+	// STORAGE_OP_CHARACTER_LOGIN
+	DBCharacter character;
+};
+
+struct Storage;
+struct StorageQueue;
+Storage *storage_init(MemArena *arena, Database *db);
+StorageQueue *storage_queue_init(MemArena *arena, Storage *storage, i32 capacity);
+bool storage_submit(StorageQueue *queue, StorageRequest *request);
+bool storage_next_result(StorageQueue *queue, StorageResult *out_result);
+i32 storage_num_pending(StorageQueue *queue);
+
+#endif //KAPLAR_STORAGE_HH_
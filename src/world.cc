@@ -1,5 +1,7 @@
 #include "world.hh"
 
+#include "profile.hh"
+
 // ----------------------------------------------------------------
 // World Loading and Initialization
 // ----------------------------------------------------------------
@@ -27,6 +29,27 @@
 
 #include "file.hh"
 
+static
+void world_alloc_chunks(MemArena *arena, World *world,
+		u32 num_dense_chunks, u32 max_chunks){
+	// NOTE: We allocate an extra chunk at the end of the dense array that
+	// is always empty. Every chunk that isn't present in the world points
+	// to it so that looking up a tile never has to check for a missing
+	// chunk. This chunk must never be modified.
+	usize num_tiles = ((usize)num_dense_chunks + 1) * WORLD_NUM_TILES_PER_CHUNK;
+	Tile empty_tile = {};
+	world->empty_chunk = num_dense_chunks;
+	world->dense_array = arena_alloc_init<Tile>(arena, num_tiles, empty_tile);
+	world->sparse_array = arena_alloc_init<u32>(arena, max_chunks, num_dense_chunks);
+	world->chunk_versions = arena_alloc_init<u32>(arena, num_dense_chunks + 1, 0);
+
+	// NOTE: Tile flags are only valid after world_set_base_items. The extra
+	// bytes at the end let world_scan_row read whole words past the last
+	// tile.
+	world->base_items = NULL;
+	world->tile_flags = arena_alloc_init<u8>(arena, num_tiles + 16, TILE_FLAG_EMPTY);
+}
+
 static
 bool world_sparse_data(KPB_Element *elem, u32 *sparse, u32 max_sparse_index){
 
@@ -63,9 +86,9 @@ void world_load(MemArena *arena, World *world, const char *filename){
 
 	// TODO: Verify world version and client version here.
 
-	world->chunk_dim_x = kpb_element_read_u16(&elem);
-	world->chunk_dim_y = kpb_element_read_u16(&elem);
-	world->chunk_dim_z = kpb_element_read_u8(&elem);
+	u16 chunk_dim_x = kpb_element_read_u16(&elem);
+	u16 chunk_dim_y = kpb_element_read_u16(&elem);
+	u8 chunk_dim_z = kpb_element_read_u8(&elem);
 	world->world_dim_in_chunks_x = kpb_element_read_u16(&elem);
 	world->world_dim_in_chunks_y = kpb_element_read_u16(&elem);
 	world->world_dim_in_chunks_z = kpb_element_read_u8(&elem);
@@ -75,10 +98,13 @@ void world_load(MemArena *arena, World *world, const char *filename){
 	u32 num_spawns = kpb_element_read_u32(&elem);
 	u32 num_temples = kpb_element_read_u32(&elem);
 
-	u32 num_tiles_per_chunk =
-			(u32)world->chunk_dim_x
-			* (u32)world->chunk_dim_y
-			* (u32)world->chunk_dim_z;
+	if(chunk_dim_x != WORLD_CHUNK_DIM_X
+	|| chunk_dim_y != WORLD_CHUNK_DIM_Y
+	|| chunk_dim_z != WORLD_CHUNK_DIM_Z){
+		PANIC("%s: unexpected chunk dimensions (expected = %dx%dx%d, got = %dx%dx%d)",
+			filename, WORLD_CHUNK_DIM_X, WORLD_CHUNK_DIM_Y, WORLD_CHUNK_DIM_Z,
+			chunk_dim_x, chunk_dim_y, chunk_dim_z);
+	}
 
 	u32 max_chunks =
 			(u32)world->world_dim_in_chunks_x
@@ -93,10 +119,7 @@ void world_load(MemArena *arena, World *world, const char *filename){
 
 	// TODO: Should we have room for a extra chunks? I don't think we
 	// should change the world structure on the fly but I don't know.
-	usize num_tiles = (usize)num_dense_chunks * (usize)world->num_tiles_per_chunk;
-	Tile empty_tile = {}; // TODO ?
-	world->dense_array = arena_alloc_init<Tile>(arena, num_tiles, empty_tile);
-	world->sparse_array = arena_alloc_init<u32>(arena, max_chunks, 0xFFFFFFFF);
+	world_alloc_chunks(arena, world, num_dense_chunks, max_chunks);
 
 	u32 num_dense_chunks_read = 0;
 	u32 num_sparse_pairs_read = 0;
@@ -117,11 +140,11 @@ void world_load(MemArena *arena, World *world, const char *filename){
 					if(chunk_index >= max_chunks){
 						PANIC("%s: chunk index exceeds maximum expected value"
 							" (chunk_index = %u, max_chunks = %u)",
-							chunk_index, max_chunks);
+							filename, chunk_index, max_chunks);
 					}else if(dense_index >= num_dense_chunks){
 						PANIC("%s: dense index exceeds maximum expected value"
 							" (dense_index = %u, num_dense_chunks = %u)",
-							dense_index, num_dense_chunks);
+							filename, dense_index, num_dense_chunks);
 					}
 					world->sparse_array[chunk_index] = dense_index;
 					remainder -= 8;
@@ -182,69 +205,1327 @@ void world_load(MemArena *arena, World *world, const char *filename){
 	}
 }
 
+void world_init_flat(MemArena *arena, World *world, u16 ground_id){
+	// NOTE: This is a 256x256 world with a single floor (z = 7) filled
+	// with `ground_id` that we use for testing while we don't have a
+	// converted world file.
+	u32 world_dim_x = 256;
+	u32 world_dim_y = 256;
+	u32 world_dim_z = 16;
+	u32 ground_z = 7;
+	world->world_dim_in_chunks_x = (u16)(world_dim_x >> WORLD_CHUNK_SHIFT_X);
+	world->world_dim_in_chunks_y = (u16)(world_dim_y >> WORLD_CHUNK_SHIFT_Y);
+	world->world_dim_in_chunks_z = (u8)(world_dim_z >> WORLD_CHUNK_SHIFT_Z);
+
+	u32 chunk_pitch_z = (u32)world->world_dim_in_chunks_x
+			* (u32)world->world_dim_in_chunks_y;
+	u32 max_chunks = chunk_pitch_z * (u32)world->world_dim_in_chunks_z;
+	u32 num_dense_chunks = chunk_pitch_z;
+	world_alloc_chunks(arena, world, num_dense_chunks, max_chunks);
+
+	u32 chunk_z = ground_z >> WORLD_CHUNK_SHIFT_Z;
+	u32 tile_z = ground_z & WORLD_CHUNK_MASK_Z;
+	for(u32 i = 0; i < num_dense_chunks; i += 1){
+		world->sparse_array[chunk_z * chunk_pitch_z + i] = i;
+		Tile *chunk = &world->dense_array[(usize)i * WORLD_NUM_TILES_PER_CHUNK];
+		for(u32 j = 0; j < WORLD_CHUNK_PITCH_Z; j += 1){
+			Tile *tile = &chunk[tile_z * WORLD_CHUNK_PITCH_Z + j];
+			tile->num_items = 1;
+			tile->items[0].id = ground_id;
+		}
+	}
+}
+
 // ----------------------------------------------------------------
 // World Utility
 // ----------------------------------------------------------------
 Tile *world_get_tile(World *world, u16 x, u16 y, u8 z){
-	u32 chunk_x = x / world->chunk_dim_x;
-	u32 tile_x = x % world->chunk_dim_x;
-	u32 chunk_y = y / world->chunk_dim_y;
-	u32 tile_y = y % world->chunk_dim_y;
-	u32 chunk_z = z / world->chunk_dim_z;
-	u32 tile_z = z % world->chunk_dim_z;
-
-	u32 chunk_dim_x = (u32)world->chunk_dim_x;
-	u32 chunk_dim_y = (u32)world->chunk_dim_y;
-	u32 chunk_dim_z = (u32)world->chunk_dim_z;
-
-	u32 world_dim_in_chunks_x = (u32)world->world_dim_in_chunks_x;
-	u32 world_dim_in_chunks_y = (u32)world->world_dim_in_chunks_y;
-	u32 world_dim_in_chunks_z = (u32)world->world_dim_in_chunks_z;
-
-	if(chunk_x > world_dim_in_chunks_x
-	|| chunk_y > world_dim_in_chunks_y
-	|| chunk_z > world_dim_in_chunks_z)
+	usize offset = world_tile_offset(world, x, y, z);
+	if(offset >= (usize)world->empty_chunk * WORLD_NUM_TILES_PER_CHUNK)
 		return NULL;
+	return &world->dense_array[offset];
+}
+
+// NOTE: Same as world_get_tile but for tiles that are about to be modified.
+// Every change to the world that should be saved must go through here so
+// the chunk is marked as changed. The tile flags must be refreshed with
+// world_update_tile_flags afterwards (world_add_item and world_remove_item
+// already do it).
+Tile *world_modify_tile(World *world, u16 x, u16 y, u8 z){
+	usize offset = world_tile_offset(world, x, y, z);
+	u32 chunk = (u32)(offset / WORLD_NUM_TILES_PER_CHUNK);
+	if(chunk >= world->empty_chunk)
+		return NULL;
+	world->chunk_versions[chunk] += 1;
+	return &world->dense_array[offset];
+}
+
+// ----------------------------------------------------------------
+// Tile Flags
+// ----------------------------------------------------------------
+
+static INLINE
+u8 item_tile_flags(const BaseItemTable *items, u16 id){
+	u32 flags = base_item_flags(items, id);
+	u8 result = 0;
+	if(flags & ITEM_FLAG_BLOCK_SOLID)		result |= TILE_FLAG_BLOCK_SOLID;
+	if(flags & ITEM_FLAG_BLOCK_PATH)		result |= TILE_FLAG_BLOCK_PATH;
+	if(flags & ITEM_FLAG_BLOCK_PROJECTILE)	result |= TILE_FLAG_BLOCK_PROJECTILE;
+	if(flags & ITEM_FLAG_HAS_HEIGHT)		result |= TILE_FLAG_HAS_HEIGHT;
+	if(flags & ITEM_FLAG_FLOOR_CHANGE)		result |= TILE_FLAG_FLOOR_CHANGE;
+	return result;
+}
+
+static
+u8 tile_compute_flags(const BaseItemTable *items, Tile *tile){
+	if(tile->num_items == 0)
+		return TILE_FLAG_EMPTY;
+	u8 result = 0;
+	for(i32 i = 0; i < tile->num_items; i += 1)
+		result |= item_tile_flags(items, tile->items[i].id);
+	return result;
+}
+
+void world_set_base_items(World *world, const BaseItemTable *items){
+	PROFILE_ZONE("world_set_base_items");
+	world->base_items = items;
+	usize num_tiles = ((usize)world->empty_chunk + 1) * WORLD_NUM_TILES_PER_CHUNK;
+	for(usize i = 0; i < num_tiles; i += 1)
+		world->tile_flags[i] = tile_compute_flags(items, &world->dense_array[i]);
+}
+
+void world_update_tile_flags(World *world, Tile *tile){
+	usize index = (usize)(tile - world->dense_array);
+	world->tile_flags[index] = tile_compute_flags(world->base_items, tile);
+}
+
+// NOTE: Items are added on top of the tile. Returns false if the position
+// is on a missing chunk or the tile is full.
+bool world_add_item(World *world, u16 x, u16 y, u8 z, Item item){
+	Tile *tile = world_modify_tile(world, x, y, z);
+	if(!tile || tile->num_items >= (i32)NARRAY(tile->items))
+		return false;
+
+	tile->items[tile->num_items] = item;
+	tile->num_items += 1;
+
+	// NOTE: Adding an item can only add flags.
+	usize index = (usize)(tile - world->dense_array);
+	u8 flags = world->tile_flags[index] & ~TILE_FLAG_EMPTY;
+	world->tile_flags[index] = flags | item_tile_flags(world->base_items, item.id);
+	return true;
+}
+
+bool world_remove_item(World *world, u16 x, u16 y, u8 z, i32 index){
+	Tile *tile = world_modify_tile(world, x, y, z);
+	if(!tile || index < 0 || index >= tile->num_items)
+		return false;
+
+	for(i32 i = index + 1; i < tile->num_items; i += 1)
+		tile->items[i - 1] = tile->items[i];
+	tile->num_items -= 1;
 
-	u32 chunk_pitch_y = world_dim_in_chunks_x;
-	u32 chunk_pitch_z = world_dim_in_chunks_x * world_dim_in_chunks_y;
+	// NOTE: Other items may have the same flags as the removed one so the
+	// flags are recomputed from the ones left, which are at most a few.
+	world_update_tile_flags(world, tile);
+	return true;
+}
+
+// NOTE: Tests eight tile flags at once. Sets bit `i` of the result if
+// `flags[i] & mask` is non zero. Bytes are loaded little endian.
+static INLINE
+u32 tile_flags_match8(const u8 *flags, u8 mask){
+	u64 v = (u64)flags[0]
+		| ((u64)flags[1] << 8)
+		| ((u64)flags[2] << 16)
+		| ((u64)flags[3] << 24)
+		| ((u64)flags[4] << 32)
+		| ((u64)flags[5] << 40)
+		| ((u64)flags[6] << 48)
+		| ((u64)flags[7] << 56);
+	v &= (u64)mask * 0x0101010101010101ULL;
+
+	// NOTE: Set the high bit of every non zero byte without carrying into
+	// the next byte, then gather the high bits into the top byte.
+	u64 nonzero = (((v & 0x7F7F7F7F7F7F7F7FULL) + 0x7F7F7F7F7F7F7F7FULL) | v)
+			& 0x8080808080808080ULL;
+	return (u32)(((nonzero >> 7) * 0x0102040810204080ULL) >> 56);
+}
+
+// NOTE: Returns a mask with bit `i` set if the tile at (x + i, y, z) has any
+// of the flags in `mask`. Tiles outside the world count as empty. `count`
+// must be at most 32.
+u32 world_scan_row(World *world, u16 x, u16 y, u8 z, i32 count, u8 mask){
+	ASSERT(count >= 0 && count <= 32);
+	u32 empty_bit = (TILE_FLAG_EMPTY & mask) ? 1 : 0;
+	u32 result = 0;
+	i32 i = 0;
+	while(i < count){
+		i32 tx = (i32)x + i;
+		if(tx > 0xFFFF){
+			if(empty_bit)
+				result |= (u32)(0xFFFFFFFFULL << i);
+			break;
+		}
+
+		// NOTE: Consume the rest of the row inside this chunk, which is
+		// contiguous in the flags array.
+		i32 run = WORLD_CHUNK_DIM_X - (tx & WORLD_CHUNK_MASK_X);
+		if(run > (count - i))
+			run = count - i;
+		const u8 *flags = &world->tile_flags[world_tile_offset(world, (u16)tx, y, z)];
+		u32 bits = 0;
+		for(i32 j = 0; j < run; j += 8)
+			bits |= tile_flags_match8(flags + j, mask) << j;
+		bits &= (u32)((1ULL << run) - 1);
+		result |= bits << i;
+		i += run;
+	}
+
+	if(count < 32)
+		result &= (1u << count) - 1;
+	return result;
+}
+
+#if BUILD_TEST
+static
+bool world_tile_flags_test_check(World *world){
+	usize num_tiles = ((usize)world->empty_chunk + 1) * WORLD_NUM_TILES_PER_CHUNK;
+	for(usize i = 0; i < num_tiles; i += 1){
+		if(world->tile_flags[i] != tile_compute_flags(world->base_items, &world->dense_array[i]))
+			return false;
+	}
+	return true;
+}
+
+bool world_tile_flags_test(void){
+	bool passed = true;
+
+	// NOTE: A small item table independent from the compiled base data.
+	u32 flags[8] = {
+		0,
+		0,
+		ITEM_FLAG_BLOCK_SOLID,
+		ITEM_FLAG_BLOCK_SOLID | ITEM_FLAG_BLOCK_PATH | ITEM_FLAG_BLOCK_PROJECTILE,
+		ITEM_FLAG_HAS_HEIGHT,
+		ITEM_FLAG_FLOOR_CHANGE,
+		ITEM_FLAG_BLOCK_PATH,
+		ITEM_FLAG_USEABLE,
+	};
+	BaseItemTable items = {};
+	items.num_items = NARRAY(flags);
+	items.flags = flags;
+
+	MemArena *arena = arena_init(256 * 1024 * 1024, 4 * 1024 * 1024);
+	World world;
+	world_init_flat(arena, &world, 1);
+	world_set_base_items(&world, &items);
+	passed = passed && world_tile_walkable(&world, 10, 10, 7);
+	passed = passed && !world_tile_walkable(&world, 10, 10, 6);
+	passed = passed && !world_tile_walkable(&world, 300, 10, 7);
+	passed = passed && world_tile_flags_test_check(&world);
+
+	// NOTE: Random adds and removes, including ids outside the table.
+	srand(1234);
+	for(i32 i = 0; i < 100000; i += 1){
+		u16 x = (u16)(rand() % 300);
+		u16 y = (u16)(rand() % 300);
+		if(rand() & 1){
+			Item item = { (u16)(rand() % 10) };
+			world_add_item(&world, x, y, 7, item);
+		}else{
+			world_remove_item(&world, x, y, 7, rand() % 4);
+		}
+	}
+	passed = passed && world_tile_flags_test_check(&world);
+
+	Item wall = { 2 };
+	world_add_item(&world, 20, 20, 7, wall);
+	passed = passed && !world_tile_walkable(&world, 20, 20, 7);
+	world_remove_item(&world, 20, 20, 7, world_get_tile(&world, 20, 20, 7)->num_items - 1);
+	passed = passed && !world_add_item(&world, 20, 20, 3, wall);
+
+	// NOTE: Compare row scans against single tile queries, including rows
+	// that cross chunks and the world bounds.
+	for(i32 i = 0; i < 100000 && passed; i += 1){
+		u16 x = (u16)(rand() % 300);
+		if(i % 1000 == 0)
+			x = (u16)(0xFFFF - rand() % 32);
+		u16 y = (u16)(rand() % 300);
+		u8 z = (u8)(6 + rand() % 2);
+		i32 count = rand() % 33;
+		u8 mask = (u8)(rand() & 0x3F);
+		u32 expected = 0;
+		for(i32 j = 0; j < count; j += 1){
+			u8 tile_flags = TILE_FLAG_EMPTY;
+			if(((i32)x + j) <= 0xFFFF)
+				tile_flags = world_get_tile_flags(&world, (u16)(x + j), y, z);
+			if(tile_flags & mask)
+				expected |= (1u << j);
+		}
+		passed = passed && world_scan_row(&world, x, y, z, count, mask) == expected;
+	}
+
+	debug_printf("world tile flags test: %s\n", (passed ? "passed" : "failed"));
+	return passed;
+}
+#endif
+
+#if BUILD_TEST
+// NOTE: This is the previous version of world_get_tile with chunk dimensions
+// known only at runtime (divisions and modulos) and a branch for missing
+// chunks. It is only used to compare against.
+static volatile u32 reference_chunk_dim[3] = {
+	WORLD_CHUNK_DIM_X, WORLD_CHUNK_DIM_Y, WORLD_CHUNK_DIM_Z };
+static
+Tile *world_get_tile_reference(World *world, u16 x, u16 y, u8 z){
+	u32 chunk_dim_x = reference_chunk_dim[0];
+	u32 chunk_dim_y = reference_chunk_dim[1];
+	u32 chunk_dim_z = reference_chunk_dim[2];
+	u32 chunk_x = x / chunk_dim_x;
+	u32 tile_x = x % chunk_dim_x;
+	u32 chunk_y = y / chunk_dim_y;
+	u32 tile_y = y % chunk_dim_y;
+	u32 chunk_z = z / chunk_dim_z;
+	u32 tile_z = z % chunk_dim_z;
+	if(chunk_x >= world->world_dim_in_chunks_x
+	|| chunk_y >= world->world_dim_in_chunks_y
+	|| chunk_z >= world->world_dim_in_chunks_z)
+		return NULL;
+
+	u32 chunk_pitch_y = world->world_dim_in_chunks_x;
+	u32 chunk_pitch_z = (u32)world->world_dim_in_chunks_x * (u32)world->world_dim_in_chunks_y;
 	u32 chunk_index = chunk_z * chunk_pitch_z + chunk_y * chunk_pitch_y + chunk_x;
 	u32 chunk_dense_index = world->sparse_array[chunk_index];
-	if(chunk_dense_index == 0xFFFFFFFF)
+	if(chunk_dense_index == world->empty_chunk)
+		return NULL;
+
+	usize chunk_first_tile = (usize)chunk_dense_index * chunk_dim_x * chunk_dim_y * chunk_dim_z;
+	u32 tile_index = tile_z * chunk_dim_x * chunk_dim_y + tile_y * chunk_dim_x + tile_x;
+	return &world->dense_array[chunk_first_tile + tile_index];
+}
+
+void world_get_tile_bench(void){
+	MemArena *arena = arena_init(256 * 1024 * 1024, 4 * 1024 * 1024);
+	World world;
+	world_init_flat(arena, &world, 106);
+
+	// NOTE: Generate lookups slightly outside the world bounds to also
+	// exercise the out of bounds path.
+	i32 num_lookups = 1 << 20;
+	u16 *xs = arena_alloc<u16>(arena, num_lookups);
+	u16 *ys = arena_alloc<u16>(arena, num_lookups);
+	u8 *zs = arena_alloc<u8>(arena, num_lookups);
+	for(i32 i = 0; i < num_lookups; i += 1){
+		xs[i] = (u16)(rand() % 300);
+		ys[i] = (u16)(rand() % 300);
+		zs[i] = (u8)(rand() % 18);
+	}
+
+	for(i32 i = 0; i < num_lookups; i += 1){
+		ASSERT(world_get_tile(&world, xs[i], ys[i], zs[i])
+			== world_get_tile_reference(&world, xs[i], ys[i], zs[i]));
+	}
+
+	i32 num_rounds = 16;
+	i64 reference_random = 0;
+	i64 reference_sequential = 0;
+	i64 checked_random = 0;
+	i64 fast_random = 0;
+	i64 checked_sequential = 0;
+	i64 fast_sequential = 0;
+	usize sink = 0;
+	for(i32 round = 0; round < num_rounds; round += 1){
+		i64 r0 = sys_clock_monotonic_nsec();
+		for(i32 i = 0; i < num_lookups; i += 1){
+			Tile *tile = world_get_tile_reference(&world, xs[i], ys[i], zs[i]);
+			sink += tile ? tile->num_items : 0;
+		}
+		i64 r1 = sys_clock_monotonic_nsec();
+		for(i32 y = 0; y < 256; y += 1)
+		for(i32 x = 0; x < 256; x += 1){
+			Tile *tile = world_get_tile_reference(&world, (u16)x, (u16)y, 7);
+			sink += tile ? tile->num_items : 0;
+		}
+		i64 r2 = sys_clock_monotonic_nsec();
+		reference_random += r1 - r0;
+		reference_sequential += r2 - r1;
+
+		i64 t0 = sys_clock_monotonic_nsec();
+		for(i32 i = 0; i < num_lookups; i += 1){
+			Tile *tile = world_get_tile(&world, xs[i], ys[i], zs[i]);
+			sink += tile ? tile->num_items : 0;
+		}
+		i64 t1 = sys_clock_monotonic_nsec();
+		for(i32 i = 0; i < num_lookups; i += 1){
+			Tile *tile = world_get_tile_fast(&world, xs[i], ys[i], zs[i]);
+			sink += tile->num_items;
+		}
+		i64 t2 = sys_clock_monotonic_nsec();
+		for(i32 y = 0; y < 256; y += 1)
+		for(i32 x = 0; x < 256; x += 1){
+			Tile *tile = world_get_tile(&world, (u16)x, (u16)y, 7);
+			sink += tile ? tile->num_items : 0;
+		}
+		i64 t3 = sys_clock_monotonic_nsec();
+		for(i32 y = 0; y < 256; y += 1)
+		for(i32 x = 0; x < 256; x += 1){
+			Tile *tile = world_get_tile_fast(&world, (u16)x, (u16)y, 7);
+			sink += tile->num_items;
+		}
+		i64 t4 = sys_clock_monotonic_nsec();
+		checked_random += t1 - t0;
+		fast_random += t2 - t1;
+		checked_sequential += t3 - t2;
+		fast_sequential += t4 - t3;
+	}
+
+	i64 num_random = (i64)num_lookups * num_rounds;
+	i64 num_sequential = (i64)256 * 256 * num_rounds;
+	debug_printf("world_get_tile (sink = %zu):\n", sink);
+	debug_printf("    random reference:     %.2f Mlookups/s\n",
+		(double)num_random * 1000.0 / (double)reference_random);
+	debug_printf("    random checked:       %.2f Mlookups/s\n",
+		(double)num_random * 1000.0 / (double)checked_random);
+	debug_printf("    random fast:          %.2f Mlookups/s\n",
+		(double)num_random * 1000.0 / (double)fast_random);
+	debug_printf("    sequential reference: %.2f Mlookups/s\n",
+		(double)num_sequential * 1000.0 / (double)reference_sequential);
+	debug_printf("    sequential checked:   %.2f Mlookups/s\n",
+		(double)num_sequential * 1000.0 / (double)checked_sequential);
+	debug_printf("    sequential fast:      %.2f Mlookups/s\n",
+		(double)num_sequential * 1000.0 / (double)fast_sequential);
+}
+#endif //BUILD_TEST
+
+// ----------------------------------------------------------------
+// World Iterator
+// ----------------------------------------------------------------
+
+// NOTE: Chunk coordinates can be negative (or past the world dimensions)
+// for parts of a box outside the world. In that case there is no chunk.
+// Also note that we rely on >> being an arithmetic shift for negative
+// values which is the case for both msvc and gcc/clang.
+static
+Tile *world_get_chunk(World *world, i32 chunk_x, i32 chunk_y, i32 chunk_z){
+	if(chunk_x < 0 || chunk_x >= (i32)world->world_dim_in_chunks_x
+	|| chunk_y < 0 || chunk_y >= (i32)world->world_dim_in_chunks_y
+	|| chunk_z < 0 || chunk_z >= (i32)world->world_dim_in_chunks_z)
+		return NULL;
+
+	u32 chunk_pitch_y = (u32)world->world_dim_in_chunks_x;
+	u32 chunk_pitch_z = (u32)world->world_dim_in_chunks_x
+			* (u32)world->world_dim_in_chunks_y;
+	u32 chunk_index = (u32)chunk_z * chunk_pitch_z
+			+ (u32)chunk_y * chunk_pitch_y + (u32)chunk_x;
+	u32 chunk_dense_index = world->sparse_array[chunk_index];
+	if(chunk_dense_index == world->empty_chunk)
 		return NULL;
 
-	usize chunk_first_tile = (usize)chunk_dense_index * (usize)world->num_tiles_per_chunk;
-	u32 tile_pitch_y = chunk_dim_x;
-	u32 tile_pitch_z = chunk_dim_x * chunk_dim_y;
-	u32 tile_index = tile_z * tile_pitch_z + tile_y * tile_pitch_y + tile_x;
-	Tile *tile = &world->dense_array[chunk_first_tile + tile_index];
-	return tile;
-}
-
-// TODO: Players (and maybe creatures?) will be kept in a separate tree structure.
-// This means that we'll need to merge both tiles and creatures before sending world
-// data to the client. On a quick thought, query the creatures on the same area we'll
-// send the client and sort them by position. This way, when we iterate over the
-// tiles, we just need to check the first creature on the sorted list and check if
-// we're sending the tile on that position.
-
-/*
-void world_get_area_description(World *world, BVH *creature_bvh, WorldArea area, OutPacket *outp){
-	creatures := bvh_query(creature_bvh, area);
-	sort_creatures_by_position(creatures);
-
-	creature_ptr := 0;
-	for(pos in area){
-		tile := world_get_tile(world, pos);
-		if(!tile)
+	usize chunk_first_tile = (usize)chunk_dense_index * WORLD_NUM_TILES_PER_CHUNK;
+	return &world->dense_array[chunk_first_tile];
+}
+
+static INLINE
+i32 chunk_tile_index(i32 x, i32 y, i32 z){
+	return (z & WORLD_CHUNK_MASK_Z) * WORLD_CHUNK_PITCH_Z
+		+ (y & WORLD_CHUNK_MASK_Y) * WORLD_CHUNK_PITCH_Y
+		+ (x & WORLD_CHUNK_MASK_X);
+}
+
+static
+void world_rect_iter_begin_chunk(WorldRectIterator *it){
+	i32 chunk_x0 = it->chunk_x << WORLD_CHUNK_SHIFT_X;
+	i32 chunk_y0 = it->chunk_y << WORLD_CHUNK_SHIFT_Y;
+	i32 chunk_z0 = it->chunk_z << WORLD_CHUNK_SHIFT_Z;
+	i32 chunk_x1 = chunk_x0 + WORLD_CHUNK_MASK_X;
+	i32 chunk_y1 = chunk_y0 + WORLD_CHUNK_MASK_Y;
+	i32 chunk_z1 = chunk_z0 + WORLD_CHUNK_MASK_Z;
+	it->cx0 = (it->x0 > chunk_x0) ? it->x0 : chunk_x0;
+	it->cy0 = (it->y0 > chunk_y0) ? it->y0 : chunk_y0;
+	it->cz0 = (it->z0 > chunk_z0) ? it->z0 : chunk_z0;
+	it->cx1 = (it->x1 < chunk_x1) ? it->x1 : chunk_x1;
+	it->cy1 = (it->y1 < chunk_y1) ? it->y1 : chunk_y1;
+	it->cz1 = (it->z1 < chunk_z1) ? it->z1 : chunk_z1;
+	it->chunk = world_get_chunk(it->world, it->chunk_x, it->chunk_y, it->chunk_z);
+	it->x = it->cx0;
+	it->y = it->cy0;
+	it->z = it->cz0;
+}
+
+void world_rect_iter_begin(WorldRectIterator *it, World *world, WorldIterOrder order,
+		i32 x0, i32 y0, i32 z0, i32 x1, i32 y1, i32 z1){
+	it->world = world;
+	it->order = order;
+	it->done = (x0 > x1 || y0 > y1 || z0 > z1);
+	it->x0 = x0; it->y0 = y0; it->z0 = z0;
+	it->x1 = x1; it->y1 = y1; it->z1 = z1;
+	it->chunk_x = x0 >> WORLD_CHUNK_SHIFT_X;
+	it->chunk_y = y0 >> WORLD_CHUNK_SHIFT_Y;
+	it->chunk_z = z0 >> WORLD_CHUNK_SHIFT_Z;
+	it->chunk = NULL;
+	it->x = x0;
+	it->y = y0;
+	it->z = z0;
+	if(!it->done && order == WORLD_ITER_CHUNK_ROWS)
+		world_rect_iter_begin_chunk(it);
+}
+
+static
+bool world_rect_iter_next_chunk_row(WorldRectIterator *it, WorldTileRun *run){
+	run->x = it->cx0;
+	run->y = it->y;
+	run->z = it->z;
+	run->count = it->cx1 - it->cx0 + 1;
+	run->stride = 1;
+	run->tiles = NULL;
+	if(it->chunk)
+		run->tiles = &it->chunk[chunk_tile_index(it->cx0, it->y, it->z)];
+
+	it->y += 1;
+	if(it->y > it->cy1){
+		it->y = it->cy0;
+		it->z += 1;
+		if(it->z > it->cz1){
+			it->chunk_x += 1;
+			if((it->chunk_x << WORLD_CHUNK_SHIFT_X) > it->x1){
+				it->chunk_x = it->x0 >> WORLD_CHUNK_SHIFT_X;
+				it->chunk_y += 1;
+				if((it->chunk_y << WORLD_CHUNK_SHIFT_Y) > it->y1){
+					it->chunk_y = it->y0 >> WORLD_CHUNK_SHIFT_Y;
+					it->chunk_z += 1;
+					if((it->chunk_z << WORLD_CHUNK_SHIFT_Z) > it->z1){
+						it->done = true;
+						return true;
+					}
+				}
+			}
+			world_rect_iter_begin_chunk(it);
+		}
+	}
+	return true;
+}
+
+static
+bool world_rect_iter_next_column(WorldRectIterator *it, WorldTileRun *run){
+	i32 chunk_y = it->y >> WORLD_CHUNK_SHIFT_Y;
+	i32 run_end = ((chunk_y + 1) << WORLD_CHUNK_SHIFT_Y) - 1;
+	if(run_end > it->y1)
+		run_end = it->y1;
+
+	Tile *chunk = world_get_chunk(it->world,
+			it->x >> WORLD_CHUNK_SHIFT_X, chunk_y,
+			it->z >> WORLD_CHUNK_SHIFT_Z);
+	run->x = it->x;
+	run->y = it->y;
+	run->z = it->z;
+	run->count = run_end - it->y + 1;
+	run->stride = WORLD_CHUNK_PITCH_Y;
+	run->tiles = NULL;
+	if(chunk)
+		run->tiles = &chunk[chunk_tile_index(it->x, it->y, it->z)];
+
+	it->y = run_end + 1;
+	if(it->y > it->y1){
+		it->y = it->y0;
+		it->x += 1;
+		if(it->x > it->x1){
+			it->x = it->x0;
+			it->z += 1;
+			if(it->z > it->z1)
+				it->done = true;
+		}
+	}
+	return true;
+}
+
+bool world_rect_iter_next(WorldRectIterator *it, WorldTileRun *run){
+	if(it->done)
+		return false;
+	if(it->order == WORLD_ITER_CHUNK_ROWS)
+		return world_rect_iter_next_chunk_row(it, run);
+	else
+		return world_rect_iter_next_column(it, run);
+}
+
+// ----------------------------------------------------------------
+// Creature Index
+// ----------------------------------------------------------------
+CreatureIndex *creature_index_init(MemArena *arena, World *world, i32 max_creatures){
+	ASSERT(max_creatures > 0);
+	CreatureIndex *index = arena_alloc<CreatureIndex>(arena, 1);
+	index->num_cells_x = world->world_dim_in_chunks_x;
+	index->num_cells_y = world->world_dim_in_chunks_y;
+	index->num_cells_z = world->world_dim_in_chunks_z;
+
+	u32 num_cells = (u32)index->num_cells_x
+			* (u32)index->num_cells_y
+			* (u32)index->num_cells_z;
+	index->cell_heads = arena_alloc_init<i32>(arena, num_cells, -1);
+
+	index->max_nodes = max_creatures;
+	index->num_nodes = 0;
+	index->freelist_head = 0;
+	index->nodes = arena_alloc<CreatureIndexNode>(arena, max_creatures);
+	for(i32 i = 0; i < max_creatures; i += 1){
+		index->nodes[i].next = i + 1;
+		index->nodes[i].prev = -1;
+		index->nodes[i].creature = NULL;
+	}
+	index->nodes[max_creatures - 1].next = -1;
+	return index;
+}
+
+static
+bool creature_index_cell(CreatureIndex *index, WorldPosition pos, u32 *out_cell){
+	u32 cell_x = (u32)pos.x >> WORLD_CHUNK_SHIFT_X;
+	u32 cell_y = (u32)pos.y >> WORLD_CHUNK_SHIFT_Y;
+	u32 cell_z = (u32)pos.z >> WORLD_CHUNK_SHIFT_Z;
+	if(cell_x >= index->num_cells_x
+	|| cell_y >= index->num_cells_y
+	|| cell_z >= index->num_cells_z)
+		return false;
+
+	u32 cell_pitch_y = index->num_cells_x;
+	u32 cell_pitch_z = (u32)index->num_cells_x * (u32)index->num_cells_y;
+	*out_cell = cell_z * cell_pitch_z + cell_y * cell_pitch_y + cell_x;
+	return true;
+}
+
+static
+void creature_index_link(CreatureIndex *index, i32 n, u32 cell){
+	CreatureIndexNode *node = &index->nodes[n];
+	i32 head = index->cell_heads[cell];
+	node->cell = cell;
+	node->prev = -1;
+	node->next = head;
+	if(head != -1)
+		index->nodes[head].prev = n;
+	index->cell_heads[cell] = n;
+}
+
+static
+void creature_index_unlink(CreatureIndex *index, i32 n){
+	CreatureIndexNode *node = &index->nodes[n];
+	if(node->prev != -1)
+		index->nodes[node->prev].next = node->next;
+	else
+		index->cell_heads[node->cell] = node->next;
+	if(node->next != -1)
+		index->nodes[node->next].prev = node->prev;
+}
+
+bool creature_index_insert(CreatureIndex *index, Creature *creature){
+	u32 cell;
+	if(!creature_index_cell(index, creature->pos, &cell))
+		return false;
+
+	i32 n = index->freelist_head;
+	if(n == -1){
+		LOG_ERROR("creature index is full (max_nodes = %d)", index->max_nodes);
+		return false;
+	}
+	index->freelist_head = index->nodes[n].next;
+	index->num_nodes += 1;
+
+	CreatureIndexNode *node = &index->nodes[n];
+	node->pos = creature->pos;
+	node->creature = creature;
+	creature_index_link(index, n, cell);
+	creature->index_node = n;
+	return true;
+}
+
+void creature_index_remove(CreatureIndex *index, Creature *creature){
+	i32 n = creature->index_node;
+	ASSERT(n >= 0 && n < index->max_nodes);
+	ASSERT(index->nodes[n].creature == creature);
+	creature_index_unlink(index, n);
+
+	CreatureIndexNode *node = &index->nodes[n];
+	node->creature = NULL;
+	node->prev = -1;
+	node->next = index->freelist_head;
+	index->freelist_head = n;
+	index->num_nodes -= 1;
+	creature->index_node = -1;
+}
+
+void creature_index_move(CreatureIndex *index, Creature *creature, WorldPosition pos){
+	i32 n = creature->index_node;
+	ASSERT(n >= 0 && n < index->max_nodes);
+	ASSERT(index->nodes[n].creature == creature);
+
+	// NOTE: Creatures can't leave the world so failing here is a bug
+	// in whoever is moving the creature.
+	u32 cell;
+	if(!creature_index_cell(index, pos, &cell))
+		PANIC("moving creature %08X outside the world", creature->id);
+
+	// NOTE: Most steps don't cross a cell boundary so we only need to
+	// update the position in that case.
+	CreatureIndexNode *node = &index->nodes[n];
+	if(node->cell != cell){
+		creature_index_unlink(index, n);
+		creature_index_link(index, n, cell);
+	}
+	node->pos = pos;
+	creature->pos = pos;
+}
+
+// NOTE: Whether there's any creature at `pos`. Same as a query on a single
+// position but stops at the first match, for tile occupancy checks.
+bool creature_index_occupied(CreatureIndex *index, WorldPosition pos){
+	u32 cell;
+	if(!creature_index_cell(index, pos, &cell))
+		return false;
+
+	i32 n = index->cell_heads[cell];
+	while(n != -1){
+		CreatureIndexNode *node = &index->nodes[n];
+		if(world_position_equals(node->pos, pos))
+			return true;
+		n = node->next;
+	}
+	return false;
+}
+
+// NOTE: Creatures on the same position are ordered by id so that the
+// order (and thus the stack position sent to clients) doesn't depend on
+// the order they were collected.
+static INLINE
+bool creature_query_result_less(CreatureQueryResult *a, CreatureQueryResult *b){
+	if(a->key != b->key)
+		return a->key < b->key;
+	return a->creature->id < b->creature->id;
+}
+
+static
+int creature_query_result_cmp(const void *a, const void *b){
+	CreatureQueryResult *result_a = (CreatureQueryResult*)a;
+	CreatureQueryResult *result_b = (CreatureQueryResult*)b;
+	if(creature_query_result_less(result_a, result_b))
+		return -1;
+	else if(creature_query_result_less(result_b, result_a))
+		return 1;
+	return 0;
+}
+
+static
+void creature_query_sort(CreatureQueryResult *results, i32 num_results){
+	// NOTE: Most queries return just a handful of creatures so an
+	// insertion sort is the way to go. We only fallback to qsort on
+	// crowded areas like depots or temples.
+	if(num_results > 32){
+		qsort(results, num_results, sizeof(CreatureQueryResult),
+			creature_query_result_cmp);
+		return;
+	}
+
+	for(i32 i = 1; i < num_results; i += 1){
+		CreatureQueryResult tmp = results[i];
+		i32 j = i - 1;
+		while(j >= 0 && creature_query_result_less(&tmp, &results[j])){
+			results[j + 1] = results[j];
+			j -= 1;
+		}
+		results[j + 1] = tmp;
+	}
+}
+
+i32 creature_index_query(CreatureIndex *index, WorldArea area,
+		CreatureQueryResult *results, i32 max_results){
+	if(area.min.x > area.max.x
+	|| area.min.y > area.max.y
+	|| area.min.z > area.max.z)
+		return 0;
+
+	u32 cell_x0 = (u32)area.min.x >> WORLD_CHUNK_SHIFT_X;
+	u32 cell_y0 = (u32)area.min.y >> WORLD_CHUNK_SHIFT_Y;
+	u32 cell_z0 = (u32)area.min.z >> WORLD_CHUNK_SHIFT_Z;
+	u32 cell_x1 = (u32)area.max.x >> WORLD_CHUNK_SHIFT_X;
+	u32 cell_y1 = (u32)area.max.y >> WORLD_CHUNK_SHIFT_Y;
+	u32 cell_z1 = (u32)area.max.z >> WORLD_CHUNK_SHIFT_Z;
+	if(cell_x1 >= index->num_cells_x) cell_x1 = index->num_cells_x - 1;
+	if(cell_y1 >= index->num_cells_y) cell_y1 = index->num_cells_y - 1;
+	if(cell_z1 >= index->num_cells_z) cell_z1 = index->num_cells_z - 1;
+
+	u32 cell_pitch_y = index->num_cells_x;
+	u32 cell_pitch_z = (u32)index->num_cells_x * (u32)index->num_cells_y;
+	i32 num_results = 0;
+	for(u32 cell_z = cell_z0; cell_z <= cell_z1; cell_z += 1)
+	for(u32 cell_y = cell_y0; cell_y <= cell_y1; cell_y += 1)
+	for(u32 cell_x = cell_x0; cell_x <= cell_x1; cell_x += 1){
+		u32 cell = cell_z * cell_pitch_z + cell_y * cell_pitch_y + cell_x;
+		i32 n = index->cell_heads[cell];
+		while(n != -1){
+			CreatureIndexNode *node = &index->nodes[n];
+			if(world_area_contains(area, node->pos)){
+				if(num_results >= max_results){
+					LOG_ERROR("query results truncated (max_results = %d)", max_results);
+					goto done;
+				}
+				results[num_results].key = world_position_key(node->pos);
+				results[num_results].creature = node->creature;
+				num_results += 1;
+			}
+			n = node->next;
+		}
+	}
+
+done:
+	creature_query_sort(results, num_results);
+	return num_results;
+}
+
+#if BUILD_TEST
+// NOTE: Brute force version of creature_index_query over every creature
+// that is in the index, sorted with qsort instead.
+static
+i32 creature_index_test_query(Creature *creatures, i32 num_creatures,
+		WorldArea area, CreatureQueryResult *results){
+	i32 num_results = 0;
+	for(i32 i = 0; i < num_creatures; i += 1){
+		Creature *creature = &creatures[i];
+		if(creature->index_node != -1 && world_area_contains(area, creature->pos)){
+			results[num_results].key = world_position_key(creature->pos);
+			results[num_results].creature = creature;
+			num_results += 1;
+		}
+	}
+	qsort(results, num_results, sizeof(CreatureQueryResult), creature_query_result_cmp);
+	return num_results;
+}
+
+static
+bool creature_index_test_check(CreatureIndex *index,
+		Creature *creatures, i32 num_creatures, WorldArea area){
+	CreatureQueryResult results[256];
+	CreatureQueryResult expected[256];
+	ASSERT(num_creatures <= (i32)NARRAY(results));
+	i32 num_results = creature_index_query(index, area, results, NARRAY(results));
+	i32 num_expected = creature_index_test_query(creatures, num_creatures, area, expected);
+	if(num_results != num_expected)
+		return false;
+	for(i32 i = 0; i < num_results; i += 1){
+		if(results[i].key != expected[i].key
+		|| results[i].creature != expected[i].creature)
+			return false;
+	}
+	return true;
+}
+
+static
+WorldPosition creature_index_test_position(void){
+	// NOTE: Most creatures are kept in a few cells so they share cells,
+	// positions, and cross cell boundaries when moving.
+	WorldPosition pos;
+	pos.x = (u16)(rand() % 64);
+	pos.y = (u16)(rand() % 64);
+	pos.z = (u8)(6 + rand() % 3);
+	if(rand() % 8 == 0){
+		pos.x = (u16)(rand() % 256);
+		pos.y = (u16)(rand() % 256);
+		pos.z = (u8)(rand() % 16);
+	}
+	return pos;
+}
+
+bool creature_index_test(void){
+	bool passed = true;
+	MemArena *arena = arena_init(256 * 1024 * 1024, 4 * 1024 * 1024);
+	World world;
+	world_init_flat(arena, &world, 1);
+
+	Creature creatures[200];
+	i32 num_creatures = NARRAY(creatures);
+	CreatureIndex *index = creature_index_init(arena, &world, num_creatures);
+	for(i32 i = 0; i < num_creatures; i += 1){
+		memset(&creatures[i], 0, sizeof(Creature));
+		creatures[i].id = 0x40000000 + (u32)(num_creatures - i);
+		creatures[i].index_node = -1;
+	}
+
+	// NOTE: Positions outside the world aren't accepted.
+	creatures[0].pos = { 256, 10, 7 };
+	passed = passed && !creature_index_insert(index, &creatures[0]);
+	creatures[0].pos = { 10, 10, 16 };
+	passed = passed && !creature_index_insert(index, &creatures[0]);
+	passed = passed && creatures[0].index_node == -1 && index->num_nodes == 0;
+
+	// NOTE: A move across a cell boundary is found on the new cell only.
+	creatures[0].pos = { 15, 15, 7 };
+	passed = passed && creature_index_insert(index, &creatures[0]);
+	creature_index_move(index, &creatures[0], { 16, 16, 7 });
+	passed = passed && creature_index_occupied(index, { 16, 16, 7 });
+	passed = passed && !creature_index_occupied(index, { 15, 15, 7 });
+	passed = passed && creature_index_test_check(index, creatures, num_creatures,
+			{ { 0, 0, 7 }, { 15, 15, 7 } });
+	passed = passed && creature_index_test_check(index, creatures, num_creatures,
+			{ { 16, 16, 7 }, { 16, 16, 7 } });
+	creature_index_remove(index, &creatures[0]);
+	passed = passed && index->num_nodes == 0;
+
+	// NOTE: Random inserts, moves, and removes checked against a brute
+	// force query, with areas that go past the world bounds and creatures
+	// sharing positions (which come ordered by id).
+	srand(4321);
+	for(i32 i = 0; i < 100000 && passed; i += 1){
+		Creature *creature = &creatures[rand() % num_creatures];
+		i32 op = rand() % 8;
+		if(creature->index_node == -1){
+			creature->pos = creature_index_test_position();
+			passed = passed && creature_index_insert(index, creature);
+		}else if(op == 0){
+			creature_index_remove(index, creature);
+		}else if(op == 1){
+			creature_index_move(index, creature, creature_index_test_position());
+		}else{
+			WorldPosition pos = creature->pos;
+			i32 dx = rand() % 3 - 1;
+			i32 dy = rand() % 3 - 1;
+			if((pos.x + dx) >= 0 && (pos.x + dx) < 256) pos.x = (u16)(pos.x + dx);
+			if((pos.y + dy) >= 0 && (pos.y + dy) < 256) pos.y = (u16)(pos.y + dy);
+			creature_index_move(index, creature, pos);
+		}
+
+		WorldArea area;
+		area.min = creature_index_test_position();
+		area.max.x = (u16)(area.min.x + rand() % 40);
+		area.max.y = (u16)(area.min.y + rand() % 40);
+		area.max.z = (u8)(area.min.z + rand() % 3);
+		if(i % 100 == 0){
+			area.max.x = 0xFFFF;
+			area.max.y = 0xFFFF;
+			area.max.z = 0xFF;
+		}
+		passed = passed && creature_index_test_check(index, creatures, num_creatures, area);
+
+		WorldPosition pos = creature_index_test_position();
+		WorldArea tile = { pos, pos };
+		CreatureQueryResult results[256];
+		passed = passed && creature_index_occupied(index, pos)
+				== (creature_index_test_query(creatures, num_creatures, tile, results) > 0);
+	}
+
+	i32 num_inserted = 0;
+	for(i32 i = 0; i < num_creatures; i += 1){
+		if(creatures[i].index_node != -1)
+			num_inserted += 1;
+	}
+	passed = passed && index->num_nodes == num_inserted;
+	debug_printf("creature index test: %s\n", (passed ? "passed" : "failed"));
+	return passed;
+}
+#endif //BUILD_TEST
+
+// ----------------------------------------------------------------
+// Map Description
+// ----------------------------------------------------------------
+
+// NOTE: Players and creatures are kept in the creature index so we need
+// to merge both tiles and creatures before sending world data to the
+// client. We query the creatures on each floor we're sending, which come
+// sorted by position, and since tiles are iterated in the same order we
+// only need to check the creature at the front of the sorted list to
+// know if it is on the tile being sent.
+//	Tiles are iterated column by column (x major then y) which is the
+// order expected by the client, using the rect iterator so that chunks
+// are only resolved once for each run of tiles inside the same chunk.
+//	Empty tiles (or tiles in missing chunks) are not sent. Instead we
+// send a skip count (0xFF00 | count) before the next tile with data, up
+// to 0xFE tiles per skip.
+
+#include "packet.hh"
+
+#define MAX_DESCRIPTION_CREATURES 256
+#define MAX_TILE_THINGS 10
+
+static
+void known_creatures_lru_unlink(KnownCreatures *known, i32 index){
+	u8 prev = known->lru_prev[index];
+	u8 next = known->lru_next[index];
+	if(index == known->lru_head)
+		known->lru_head = next;
+	else
+		known->lru_next[prev] = next;
+
+	if(index == known->lru_tail)
+		known->lru_tail = prev;
+	else
+		known->lru_prev[next] = prev;
+}
+
+static
+void known_creatures_lru_push_front(KnownCreatures *known, i32 index){
+	if(known->num_known == 1){
+		known->lru_head = (u8)index;
+		known->lru_tail = (u8)index;
+		return;
+	}
+	known->lru_prev[index] = 0;
+	known->lru_next[index] = known->lru_head;
+	known->lru_prev[known->lru_head] = (u8)index;
+	known->lru_head = (u8)index;
+}
+
+// NOTE: Returns true if the client already knows the creature. Otherwise
+// the creature is added to the set and, if the set was full, the least
+// recently used creature is replaced and returned in `out_removed_id` so
+// the client can remove it from its own cache. Either way the creature is
+// now the most recently used.
+bool known_creatures_use(KnownCreatures *known, u32 creature_id, u32 *out_removed_id){
+	i32 num_known = known->num_known;
+	for(i32 i = 0; i < num_known; i += 1){
+		if(known->ids[i] == creature_id){
+			if(i != known->lru_head){
+				known_creatures_lru_unlink(known, i);
+				known_creatures_lru_push_front(known, i);
+			}
+			*out_removed_id = 0;
+			return true;
+		}
+	}
+
+	if(num_known < KNOWN_CREATURES_MAX){
+		known->ids[num_known] = creature_id;
+		known->num_known = num_known + 1;
+		known_creatures_lru_push_front(known, num_known);
+		*out_removed_id = 0;
+	}else{
+		i32 victim = known->lru_tail;
+		*out_removed_id = known->ids[victim];
+		known->ids[victim] = creature_id;
+		if(victim != known->lru_head){
+			known_creatures_lru_unlink(known, victim);
+			known_creatures_lru_push_front(known, victim);
+		}
+	}
+	return false;
+}
+
+// NOTE: The schema for a creature the client doesn't know yet. A known
+// creature is sent without the remove id, name, and war emblem so this
+// is also an upper bound for it.
+typedef PacketSchema<
+	PacketFieldU16,			// 0x61 (unknown) or 0x62 (known)
+	PacketFieldU32,			// remove known
+	PacketFieldU32,			// creature id
+	PacketFieldStr<31>,		// name
+	PacketFieldU8,			// health percent
+	PacketFieldU8,			// direction
+	PacketFieldU16,			// look type
+	PacketFieldU8,			// look head
+	PacketFieldU8,			// look body
+	PacketFieldU8,			// look legs
+	PacketFieldU8,			// look feet
+	PacketFieldU8,			// look addons
+	PacketFieldU8,			// light level
+	PacketFieldU8,			// light color
+	PacketFieldU16,			// speed
+	PacketFieldU8,			// skull
+	PacketFieldU8,			// party shield
+	PacketFieldU8,			// war emblem
+	PacketFieldU8			// blocks path
+> CreatureSchema;
+static_assert(CreatureSchema::max_size == PACKET_CREATURE_MAX_SIZE,
+	"PACKET_CREATURE_MAX_SIZE is out of sync with CreatureSchema");
+
+void packet_write_creature(OutPacket *p, KnownCreatures *known, Creature *creature){
+	// NOTE: Check for space before touching the known creatures or the
+	// client could end up not knowing a creature we think it knows.
+	if(!packet_reserve<CreatureSchema>(p))
+		return;
+
+	u32 removed_id;
+	bool is_known = known_creatures_use(known, creature->id, &removed_id);
+	if(is_known){
+		packet_store_u16(p, 0x62);
+		packet_store_u32(p, creature->id);
+	}else{
+		packet_store_u16(p, 0x61);
+		packet_store_u32(p, removed_id);		// remove known
+		packet_store_u32(p, creature->id);
+		packet_store_str(p, creature->name, 31);
+	}
+	packet_store_u8(p, creature->health_percent);
+	packet_store_u8(p, creature->direction);
+	packet_store_u16(p, creature->outfit.look_type);
+	packet_store_u8(p, creature->outfit.look_head);
+	packet_store_u8(p, creature->outfit.look_body);
+	packet_store_u8(p, creature->outfit.look_legs);
+	packet_store_u8(p, creature->outfit.look_feet);
+	packet_store_u8(p, creature->outfit.look_addons);
+	packet_store_u8(p, creature->light_level);
+	packet_store_u8(p, creature->light_color);
+	packet_store_u16(p, creature->speed);
+	packet_store_u8(p, creature->skull);
+	packet_store_u8(p, creature->party_shield);
+	if(!is_known)
+		packet_store_u8(p, creature->war_emblem);
+	packet_store_u8(p, creature->blocks_path);
+}
+
+static INLINE
+void description_skip_tile(OutPacket *p, i32 *skip){
+	if(*skip == 0xFE){
+		packet_write_u16(p, 0xFFFF);
+		*skip = -1;
+	}else{
+		*skip += 1;
+	}
+}
+
+static
+void description_write_tile(OutPacket *p, const BaseItemTable *items,
+		KnownCreatures *known, Tile *tile, u64 key, CreatureQueryResult *creatures,
+		i32 num_creatures, i32 *creature_ptr, i32 *skip){
+	if(*skip >= 0){
+		packet_write_u8(p, (u8)*skip);
+		packet_write_u8(p, 0xFF);
+	}
+	*skip = 0;
+
+	// NOTE: Creatures on positions we have already passed were on empty
+	// tiles so the client wouldn't be able to display them anyways.
+	i32 ptr = *creature_ptr;
+	while(ptr < num_creatures && creatures[ptr].key < key)
+		ptr += 1;
+
+	// TODO: Items should be sent in their proper stack order (top items,
+	// creatures, then bottom items) using the top order from the base items.
+	// For now tile items are assumed to be already in stack order.
+	i32 num_things = 0;
+	for(i32 i = 0; i < tile->num_items && num_things < MAX_TILE_THINGS; i += 1){
+		packet_write_u16(p, base_item_client_id(items, tile->items[i].id));
+		num_things += 1;
+	}
+
+	while(ptr < num_creatures && creatures[ptr].key == key){
+		if(num_things < MAX_TILE_THINGS){
+			packet_write_creature(p, known, creatures[ptr].creature);
+			num_things += 1;
+		}
+		ptr += 1;
+	}
+	*creature_ptr = ptr;
+}
+
+static
+i32 description_query_creatures(CreatureIndex *creature_index,
+		i32 x, i32 y, i32 z, i32 width, i32 height,
+		CreatureQueryResult *creatures, i32 max_creatures){
+	if(!creature_index)
+		return 0;
+
+	i32 x0 = x, y0 = y;
+	i32 x1 = x + width - 1, y1 = y + height - 1;
+	if(x0 < 0) x0 = 0;
+	if(y0 < 0) y0 = 0;
+	if(x1 > 0xFFFF) x1 = 0xFFFF;
+	if(y1 > 0xFFFF) y1 = 0xFFFF;
+	if(x0 > x1 || y0 > y1)
+		return 0;
+
+	WorldArea area;
+	area.min.x = (u16)x0;
+	area.min.y = (u16)y0;
+	area.min.z = (u8)z;
+	area.max.x = (u16)x1;
+	area.max.y = (u16)y1;
+	area.max.z = (u8)z;
+	return creature_index_query(creature_index, area, creatures, max_creatures);
+}
+
+static
+void describe_floor(World *world, CreatureIndex *creature_index,
+		KnownCreatures *known, i32 x, i32 y, i32 z, i32 width, i32 height,
+		OutPacket *p, i32 *skip){
+	CreatureQueryResult creatures[MAX_DESCRIPTION_CREATURES];
+	i32 num_creatures = description_query_creatures(creature_index,
+			x, y, z, width, height, creatures, NARRAY(creatures));
+	i32 creature_ptr = 0;
+
+	WorldRectIterator it;
+	WorldTileRun run;
+	world_rect_iter_begin(&it, world, WORLD_ITER_COLUMNS,
+		x, y, z, x + width - 1, y + height - 1, z);
+	while(world_rect_iter_next(&it, &run)){
+		if(!run.tiles){
+			for(i32 i = 0; i < run.count; i += 1)
+				description_skip_tile(p, skip);
 			continue;
+		}
+
+		Tile *tile = run.tiles;
+		for(i32 i = 0; i < run.count; i += 1, tile += run.stride){
+			if(tile->num_items > 0){
+				WorldPosition pos = { (u16)run.x, (u16)(run.y + i), (u8)run.z };
+				description_write_tile(p, world->base_items, known, tile,
+					world_position_key(pos), creatures, num_creatures,
+					&creature_ptr, skip);
+			}else{
+				description_skip_tile(p, skip);
+			}
+		}
+	}
+}
+
+i32 world_get_creature_stackpos(World *world, CreatureIndex *creature_index, Creature *creature){
+	// NOTE: This must match the order in which things are sent with
+	// description_write_tile. Returns -1 if the creature isn't visible
+	// because there are too many things on the tile.
+	WorldPosition pos = creature->pos;
+	Tile *tile = world_get_tile_fast(world, pos.x, pos.y, pos.z);
+	i32 stackpos = (tile->num_items < MAX_TILE_THINGS) ? tile->num_items : MAX_TILE_THINGS;
+
+	WorldArea area = { pos, pos };
+	CreatureQueryResult creatures[MAX_DESCRIPTION_CREATURES];
+	i32 num_creatures = creature_index_query(creature_index,
+			area, creatures, NARRAY(creatures));
+	for(i32 i = 0; i < num_creatures; i += 1){
+		if(creatures[i].creature == creature)
+			return ((stackpos + i) < MAX_TILE_THINGS) ? (stackpos + i) : -1;
+	}
+	return -1;
+}
+
+void world_get_area_description(World *world, CreatureIndex *creature_index,
+		KnownCreatures *known, i32 x, i32 y, i32 z, i32 width, i32 height,
+		OutPacket *outp){
+	PROFILE_ZONE("world_get_area_description");
+	// NOTE: Above ground (z <= 7) the client displays every floor from the
+	// surface down to the ground floor. Underground it displays two floors
+	// above and below the current one. Each floor is shifted by one tile
+	// per floor of distance to give the perspective effect.
+	i32 start_z, end_z, step_z;
+	if(z > 7){
+		start_z = z - 2;
+		end_z = (z + 2) < 15 ? (z + 2) : 15;
+		step_z = 1;
+	}else{
+		start_z = 7;
+		end_z = 0;
+		step_z = -1;
+	}
+
+	i32 skip = -1;
+	for(i32 nz = start_z; nz != (end_z + step_z); nz += step_z){
+		i32 offset = z - nz;
+		describe_floor(world, creature_index, known, x + offset, y + offset,
+			nz, width, height, outp, &skip);
+	}
 
-		creature_start := creature_ptr;
-		while(creatures[creature_ptr].pos == pos)
-			creature_ptr += 1;
-		creature_end := creature_ptr;
-		packet_append_tile(outp, tile, &creatures[creature_start], creature_end - creature_start);
+	if(skip >= 0){
+		packet_write_u8(outp, (u8)skip);
+		packet_write_u8(outp, 0xFF);
 	}
 }
-*/
 
+#if BUILD_TEST
+#include "base_data.hh"
+
+// NOTE: This is the straightforward version of describe_floor that calls
+// world_get_tile for every tile. It is only used to compare against.
+static
+void describe_floor_naive(World *world, CreatureIndex *creature_index,
+		KnownCreatures *known, i32 x, i32 y, i32 z, i32 width, i32 height,
+		OutPacket *p, i32 *skip){
+	CreatureQueryResult creatures[MAX_DESCRIPTION_CREATURES];
+	i32 num_creatures = description_query_creatures(creature_index,
+			x, y, z, width, height, creatures, NARRAY(creatures));
+	i32 creature_ptr = 0;
+	for(i32 tx = x; tx < (x + width); tx += 1)
+	for(i32 ty = y; ty < (y + height); ty += 1){
+		Tile *tile = world_get_tile(world, (u16)tx, (u16)ty, (u8)z);
+		if(tile && tile->num_items > 0){
+			WorldPosition pos = { (u16)tx, (u16)ty, (u8)z };
+			description_write_tile(p, world->base_items, known, tile,
+				world_position_key(pos), creatures, num_creatures,
+				&creature_ptr, skip);
+		}else{
+			description_skip_tile(p, skip);
+		}
+	}
+}
+
+static
+void world_get_area_description_naive(World *world, CreatureIndex *creature_index,
+		KnownCreatures *known, i32 x, i32 y, i32 z, i32 width, i32 height,
+		OutPacket *outp){
+	i32 skip = -1;
+	for(i32 nz = 7; nz >= 0; nz -= 1){
+		i32 offset = z - nz;
+		describe_floor_naive(world, creature_index, known, x + offset, y + offset,
+			nz, width, height, outp, &skip);
+	}
+
+	if(skip >= 0){
+		packet_write_u8(outp, (u8)skip);
+		packet_write_u8(outp, 0xFF);
+	}
+}
+
+void world_description_bench(void){
+	MemArena *arena = arena_init(256 * 1024 * 1024, 4 * 1024 * 1024);
+	World world;
+	world_init_flat(arena, &world, 4526);
+	world_set_base_items(&world, &base_data.items);
+
+	// NOTE: Punch a few holes in the ground so we also exercise skips.
+	for(u16 i = 0; i < 256; i += 3)
+		world_get_tile(&world, i, (u16)((i * 7) & 0xFF), 7)->num_items = 0;
+
+	i32 num_creatures = 2000;
+	CreatureIndex *creature_index = creature_index_init(arena, &world, num_creatures);
+	Creature *creatures = arena_alloc<Creature>(arena, num_creatures);
+	for(i32 i = 0; i < num_creatures; i += 1){
+		memset(&creatures[i], 0, sizeof(Creature));
+		creatures[i].id = 0x40000000 + (u32)i;
+		creatures[i].pos.x = (u16)(rand() % 256);
+		creatures[i].pos.y = (u16)(rand() % 256);
+		creatures[i].pos.z = 7;
+		strcpy(creatures[i].name, "Rat");
+		creatures[i].outfit.look_type = 21;
+		creatures[i].client = NULL;
+		creature_index_insert(creature_index, &creatures[i]);
+	}
+
+	// NOTE: Both versions start with the same (empty) known creatures
+	// so they should stay in sync and generate the same output.
+	KnownCreatures known1 = {};
+	KnownCreatures known2 = {};
+	u8 buf1[16 * 1024];
+	u8 buf2[16 * 1024];
+	i32 num_iterations = 20000;
+	i64 naive_time = 0;
+	i64 chunked_time = 0;
+	i64 total_bytes = 0;
+	for(i32 i = 0; i < num_iterations; i += 1){
+		i32 x = 8 + rand() % 232;
+		i32 y = 6 + rand() % 236;
+		OutPacket p1 = { NULL, buf1, sizeof(buf1), 0 };
+		OutPacket p2 = { NULL, buf2, sizeof(buf2), 0 };
+
+		i64 t0 = sys_clock_monotonic_nsec();
+		world_get_area_description_naive(&world, creature_index,
+			&known1, x - 8, y - 6, 7, 18, 14, &p1);
+		i64 t1 = sys_clock_monotonic_nsec();
+		world_get_area_description(&world, creature_index,
+			&known2, x - 8, y - 6, 7, 18, 14, &p2);
+		i64 t2 = sys_clock_monotonic_nsec();
+
+		naive_time += t1 - t0;
+		chunked_time += t2 - t1;
+		total_bytes += packet_written_len(&p2);
+		ASSERT(packet_ok(&p1) && packet_ok(&p2));
+		ASSERT(p1.bufpos == p2.bufpos);
+		ASSERT(memcmp(buf1, buf2, p1.bufpos) == 0);
+	}
+
+	debug_printf("area description (%d iterations, avg %lld bytes):\n",
+		num_iterations, (long long)(total_bytes / num_iterations));
+	debug_printf("    naive:   %lld ns/description\n", (long long)(naive_time / num_iterations));
+	debug_printf("    chunked: %lld ns/description\n", (long long)(chunked_time / num_iterations));
+}
+#endif //BUILD_TEST
@@ -39,26 +39,75 @@ struct BaseGround{
 #endif
 
 enum ItemType : u16 {
-	ITEM_TYPE_GROUND = 0,
+	ITEM_TYPE_NONE = 0,
+	ITEM_TYPE_GROUND,
+	ITEM_TYPE_CONTAINER,
+	ITEM_TYPE_SPLASH,
+	ITEM_TYPE_FLUID,
 	//ITEM_TYPE_EQUIPMENT,
 };
 
-struct BaseItem{
-	// NOTE: Every item has a name. Few items have plurals or descriptions
-	// so can get away with allocating them in a separate string buffer.
-	char name[32];
-	char *plural;
-	char *description;
+enum ItemFlags : u32 {
+	ITEM_FLAG_BLOCK_SOLID		= (1 << 0),
+	ITEM_FLAG_BLOCK_PROJECTILE	= (1 << 1),
+	ITEM_FLAG_BLOCK_PATH		= (1 << 2),
+	ITEM_FLAG_HAS_HEIGHT		= (1 << 3),
+	ITEM_FLAG_USEABLE			= (1 << 4),
+	ITEM_FLAG_PICKUPABLE		= (1 << 5),
+	ITEM_FLAG_MOVEABLE			= (1 << 6),
+	ITEM_FLAG_STACKABLE			= (1 << 7),
+	ITEM_FLAG_ALWAYS_ON_TOP		= (1 << 8),
+	ITEM_FLAG_READABLE			= (1 << 9),
+	ITEM_FLAG_ROTATABLE			= (1 << 10),
+	ITEM_FLAG_HANGABLE			= (1 << 11),
+	ITEM_FLAG_LOOKTHROUGH		= (1 << 12),
+	ITEM_FLAG_FLOOR_CHANGE		= (1 << 13),
+};
+
+// NOTE: Base items and monsters are compiled into the server from tables
+// generated by otcvt (see base_data.hh) so they're never built at runtime
+// and must stay literal types (no constructors, only const pointers).
+//	Base items are split by how often they're accessed. Movement, pathing
+// and map descriptions only need the hot arrays, which are indexed by
+// server id and packed tightly so a scan over a tile's items touches a
+// cache line or two. Names and descriptions are only needed when looking
+// at items so they live in a separate cold array.
 
-	u32 flags;
-	u16 client_id;
+struct BaseItemInfo{
+	char name[32];
+	const char *plural;
+	const char *description;
 	ItemType type;
+};
+
+// NOTE: The tables are indexed by server id and have `num_items` entries,
+// one past the largest server id.
+struct BaseItemTable{
+	u32 num_items;
 
-	union{
-		struct{ u16 speed; } ground;
-	};
+	// NOTE: Hot data.
+	const u32 *flags;
+	const u16 *ground_speed;
+	const u16 *client_id;
+	const u8 *top_order;
+
+	// NOTE: Cold data.
+	const BaseItemInfo *info;
 };
 
+// NOTE: Ids outside the table are treated as an empty item (no flags,
+// client id zero) since the world and the base items are loaded from
+// different files.
+static INLINE
+u32 base_item_flags(const BaseItemTable *items, u16 id){
+	return (id < items->num_items) ? items->flags[id] : 0;
+}
+
+static INLINE
+u16 base_item_client_id(const BaseItemTable *items, u16 id){
+	return (id < items->num_items) ? items->client_id[id] : 0;
+}
+
 // TODO: An item is basically and ID to the base item and for items that
 // are stackable, have some custom text, have teleport coordinates, is a
 // container, etc... they need some extra piece of state. We gonna stick
@@ -79,20 +128,394 @@ struct Tile{
 	Item items[4];
 };
 
+struct WorldPosition{
+	u16 x;
+	u16 y;
+	u8 z;
+};
+
+// NOTE: Both min and max are inclusive.
+struct WorldArea{
+	WorldPosition min;
+	WorldPosition max;
+};
+
+static INLINE
+bool world_position_equals(WorldPosition a, WorldPosition b){
+	return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+static INLINE
+bool world_area_contains(WorldArea area, WorldPosition pos){
+	return pos.x >= area.min.x && pos.x <= area.max.x
+		&& pos.y >= area.min.y && pos.y <= area.max.y
+		&& pos.z >= area.min.z && pos.z <= area.max.z;
+}
+
+// NOTE: This is the order in which the client expects tiles when
+// describing a floor (x major then y) so sorting by this key is the
+// same as sorting creatures in the order we're sending tiles.
+static INLINE
+u64 world_position_key(WorldPosition pos){
+	return ((u64)pos.z << 32) | ((u64)pos.x << 16) | (u64)pos.y;
+}
+
+// NOTE: Chunk dimensions are fixed at compile time and must be powers of
+// two so that splitting a position into chunk and tile coordinates is just
+// a shift and a mask. World files must be converted with the same chunk
+// dimensions.
+#define WORLD_CHUNK_SHIFT_X 4
+#define WORLD_CHUNK_SHIFT_Y 4
+#define WORLD_CHUNK_SHIFT_Z 0
+#define WORLD_CHUNK_DIM_X (1 << WORLD_CHUNK_SHIFT_X)
+#define WORLD_CHUNK_DIM_Y (1 << WORLD_CHUNK_SHIFT_Y)
+#define WORLD_CHUNK_DIM_Z (1 << WORLD_CHUNK_SHIFT_Z)
+#define WORLD_CHUNK_MASK_X (WORLD_CHUNK_DIM_X - 1)
+#define WORLD_CHUNK_MASK_Y (WORLD_CHUNK_DIM_Y - 1)
+#define WORLD_CHUNK_MASK_Z (WORLD_CHUNK_DIM_Z - 1)
+#define WORLD_CHUNK_PITCH_Y WORLD_CHUNK_DIM_X
+#define WORLD_CHUNK_PITCH_Z (WORLD_CHUNK_DIM_X * WORLD_CHUNK_DIM_Y)
+#define WORLD_NUM_TILES_PER_CHUNK (WORLD_CHUNK_DIM_X * WORLD_CHUNK_DIM_Y * WORLD_CHUNK_DIM_Z)
+
 struct World{
-	u16 chunk_dim_x;
-	u16 chunk_dim_y;
-	u8 chunk_dim_z;
 	u16 world_dim_in_chunks_x;
 	u16 world_dim_in_chunks_y;
 	u8 world_dim_in_chunks_z;
-	u32 num_tiles_per_chunk;
 
+	// NOTE: `empty_chunk` is the dense index of an always empty chunk at
+	// the end of the dense array. Chunks that aren't present in the world
+	// point to it in the sparse array.
+	u32 empty_chunk;
 	Tile *dense_array;
 	u32 *sparse_array;
+
+	// NOTE: Each dense chunk has a version that is bumped whenever one of
+	// its tiles is modified through world_modify_tile. The world saver uses
+	// it to find the chunks that changed since it last saved them (see
+	// world_save.hh).
+	u32 *chunk_versions;
+
+	// NOTE: Set by the game once the world is loaded (world_set_base_items).
+	// Needed to map items to their client ids in map descriptions and to
+	// build `tile_flags` (see Tile Flags below).
+	const BaseItemTable *base_items;
+	u8 *tile_flags;
 };
 
 void world_load(MemArena *arena, World *world, const char *filename);
+void world_init_flat(MemArena *arena, World *world, u16 ground_id);
+
+// NOTE: Returns the offset of a tile in the dense array. Positions outside
+// the world or in missing chunks resolve to a tile in the empty chunk. This
+// is done with selects instead of branches so lookups don't suffer from
+// branch mispredictions on random access.
+static INLINE
+usize world_tile_offset(World *world, u16 x, u16 y, u8 z){
+	u32 chunk_x = (u32)x >> WORLD_CHUNK_SHIFT_X;
+	u32 chunk_y = (u32)y >> WORLD_CHUNK_SHIFT_Y;
+	u32 chunk_z = (u32)z >> WORLD_CHUNK_SHIFT_Z;
+	u32 tile_index = ((u32)z & WORLD_CHUNK_MASK_Z) * WORLD_CHUNK_PITCH_Z
+			+ ((u32)y & WORLD_CHUNK_MASK_Y) * WORLD_CHUNK_PITCH_Y
+			+ ((u32)x & WORLD_CHUNK_MASK_X);
+
+	u32 world_dim_in_chunks_x = (u32)world->world_dim_in_chunks_x;
+	u32 world_dim_in_chunks_y = (u32)world->world_dim_in_chunks_y;
+	u32 world_dim_in_chunks_z = (u32)world->world_dim_in_chunks_z;
+	u32 in_bounds = (u32)(chunk_x < world_dim_in_chunks_x)
+			& (u32)(chunk_y < world_dim_in_chunks_y)
+			& (u32)(chunk_z < world_dim_in_chunks_z);
+	u32 in_bounds_mask = 0 - in_bounds;
+
+	// NOTE: Out of bounds positions read the first sparse entry (which
+	// always exists) and then get masked into the empty chunk.
+	u32 chunk_index = (chunk_z * world_dim_in_chunks_y + chunk_y)
+			* world_dim_in_chunks_x + chunk_x;
+	u32 chunk_dense_index = world->sparse_array[chunk_index & in_bounds_mask];
+	chunk_dense_index = (chunk_dense_index & in_bounds_mask)
+			| (world->empty_chunk & ~in_bounds_mask);
+	return (usize)chunk_dense_index * WORLD_NUM_TILES_PER_CHUNK + tile_index;
+}
+
+// NOTE: The fast version never returns NULL but the returned tile may be a
+// tile from the empty chunk which must NOT be modified. Use it for read-only
+// queries where an empty tile is as good as no tile.
+static INLINE
+Tile *world_get_tile_fast(World *world, u16 x, u16 y, u8 z){
+	return &world->dense_array[world_tile_offset(world, x, y, z)];
+}
+
 Tile *world_get_tile(World *world, u16 x, u16 y, u8 z);
+Tile *world_modify_tile(World *world, u16 x, u16 y, u8 z);
+
+#if BUILD_TEST
+void world_get_tile_bench(void);
+#endif
+
+// ----------------------------------------------------------------
+// Tile Flags
+// ----------------------------------------------------------------
+
+// NOTE: Queries like walkability, pathfinding and projectile traces only
+// care about a few flags from the items on a tile, so each tile has a one
+// byte summary in `tile_flags`, parallel to the dense array (same index).
+// It's rebuilt when the base items are set and updated whenever items are
+// added or removed through world_add_item/world_remove_item. Tiles that
+// are modified directly (world_modify_tile) must be refreshed with
+// world_update_tile_flags.
+//	Since tiles along x are contiguous inside a chunk, so are their flags
+// and a row can be tested eight tiles at a time (see world_scan_row).
+
+enum TileFlags : u8 {
+	TILE_FLAG_EMPTY				= (1 << 0),	// no items, including missing chunks
+	TILE_FLAG_BLOCK_SOLID		= (1 << 1),
+	TILE_FLAG_BLOCK_PATH		= (1 << 2),
+	TILE_FLAG_BLOCK_PROJECTILE	= (1 << 3),
+	TILE_FLAG_HAS_HEIGHT		= (1 << 4),
+	TILE_FLAG_FLOOR_CHANGE		= (1 << 5),
+};
+
+#define TILE_FLAGS_NOT_WALKABLE (TILE_FLAG_EMPTY | TILE_FLAG_BLOCK_SOLID)
+
+void world_set_base_items(World *world, const BaseItemTable *items);
+void world_update_tile_flags(World *world, Tile *tile);
+bool world_add_item(World *world, u16 x, u16 y, u8 z, Item item);
+bool world_remove_item(World *world, u16 x, u16 y, u8 z, i32 index);
+u32 world_scan_row(World *world, u16 x, u16 y, u8 z, i32 count, u8 mask);
+
+static INLINE
+u8 world_get_tile_flags(World *world, u16 x, u16 y, u8 z){
+	return world->tile_flags[world_tile_offset(world, x, y, z)];
+}
+
+static INLINE
+bool world_tile_walkable(World *world, u16 x, u16 y, u8 z){
+	return (world_get_tile_flags(world, x, y, z) & TILE_FLAGS_NOT_WALKABLE) == 0;
+}
+
+#if BUILD_TEST
+bool world_tile_flags_test(void);
+#endif
+
+// ----------------------------------------------------------------
+// World Iterator
+// ----------------------------------------------------------------
+
+// NOTE: For bulk scans (map descriptions, area effects, decay sweeps, etc)
+// the rect iterator walks a box of tiles and yields runs of tiles that are
+// inside the same chunk so the chunk is only resolved once per run.
+//	With WORLD_ITER_CHUNK_ROWS, the box is walked chunk by chunk and each
+// run is a contiguous row of tiles along x (stride = 1). This is the most
+// cache friendly order and should be used whenever the order of tiles
+// doesn't matter.
+//	With WORLD_ITER_COLUMNS, the box is walked one floor at a time, x major
+// then y, which is the order the client expects tiles in map descriptions.
+// Each run is a column of tiles along y (stride = WORLD_CHUNK_PITCH_Y).
+//	Parts of the box that are outside the world or on missing chunks are
+// still yielded but with `tiles` set to NULL. The box is inclusive and may
+// extend outside the world.
+
+enum WorldIterOrder : u8 {
+	WORLD_ITER_CHUNK_ROWS = 0,
+	WORLD_ITER_COLUMNS,
+};
+
+struct WorldTileRun{
+	Tile *tiles;
+	i32 stride;
+	i32 count;
+	i32 x;
+	i32 y;
+	i32 z;
+};
+
+struct WorldRectIterator{
+	World *world;
+	WorldIterOrder order;
+	bool done;
+
+	// NOTE: The box being iterated.
+	i32 x0, y0, z0;
+	i32 x1, y1, z1;
+
+	// NOTE: The current chunk clipped to the box (for chunk rows).
+	i32 chunk_x, chunk_y, chunk_z;
+	i32 cx0, cy0, cz0;
+	i32 cx1, cy1, cz1;
+	Tile *chunk;
+
+	// NOTE: The start of the next run.
+	i32 x, y, z;
+};
+
+void world_rect_iter_begin(WorldRectIterator *it, World *world, WorldIterOrder order,
+		i32 x0, i32 y0, i32 z0, i32 x1, i32 y1, i32 z1);
+bool world_rect_iter_next(WorldRectIterator *it, WorldTileRun *run);
+
+// ----------------------------------------------------------------
+// Creature Index
+// ----------------------------------------------------------------
+
+// NOTE: Creatures are kept outside the tile grid in a separate grid with
+// one cell per world chunk (WORLD_CHUNK_DIM_*). Each cell has an intrusive doubly linked list
+// of nodes allocated from a fixed pool so moving a creature is O(1) and
+// querying an area is O(k) on the number of creatures in the cells that
+// overlap the area.
+//	The nodes keep a copy of the creature position so we don't need to
+// touch creature memory when filtering a cell.
+
+struct Outfit{
+	u16 look_type;
+	u8 look_head;
+	u8 look_body;
+	u8 look_legs;
+	u8 look_feet;
+	u8 look_addons;
+};
+
+struct BaseMonster{
+	char name[32];
+	u32 experience;
+	u16 health;
+	u16 speed;
+	Outfit outfit;
+	u16 corpse_id;
+};
+
+enum Direction : u8 {
+	DIRECTION_NORTH = 0,
+	DIRECTION_EAST,
+	DIRECTION_SOUTH,
+	DIRECTION_WEST,
+};
+
+struct Client;
+struct Creature{
+	u32 id;
+	WorldPosition pos;
+	i32 index_node;
+
+	// NOTE: The client controlling this creature or NULL if the creature
+	// isn't a player.
+	Client *client;
+
+	char name[32];
+	u8 health_percent;
+	u8 direction;
+	Outfit outfit;
+	u8 light_level;
+	u8 light_color;
+	u16 speed;
+	u8 skull;
+	u8 party_shield;
+	u8 war_emblem;
+	u8 blocks_path;
+};
+
+struct CreatureIndexNode{
+	WorldPosition pos;
+	u32 cell;
+	i32 next;
+	i32 prev;
+	Creature *creature;
+};
+
+struct CreatureIndex{
+	u16 num_cells_x;
+	u16 num_cells_y;
+	u8 num_cells_z;
+	i32 *cell_heads;
+
+	i32 max_nodes;
+	i32 num_nodes;
+	i32 freelist_head;
+	CreatureIndexNode *nodes;
+};
+
+struct CreatureQueryResult{
+	u64 key;
+	Creature *creature;
+};
+
+CreatureIndex *creature_index_init(MemArena *arena, World *world, i32 max_creatures);
+bool creature_index_insert(CreatureIndex *index, Creature *creature);
+void creature_index_remove(CreatureIndex *index, Creature *creature);
+void creature_index_move(CreatureIndex *index, Creature *creature, WorldPosition pos);
+bool creature_index_occupied(CreatureIndex *index, WorldPosition pos);
+i32 creature_index_query(CreatureIndex *index, WorldArea area,
+		CreatureQueryResult *results, i32 max_results);
+
+#if BUILD_TEST
+bool creature_index_test(void);
+#endif
+
+// ----------------------------------------------------------------
+// Map Description
+// ----------------------------------------------------------------
+// NOTE: The client keeps a cache of creatures it knows about so we can send
+// creatures it already knows by id only. We need to keep track of that same
+// set for each client so we know when to send the whole creature and which
+// creature the client should remove from its cache when it is full.
+//	The set is a flat array of ids with an intrusive LRU list of u8 indices
+// on the side so there are no allocations, finding an id is a linear scan
+// over 1KB of contiguous memory, and updating the LRU or picking a victim
+// is O(1). A zeroed KnownCreatures is an empty set.
+#define KNOWN_CREATURES_MAX 250
+static_assert(KNOWN_CREATURES_MAX < 256, "LRU indices are stored as u8");
+struct KnownCreatures{
+	i32 num_known;
+	u8 lru_head;	// most recently used
+	u8 lru_tail;	// least recently used
+	u8 lru_prev[KNOWN_CREATURES_MAX];
+	u8 lru_next[KNOWN_CREATURES_MAX];
+	u32 ids[KNOWN_CREATURES_MAX];
+};
+
+bool known_creatures_use(KnownCreatures *known, u32 creature_id, u32 *out_removed_id);
+
+// NOTE: This is the area the client displays relative to the player position
+// on the player's floor. The client displays 18x14 tiles with the player at
+// (8, 6) from the top-left corner.
+#define VIEWPORT_MIN_X 8
+#define VIEWPORT_MAX_X 9
+#define VIEWPORT_MIN_Y 6
+#define VIEWPORT_MAX_Y 7
+#define VIEWPORT_WIDTH (VIEWPORT_MIN_X + VIEWPORT_MAX_X + 1)
+#define VIEWPORT_HEIGHT (VIEWPORT_MIN_Y + VIEWPORT_MAX_Y + 1)
+
+static INLINE
+bool world_position_in_view(WorldPosition viewer, WorldPosition pos){
+	// NOTE: Above ground, the client displays floors 0 through 7. Underground
+	// it displays two floors above and below the current one.
+	if(viewer.z <= 7){
+		if(pos.z > 7)
+			return false;
+	}else if(((i32)viewer.z - (i32)pos.z) > 2 || ((i32)pos.z - (i32)viewer.z) > 2){
+		return false;
+	}
+
+	// NOTE: Each floor is shifted by one tile per floor of distance.
+	i32 offset = (i32)viewer.z - (i32)pos.z;
+	i32 x = (i32)pos.x - offset;
+	i32 y = (i32)pos.y - offset;
+	return x >= ((i32)viewer.x - VIEWPORT_MIN_X)
+		&& x <= ((i32)viewer.x + VIEWPORT_MAX_X)
+		&& y >= ((i32)viewer.y - VIEWPORT_MIN_Y)
+		&& y <= ((i32)viewer.y + VIEWPORT_MAX_Y);
+}
+
+// NOTE: Upper bound on the bytes written by packet_write_creature. It is
+// checked against the creature schema in world.cc.
+#define PACKET_CREATURE_MAX_SIZE 60
+
+struct OutPacket;
+void packet_write_creature(OutPacket *p, KnownCreatures *known, Creature *creature);
+i32 world_get_creature_stackpos(World *world, CreatureIndex *creature_index, Creature *creature);
+void world_get_area_description(World *world, CreatureIndex *creature_index,
+		KnownCreatures *known, i32 x, i32 y, i32 z, i32 width, i32 height,
+		OutPacket *outp);
+
+#if BUILD_TEST
+void world_description_bench(void);
+#endif
 
 #endif //KAPLAR_WORLD_HH_
\ No newline at end of file
@@ -0,0 +1,626 @@
+#include "world_save.hh"
+
+#include "buffer_util.hh"
+#include "crypto.hh"
+#include "file.hh"
+#include "metrics.hh"
+#include "profile.hh"
+
+#include <atomic>
+#include <stdio.h>
+
+#define WORLD_TILE_MAX_ITEMS ((i32)NARRAY(((Tile*)0)->items))
+
+// NOTE: Element sizes, not including the element header.
+#define WORLD_DELTA_BEGIN_SIZE (4 + 4 + 4)
+#define WORLD_DELTA_END_SIZE (4 + 4)
+#define WORLD_DELTA_MAX_CHUNK_SIZE (4 + WORLD_NUM_TILES_PER_CHUNK * (1 + 2 * WORLD_TILE_MAX_ITEMS))
+
+enum WorldSaverState : u32 {
+	WORLD_SAVER_IDLE = 0,
+	WORLD_SAVER_WRITING,
+	WORLD_SAVER_DONE,
+};
+
+// NOTE: The game thread owns the snapshot while the state is IDLE or DONE
+// and the writer thread owns it (along with the file) while it's WRITING.
+struct WorldSaver{
+	World *world;
+	char delta_file[256];
+	FILE *fp;
+	i64 file_size;
+	i64 max_file_size;
+	u32 sequence;
+
+	// NOTE: `chunk_offsets` is where the last saved copy of each dense
+	// chunk is in the delta file, or -1 if it was never saved. It belongs
+	// to the writer thread once it's started.
+	i64 *chunk_offsets;
+	i64 *compact_offsets;
+
+	// NOTE: `saved_versions` is the version of each dense chunk that is
+	// known to be on disk.
+	i64 interval;
+	i64 last_snapshot;
+	u32 scan_cursor;
+	u32 *saved_versions;
+
+	std::atomic<u32> state;
+	bool write_ok;
+	i32 max_chunks;
+	i32 num_chunks;
+	u32 *chunk_dense_indices;
+	u32 *chunk_versions;
+	i64 *chunk_write_offsets;
+	Tile *chunk_tiles;
+	u8 *write_buf;
+};
+
+// ----------------------------------------------------------------
+// Delta Elements
+// ----------------------------------------------------------------
+
+static
+i32 world_delta_encode_chunk(u8 *buf, u32 dense_index, Tile *tiles){
+	i32 pos = 8;
+	buffer_write_u32_le(buf + pos, dense_index);					pos += 4;
+	for(i32 i = 0; i < WORLD_NUM_TILES_PER_CHUNK; i += 1){
+		Tile *tile = &tiles[i];
+		ASSERT(tile->num_items >= 0 && tile->num_items <= WORLD_TILE_MAX_ITEMS);
+		buffer_write_u8(buf + pos, (u8)tile->num_items);			pos += 1;
+		for(i32 j = 0; j < tile->num_items; j += 1){
+			buffer_write_u16_le(buf + pos, tile->items[j].id);		pos += 2;
+		}
+	}
+	buffer_write_u32_le(buf + 0, KPB_ID_WORLD_DELTA_CHUNK);
+	buffer_write_u32_le(buf + 4, (u32)(pos - 8));
+	return pos;
+}
+
+static
+bool world_delta_decode_chunk(KPB_Element *elem, World *world,
+		u32 *out_dense_index, Tile *out_tiles){
+	u32 dense_index = kpb_element_read_u32(elem);
+	if(dense_index >= world->empty_chunk)
+		return false;
+
+	for(i32 i = 0; i < WORLD_NUM_TILES_PER_CHUNK; i += 1){
+		Tile *tile = &out_tiles[i];
+		memset(tile, 0, sizeof(Tile));
+		i32 num_items = kpb_element_read_u8(elem);
+		if(num_items > WORLD_TILE_MAX_ITEMS)
+			return false;
+		tile->num_items = num_items;
+		for(i32 j = 0; j < num_items; j += 1)
+			tile->items[j].id = kpb_element_read_u16(elem);
+	}
+	*out_dense_index = dense_index;
+	return kpb_element_remainder(elem) == 0;
+}
+
+// NOTE: Applies the chunks of a snapshot whose checksum was already
+// verified. `file_pos` is where the snapshot starts in the delta file.
+// Returns the number of chunks applied.
+static
+i32 world_delta_apply(WorldSaver *saver, u8 *buf, i32 len, i64 file_pos){
+	World *world = saver->world;
+	KPB_Element top = kpb_top_level(buf, len);
+	KPB_Element elem;
+	i32 num_chunks = 0;
+	while(1){
+		i32 elem_pos = top.bufpos;
+		if(!kpb_next_element(&top, &elem))
+			break;
+		if(elem.elem_id != KPB_ID_WORLD_DELTA_CHUNK)
+			continue;
+
+		u32 dense_index;
+		Tile tiles[WORLD_NUM_TILES_PER_CHUNK];
+		if(!world_delta_decode_chunk(&elem, world, &dense_index, tiles))
+			PANIC("\"%s\": invalid chunk in a valid snapshot", saver->delta_file);
+		memcpy(&world->dense_array[(usize)dense_index * WORLD_NUM_TILES_PER_CHUNK],
+			tiles, sizeof(tiles));
+		saver->chunk_offsets[dense_index] = file_pos + elem_pos;
+		num_chunks += 1;
+	}
+	return num_chunks;
+}
+
+static
+void world_delta_load(WorldSaver *saver){
+	World *world = saver->world;
+	i32 fsize;
+	u8 *fbuf = read_entire_file_temp(saver->delta_file, &fsize);
+	if(!fbuf){
+		LOG("no world delta file \"%s\", starting from the world file",
+			saver->delta_file);
+		return;
+	}
+
+	// NOTE: Snapshots must come in sequence. Anything that breaks it (a
+	// snapshot cut short or leftovers from a failed write) ends the log.
+	i32 num_snapshots = 0;
+	i32 num_chunks = 0;
+	i32 begin_pos = -1;
+	u32 begin_num_chunks = 0;
+	u32 group_num_chunks = 0;
+	KPB_Element top = kpb_top_level(fbuf, fsize);
+	KPB_Element elem;
+	while(1){
+		i32 elem_pos = top.bufpos;
+		if(!kpb_next_element(&top, &elem))
+			break;
+
+		if(elem.elem_id == KPB_ID_WORLD_DELTA_BEGIN){
+			if(begin_pos != -1 || kpb_element_remainder(&elem) != WORLD_DELTA_BEGIN_SIZE)
+				break;
+			u32 sequence = kpb_element_read_u32(&elem);
+			u32 num_dense_chunks = kpb_element_read_u32(&elem);
+			if(sequence != saver->sequence + 1)
+				break;
+			if(num_dense_chunks != world->empty_chunk){
+				PANIC("\"%s\": delta was made for a different world"
+					" (num_dense_chunks = %u, expected = %u)",
+					saver->delta_file, num_dense_chunks, world->empty_chunk);
+			}
+			begin_pos = elem_pos;
+			begin_num_chunks = kpb_element_read_u32(&elem);
+			group_num_chunks = 0;
+		}else if(elem.elem_id == KPB_ID_WORLD_DELTA_CHUNK){
+			if(begin_pos == -1)
+				break;
+			group_num_chunks += 1;
+		}else if(elem.elem_id == KPB_ID_WORLD_DELTA_END){
+			if(begin_pos == -1 || kpb_element_remainder(&elem) != WORLD_DELTA_END_SIZE)
+				break;
+			u32 sequence = kpb_element_read_u32(&elem);
+			u32 checksum = kpb_element_read_u32(&elem);
+			if(sequence != saver->sequence + 1
+			|| group_num_chunks != begin_num_chunks
+			|| adler32(fbuf + begin_pos, elem_pos - begin_pos) != checksum)
+				break;
+
+			num_chunks += world_delta_apply(saver, fbuf + begin_pos,
+					elem_pos - begin_pos, begin_pos);
+			num_snapshots += 1;
+			saver->sequence = sequence;
+			saver->file_size = top.bufpos;
+			begin_pos = -1;
+		}else{
+			break;
+		}
+	}
+
+	if(saver->file_size != fsize){
+		LOG_ERROR("\"%s\": dropping %d bytes after snapshot %u",
+			saver->delta_file, (i32)(fsize - saver->file_size), saver->sequence);
+	}
+	LOG("applied %d snapshots (%d chunks) from \"%s\"",
+		num_snapshots, num_chunks, saver->delta_file);
+	free(fbuf);
+}
+
+// ----------------------------------------------------------------
+// Writer
+// ----------------------------------------------------------------
+
+static
+bool world_saver_write(WorldSaver *saver){
+	// NOTE: The file is closed while it's being replaced by a compacted
+	// one and only stays closed if reopening it failed.
+	if(!saver->fp){
+		saver->fp = fopen(saver->delta_file, "r+b");
+		if(!saver->fp){
+			LOG_ERROR("failed to reopen \"%s\"", saver->delta_file);
+			return false;
+		}
+	}
+
+	FILE *fp = saver->fp;
+	u8 *buf = saver->write_buf;
+	u32 sequence = saver->sequence + 1;
+	u32 checksum = 1;
+	i64 size = 0;
+
+	// NOTE: Start where the last complete snapshot ended so a failed
+	// write is overwritten by the next one.
+	bool ok = sys_fseek(fp, saver->file_size);
+
+	i32 pos = 0;
+	buffer_write_u32_le(buf + pos, KPB_ID_WORLD_DELTA_BEGIN);				pos += 4;
+	buffer_write_u32_le(buf + pos, WORLD_DELTA_BEGIN_SIZE);					pos += 4;
+	buffer_write_u32_le(buf + pos, sequence);								pos += 4;
+	buffer_write_u32_le(buf + pos, saver->world->empty_chunk);				pos += 4;
+	buffer_write_u32_le(buf + pos, (u32)saver->num_chunks);					pos += 4;
+	checksum = adler32_accumulate(checksum, buf, pos);
+	ok = ok && fwrite(buf, 1, pos, fp) == (usize)pos;
+	size += pos;
+
+	for(i32 i = 0; i < saver->num_chunks && ok; i += 1){
+		Tile *tiles = &saver->chunk_tiles[(usize)i * WORLD_NUM_TILES_PER_CHUNK];
+		pos = world_delta_encode_chunk(buf, saver->chunk_dense_indices[i], tiles);
+		saver->chunk_write_offsets[i] = saver->file_size + size;
+		checksum = adler32_accumulate(checksum, buf, pos);
+		ok = fwrite(buf, 1, pos, fp) == (usize)pos;
+		size += pos;
+	}
+
+	pos = 0;
+	buffer_write_u32_le(buf + pos, KPB_ID_WORLD_DELTA_END);					pos += 4;
+	buffer_write_u32_le(buf + pos, WORLD_DELTA_END_SIZE);					pos += 4;
+	buffer_write_u32_le(buf + pos, sequence);								pos += 4;
+	buffer_write_u32_le(buf + pos, checksum);								pos += 4;
+	ok = ok && fwrite(buf, 1, pos, fp) == (usize)pos && sys_fsync(fp);
+	size += pos;
+
+	if(!ok){
+		LOG_ERROR("failed to write snapshot %u to \"%s\"", sequence, saver->delta_file);
+		clearerr(fp);
+		return false;
+	}
+	for(i32 i = 0; i < saver->num_chunks; i += 1)
+		saver->chunk_offsets[saver->chunk_dense_indices[i]] = saver->chunk_write_offsets[i];
+	saver->sequence = sequence;
+	saver->file_size += size;
+	return true;
+}
+
+// NOTE: Rewrites the delta file as a single snapshot with the last saved
+// copy of every chunk, which is what loading the whole log would give. The
+// chunks are copied from the current file so the game isn't involved. The
+// new file is written next to it and then replaces it, so the log is left
+// as it was if anything fails.
+static
+bool world_saver_compact(WorldSaver *saver){
+	char temp_file[sizeof(saver->delta_file) + 4];
+	snprintf(temp_file, sizeof(temp_file), "%s.tmp", saver->delta_file);
+	FILE *out = fopen(temp_file, "wb");
+	if(!out){
+		LOG_ERROR("failed to open \"%s\"", temp_file);
+		return false;
+	}
+
+	FILE *fp = saver->fp;
+	u8 *buf = saver->write_buf;
+	u32 num_dense_chunks = saver->world->empty_chunk;
+	u32 num_chunks = 0;
+	for(u32 i = 0; i < num_dense_chunks; i += 1){
+		if(saver->chunk_offsets[i] >= 0)
+			num_chunks += 1;
+	}
+
+	u32 checksum = 1;
+	i64 size = 0;
+	i32 pos = 0;
+	buffer_write_u32_le(buf + pos, KPB_ID_WORLD_DELTA_BEGIN);				pos += 4;
+	buffer_write_u32_le(buf + pos, WORLD_DELTA_BEGIN_SIZE);					pos += 4;
+	buffer_write_u32_le(buf + pos, 1);										pos += 4;
+	buffer_write_u32_le(buf + pos, num_dense_chunks);						pos += 4;
+	buffer_write_u32_le(buf + pos, num_chunks);								pos += 4;
+	checksum = adler32_accumulate(checksum, buf, pos);
+	bool ok = fwrite(buf, 1, pos, out) == (usize)pos;
+	size += pos;
+
+	for(u32 i = 0; i < num_dense_chunks && ok; i += 1){
+		saver->compact_offsets[i] = -1;
+		if(saver->chunk_offsets[i] < 0)
+			continue;
+
+		// NOTE: The element was written by us and is checked by the
+		// snapshot's checksum when loading, so only make sure it's the
+		// chunk we expect.
+		ok = sys_fseek(fp, saver->chunk_offsets[i])
+			&& fread(buf, 1, 12, fp) == 12
+			&& buffer_read_u32_le(buf + 0) == KPB_ID_WORLD_DELTA_CHUNK
+			&& buffer_read_u32_le(buf + 4) <= WORLD_DELTA_MAX_CHUNK_SIZE
+			&& buffer_read_u32_le(buf + 8) == i;
+		if(!ok)
+			break;
+
+		pos = 8 + (i32)buffer_read_u32_le(buf + 4);
+		ok = fread(buf + 12, 1, pos - 12, fp) == (usize)(pos - 12)
+			&& fwrite(buf, 1, pos, out) == (usize)pos;
+		checksum = adler32_accumulate(checksum, buf, pos);
+		saver->compact_offsets[i] = size;
+		size += pos;
+	}
+
+	pos = 0;
+	buffer_write_u32_le(buf + pos, KPB_ID_WORLD_DELTA_END);					pos += 4;
+	buffer_write_u32_le(buf + pos, WORLD_DELTA_END_SIZE);					pos += 4;
+	buffer_write_u32_le(buf + pos, 1);										pos += 4;
+	buffer_write_u32_le(buf + pos, checksum);								pos += 4;
+	ok = ok && fwrite(buf, 1, pos, out) == (usize)pos && sys_fsync(out);
+	size += pos;
+	fclose(out);
+
+	if(!ok){
+		LOG_ERROR("failed to compact \"%s\" into \"%s\"",
+			saver->delta_file, temp_file);
+		clearerr(fp);
+		return false;
+	}
+
+	// NOTE: The file can't be replaced while it's open on Windows.
+	fclose(fp);
+	saver->fp = NULL;
+	if(!sys_file_replace(temp_file, saver->delta_file)){
+		LOG_ERROR("failed to replace \"%s\" with \"%s\"",
+			saver->delta_file, temp_file);
+		return false;
+	}
+
+	LOG("compacted \"%s\" from %lld to %lld bytes (%u chunks)",
+		saver->delta_file, (long long)saver->file_size, (long long)size, num_chunks);
+	i64 *offsets = saver->chunk_offsets;
+	saver->chunk_offsets = saver->compact_offsets;
+	saver->compact_offsets = offsets;
+	saver->sequence = 1;
+	saver->file_size = size;
+	saver->fp = fopen(saver->delta_file, "r+b");
+	return true;
+}
+
+static
+void world_saver_thread(void *arg){
+	WorldSaver *saver = (WorldSaver*)arg;
+	profile_thread_name("world_saver");
+	while(1){
+		if(saver->state.load(std::memory_order_acquire) != WORLD_SAVER_WRITING){
+			sys_sleep_msec(1);
+			continue;
+		}
+
+		i64 start = sys_clock_monotonic_nsec();
+		{
+			PROFILE_ZONE("world_saver_write");
+			saver->write_ok = world_saver_write(saver);
+		}
+		if(saver->write_ok && saver->file_size > saver->max_file_size){
+			PROFILE_ZONE("world_saver_compact");
+			world_saver_compact(saver);
+		}
+		metrics_add(METRIC_WORLD_SAVE_NSEC, sys_clock_monotonic_nsec() - start);
+		saver->state.store(WORLD_SAVER_DONE, std::memory_order_release);
+	}
+}
+
+// ----------------------------------------------------------------
+
+// NOTE: Applies the delta file on top of the world (which must be freshly
+// loaded) and starts the writer thread.
+WorldSaver *world_saver_init(MemArena *arena, World *world, Config *cfg){
+	ASSERT(cfg->game_world_delta_file != NULL);
+	ASSERT(cfg->game_world_save_max_chunks > 0);
+	ASSERT(cfg->game_world_delta_max_size > 0);
+	WorldSaver *saver = arena_alloc<WorldSaver>(arena, 1);
+	saver->world = world;
+	if(strlen(cfg->game_world_delta_file) >= sizeof(saver->delta_file))
+		PANIC("world delta file name is too long");
+	strcpy(saver->delta_file, cfg->game_world_delta_file);
+	saver->file_size = 0;
+	saver->max_file_size = cfg->game_world_delta_max_size;
+	saver->sequence = 0;
+
+	u32 num_dense_chunks = world->empty_chunk;
+	saver->chunk_offsets = arena_alloc<i64>(arena, num_dense_chunks + 1);
+	saver->compact_offsets = arena_alloc<i64>(arena, num_dense_chunks + 1);
+	for(u32 i = 0; i < num_dense_chunks; i += 1)
+		saver->chunk_offsets[i] = -1;
+	world_delta_load(saver);
+
+	// NOTE: Everything in the world now matches what's on disk.
+	saver->interval = cfg->game_world_save_interval * 1000000;
+	saver->last_snapshot = sys_clock_monotonic_nsec();
+	saver->scan_cursor = 0;
+	saver->saved_versions = arena_alloc<u32>(arena, num_dense_chunks + 1);
+	memcpy(saver->saved_versions, world->chunk_versions,
+		sizeof(u32) * num_dense_chunks);
+
+	// NOTE: Anything after the last complete snapshot is overwritten by
+	// the next one.
+	saver->fp = fopen(saver->delta_file, "r+b");
+	if(!saver->fp)
+		saver->fp = fopen(saver->delta_file, "w+b");
+	if(!saver->fp)
+		PANIC("failed to open \"%s\"", saver->delta_file);
+
+	saver->state.store(WORLD_SAVER_IDLE, std::memory_order_relaxed);
+	saver->write_ok = false;
+	saver->max_chunks = cfg->game_world_save_max_chunks;
+	saver->num_chunks = 0;
+	saver->chunk_dense_indices = arena_alloc<u32>(arena, saver->max_chunks);
+	saver->chunk_versions = arena_alloc<u32>(arena, saver->max_chunks);
+	saver->chunk_write_offsets = arena_alloc<i64>(arena, saver->max_chunks);
+	saver->chunk_tiles = arena_alloc<Tile>(arena,
+		(usize)saver->max_chunks * WORLD_NUM_TILES_PER_CHUNK);
+	saver->write_buf = arena_alloc<u8>(arena, 8 + WORLD_DELTA_MAX_CHUNK_SIZE);
+	sys_thread_start(world_saver_thread, saver);
+	return saver;
+}
+
+// NOTE: Called by the game at a frame boundary. Takes a snapshot of the
+// chunks that changed (at most `max_chunks`, the rest go in the next one)
+// and hands it to the writer thread. Nothing is done while the writer is
+// still busy with the previous snapshot.
+void world_saver_update(WorldSaver *saver){
+	PROFILE_ZONE("world_saver_update");
+	u32 state = saver->state.load(std::memory_order_acquire);
+	if(state == WORLD_SAVER_WRITING)
+		return;
+
+	if(state == WORLD_SAVER_DONE){
+		// NOTE: Chunks are only marked as saved once they're on disk. If
+		// the write failed, they still differ from their saved version and
+		// go in the next snapshot.
+		if(saver->write_ok){
+			for(i32 i = 0; i < saver->num_chunks; i += 1)
+				saver->saved_versions[saver->chunk_dense_indices[i]] = saver->chunk_versions[i];
+		}
+		saver->num_chunks = 0;
+		saver->state.store(WORLD_SAVER_IDLE, std::memory_order_relaxed);
+	}
+
+	i64 start = sys_clock_monotonic_nsec();
+	if((start - saver->last_snapshot) < saver->interval)
+		return;
+	saver->last_snapshot = start;
+
+	World *world = saver->world;
+	u32 num_dense_chunks = world->empty_chunk;
+	u32 chunk = saver->scan_cursor;
+	i32 num_chunks = 0;
+	for(u32 i = 0; i < num_dense_chunks; i += 1){
+		if(num_chunks >= saver->max_chunks)
+			break;
+
+		u32 version = world->chunk_versions[chunk];
+		if(version != saver->saved_versions[chunk]){
+			saver->chunk_dense_indices[num_chunks] = chunk;
+			saver->chunk_versions[num_chunks] = version;
+			memcpy(&saver->chunk_tiles[(usize)num_chunks * WORLD_NUM_TILES_PER_CHUNK],
+				&world->dense_array[(usize)chunk * WORLD_NUM_TILES_PER_CHUNK],
+				sizeof(Tile) * WORLD_NUM_TILES_PER_CHUNK);
+			num_chunks += 1;
+		}
+
+		chunk += 1;
+		if(chunk >= num_dense_chunks)
+			chunk = 0;
+	}
+	saver->scan_cursor = chunk;
+
+	if(num_chunks > 0){
+		saver->num_chunks = num_chunks;
+		saver->state.store(WORLD_SAVER_WRITING, std::memory_order_release);
+		metrics_add(METRIC_WORLD_SNAPSHOTS, 1);
+		metrics_add(METRIC_WORLD_SNAPSHOT_CHUNKS, num_chunks);
+	}
+	metrics_add(METRIC_WORLD_SNAPSHOT_NSEC, sys_clock_monotonic_nsec() - start);
+}
+
+#if BUILD_TEST
+static
+bool world_save_test_equal(World *a, World *b){
+	usize num_tiles = (usize)a->empty_chunk * WORLD_NUM_TILES_PER_CHUNK;
+	for(usize i = 0; i < num_tiles; i += 1){
+		Tile *ta = &a->dense_array[i];
+		Tile *tb = &b->dense_array[i];
+		if(ta->num_items != tb->num_items)
+			return false;
+		for(i32 j = 0; j < ta->num_items; j += 1){
+			if(ta->items[j].id != tb->items[j].id)
+				return false;
+		}
+	}
+	return true;
+}
+
+static
+void world_save_test_wait(WorldSaver *saver){
+	while(saver->state.load(std::memory_order_acquire) == WORLD_SAVER_WRITING)
+		sys_sleep_msec(1);
+	world_saver_update(saver);
+}
+
+bool world_save_test(void){
+	bool passed = true;
+	const char *delta_file = "world_save_test.kwr";
+	remove(delta_file);
+
+	Config cfg = {};
+	cfg.game_world_delta_file = delta_file;
+	cfg.game_world_save_interval = 0;
+	cfg.game_world_save_max_chunks = 2;
+	cfg.game_world_delta_max_size = 1024 * 1024;
+
+	MemArena *arena = arena_init(256 * 1024 * 1024, 4 * 1024 * 1024);
+	World world;
+	world_init_flat(arena, &world, 106);
+	WorldSaver *saver = world_saver_init(arena, &world, &cfg);
+
+	// NOTE: Three chunks changed but only two fit in a snapshot.
+	world_modify_tile(&world, 10, 10, 7)->items[0].id = 107;
+	world_modify_tile(&world, 11, 10, 7)->num_items = 0;
+	world_modify_tile(&world, 100, 100, 7)->items[0].id = 108;
+	Tile *tile = world_modify_tile(&world, 200, 30, 7);
+	tile->num_items = 2;
+	tile->items[1].id = 1234;
+	passed = passed && world_modify_tile(&world, 10, 10, 3) == NULL;
+
+	world_saver_update(saver);
+	passed = passed && saver->num_chunks == 2;
+	world_save_test_wait(saver);
+	passed = passed && saver->num_chunks == 1;
+	world_save_test_wait(saver);
+	world_saver_update(saver);
+	passed = passed && saver->num_chunks == 0;
+
+	// NOTE: Changes made while a snapshot is being written go in the next one.
+	world_modify_tile(&world, 10, 10, 7)->items[0].id = 109;
+	world_saver_update(saver);
+	world_modify_tile(&world, 10, 11, 7)->items[0].id = 110;
+	world_save_test_wait(saver);
+	world_save_test_wait(saver);
+	world_saver_update(saver);
+	passed = passed && saver->num_chunks == 0 && saver->sequence == 4;
+
+	// NOTE: A torn snapshot at the end is dropped.
+	FILE *fp = fopen(delta_file, "ab");
+	u8 garbage[20] = { 0x06, 0x52, 0x57, 0x4B, 0x00, 0x10, 0x00, 0x00, 1, 2, 3 };
+	fwrite(garbage, 1, sizeof(garbage), fp);
+	fclose(fp);
+
+	World loaded;
+	world_init_flat(arena, &loaded, 106);
+	WorldSaver *loaded_saver = world_saver_init(arena, &loaded, &cfg);
+	passed = passed && loaded_saver->sequence == 4;
+	passed = passed && world_save_test_equal(&loaded, &world);
+	passed = passed && world_get_tile(&loaded, 10, 11, 7)->items[0].id == 110;
+	passed = passed && world_get_tile(&loaded, 200, 30, 7)->items[1].id == 1234;
+
+	// NOTE: The next snapshot overwrites the torn one.
+	world_modify_tile(&loaded, 50, 50, 7)->items[0].id = 111;
+	world_saver_update(loaded_saver);
+	world_save_test_wait(loaded_saver);
+	World reloaded;
+	world_init_flat(arena, &reloaded, 106);
+	WorldSaver *reloaded_saver = world_saver_init(arena, &reloaded, &cfg);
+	passed = passed && reloaded_saver->sequence == 5;
+	passed = passed && world_get_tile(&reloaded, 50, 50, 7)->items[0].id == 111;
+
+	// NOTE: Once the file grows past the limit it's compacted into a single
+	// snapshot with the last copy of each chunk.
+	// The other savers are idle but their files must be closed for it to
+	// be replaced on Windows.
+	i64 uncompacted_size = reloaded_saver->file_size;
+	WorldSaver *idle_savers[] = { saver, loaded_saver, reloaded_saver };
+	for(i32 i = 0; i < (i32)NARRAY(idle_savers); i += 1){
+		fclose(idle_savers[i]->fp);
+		idle_savers[i]->fp = NULL;
+	}
+	cfg.game_world_delta_max_size = 1;
+	World compacted;
+	world_init_flat(arena, &compacted, 106);
+	WorldSaver *compacted_saver = world_saver_init(arena, &compacted, &cfg);
+	world_modify_tile(&compacted, 10, 10, 7)->items[0].id = 112;
+	world_saver_update(compacted_saver);
+	world_save_test_wait(compacted_saver);
+	passed = passed && compacted_saver->sequence == 1;
+	passed = passed && compacted_saver->file_size < uncompacted_size;
+	world_modify_tile(&compacted, 12, 10, 7)->items[0].id = 113;
+	world_saver_update(compacted_saver);
+	world_save_test_wait(compacted_saver);
+	passed = passed && compacted_saver->sequence == 1;
+
+	World recompacted;
+	world_init_flat(arena, &recompacted, 106);
+	WorldSaver *recompacted_saver = world_saver_init(arena, &recompacted, &cfg);
+	passed = passed && recompacted_saver->sequence == 1;
+	passed = passed && world_save_test_equal(&recompacted, &compacted);
+	passed = passed && world_get_tile(&recompacted, 12, 10, 7)->items[0].id == 113;
+	passed = passed && world_get_tile(&recompacted, 200, 30, 7)->items[1].id == 1234;
+	debug_printf("world save test: %s\n", (passed ? "passed" : "failed"));
+	return passed;
+}
+#endif //BUILD_TEST
@@ -0,0 +1,53 @@
+#ifndef KAPLAR_WORLD_SAVE_HH_
+#define KAPLAR_WORLD_SAVE_HH_ 1
+
+#include "common.hh"
+#include "world.hh"
+
+// ----------------------------------------------------------------
+// World Save
+// ----------------------------------------------------------------
+
+// NOTE: Changes to the map (dropped items, house contents, etc) are saved
+// to a delta file next to the world file, so the world file itself is never
+// written while the server is running.
+//	At a frame boundary, the saver copies every chunk whose version changed
+// since it was last saved into a snapshot buffer. Only changed chunks are
+// copied so taking a snapshot is cheap, and the copy is what the writer
+// thread works with so the game keeps running (and changing the world)
+// while the snapshot is written.
+//	The delta file is a log of snapshots, each one being a DELTA_BEGIN
+// element, one DELTA_CHUNK element per chunk, and a DELTA_END element with
+// the adler32 of the whole snapshot. Snapshots are applied in order when
+// loading and a snapshot without a valid end (a crash while writing it) is
+// dropped along with anything after it.
+//	Chunks are identified by their dense index, so the delta only makes
+// sense for the world file it was made for.
+
+// - WORLD_DELTA_BEGIN
+// -- SEQUENCE
+// -- NUM_DENSE_CHUNKS
+// -- NUM_CHUNKS
+
+// - WORLD_DELTA_CHUNK
+// -- DENSE_INDEX
+// -- TILES IN SEQUENCE (NUM_ITEMS, ITEM IDS)
+
+// - WORLD_DELTA_END
+// -- SEQUENCE
+// -- CHECKSUM
+
+// NOTE: The delta file grows with every snapshot. Once it's past
+// `game_world_delta_max_size`, the writer thread rewrites it as a single
+// snapshot (sequence 1) with the last saved copy of each chunk, so its size
+// is bounded by the chunks that differ from the world file plus the limit.
+
+struct WorldSaver;
+WorldSaver *world_saver_init(MemArena *arena, World *world, Config *cfg);
+void world_saver_update(WorldSaver *saver);
+
+#if BUILD_TEST
+bool world_save_test(void);
+#endif
+
+#endif //KAPLAR_WORLD_SAVE_HH_